@@ -0,0 +1,664 @@
+#include "host.h"
+
+#include "malkuth_fs.h"
+#include "malkuth_display.h"
+#include "malkuth_cover.h"
+
+#include <jpeglib.h>
+#include <png.h>
+
+#include <filesystem>
+#include <thread>
+#include <vector>
+
+extern MalkuthFs        filesystem;
+extern MalkuthDisplay   display;
+
+typedef std::vector<uint8_t> Bytes;
+
+struct Track {
+    const char* path;
+    uint16_t    width;      // of the picture it should end up with
+    uint16_t    height;
+    bool        covered;
+};
+
+///
+/// Pictures
+///
+
+// Red across, green down, so every thumbnail pixel says where it came from
+static void pattern(uint16_t width, uint16_t height, uint16_t x, uint16_t y, uint8_t* rgb) {
+    rgb[0] = x * 255 / (width  - 1);
+    rgb[1] = y * 255 / (height - 1);
+    rgb[2] = 96;
+}
+
+static Bytes jpeg(uint16_t width, uint16_t height, bool progressive, bool gray = false) {
+    jpeg_compress_struct cinfo;
+    jpeg_error_mgr       jerr;
+
+    unsigned char* out  = nullptr;
+    unsigned long  size = 0;
+
+    cinfo.err = jpeg_std_error(&jerr);
+    jpeg_create_compress(&cinfo);
+    jpeg_mem_dest(&cinfo, &out, &size);
+
+    cinfo.image_width      = width;
+    cinfo.image_height     = height;
+    cinfo.input_components = 3;
+    cinfo.in_color_space   = JCS_RGB;
+
+    jpeg_set_defaults(&cinfo);
+    jpeg_set_quality(&cinfo, 90, TRUE);
+    if (gray)        jpeg_set_colorspace(&cinfo, JCS_GRAYSCALE);
+    if (progressive) jpeg_simple_progression(&cinfo);
+
+    jpeg_start_compress(&cinfo, TRUE);
+
+    std::vector<uint8_t> row(width * 3);
+    while (cinfo.next_scanline < cinfo.image_height) {
+        for (uint16_t x = 0; x < width; x++)
+            pattern(width, height, x, cinfo.next_scanline, &row[x * 3]);
+
+        JSAMPROW rows[1] = { row.data() };
+        jpeg_write_scanlines(&cinfo, rows, 1);
+    }
+
+    jpeg_finish_compress(&cinfo);
+    jpeg_destroy_compress(&cinfo);
+
+    Bytes bytes(out, out + size);
+    free(out);
+    return bytes;
+}
+
+static Bytes png(uint16_t width, uint16_t height) {
+    png_image image;
+    memset(&image, 0, sizeof(image));
+
+    image.version = PNG_IMAGE_VERSION;
+    image.width   = width;
+    image.height  = height;
+    image.format  = PNG_FORMAT_RGB;
+
+    std::vector<uint8_t> pixels(width * height * 3);
+    for (uint16_t y = 0; y < height; y++)
+        for (uint16_t x = 0; x < width; x++)
+            pattern(width, height, x, y, &pixels[(y * width + x) * 3]);
+
+    png_alloc_size_t size = 0;
+    png_image_write_to_memory(&image, nullptr, &size, 0, pixels.data(), 0, nullptr);
+
+    Bytes bytes(size);
+    png_image_write_to_memory(&image, bytes.data(), &size, 0, pixels.data(), 0, nullptr);
+    bytes.resize(size);
+    return bytes;
+}
+
+// A gray picture with its Huffman tables in one DHT segment of exactly
+// JD_SZBUF bytes. Padded with a copy of the AC table as table 1, which the
+// one component never uses, and 16 bit DC codes the data never has. Gray
+// leaves the small workspace room for them
+static Bytes one_dht(const Bytes& in) {
+    Bytes              out(in.begin(), in.begin() + 2);
+    std::vector<Bytes> tables;
+    size_t             at = 2;
+
+    while (at + 4 <= in.size() && in[at + 1] != 0xDA) {
+        size_t length = in[at + 2] << 8 | in[at + 3];
+        if (in[at + 1] == 0xC4) tables.emplace_back(in.begin() + at + 4, in.begin() + at + 2 + length);
+        else                    out.insert(out.end(), in.begin() + at, in.begin() + at + 2 + length);
+        at += 2 + length;
+    }
+
+    // libjpeg writes the standard tables one per segment, DC first
+    tables.push_back(tables[1]);
+    tables.back()[0] = 0x11;
+
+    size_t size = 0;
+    for (const Bytes& table : tables)
+        size += table.size();
+
+    // The last 9 bit DC code leaves room for 127 of 16 bits
+    size_t pad = JD_SZBUF - size;
+    tables[0][16] += pad;
+    tables[0].insert(tables[0].end(), pad, 0);
+
+    out.push_back(0xFF);
+    out.push_back(0xC4);
+    out.push_back((JD_SZBUF + 2) >> 8);
+    out.push_back((JD_SZBUF + 2) & 0xFF);
+    for (const Bytes& table : tables)
+        out.insert(out.end(), table.begin(), table.end());
+
+    out.insert(out.end(), in.begin() + at, in.end());
+    return out;
+}
+
+///
+/// Containers
+///
+
+static void put_be(Bytes& out, uint32_t value, int bytes) {
+    for (int i = bytes - 1; i >= 0; i--)
+        out.push_back((value >> (i * 8)) & 0xFF);
+}
+
+static void append(Bytes& out, const Bytes& more) {
+    out.insert(out.end(), more.begin(), more.end());
+}
+
+static void append(Bytes& out, const char* text, bool terminate) {
+    out.insert(out.end(), text, text + strlen(text) + (terminate ? 1 : 0));
+}
+
+// Frame sync and some zeros, nothing here decodes the audio
+static Bytes audio() {
+    Bytes bytes = { 0xFF, 0xFB, 0x90, 0x64 };
+    bytes.resize(4096, 0);
+    return bytes;
+}
+
+// v2.3 tag, a back cover in front of the front cover to check that the
+// front one wins, UTF-16 description
+static Bytes mp3(const Bytes& front) {
+    Bytes frames;
+
+    auto apic = [&](uint8_t type, const Bytes& picture) {
+        Bytes body = { 1 };
+        append(body, "image/jpeg", true);
+        body.push_back(type);
+        append(body, Bytes{ 0xFF, 0xFE, 'C', 0, 'v', 0, 0, 0 });
+        append(body, picture);
+
+        append(frames, "APIC", false);
+        put_be(frames, body.size(), 4);
+        append(frames, Bytes{ 0, 0 });
+        append(frames, body);
+    };
+
+    append(frames, "TIT2", false);
+    put_be(frames, 6, 4);
+    append(frames, Bytes{ 0, 0, 0 });
+    append(frames, "Title", false);
+
+    apic(4, jpeg(64, 64, false));
+    apic(3, front);
+
+    frames.resize(frames.size() + 256, 0);
+
+    Bytes tag = { 'I', 'D', '3', 3, 0, 0 };
+    uint32_t size = frames.size();
+    tag.push_back((size >> 21) & 0x7F);
+    tag.push_back((size >> 14) & 0x7F);
+    tag.push_back((size >> 7)  & 0x7F);
+    tag.push_back(size & 0x7F);
+
+    append(tag, frames);
+    append(tag, audio());
+    return tag;
+}
+
+static Bytes flac(const Bytes& picture) {
+    Bytes bytes;
+    append(bytes, "fLaC", false);
+
+    // STREAMINFO, 44.1 kHz stereo 16 bit
+    bytes.push_back(0x00);
+    put_be(bytes, 34, 3);
+    Bytes info(34, 0);
+    info[10] = 0x0A; info[11] = 0xC4; info[12] = 0x42; info[13] = 0xF0;
+    append(bytes, info);
+
+    Bytes block;
+    put_be(block, 3, 4);
+    put_be(block, 10, 4);
+    append(block, "image/jpeg", false);
+    put_be(block, 0, 4);
+    block.resize(block.size() + 16, 0);
+    put_be(block, picture.size(), 4);
+    append(block, picture);
+
+    bytes.push_back(0x80 | 6);
+    put_be(bytes, block.size(), 3);
+    append(bytes, block);
+
+    append(bytes, audio());
+    return bytes;
+}
+
+static bool write_file(const std::string& path, const Bytes& bytes) {
+    std::filesystem::create_directories(std::filesystem::path(path).parent_path());
+
+    FILE* file = fopen(path.c_str(), "wb");
+    if (!file) return false;
+
+    bool ok = fwrite(bytes.data(), 1, bytes.size(), file) == bytes.size();
+    return fclose(file) == 0 && ok;
+}
+
+///
+/// Checks
+///
+
+// Panel (big endian) RGB565 against what it should be, worst channel
+static int pixel_error(uint16_t pixel, const uint8_t* want) {
+    pixel = (pixel >> 8) | (pixel << 8);
+
+    int got[3] = { (pixel >> 11) << 3, ((pixel >> 5) & 0x3F) << 2, (pixel & 0x1F) << 3 };
+    int worst  = 0;
+
+    for (int c = 0; c < 3; c++)
+        worst = std::max(worst, abs(got[c] - want[c]));
+    return worst;
+}
+
+// Worst channel error (in 8 bit steps) against the centre crop the
+// thumbnail should be, sampled every few pixels
+static int thumb_error(const char* path, const Track& track) {
+    FsFile file;
+    MalkuthCovers::Header header;
+
+    if (!file.open(path) || file.read(&header, sizeof(header)) != sizeof(header) ||
+        memcmp(header.magic, "MKTH", 4) != 0 || header.width != COVER_SIZE || header.height != COVER_SIZE)
+        return 255;
+
+    std::vector<uint16_t> pixels(COVER_SIZE * COVER_SIZE);
+    if (file.read(pixels.data(), pixels.size() * 2) != (int)(pixels.size() * 2)) return 255;
+
+    int side  = std::min(track.width, track.height);
+    int x0    = (track.width  - side) / 2;
+    int y0    = (track.height - side) / 2;
+    int worst = 0;
+
+    for (int v = 2; v < COVER_SIZE; v += 7) {
+        for (int u = 2; u < COVER_SIZE; u += 7) {
+            uint8_t  want[3];
+            pattern(track.width, track.height, x0 + (u + 0.5f) * side / COVER_SIZE, y0 + (v + 0.5f) * side / COVER_SIZE, want);
+
+            worst = std::max(worst, pixel_error(pixels[v * COVER_SIZE + u], want));
+        }
+    }
+
+    return worst;
+}
+
+// Every block a decoder hands out, in order, folded into one hash
+struct Capture {
+    uint32_t hash   = 2166136261u;
+    uint32_t blocks = 0;
+};
+
+static void fold(uint32_t& hash, const void* data, size_t size) {
+    const uint8_t* byte = static_cast<const uint8_t*>(data);
+    while (size--) {
+        hash ^= *byte++;
+        hash *= 16777619u;
+    }
+}
+
+static bool capture(void* user, int16_t x, int16_t y, uint16_t w, uint16_t h, uint16_t* data) {
+    Capture* out    = static_cast<Capture*>(user);
+    int16_t  box[4] = { x, y, (int16_t)w, (int16_t)h };
+
+    fold(out->hash, box, sizeof(box));
+    fold(out->hash, data, w * h * sizeof(uint16_t));
+
+    out->blocks++;
+    return true;
+}
+
+static void lock_fs(void* user, bool take) {
+    if (take) static_cast<MalkuthFs*>(user)->lock();
+    else      static_cast<MalkuthFs*>(user)->unlock();
+}
+
+static Capture decode(TJpg_Decoder& jpg, const char* path, uint8_t scale) {
+    Capture out;
+
+    jpg.setJpgScale(scale);
+    jpg.setCallback(capture, &out);
+    if (jpg.drawJpg(0, 0, path) != JDR_OK) out.blocks = 0;
+
+    return out;
+}
+
+// Two decoders on two threads against the same two pictures decoded one
+// after the other, nothing may leak from one instance into the other
+static bool concurrent() {
+    const char*   paths[2]  = { "/Album C/Cover.JPG", "/Album C/AlbumArtSmall.jpg" };
+    const uint8_t scales[2] = { 2, 1 };
+    const int     rounds    = 20;
+
+    // Alone, the plain constructor without a lock is enough
+    TJpg_Decoder reference(filesystem.get_sdfs());
+
+    Capture want[2];
+    for (int i = 0; i < 2; i++) {
+        want[i] = decode(reference, paths[i], scales[i]);
+        if (want[i].blocks == 0) return false;
+    }
+
+    int mismatches[2] = { 0, 0 };
+
+    auto worker = [&](int i) {
+        TJpg_Decoder jpg;
+        jpg.setFileSystem(&filesystem.get_sdfs(), lock_fs, &filesystem);
+
+        for (int round = 0; round < rounds; round++) {
+            Capture got = decode(jpg, paths[i], scales[i]);
+            mismatches[i] += got.hash != want[i].hash || got.blocks != want[i].blocks;
+        }
+    };
+
+    std::thread first(worker, 0), second(worker, 1);
+    first.join();
+    second.join();
+
+    Serial.printf("%-4s two decoders, %d rounds each, %d / %d mismatched\n",
+        mismatches[0] + mismatches[1] ? "FAIL" : "ok", rounds, mismatches[0], mismatches[1]);
+
+    return mismatches[0] + mismatches[1] == 0;
+}
+
+int run_cover(int argc, char** argv) {
+    if (argc < 3) {
+        Serial.printf("usage: malkuth_host cover <work dir> [--png out.png]\n");
+        return 1;
+    }
+
+    const char* dir = argv[2];
+    const char* out = option(argc, argv, "--png", nullptr);
+
+    Bytes front = jpeg(500, 500, false);
+
+    // Size of the picture each track should end up showing
+    const Track tracks[] = {
+        { "/Album A/01.mp3",   500,  500,  true  },     // APIC, scale 1/2
+        { "/Album A/02.mp3",   500,  500,  true  },     // same picture, cache hit
+        { "/Album B/01.flac",  1400, 1400, true  },     // PICTURE, scale 1/4
+        { "/Album C/01.mp3",   640,  480,  true  },     // Cover.JPG next to it
+        { "/Album D/01.flac",  300,  300,  true  },     // progressive, cover.png instead
+        { "/Album E/01.wav",   0,    0,    false },     // nothing at all
+    };
+    const size_t count = sizeof(tracks) / sizeof(tracks[0]);
+
+    std::filesystem::remove_all(std::string(dir) + "/.malkuth");
+
+    bool written =
+        write_file(std::string(dir) + tracks[0].path, mp3(front)) &&
+        write_file(std::string(dir) + tracks[1].path, mp3(front)) &&
+        write_file(std::string(dir) + tracks[2].path, flac(jpeg(1400, 1400, false))) &&
+        write_file(std::string(dir) + tracks[3].path, audio()) &&
+        write_file(std::string(dir) + "/Album C/Cover.JPG", jpeg(640, 480, false)) &&
+        write_file(std::string(dir) + "/Album C/AlbumArtSmall.jpg", jpeg(75, 75, false)) &&
+        write_file(std::string(dir) + tracks[4].path, flac(jpeg(800, 800, true))) &&
+        write_file(std::string(dir) + "/Album D/cover.png", png(300, 300)) &&
+        write_file(std::string(dir) + tracks[5].path, Bytes(64, 0));
+
+    if (!written) { Serial.printf("can't write the corpus to %s\n", dir); return 1; }
+
+    SdFatHost::set_root(dir);
+    if (!filesystem.init()) { Serial.printf("%s is not a directory\n", dir); return 1; }
+
+    MalkuthCovers covers;
+    if (!covers.begin(filesystem)) { Serial.printf("can't create " COVER_DIR "\n"); return 1; }
+
+    Serial.printf("--------------- COVER ART ---------------\n");
+
+    int  failed = !concurrent();
+    char thumb[48];
+
+    display.init();
+    display.set_filesystem(filesystem);
+    display.object(Anchor::TOP_CENTER, 320, 480, TFT_BLACK, 0, 0, 0);
+
+    // Album A first, its cover then gets loaded over and over while the
+    // cover task makes the rest. Loading it takes the card lock on this
+    // task, which is what the player page has to wait for
+    auto wait = [&](bool blit) {
+        uint32_t loads = 0, worst = 0;
+        uint32_t start = micros();
+
+        while (covers.is_busy()) {
+            if (blit) {
+                uint32_t load = micros();
+                display.image(1, ImageType::THUMB, thumb, COVER_SIZE, COVER_SIZE, 60, 40);
+                worst = std::max(worst, micros() - load);
+                loads++;
+
+                display.object(1, Anchor::TOP_CENTER, COVER_SIZE, COVER_SIZE, TFT_DARKGREY, 8, 0, 40);
+            }
+            delay(2);
+        }
+        covers.yeah_i_have_updated();
+
+        if (blit)
+            Serial.printf("Made in the background   : %u us, %u cover loads meanwhile, worst %u us\n",
+                micros() - start, loads, worst);
+        settle();
+    };
+
+    covers.get(tracks[0].path, thumb, sizeof(thumb));
+    wait(false);
+
+    if (!covers.get(tracks[0].path, thumb, sizeof(thumb))) {
+        Serial.printf("FAIL %s never got a thumbnail\n", tracks[0].path);
+        return 1;
+    }
+
+    bool     queued[count];
+    uint32_t first[count];
+
+    for (size_t i = 1; i < count; i++) {
+        char     path[48];
+        uint32_t start = micros();
+        queued[i] = !covers.get(tracks[i].path, path, sizeof(path));
+        first[i]  = micros() - start;
+    }
+    queued[0] = true;
+    first[0]  = 0;
+
+    wait(true);
+
+    for (size_t i = 0; i < count; i++) {
+        const Track& track = tracks[i];
+
+        uint32_t start = micros();
+        bool     got   = covers.get(track.path, thumb, sizeof(thumb));
+        uint32_t again = micros() - start;
+
+        // Only the second track of Album A may already be there
+        int  error = got ? thumb_error(thumb, track) : 0;
+        bool ok    = got == track.covered && error <= 24 && queued[i] == (i != 1);
+        failed    += !ok;
+
+        Serial.printf("%-4s %-18s %-24s first %5u us, again %5u us, error %d\n",
+            ok ? "ok" : "FAIL", track.path, got ? thumb : "(none)", first[i], again, error);
+    }
+
+    Serial.printf("Thumbnail hits           : %u\n", covers.get_hits());
+    Serial.printf("Thumbnails made / failed : %u / %u\n", covers.get_generated(), covers.get_failed());
+    Serial.printf("Last thumbnail           : %u us\n", covers.get_last_us());
+
+    // What the player page does with it
+    covers.get(tracks[2].path, thumb, sizeof(thumb));
+
+    uint32_t start = micros();
+    display.image(1, ImageType::THUMB, thumb, COVER_SIZE, COVER_SIZE, 60, 40);
+    uint32_t shown = settle() - start;
+
+    Serial.printf("Player cover on screen   : %u us\n", shown);
+
+    // A folder JPEG straight off the card, fit to a wide box under it
+    start = micros();
+    display.image(2, ImageType::JPG, "/Album C/Cover.JPG", 200, 120, 60, 260);
+    shown = settle() - start;
+
+    Serial.printf("JPEG fit to 200x120      : %u us\n", shown);
+
+    if (out && !TftHost::screen()->savePng(out)) {
+        Serial.printf("can't write %s\n", out);
+        return 1;
+    }
+
+    return failed ? 1 : 0;
+}
+
+// One 500x500 cover through every profile, at full and at the half scale a
+// thumbnail of it is made at. All of them have to hand out the same pixels
+int run_jpeg(int argc, char** argv) {
+    if (argc < 3) {
+        Serial.printf("usage: malkuth_host jpeg <work dir> [--rounds n]\n");
+        return 1;
+    }
+
+    const char* dir    = argv[2];
+    int         rounds = std::max(1, atoi(option(argc, argv, "--rounds", "20")));
+
+    Bytes gray = jpeg(500, 500, false, true);
+
+    if (!write_file(std::string(dir) + "/bench.jpg", jpeg(500, 500, false)) ||
+        !write_file(std::string(dir) + "/gray.jpg", gray) || !write_file(std::string(dir) + "/one_dht.jpg", one_dht(gray))) {
+        Serial.printf("can't write to %s\n", dir);
+        return 1;
+    }
+
+    SdFatHost::set_root(dir);
+    if (!filesystem.init()) { Serial.printf("%s is not a directory\n", dir); return 1; }
+
+    // Every read takes the lock once, so this counts them
+    struct Reads {
+        MalkuthFs* fs;
+        uint32_t   count;
+    } reads = { &filesystem, 0 };
+
+    auto counted = [](void* user, bool take) {
+        Reads* reads = static_cast<Reads*>(user);
+        if (take) reads->count++;
+        lock_fs(reads->fs, take);
+    };
+
+    const struct {
+        uint8_t     id;
+        const char* name;
+    } profiles[] = {
+        { TJPG_PROFILE_SMALL,         "small"         },
+        { TJPG_PROFILE_FAST_INTERNAL, "fast internal" },
+        { TJPG_PROFILE_FAST_PSRAM,    "fast psram"    },
+    };
+
+    TJpg_Decoder jpg;
+    jpg.setFileSystem(&filesystem.get_sdfs(), counted, &reads);
+
+    Serial.printf("--------------- JPEG PROFILES (500x500, %d rounds) ---------------\n", rounds);
+
+    int failed = 0;
+
+    for (uint8_t scale : { 1, 2 }) {
+        Capture want;
+
+        for (const auto& profile : profiles) {
+            jpg.setProfile(profile.id);
+
+            Capture  got;
+            uint32_t start = micros();
+            reads.count    = 0;
+
+            for (int round = 0; round < rounds; round++)
+                got = decode(jpg, "/bench.jpg", scale);
+
+            float ms = (micros() - start) / 1000.0f / rounds;
+
+            if (profile.id == TJPG_PROFILE_SMALL) want = got;
+
+            bool ok = got.blocks && got.hash == want.hash && got.blocks == want.blocks &&
+                      jpg.getLastProfile() == profile.id;
+            failed += !ok;
+
+            Serial.printf("%-4s %-14s 1/%u : %6.2f ms per cover, %3u reads\n",
+                ok ? "ok" : "FAIL", profile.name, scale, ms, reads.count / rounds);
+        }
+    }
+
+    // A header segment as long as the input buffer has to be loaded whole,
+    // only the refills while decoding stop at sector boundaries
+    for (const auto& profile : profiles) {
+        jpg.setProfile(profile.id);
+
+        Capture want = decode(jpg, "/gray.jpg", 1);
+        Capture got  = decode(jpg, "/one_dht.jpg", 1);
+        bool    ok   = got.blocks && got.hash == want.hash && got.blocks == want.blocks;
+        failed += !ok;
+
+        Serial.printf("%-4s %-14s %u byte DHT segment\n", ok ? "ok" : "FAIL", profile.name, JD_SZBUF);
+    }
+
+    // Fit-to-box against the box shaped centre crop of the pattern, rows
+    // have to come out once each and in order
+    const struct {
+        uint16_t width, height;     // picture
+        uint16_t box_w, box_h;
+    } fits[] = {
+        { 600,  600,  200, 200 },   // 1/2 then 300 -> 200
+        { 1400, 1400, 200, 200 },   // 1/4 then 350 -> 200
+        { 640,  480,  200, 200 },   // cropped to 480x480 first
+        { 500,  300,  320, 120 },   // wide box
+        { 75,   75,   200, 200 },   // smaller than the box, bilinear up
+    };
+
+    struct Rows {
+        std::vector<uint16_t> pixels;
+        uint16_t              width;
+        uint16_t              next;
+        bool                  ordered;
+    };
+
+    auto store = [](void* user, uint16_t y, uint16_t w, uint16_t* row) {
+        Rows* rows = static_cast<Rows*>(user);
+
+        rows->ordered &= y == rows->next++ && w == rows->width;
+        if (rows->ordered) memcpy(&rows->pixels[y * w], row, w * sizeof(uint16_t));
+        return true;
+    };
+
+    jpg.setProfile(TJPG_PROFILE_FAST_INTERNAL);
+    jpg.setSwapBytes(true);
+
+    for (const auto& fit : fits) {
+        char path[32];
+        snprintf(path, sizeof(path), "/fit_%ux%u.jpg", fit.width, fit.height);
+        if (!write_file(std::string(dir) + path, jpeg(fit.width, fit.height, false))) return 1;
+
+        Rows     rows  = { std::vector<uint16_t>(fit.box_w * fit.box_h), fit.box_w, 0, true };
+        uint32_t start = micros();
+        JRESULT  res   = jpg.drawJpgFit(path, fit.box_w, fit.box_h, store, &rows);
+        float    ms    = (micros() - start) / 1000.0f;
+
+        // Same crop the decoder takes, in full size pixels
+        float crop_w = fit.width, crop_h = fit.height;
+        if (crop_w * fit.box_h > crop_h * fit.box_w) crop_w = crop_h * fit.box_w / fit.box_h;
+        else                                         crop_h = crop_w * fit.box_h / fit.box_w;
+
+        float x0 = (fit.width - crop_w) / 2, y0 = (fit.height - crop_h) / 2;
+        int   worst = 0;
+
+        for (uint16_t v = 1; v + 1 < fit.box_h; v += 3) {
+            for (uint16_t u = 1; u + 1 < fit.box_w; u += 3) {
+                uint8_t want[3];
+                pattern(fit.width, fit.height, x0 + (u + 0.5f) * crop_w / fit.box_w, y0 + (v + 0.5f) * crop_h / fit.box_h, want);
+                worst = std::max(worst, pixel_error(rows.pixels[v * fit.box_w + u], want));
+            }
+        }
+
+        bool ok = res == JDR_OK && rows.ordered && rows.next == fit.box_h && worst <= 24;
+        failed += !ok;
+
+        Serial.printf("%-4s fit %4ux%-4u -> %ux%u : %6.2f ms, error %d\n",
+            ok ? "ok" : "FAIL", fit.width, fit.height, fit.box_w, fit.box_h, ms, worst);
+    }
+
+    return failed ? 1 : 0;
+}
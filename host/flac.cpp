@@ -0,0 +1,330 @@
+#include "host.h"
+
+#include "malkuth_flac.h"
+
+#include <chrono>
+#include <filesystem>
+#include <random>
+#include <vector>
+
+typedef std::vector<uint8_t> Bytes;
+
+// Where every frame went, what locate() is checked against
+struct Frame {
+    uint64_t offset;
+    uint64_t sample;
+    uint32_t block;
+    uint32_t header;    // frame header bytes, CRC-8 included
+};
+
+struct Fixture {
+    const char*           name;
+    uint8_t               channels;
+    bool                  variable;
+    std::vector<uint32_t> blocks;       // cycled through, the last frame gets what's left
+    uint64_t              samples;
+    uint32_t              seek_every;   // seekpoint interval in samples, 0 for no SEEKTABLE
+};
+
+///
+/// Stream building
+///
+
+// 16 bit, 44.1 kHz, every subframe VERBATIM so any sample can be read back
+// from the file without a decoder. Every 37th sample is -8, i.e. 0xFFF8,
+// followed by what reads as 4096 samples at 44.1 kHz, mono on the left
+// channel and stereo on the right. Only the number and the CRC-8 after
+// that are left to chance, plenty of them pass for a frame header
+static int16_t sample_at(uint8_t channel, uint64_t n) {
+    if (n % 37 == 5) return -8;
+    if (n % 37 == 6) return (int16_t)(0xC908 | (channel << 4));
+
+    uint32_t x = (uint32_t)(n * 2 + channel) * 2654435761u;
+    return (int16_t)(x >> 16);
+}
+
+static void put_be(Bytes& out, uint64_t value, int bytes) {
+    for (int i = bytes - 1; i >= 0; i--)
+        out.push_back((value >> (i * 8)) & 0xFF);
+}
+
+// The UTF-8 like coding of frame and sample numbers, up to 36 bits
+static void put_coded(Bytes& out, uint64_t value) {
+    if (value < 0x80) { out.push_back(value); return; }
+
+    int extra = 1;
+    while (extra < 6 && value >= (1ULL << (6 * extra + 6 - extra))) extra++;
+
+    static const uint8_t lead[7] = { 0, 0xC0, 0xE0, 0xF0, 0xF8, 0xFC, 0xFE };
+    out.push_back(lead[extra] | (uint8_t)(value >> (6 * extra)));
+    for (int i = extra - 1; i >= 0; i--)
+        out.push_back(0x80 | ((value >> (6 * i)) & 0x3F));
+}
+
+static uint8_t crc8(const uint8_t* data, size_t len) {
+    uint8_t crc = 0;
+
+    while (len--) {
+        crc ^= *data++;
+        for (int i = 0; i < 8; i++)
+            crc = (crc & 0x80) ? (crc << 1) ^ 0x07 : (crc << 1);
+    }
+
+    return crc;
+}
+
+static uint16_t crc16(const uint8_t* data, size_t len) {
+    uint16_t crc = 0;
+
+    while (len--) {
+        crc ^= (uint16_t)*data++ << 8;
+        for (int i = 0; i < 8; i++)
+            crc = (crc & 0x8000) ? (crc << 1) ^ 0x8005 : (crc << 1);
+    }
+
+    return crc;
+}
+
+// Block size code for the header, 6 and 7 mean the size follows the number
+static uint8_t block_code(uint32_t block) {
+    if (block == 192)                               return 1;
+    for (uint8_t code = 2; code <= 5; code++)
+        if (block == (576u << (code - 2)))          return code;
+    for (uint8_t code = 8; code <= 15; code++)
+        if (block == (256u << (code - 8)))          return code;
+    return block <= 256 ? 6 : 7;
+}
+
+static Bytes frame(const Fixture& fixture, uint64_t number, uint64_t first, uint32_t block, uint32_t& header) {
+    Bytes   out;
+    uint8_t code = block_code(block);
+
+    out.push_back(0xFF);
+    out.push_back(fixture.variable ? 0xF9 : 0xF8);
+    out.push_back((code << 4) | 9);                     // 44.1 kHz
+    out.push_back(((fixture.channels - 1) << 4) | (4 << 1));   // independent, 16 bit
+    put_coded(out, number);
+    if (code == 6) put_be(out, block - 1, 1);
+    if (code == 7) put_be(out, block - 1, 2);
+    out.push_back(crc8(out.data(), out.size()));
+    header = out.size();
+
+    for (uint8_t c = 0; c < fixture.channels; c++) {
+        out.push_back(0x02);                            // VERBATIM, no wasted bits
+        for (uint32_t i = 0; i < block; i++)
+            put_be(out, (uint16_t)sample_at(c, first + i), 2);
+    }
+
+    put_be(out, crc16(out.data(), out.size()), 2);
+    return out;
+}
+
+static Bytes stream(const Fixture& fixture, std::vector<Frame>& frames) {
+    Bytes    audio;
+    uint64_t sample = 0;
+    uint32_t min_block = UINT32_MAX, max_block = 0, max_frame = 0;
+
+    frames.clear();
+    for (size_t i = 0; sample < fixture.samples; i++) {
+        uint32_t block = fixture.blocks[i % fixture.blocks.size()];
+        block = (uint32_t)std::min<uint64_t>(block, fixture.samples - sample);
+
+        // A fixed blocksize stream may only end on a shorter frame, min and
+        // max don't count that one
+        if (fixture.variable || sample + block < fixture.samples || i == 0) {
+            min_block = std::min(min_block, block);
+            max_block = std::max(max_block, block);
+        }
+
+        uint32_t header;
+        Bytes    bytes = frame(fixture, fixture.variable ? sample : i, sample, block, header);
+
+        frames.push_back({ audio.size(), sample, block, header });
+        max_frame = std::max(max_frame, (uint32_t)bytes.size());
+        audio.insert(audio.end(), bytes.begin(), bytes.end());
+        sample += block;
+    }
+
+    Bytes out = { 'f', 'L', 'a', 'C' };
+
+    // STREAMINFO
+    out.push_back(fixture.seek_every ? 0x00 : 0x80);
+    put_be(out, 34, 3);
+    put_be(out, min_block, 2);
+    put_be(out, max_block, 2);
+    put_be(out, 0, 3);
+    put_be(out, max_frame, 3);
+    put_be(out, ((uint64_t)44100 << 44) | ((uint64_t)(fixture.channels - 1) << 41) | ((uint64_t)15 << 36) | fixture.samples, 8);
+    out.insert(out.end(), 16, 0);                       // no MD5
+
+    if (fixture.seek_every) {
+        std::vector<std::pair<uint64_t, uint64_t>> points;
+
+        // The frame each interval starts in, like the reference encoder
+        for (uint64_t at = 0; at < fixture.samples; at += fixture.seek_every) {
+            for (const Frame& f : frames) {
+                if (f.sample + f.block > at) {
+                    if (points.empty() || points.back().first != f.sample)
+                        points.push_back({ f.sample, f.offset });
+                    break;
+                }
+            }
+        }
+
+        out.push_back(0x80 | 3);
+        put_be(out, (points.size() + 2) * 18, 3);
+        for (const auto& point : points) {
+            put_be(out, point.first, 8);
+            put_be(out, point.second, 8);
+            put_be(out, fixture.blocks[0], 2);
+        }
+
+        // Placeholders, have to be skipped
+        for (int i = 0; i < 2; i++) {
+            put_be(out, 0xFFFFFFFFFFFFFFFFULL, 8);
+            put_be(out, 0, 8);
+            put_be(out, 0, 2);
+        }
+    }
+
+    for (Frame& f : frames) f.offset += out.size();
+    out.insert(out.end(), audio.begin(), audio.end());
+    return out;
+}
+
+static bool write_file(const std::string& path, const Bytes& bytes) {
+    FILE* file = fopen(path.c_str(), "wb");
+    if (!file) return false;
+
+    bool ok = fwrite(bytes.data(), 1, bytes.size(), file) == bytes.size();
+    return fclose(file) == 0 && ok;
+}
+
+///
+/// Checks
+///
+
+// Every frame parses to what was written, and scanning on from one byte in
+// skips everything in between, the false syncs in the samples included
+static int check_frames(FsFile& file, const MalkuthFlac::StreamInfo& info, const std::vector<Frame>& frames) {
+    int failed = 0;
+
+    for (size_t i = 0; i < frames.size(); i++) {
+        uint8_t  buf[16];
+        uint64_t sample, offset;
+        uint32_t block;
+
+        file.seek(frames[i].offset);
+        int got = file.read(buf, sizeof(buf));
+
+        if (!MalkuthFlac::frameheader(buf, got, info, sample, block) ||
+            sample != frames[i].sample || block != frames[i].block) {
+            failed++;
+            continue;
+        }
+
+        uint64_t next = i + 1 < frames.size() ? frames[i + 1].offset : 0;
+        bool     found = MalkuthFlac::nextframe(file, frames[i].offset + 1, file.size(), info, offset, sample, block);
+
+        if (next ? !found || offset != next : found) failed++;
+    }
+
+    return failed;
+}
+
+// locate() has to land on the start of the frame holding target, and that
+// frame has to hold target's sample where it should
+static bool check_seek(FsFile& file, const MalkuthFlac::StreamInfo& info, const std::vector<MalkuthFlac::SeekPoint>& table,
+                       const std::vector<Frame>& frames, uint64_t target) {
+    uint64_t offset, sample;
+    if (!MalkuthFlac::locate(file, info, table, target, offset, sample)) return false;
+
+    const Frame* landed = nullptr;
+    for (const Frame& f : frames)
+        if (f.offset == offset) landed = &f;
+
+    if (!landed || landed->sample != sample) return false;
+    if (target < sample || target >= sample + landed->block) return false;
+
+    uint8_t bytes[2];
+    file.seek(offset + landed->header + 1 + (target - sample) * 2);
+    if (file.read(bytes, 2) != 2) return false;
+
+    return (int16_t)((bytes[0] << 8) | bytes[1]) == sample_at(0, target);
+}
+
+int run_flac(int argc, char** argv) {
+    if (argc < 3) {
+        Serial.printf("usage: malkuth_host flac <work dir> [--seeks n] [--seed n]\n");
+        return 1;
+    }
+
+    const char* dir   = argv[2];
+    int         seeks = atoi(option(argc, argv, "--seeks", "200"));
+    uint32_t    seed  = atoi(option(argc, argv, "--seed", "1"));
+
+    const Fixture fixtures[] = {
+        { "table.flac",    2, false, { 4096 },                         44100 * 20, 44100 * 2 },
+        { "notable.flac",  2, false, { 1152 },                         44100 * 20, 0 },
+        { "variable.flac", 1, true,  { 576, 1000, 4608, 193, 2047 },   44100 * 20, 0 },
+        { "short.flac",    1, false, { 4096 },                         10000,      44100 },
+    };
+
+    std::filesystem::create_directories(dir);
+    SdFatHost::set_root(dir);
+
+    Serial.printf("--------------- FLAC SEEK ---------------\n");
+
+    std::mt19937 random(seed);
+    int          failed = 0;
+
+    for (const Fixture& fixture : fixtures) {
+        std::vector<Frame> frames;
+        Bytes              bytes = stream(fixture, frames);
+
+        if (!write_file(std::string(dir) + "/" + fixture.name, bytes)) {
+            Serial.printf("can't write %s to %s\n", fixture.name, dir);
+            return 1;
+        }
+
+        FsFile                              file;
+        MalkuthFlac::StreamInfo             info;
+        std::vector<MalkuthFlac::SeekPoint> table;
+
+        if (!file.open((std::string("/") + fixture.name).c_str()) || !MalkuthFlac::streaminfo(file, info, table) ||
+            info.total_samples != fixture.samples || info.channels != fixture.channels || info.bps != 16) {
+            Serial.printf("%-25s: STREAMINFO FAIL\n", fixture.name);
+            failed++;
+            continue;
+        }
+
+        int bad_frames = check_frames(file, info, frames);
+
+        // Both ends and both sides of a frame boundary, then anywhere
+        std::vector<uint64_t> targets = { 0, 1, fixture.samples - 1 };
+        for (size_t i = 1; i < frames.size(); i += frames.size() / 7 + 1) {
+            targets.push_back(frames[i].sample - 1);
+            targets.push_back(frames[i].sample);
+        }
+        for (int i = 0; i < seeks; i++)
+            targets.push_back(random() % fixture.samples);
+
+        int  bad_seeks = 0;
+        auto start     = std::chrono::steady_clock::now();
+
+        for (uint64_t target : targets)
+            bad_seeks += !check_seek(file, info, table, frames, target);
+
+        double us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+
+        Serial.printf("%-25s: %s, %zu frames, %zu seekpoints, %d bad frames, %zu seeks %d failed, %.1f us/seek\n",
+            fixture.name, bad_frames + bad_seeks ? "FAIL" : "ok", frames.size(), table.size(),
+            bad_frames, targets.size(), bad_seeks, us / targets.size());
+
+        failed += bad_frames + bad_seeks;
+        file.close();
+    }
+
+    Serial.printf("FLAC seek                : %s\n", failed ? "FAILED" : "ok");
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,169 @@
+#include "host.h"
+
+#include "malkuth_gain.h"
+
+#include <chrono>
+#include <random>
+#include <vector>
+
+///
+/// Reference
+///
+
+// Written out with plain division instead of shifts, so a shift or rounding
+// slip in MalkuthGain doesn't show up on both sides
+static int64_t floor_div(int64_t value, int64_t by) {
+    return value >= 0 ? value / by : -((-value + by - 1) / by);
+}
+
+static int16_t reference_s16(int16_t sample, int32_t gain) {
+    if (gain == GAIN_UNITY) return sample;
+    return (int16_t)floor_div((int64_t)sample * (gain / 65536), 32768);
+}
+
+static int32_t reference_s32(int32_t sample, int32_t gain) {
+    if (gain == GAIN_UNITY) return sample;
+    return (int32_t)floor_div((int64_t)sample * gain + 1073741824, 2147483648LL);
+}
+
+static int32_t reference_s24(int32_t sample, int32_t gain) {
+    if (gain == GAIN_UNITY) return sample * 256;
+    return (int32_t)floor_div((int64_t)sample * gain + 4194304, 8388608);
+}
+
+///
+/// Checks
+///
+
+// Every 16 bit value, and the extremes plus a spread of random values for
+// 24 and 32 bit, at every percent. Returns the samples that came out wrong
+static uint32_t check(uint32_t seed) {
+    std::mt19937          random(seed);
+    std::vector<int16_t>  s16(65536);
+    std::vector<int32_t>  s32, s24;
+
+    for (int32_t value : { INT32_MIN, INT32_MIN + 1, -1, 0, 1, INT32_MAX - 1, INT32_MAX })
+        s32.push_back(value);
+    for (int32_t value : { -8388608, -8388607, -1, 0, 1, 8388606, 8388607 })
+        s24.push_back(value);
+    for (int i = 0; i < 4096; i++) {
+        s32.push_back((int32_t)random());
+        s24.push_back((int32_t)(random() << 8) >> 8);
+    }
+
+    std::vector<int16_t> out16(s16.size());
+    std::vector<int32_t> out32(s32.size()), out24(s24.size());
+    uint32_t             wrong = 0;
+    MalkuthGain          gain;
+
+    for (uint8_t percent = 0; percent <= 100; percent++) {
+        gain.set_percent(percent);
+
+        for (size_t i = 0; i < out16.size(); i++)
+            out16[i] = (int16_t)(i - 32768);
+        out32 = s32;
+
+        gain.apply((uint8_t*)out16.data(), out16.size() * 2, 16);
+        gain.apply((uint8_t*)out32.data(), out32.size() * 4, 32);
+        gain.pack_s24(s24.data(), out24.data(), s24.size());
+
+        for (size_t i = 0; i < out16.size(); i++)
+            wrong += out16[i] != reference_s16((int16_t)(i - 32768), gain.get());
+        for (size_t i = 0; i < out32.size(); i++)
+            wrong += out32[i] != reference_s32(s32[i], gain.get());
+        for (size_t i = 0; i < out24.size(); i++)
+            wrong += out24[i] != reference_s24(s24[i], gain.get());
+    }
+
+    // Odd starts and lengths, the S3 vector loop only takes aligned blocks
+    gain.set_percent(63);
+    for (size_t start = 0; start < 9; start++) {
+        for (size_t count : { 0, 1, 7, 8, 9, 31, 1027 }) {
+            std::vector<int16_t> block(start + count + 8);
+            for (size_t i = 0; i < block.size(); i++)
+                block[i] = (int16_t)random();
+
+            std::vector<int16_t> before = block;
+            gain.apply((uint8_t*)(block.data() + start), count * 2, 16);
+
+            for (size_t i = 0; i < block.size(); i++) {
+                bool inside = i >= start && i < start + count;
+                wrong += block[i] != (inside ? reference_s16(before[i], gain.get()) : before[i]);
+            }
+        }
+    }
+
+    return wrong;
+}
+
+///
+/// Benchmark
+///
+
+template <typename Run>
+static double ns_per_sample(size_t samples, int rounds, Run run) {
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < rounds; i++)
+        run();
+    double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+    return ns / ((double)samples * rounds);
+}
+
+int run_gain(int argc, char** argv) {
+    size_t   samples = atoi(option(argc, argv, "--samples", "4096"));
+    int      rounds  = atoi(option(argc, argv, "--rounds", "2000"));
+    uint32_t seed    = atoi(option(argc, argv, "--seed", "1"));
+
+    std::vector<int16_t> s16(samples);
+    std::vector<int32_t> s32(samples), s24(samples), out(samples);
+
+    for (size_t i = 0; i < samples; i++) {
+        s16[i] = (int16_t)(i * 2654435761u >> 16);
+        s32[i] = (int32_t)(i * 2654435761u);
+        s24[i] = s32[i] >> 8;
+    }
+
+    MalkuthGain gain;
+    gain.set_percent(90);
+
+    volatile float factor = gain.get() / (float)GAIN_UNITY;
+    float          f      = factor;
+
+    // Blocks are reloaded every round, 90% of 90% of ... decays to silence
+    // long before the rounds run out. The copy is in both sides' numbers
+    std::vector<int16_t> work16(samples);
+    std::vector<int32_t> work32(samples);
+
+    double fixed16 = ns_per_sample(samples, rounds, [&] {
+        work16 = s16;
+        gain.apply((uint8_t*)work16.data(), samples * 2, 16);
+    });
+    double float16 = ns_per_sample(samples, rounds, [&] {
+        work16 = s16;
+        for (size_t i = 0; i < samples; i++)
+            work16[i] = (int16_t)(f * work16[i]);
+    });
+    double fixed32 = ns_per_sample(samples, rounds, [&] {
+        work32 = s32;
+        gain.apply((uint8_t*)work32.data(), samples * 4, 32);
+    });
+    double packed  = ns_per_sample(samples, rounds, [&] {
+        gain.pack_s24(s24.data(), out.data(), samples);
+    });
+
+    gain.set_percent(100);
+    double unity   = ns_per_sample(samples, rounds, [&] {
+        gain.pack_s24(s24.data(), out.data(), samples);
+    });
+
+    uint32_t wrong = check(seed);
+
+    Serial.printf("--------------- GAIN ---------------\n");
+    Serial.printf("Block                    : %zu samples, %d rounds\n", samples, rounds);
+    Serial.printf("16 bit Q15 / float       : %.2f / %.2f ns per sample\n", fixed16, float16);
+    Serial.printf("32 bit Q31               : %.2f ns per sample\n", fixed32);
+    Serial.printf("pack_s24 90%% / unity     : %.2f / %.2f ns per sample\n", packed, unity);
+    Serial.printf("Exact output             : %s, %u wrong samples\n", wrong ? "FAIL" : "ok", wrong);
+
+    return wrong ? 1 : 0;
+}
@@ -0,0 +1,24 @@
+#pragma once
+
+#include <Arduino.h>
+
+// Value following name on the command line, fallback if it isn't there
+inline const char* option(int argc, char** argv, const char* name, const char* fallback) {
+    for (int i = 0; i + 1 < argc; i++)
+        if (strcmp(argv[i], name) == 0) return argv[i + 1];
+    return fallback;
+}
+
+// Queue drained and nothing reached the panel for a while, returns when the
+// last push happened
+uint32_t settle();
+
+int run_id3(int argc, char** argv);
+int run_cover(int argc, char** argv);
+int run_jpeg(int argc, char** argv);
+int run_sd(int argc, char** argv);
+int run_readahead(int argc, char** argv);
+int run_spi(int argc, char** argv);
+int run_flac(int argc, char** argv);
+int run_queue(int argc, char** argv);
+int run_gain(int argc, char** argv);
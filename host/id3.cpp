@@ -0,0 +1,453 @@
+#include "host.h"
+
+#include "malkuth_id3.h"
+
+#include <atomic>
+#include <new>
+#include <random>
+#include <vector>
+
+// Every operator new in the process, the tag reader must not move it
+static std::atomic<uint64_t> allocations(0);
+
+void* operator new(size_t size) {
+    allocations++;
+    if (void* ptr = malloc(size ? size : 1)) return ptr;
+    throw std::bad_alloc();
+}
+
+void  operator delete(void* ptr) noexcept              { free(ptr); }
+void  operator delete(void* ptr, size_t) noexcept      { free(ptr); }
+
+typedef std::vector<uint8_t> Bytes;
+
+struct Sample {
+    const char* name;
+    Bytes       bytes;
+    bool        tagged;
+    std::string title;
+    std::string artist;
+    std::string album;
+};
+
+///
+/// Tag building
+///
+
+static void append(Bytes& out, const Bytes& more) {
+    out.insert(out.end(), more.begin(), more.end());
+}
+
+static void append(Bytes& out, const char* text) {
+    out.insert(out.end(), text, text + strlen(text));
+}
+
+static void put_syncsafe(Bytes& out, uint32_t value) {
+    out.push_back((value >> 21) & 0x7F);
+    out.push_back((value >> 14) & 0x7F);
+    out.push_back((value >> 7)  & 0x7F);
+    out.push_back(value & 0x7F);
+}
+
+static void put_be(Bytes& out, uint32_t value, int bytes) {
+    for (int i = bytes - 1; i >= 0; i--)
+        out.push_back((value >> (i * 8)) & 0xFF);
+}
+
+// UTF-8 in, UTF-16 code units out
+static std::vector<uint16_t> utf16(const std::string& text) {
+    std::vector<uint16_t> units;
+
+    for (size_t i = 0; i < text.size(); ) {
+        uint8_t  lead = text[i];
+        int      extra = lead < 0x80 ? 0 : lead < 0xE0 ? 1 : lead < 0xF0 ? 2 : 3;
+        uint32_t code  = extra == 0 ? lead : lead & (0x3F >> extra);
+
+        for (int k = 1; k <= extra; k++)
+            code = (code << 6) | (text[i + k] & 0x3F);
+        i += extra + 1;
+
+        if (code >= 0x10000) {
+            code -= 0x10000;
+            units.push_back(0xD800 | (code >> 10));
+            units.push_back(0xDC00 | (code & 0x3FF));
+        } else {
+            units.push_back(code);
+        }
+    }
+
+    return units;
+}
+
+enum Encoding { LATIN1 = 0, UTF16_BOM_LE = 1, UTF16_BE = 2, UTF8 = 3, UTF16_BOM_BE = 4 };
+
+static Bytes text(Encoding encoding, const std::string& value) {
+    Bytes out;
+    out.push_back(encoding == UTF16_BOM_BE ? 1 : encoding);
+
+    if (encoding == LATIN1) {
+        for (uint16_t unit : utf16(value)) out.push_back(unit);
+        out.push_back(0);
+    } else if (encoding == UTF8) {
+        append(out, value.c_str());
+        out.push_back(0);
+    } else {
+        bool little = encoding == UTF16_BOM_LE;
+
+        if (encoding == UTF16_BOM_LE) { out.push_back(0xFF); out.push_back(0xFE); }
+        if (encoding == UTF16_BOM_BE) { out.push_back(0xFE); out.push_back(0xFF); }
+
+        for (uint16_t unit : utf16(value)) {
+            out.push_back(little ? unit & 0xFF : unit >> 8);
+            out.push_back(little ? unit >> 8 : unit & 0xFF);
+        }
+        out.push_back(0);
+        out.push_back(0);
+    }
+
+    return out;
+}
+
+static Bytes unsync(const Bytes& in) {
+    Bytes out;
+
+    for (size_t i = 0; i < in.size(); i++) {
+        out.push_back(in[i]);
+        if (in[i] == 0xFF && (i + 1 == in.size() || in[i + 1] == 0x00 || in[i + 1] >= 0xE0))
+            out.push_back(0x00);
+    }
+
+    return out;
+}
+
+enum SizeStyle { SYNCSAFE, PLAIN };
+
+static Bytes frame(uint8_t version, const char* id, const Bytes& payload, uint8_t format = 0, SizeStyle style = SYNCSAFE) {
+    Bytes out;
+    append(out, id);
+
+    if (version == 2) {
+        put_be(out, payload.size(), 3);
+    } else {
+        if (version == 4 && style == SYNCSAFE) put_syncsafe(out, payload.size());
+        else                                   put_be(out, payload.size(), 4);
+
+        out.push_back(0);
+        out.push_back(format);
+    }
+
+    append(out, payload);
+    return out;
+}
+
+static Bytes tag(uint8_t version, uint8_t flags, const Bytes& body, bool footer = false) {
+    Bytes out;
+    append(out, "ID3");
+    out.push_back(version);
+    out.push_back(0);
+    out.push_back(flags);
+    put_syncsafe(out, body.size());
+    append(out, body);
+
+    if (footer) {
+        append(out, "3DI");
+        out.push_back(version);
+        out.push_back(0);
+        out.push_back(flags);
+        put_syncsafe(out, body.size());
+    }
+
+    return out;
+}
+
+static Bytes filler(size_t size, uint8_t seed) {
+    Bytes out(size);
+    for (size_t i = 0; i < size; i++)
+        out[i] = (uint8_t)(i * 37 + seed) | ((i % 5 == 0) ? 0xE0 : 0);  // plenty of 0xFF 0xEx
+    return out;
+}
+
+// Two MPEG frame headers, enough for the duration scan to find a sync
+static Bytes audio() {
+    Bytes out;
+    for (int i = 0; i < 2; i++) {
+        Bytes mpeg(417, 0);
+        mpeg[0] = 0xFF; mpeg[1] = 0xFB; mpeg[2] = 0x90; mpeg[3] = 0x00;
+        append(out, mpeg);
+    }
+    return out;
+}
+
+static std::vector<Sample> corpus() {
+    std::vector<Sample> samples;
+    const std::string long_title(300, 'x');
+
+    {
+        Bytes body;
+        append(body, frame(2, "TT2", text(LATIN1, "Café ÿ")));
+        append(body, frame(2, "TP1", text(LATIN1, "Artiste")));
+        append(body, frame(2, "TAL", text(LATIN1, "Album")));
+        samples.push_back({ "v22_latin1", tag(2, 0, body), true, "Café ÿ", "Artiste", "Album" });
+    }
+    {
+        // Title sits behind a frame far over the old 512 byte limit
+        Bytes body;
+        append(body, frame(3, "APIC", filler(4096, 1)));
+        append(body, frame(3, "TIT2", text(UTF16_BOM_LE, "夜に駆ける")));
+        append(body, frame(3, "TPE1", text(UTF16_BOM_BE, "YOASOBI")));
+        append(body, frame(3, "TALB", text(LATIN1, "THE BOOK")));
+        samples.push_back({ "v23_utf16", tag(3, 0, body), true, "夜に駆ける", "YOASOBI", "THE BOOK" });
+    }
+    {
+        // Sizes are what they were before the whole tag got unsynchronised
+        Bytes body;
+        append(body, frame(3, "PRIV", filler(700, 2)));
+        append(body, frame(3, "TIT2", text(LATIN1, "ÿÿà unsync")));
+        append(body, frame(3, "TPE1", text(UTF16_BOM_LE, "ÿÿ")));
+        append(body, frame(3, "TALB", text(LATIN1, "Sync")));
+        samples.push_back({ "v23_unsync", tag(3, 0x80, unsync(body)), true, "ÿÿà unsync", "ÿÿ", "Sync" });
+    }
+    {
+        // Extended header, and a compressed TPE1 that has to be passed over
+        Bytes body;
+        put_be(body, 6, 4);
+        append(body, Bytes{ 0, 0, 0, 0, 0, 0 });
+
+        Bytes compressed;
+        put_be(compressed, 64, 4);
+        append(compressed, filler(20, 3));
+
+        append(body, frame(3, "TPE1", compressed, 0x80));
+        append(body, frame(3, "TIT2", text(UTF8, "Extended")));
+        append(body, frame(3, "TPE1", text(UTF8, "Plain")));
+        append(body, frame(3, "TALB", text(UTF8, "")));
+        samples.push_back({ "v23_exthdr", tag(3, 0x40, body), true, "Extended", "Plain", "" });
+    }
+    {
+        // Sizes only make sense read syncsafe, the title gets cut at the
+        // buffer on a character boundary
+        Bytes body;
+        append(body, frame(4, "TXXX", text(LATIN1, std::string(200, 'y'))));
+        append(body, frame(4, "TIT2", text(UTF8, long_title)));
+        append(body, frame(4, "TPE1", text(UTF8, "é" + std::string(200, 'z'))));
+        append(body, frame(4, "TALB", text(UTF8, "Syncsafe")));
+        samples.push_back({
+            "v24_syncsafe", tag(4, 0, body), true,
+            long_title.substr(0, ID3_TEXT_MAX - 1), "é" + std::string(ID3_TEXT_MAX - 3, 'z'), "Syncsafe"
+        });
+    }
+    {
+        // Per frame unsynchronisation with a data length indicator, an
+        // extended header and a footer
+        Bytes body;
+        body.push_back(0); body.push_back(0); body.push_back(0); body.push_back(6);
+        body.push_back(1); body.push_back(0);
+
+        Bytes title   = text(UTF16_BOM_LE, "ÿÿv24");
+        Bytes payload;
+        put_syncsafe(payload, title.size());
+        append(payload, unsync(title));
+
+        append(body, frame(4, "TIT2", payload, 0x03));
+        append(body, frame(4, "TPE1", unsync(text(LATIN1, "ÿà")), 0x02));
+        append(body, frame(4, "TALB", text(UTF16_BE, "Footer")));
+        samples.push_back({ "v24_unsync", tag(4, 0x50, body, true), true, "ÿÿv24", "ÿà", "Footer" });
+    }
+    {
+        // Old iTunes, plain big endian sizes in a v2.4 tag
+        Bytes body;
+        append(body, frame(4, "TXXX", text(LATIN1, std::string(200, 'i')), 0, PLAIN));
+        append(body, frame(4, "TIT2", text(UTF8, "iTunes"), 0, PLAIN));
+        append(body, frame(4, "TPE1", text(UTF8, "Apple"), 0, PLAIN));
+        samples.push_back({ "v24_itunes", tag(4, 0, body), true, "iTunes", "Apple", "" });
+    }
+    {
+        Bytes body;
+        append(body, frame(4, "TIT2", text(UTF16_BE, "Note \U0001F3B5")));
+        append(body, frame(4, "TPE1", text(UTF8, "アーティスト")));
+        append(body, frame(4, "TALB", text(UTF16_BOM_LE, "\U0001F4BF")));
+        samples.push_back({ "v24_surrogate", tag(4, 0, body), true, "Note \U0001F3B5", "アーティスト", "\U0001F4BF" });
+    }
+    {
+        Bytes body;
+        append(body, frame(3, "TIT2", text(LATIN1, "Padded")));
+        body.resize(body.size() + 1024, 0);
+        samples.push_back({ "v23_padding", tag(3, 0, body), true, "Padded", "", "" });
+    }
+    samples.push_back({ "no_tag", Bytes(), false, "", "", "" });
+
+    for (auto& sample : samples)
+        append(sample.bytes, audio());
+
+    return samples;
+}
+
+///
+/// Checks
+///
+
+static bool write_file(const char* path, const Bytes& bytes) {
+    FILE* file = fopen(path, "wb");
+    if (!file) return false;
+
+    bool ok = fwrite(bytes.data(), 1, bytes.size(), file) == bytes.size();
+    return fclose(file) == 0 && ok;
+}
+
+static bool valid_utf8(const char* text, size_t cap) {
+    size_t length = strnlen(text, cap);
+    if (length == cap) return false;
+
+    for (size_t i = 0; i < length; ) {
+        uint8_t lead  = text[i];
+        int     extra = lead < 0x80 ? 0 : (lead & 0xE0) == 0xC0 ? 1 : (lead & 0xF0) == 0xE0 ? 2 : (lead & 0xF8) == 0xF0 ? 3 : -1;
+        if (extra < 0 || i + extra >= length + (extra == 0)) return false;
+
+        for (int k = 1; k <= extra; k++)
+            if ((text[i + k] & 0xC0) != 0x80) return false;
+        i += extra + 1;
+    }
+
+    return true;
+}
+
+static bool parse(const char* path, MalkuthId3::Tags& tags, MalkuthId3::Header& header, bool& tagged, uint64_t& allocated) {
+    FsFile file;
+    if (!file.open(path)) return false;
+
+    uint64_t before = allocations;
+    tagged          = MalkuthId3::read_tags(file, tags, &header);
+    allocated       = allocations - before;
+    return true;
+}
+
+static int check_corpus(const std::vector<Sample>& samples, const char* dir) {
+    int failed = 0;
+
+    for (const auto& sample : samples) {
+        std::string host = std::string(dir) + "/" + sample.name + ".mp3";
+        std::string path = std::string("/") + sample.name + ".mp3";
+        if (!write_file(host.c_str(), sample.bytes)) {
+            Serial.printf("can't write %s\n", host.c_str());
+            return 1;
+        }
+
+        MalkuthId3::Tags   tags;
+        MalkuthId3::Header header;
+        bool               tagged    = false;
+        uint64_t           allocated = 0;
+
+        bool ok = parse(path.c_str(), tags, header, tagged, allocated) &&
+                  tagged == sample.tagged && allocated == 0 &&
+                  sample.title == tags.title && sample.artist == tags.artist && sample.album == tags.album;
+
+        if (ok && tagged) {
+            FsFile file;
+            file.open(path.c_str());
+            ok = MalkuthId3::tag_size(file) == sample.bytes.size() - audio().size();
+        }
+
+        Serial.printf("%-24s : %s\n", sample.name, ok ? "ok" : "FAILED");
+        if (!ok) {
+            Serial.printf("    title  \"%s\"\n    artist \"%s\"\n    album  \"%s\"\n    allocations %llu\n",
+                tags.title, tags.artist, tags.album, (unsigned long long)allocated);
+            failed++;
+        }
+    }
+
+    return failed;
+}
+
+static void benchmark(const std::vector<Sample>& samples, int runs) {
+    Serial.printf("--------------- ID3 BENCH ----------------\n");
+
+    for (const auto& sample : samples) {
+        std::string path = std::string("/") + sample.name + ".mp3";
+
+        FsFile file;
+        file.open(path.c_str());
+
+        MalkuthId3::Tags tags;
+        uint32_t start = micros();
+        for (int i = 0; i < runs; i++)
+            MalkuthId3::read_tags(file, tags);
+        uint32_t elapsed = micros() - start;
+
+        Serial.printf("%-24s : %6u bytes, %8.2f us per tag\n",
+            sample.name, (unsigned)sample.bytes.size(), (float)elapsed / runs);
+    }
+}
+
+// Random damage to a random sample, the reader has to come back with
+// terminated UTF-8 no matter what
+static int fuzz(const std::vector<Sample>& samples, const char* dir, int iterations, uint32_t seed) {
+    std::mt19937 random(seed);
+    std::string  host = std::string(dir) + "/fuzz.mp3";
+    int          failed = 0;
+
+    for (int i = 0; i < iterations; i++) {
+        Bytes bytes = samples[random() % samples.size()].bytes;
+        int   edits = 1 + random() % 8;
+
+        for (int e = 0; e < edits && !bytes.empty(); e++) {
+            size_t at = random() % bytes.size();
+
+            switch (random() % 6) {
+                case 0: bytes[at] ^= 1 << (random() % 8);                      break;
+                case 1: bytes[at]  = random();                                 break;
+                case 2: bytes[random() % std::min<size_t>(bytes.size(), 32)] = random(); break;  // headers
+                case 3: bytes.resize(at);                                      break;
+                case 4: bytes[at]  = random() % 2 ? 0xFF : 0x00;               break;
+                case 5: bytes.insert(bytes.begin() + at, random() % 16, random()); break;
+            }
+        }
+
+        write_file(host.c_str(), bytes);
+
+        MalkuthId3::Tags   tags;
+        MalkuthId3::Header header;
+        bool               tagged    = false;
+        uint64_t           allocated = 0;
+
+        bool ok = parse("/fuzz.mp3", tags, header, tagged, allocated) && allocated == 0 &&
+                  valid_utf8(tags.title, ID3_TEXT_MAX) &&
+                  valid_utf8(tags.artist, ID3_TEXT_MAX) &&
+                  valid_utf8(tags.album, ID3_TEXT_MAX) &&
+                  (!tagged || header.total >= 10);
+
+        if (!ok) {
+            std::string keep = std::string(dir) + "/fuzz_fail_" + std::to_string(i) + ".mp3";
+            write_file(keep.c_str(), bytes);
+            Serial.printf("fuzz %d failed, kept as %s\n", i, keep.c_str());
+            failed++;
+        }
+    }
+
+    remove(host.c_str());
+    Serial.printf("Fuzz iterations          : %d (seed %u), %d failed\n", iterations, seed, failed);
+    return failed;
+}
+
+int run_id3(int argc, char** argv) {
+    if (argc < 3) {
+        Serial.printf("usage: malkuth_host id3 <work dir> [--runs n] [--fuzz n] [--seed n]\n");
+        return 1;
+    }
+
+    const char* dir        = argv[2];
+    int         runs       = atoi(option(argc, argv, "--runs", "2000"));
+    int         iterations = atoi(option(argc, argv, "--fuzz", "20000"));
+    uint32_t    seed       = strtoul(option(argc, argv, "--seed", "1"), nullptr, 0);
+
+    SdFatHost::set_root(dir);
+
+    std::vector<Sample> samples = corpus();
+
+    Serial.printf("--------------- ID3 CORPUS ---------------\n");
+    int failed = check_corpus(samples, dir);
+
+    if (runs > 0)       benchmark(samples, runs);
+    if (iterations > 0) failed += fuzz(samples, dir, iterations, seed);
+
+    return failed ? 1 : 0;
+}
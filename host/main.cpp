@@ -0,0 +1,256 @@
+#include "host.h"
+
+#include "malkuth_fs.h"
+#include "malkuth_display.h"
+#include "malkuth_i2s.h"
+
+#include "fonts/Icons.h"
+#include "flash_images/BootBg.h"
+
+#include <fstream>
+#include <iterator>
+
+// Same layout as page_files_listing, minus the buttons
+constexpr uint8_t   VISIBLE_ITEMS       = 5;
+constexpr size_t    MAX_VISIBLE_STRING  = 29;
+
+constexpr uint16_t  C_ACCENT_EXMUTED    = 0x0904;
+constexpr uint16_t  C_TEXT_PRIMARY      = TFT_WHITE;
+constexpr uint16_t  C_TEXT_MUTED        = 0x7BEF;
+
+MalkuthFs       filesystem;
+MalkuthDisplay  display;
+
+// Same as main.ino's
+static String format_elipsis(const String& text, uint8_t length) {
+    if (text.length() <= length || length < 5) {
+        return text;
+    }
+
+    size_t keep  = length - 3;
+    size_t front = keep / 2;
+    size_t back  = keep - front;
+
+    return text.substring(0, front) + "..." + text.substring(text.length() - back);
+}
+
+static void usage() {
+    Serial.printf(
+        "usage: malkuth_host files <sd root> [dir] [--font file.vlw] [--png out.png] [--frames n]\n"
+        "       malkuth_host pcm <in.wav> <out.wav> [--volume 0-100]\n"
+        "       malkuth_host id3 <work dir> [--runs n] [--fuzz n] [--seed n]\n"
+        "       malkuth_host cover <work dir> [--png out.png]\n"
+        "       malkuth_host jpeg <work dir> [--rounds n]\n"
+        "       malkuth_host sd <work dir> [--seconds n]\n"
+        "       malkuth_host readahead\n"
+        "       malkuth_host spi [--call-us n] [--fill-us n]\n"
+        "       malkuth_host flac <work dir> [--seeks n] [--seed n]\n"
+        "       malkuth_host queue [--commands n]\n"
+        "       malkuth_host gain [--samples n] [--rounds n] [--seed n]\n"
+    );
+}
+
+static std::vector<uint8_t> load(const char* path) {
+    std::ifstream file(path, std::ios::binary);
+    return std::vector<uint8_t>(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+}
+
+uint32_t settle() {
+    while (true) {
+        uint32_t pushes = TftHost::screen() ? TftHost::screen()->pushes() : 0;
+        delay(SCENE_MAX_LATENCY_MS * 2);
+
+        if (display.get_free_queue() == DISPLAY_QUEUE_LENGTH &&
+            TftHost::screen() && TftHost::screen()->pushes() == pushes)
+            return TftHost::screen()->lastPush();
+    }
+}
+
+///
+/// Files page
+///
+
+static void listing(const MalkuthDirCache::Listing* files, const char* dir, const uint8_t* font, uint16_t start_idx) {
+    // Folder, audio, image and file, in EntryType order
+    static const char* icons[] = { "", "", "", "" };
+    uint16_t count = files ? files->count() : 0;
+
+    display.object(Anchor::TOP_CENTER, 320, 240, TFT_BLACK, 0, 0, 120);
+
+    for (uint8_t i = 0; i < VISIBLE_ITEMS; ++i) {
+        uint16_t idx = start_idx + i;
+        if (idx >= count) break;
+
+        int16_t y_offset = 75 + ((i + 1) * 45);
+        String  name     = format_elipsis(String((*files)[idx]), MAX_VISIBLE_STRING);
+
+        display.object(Anchor::TOP_CENTER, 300, 40, C_ACCENT_EXMUTED, 10, 0, y_offset);
+        display.text(Anchor::TOP_LEFT, true, icons[(uint8_t)files->type(idx)], Icons, C_TEXT_PRIMARY, 20, 82 + (i + 1) * 45);
+        if (font)
+            display.text(Anchor::TOP_LEFT, true, name.c_str(), font, C_TEXT_PRIMARY, 45, 84 + (i + 1) * 45);
+    }
+
+    if (font)
+        display.text(Anchor::BOTTOM_LEFT, true, dir, font, C_TEXT_MUTED, 0, -116);
+}
+
+static int run_files(int argc, char** argv) {
+    if (argc < 3) { usage(); return 1; }
+
+    const char* dir    = argc > 3 && argv[3][0] != '-' ? argv[3] : "/";
+    const char* png    = option(argc, argv, "--png", nullptr);
+    const char* vlw    = option(argc, argv, "--font", nullptr);
+    int         frames = atoi(option(argc, argv, "--frames", "1"));
+
+    std::vector<uint8_t> font;
+    if (vlw) {
+        font = load(vlw);
+        if (font.empty()) { Serial.printf("can't read %s\n", vlw); return 1; }
+    }
+
+    SdFatHost::set_root(argv[2]);
+    if (!filesystem.init()) { Serial.printf("%s is not a directory\n", argv[2]); return 1; }
+
+    display.init();
+
+    display.image(ImageType::FLASH, BootBg, sizeof(BootBg));
+    settle();
+
+    uint32_t start = micros();
+    auto*    files = filesystem.get_directory(dir);
+    uint32_t load  = micros() - start;
+
+    if (!files) { Serial.printf("%s is not a directory on the card\n", dir); return 1; }
+
+    // Every frame after the first pages through the listing, the way the
+    // down button does
+    uint64_t total_us     = 0;
+    uint64_t total_pixels = 0;
+    uint32_t worst_us     = 0;
+
+    for (int frame = 0; frame < std::max(frames, 1); frame++) {
+        uint16_t start_idx = files->count() ? (frame * VISIBLE_ITEMS) % std::max<uint16_t>(files->count(), 1) : 0;
+        uint64_t before    = TftHost::screen()->pushed();
+
+        start = micros();
+        listing(files, dir, font.empty() ? nullptr : font.data(), start_idx);
+        uint32_t cost = settle() - start;
+
+        total_us     += cost;
+        total_pixels += TftHost::screen()->pushed() - before;
+        worst_us      = std::max(worst_us, cost);
+    }
+
+    Serial.printf("--------------- FILES PAGE ---------------\n");
+    Serial.printf("Entries                  : %u\n", files->count());
+    Serial.printf("Listing load             : %u us\n", load);
+    Serial.printf("Frames                   : %d\n", std::max(frames, 1));
+    Serial.printf("Frame cost avg           : %llu us\n", (unsigned long long)(total_us / std::max(frames, 1)));
+    Serial.printf("Frame cost max           : %u us\n", worst_us);
+    Serial.printf("Pixels pushed per frame  : %llu\n", (unsigned long long)(total_pixels / std::max(frames, 1)));
+    Serial.printf("Image cache hits / misses: %u / %u\n", display.get_cache_hits(), display.get_cache_misses());
+
+    if (png && !TftHost::screen()->savePng(png)) {
+        Serial.printf("can't write %s\n", png);
+        return 1;
+    }
+
+    return 0;
+}
+
+///
+/// PCM through the output stages
+///
+
+static uint32_t le(const uint8_t* ptr, int bytes) {
+    uint32_t value = 0;
+    for (int i = bytes - 1; i >= 0; i--)
+        value = (value << 8) | ptr[i];
+    return value;
+}
+
+static int run_pcm(int argc, char** argv) {
+    if (argc < 4) { usage(); return 1; }
+
+    std::vector<uint8_t> wav = load(argv[2]);
+    int volume = atoi(option(argc, argv, "--volume", "100"));
+
+    if (wav.size() < 12 || memcmp(wav.data(), "RIFF", 4) != 0 || memcmp(wav.data() + 8, "WAVE", 4) != 0) {
+        Serial.printf("%s is not a WAV file\n", argv[2]);
+        return 1;
+    }
+
+    AudioInfo      info;
+    const uint8_t* data = nullptr;
+    size_t         size = 0;
+
+    for (size_t at = 12; at + 8 <= wav.size(); ) {
+        const uint8_t* chunk  = wav.data() + at;
+        size_t         length = std::min<size_t>(le(chunk + 4, 4), wav.size() - at - 8);
+
+        if (memcmp(chunk, "fmt ", 4) == 0 && length >= 16) {
+            info.channels        = le(chunk + 10, 2);
+            info.sample_rate     = le(chunk + 12, 4);
+            info.bits_per_sample = le(chunk + 22, 2);
+        } else if (memcmp(chunk, "data", 4) == 0) {
+            data = chunk + 8;
+            size = length;
+        }
+
+        at += 8 + length + (length & 1);
+    }
+
+    if (!data || (info.bits_per_sample != 16 && info.bits_per_sample != 32)) {
+        Serial.printf("only 16 and 32 bit PCM WAV is supported\n");
+        return 1;
+    }
+
+    CustomI2S i2s;
+    if (!i2s.openWav(argv[3])) { Serial.printf("can't write %s\n", argv[3]); return 1; }
+
+    i2s.setAudioInfo(info);
+    i2s.gain.set_percent(volume);
+    i2s.dma.set_capacity(512 * 6);
+
+    // Decoders hand over a few KB at a time
+    const size_t frame   = i2s.frameSize();
+    const size_t chunk   = 4096 / frame * frame;
+    uint32_t     start   = micros();
+
+    for (size_t at = 0; at < size; at += chunk)
+        i2s.write(data + at, std::min(chunk, size - at));
+
+    uint32_t elapsed = micros() - start;
+    i2s.end();
+
+    float seconds = (float)size / (info.sample_rate * frame);
+
+    Serial.printf("--------------- PCM OUTPUT ---------------\n");
+    Serial.printf("Format                   : %d Hz, %d ch, %d bit\n", info.sample_rate, info.channels, info.bits_per_sample);
+    Serial.printf("Audio                    : %.2f s\n", seconds);
+    Serial.printf("Wall time                : %u us\n", elapsed);
+    Serial.printf("Real time factor         : %.1fx\n", elapsed ? seconds * 1e6f / elapsed : 0.0f);
+    i2s.stats_convert.print(Serial);
+    i2s.stats_write.print(Serial);
+
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    if (argc < 2) { usage(); return 1; }
+
+    if (strcmp(argv[1], "files") == 0) return run_files(argc, argv);
+    if (strcmp(argv[1], "pcm") == 0)   return run_pcm(argc, argv);
+    if (strcmp(argv[1], "id3") == 0)   return run_id3(argc, argv);
+    if (strcmp(argv[1], "cover") == 0) return run_cover(argc, argv);
+    if (strcmp(argv[1], "jpeg") == 0)  return run_jpeg(argc, argv);
+    if (strcmp(argv[1], "sd") == 0)    return run_sd(argc, argv);
+    if (strcmp(argv[1], "readahead") == 0) return run_readahead(argc, argv);
+    if (strcmp(argv[1], "spi") == 0)   return run_spi(argc, argv);
+    if (strcmp(argv[1], "flac") == 0)  return run_flac(argc, argv);
+    if (strcmp(argv[1], "queue") == 0) return run_queue(argc, argv);
+    if (strcmp(argv[1], "gain") == 0)  return run_gain(argc, argv);
+
+    usage();
+    return 1;
+}
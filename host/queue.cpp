@@ -0,0 +1,249 @@
+#include "host.h"
+
+#include "malkuth_display.h"
+
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+extern MalkuthDisplay display;
+
+// Empty text goes through the whole arena and queue path but draws nothing,
+// this is the display's own queue, on the board it would be the UI's
+static double throughput(uint32_t count, int producers) {
+    uint32_t first = display.get_commands_handled();
+    uint32_t start = micros();
+
+    std::vector<std::thread> threads;
+    for (int p = 0; p < producers; p++) {
+        threads.emplace_back([count, producers] {
+            for (uint32_t i = 0; i < count / producers; i++)
+                display.text(Anchor::TOP_LEFT, true, "", nullptr, 0);
+        });
+    }
+
+    for (std::thread& thread : threads)
+        thread.join();
+
+    uint32_t sent = count / producers * producers;
+    while (display.get_commands_handled() - first < sent && micros() - start < 10000000)
+        delay(1);
+
+    uint32_t elapsed = micros() - start;
+    uint32_t handled = display.get_commands_handled() - first;
+
+    return elapsed ? (double)handled * 1000000 / elapsed : 0.0;
+}
+
+///
+/// Layout before and after
+///
+
+// What DisplayCommand looked like before the arena, every command carried
+// its string or path inline and was as big as the image member
+struct InlineCommand {
+    DisplayType type;
+    uint16_t    widget;
+
+    union {
+        struct {
+            ImageType       type;
+            size_t          data_size;
+            const uint8_t*  data;
+            char            path[MAX_TEXT_LENGTH];
+
+            uint16_t    size_x, size_y;
+            uint16_t    offset_x, offset_y;
+        } image;
+
+        struct {
+            int16_t offset_x, offset_y;
+
+            char            string[MAX_TEXT_LENGTH];
+            const uint8_t*  typeface;
+            uint16_t        color;
+            bool            transparent;
+            Anchor          anchor;
+        } text;
+    } payload;
+};
+
+// Only the transport, a queue as deep as the display's and a consumer that
+// looks at every string, so the two layouts can be put side by side. The
+// display task can't take the old one any more.
+// Long strings fill TEXT_ARENA_SIZE before the queue is full, producers
+// then wait on push instead of the queue
+template <typename Send, typename Receive>
+static double transport(uint32_t count, int producers, size_t size, const char* label, Send send, Receive receive) {
+    QueueHandle_t queue    = xQueueCreate(DISPLAY_QUEUE_LENGTH, size);
+    uint32_t      sent     = count / producers * producers;
+    uint32_t      start    = micros();
+    size_t        checksum = 0;
+
+    std::thread consumer([&] {
+        std::vector<uint8_t> item(size);
+        for (uint32_t i = 0; i < sent; i++) {
+            xQueueReceive(queue, item.data(), portMAX_DELAY);
+            checksum += receive(item.data());
+        }
+    });
+
+    std::vector<std::thread> threads;
+    for (int p = 0; p < producers; p++) {
+        threads.emplace_back([&] {
+            for (uint32_t i = 0; i < count / producers; i++)
+                send(queue, label);
+        });
+    }
+
+    for (std::thread& thread : threads)
+        thread.join();
+    consumer.join();
+
+    uint32_t elapsed = micros() - start;
+    vQueueDelete(queue);
+
+    return checksum == sent * strlen(label) && elapsed ? (double)sent * 1000000 / elapsed : 0.0;
+}
+
+static double inline_layout(uint32_t count, int producers, const char* label) {
+    return transport(count, producers, sizeof(InlineCommand), label,
+        [](QueueHandle_t queue, const char* label) {
+            InlineCommand cmd = {};
+            cmd.type = DisplayType::TEXT;
+            strncpy(cmd.payload.text.string, label, MAX_TEXT_LENGTH - 1);
+            xQueueSend(queue, &cmd, portMAX_DELAY);
+        },
+        [](const uint8_t* item) {
+            return strlen(((const InlineCommand*)item)->payload.text.string);
+        });
+}
+
+// Same steps as MalkuthDisplay::send and the display task's release
+static double arena_layout(uint32_t count, int producers, const char* label) {
+    static MalkuthTextArena arena;
+    static bool             ready = arena.init(TEXT_ARENA_SIZE, TEXT_ARENA_SLOTS);
+    if (!ready) return 0.0;
+
+    return transport(count, producers, sizeof(DisplayCommand), label,
+        [](QueueHandle_t queue, const char* label) {
+            DisplayCommand cmd = {};
+            cmd.type = DisplayType::TEXT;
+
+            TextRef& ref = cmd.payload.text.string;
+            arena.lock();
+            bool pushed = arena.push(label, MAX_TEXT_LENGTH - 1, ref, portMAX_DELAY);
+            bool sent   = pushed && xQueueSend(queue, &cmd, 0) == pdTRUE;
+            arena.unlock();
+
+            if (pushed && !sent && xQueueSend(queue, &cmd, portMAX_DELAY) != pdTRUE)
+                arena.cancel(ref);
+        },
+        [](const uint8_t* item) {
+            const TextRef& ref = ((const DisplayCommand*)item)->payload.text.string;
+            size_t length = strlen(arena.get(ref));
+            arena.release(ref);
+            return length;
+        });
+}
+
+///
+/// Arena
+///
+
+struct Item {
+    TextRef  ref;
+    uint32_t id;    // producer in the top byte, sequence below
+};
+
+static std::string expected(uint32_t id) {
+    return "p" + std::to_string(id >> 24) + "-" + std::to_string(id & 0xFFFFFF) + std::string((id & 0xFFFFFF) % 61, 'x');
+}
+
+// Same steps as MalkuthDisplay::send, on a short queue with a consumer that
+// stalls now and then, so commands overtake each other and sends time out.
+// Every string has to come out the way it went in and the arena has to end
+// up empty again
+static bool arena(uint32_t count, int producers) {
+    MalkuthTextArena  arena;
+    QueueHandle_t     queue = xQueueCreate(4, sizeof(Item));
+
+    arena.init(512, 4 + producers);
+
+    std::atomic<uint32_t> cancelled(0), wrong(0), received(0);
+    std::atomic<bool>     done(false);
+
+    std::thread consumer([&] {
+        Item item;
+        while (!done || uxQueueMessagesWaiting(queue)) {
+            if (xQueueReceive(queue, &item, 1) != pdTRUE) continue;
+
+            if (expected(item.id) != arena.get(item.ref)) wrong++;
+            if (++received % 97 == 0) delay(2);
+            arena.release(item.ref);
+        }
+    });
+
+    std::vector<std::thread> threads;
+    for (int p = 0; p < producers; p++) {
+        threads.emplace_back([&, p] {
+            // The last one always waits, it's what frees whatever got
+            // cancelled behind it
+            for (uint32_t i = 0; i <= count; i++) {
+                Item        item   = { {}, ((uint32_t)p << 24) | i };
+                std::string string = expected(item.id);
+
+                arena.lock();
+                bool pushed = arena.push(string.c_str(), MAX_TEXT_LENGTH - 1, item.ref, 1000);
+                bool sent   = pushed && xQueueSend(queue, &item, 0) == pdTRUE;
+                arena.unlock();
+
+                if (pushed && !sent && xQueueSend(queue, &item, i == count ? 1000 : 1) != pdTRUE) {
+                    arena.cancel(item.ref);
+                    cancelled++;
+                }
+            }
+        });
+    }
+
+    for (std::thread& thread : threads)
+        thread.join();
+    done = true;
+    consumer.join();
+
+    bool empty = arena.empty();
+
+    Serial.printf("Arena, %d producer%s       : %s, %u received, %u cancelled, %u wrong, %s\n",
+        producers, producers > 1 ? "s" : " ", wrong == 0 && empty ? "ok" : "FAIL",
+        (unsigned)received, (unsigned)cancelled, (unsigned)wrong, empty ? "empty after" : "NOT EMPTY after");
+
+    vQueueDelete(queue);
+    return wrong == 0 && empty;
+}
+
+int run_queue(int argc, char** argv) {
+    uint32_t count = atoi(option(argc, argv, "--commands", "20000"));
+
+    display.init();
+
+    Serial.printf("--------------- DISPLAY QUEUE ---------------\n");
+    Serial.printf("Command size before/after: %u / %u bytes\n", (unsigned)sizeof(InlineCommand), (unsigned)sizeof(DisplayCommand));
+
+    // Queue alone, inline strings against the arena, a time and a title
+    for (const char* label : { "12:34", "01 - Some Track Title.flac" }) {
+        for (int producers : { 1, 2, 4 })
+            Serial.printf("%2u chars, %d producer%s    : %.0f -> %.0f commands/s\n", (unsigned)strlen(label), producers, producers > 1 ? "s" : " ",
+                inline_layout(count, producers, label), arena_layout(count, producers, label));
+    }
+
+    // The whole way through the display task, arena only
+    for (int producers : { 1, 2, 4 })
+        Serial.printf("Display, %d producer%s     : %.0f commands/s\n", producers, producers > 1 ? "s" : " ", throughput(count, producers));
+
+    bool ok = true;
+    for (int producers : { 1, 2, 4 })
+        ok = arena(count / 10, producers) && ok;
+
+    return ok ? 0 : 1;
+}
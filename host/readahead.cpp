@@ -0,0 +1,210 @@
+#include "host.h"
+
+#include "malkuth_fs.h"
+
+#include <chrono>
+#include <filesystem>
+#include <thread>
+#include <vector>
+
+extern MalkuthFs filesystem;
+
+#define CARD_SECTORS    8192        // 4 MB
+#define TRACK_SECTOR    1000        // not window aligned on purpose
+#define TRACK_SECTORS   2048
+#define FAT_SECTOR      16
+
+// A card in RAM that takes about as long per command as a real one on SPI
+// (~100 us to get going, then ~7 us per sector at 75 MHz)
+class RamCard : public FsBlockDeviceInterface {
+public:
+    std::vector<uint8_t> data = std::vector<uint8_t>(CARD_SECTORS * 512);
+    uint32_t commands = 0;
+
+    bool     isBusy() override       { return false; }
+    uint32_t sectorCount() override  { return CARD_SECTORS; }
+    bool     syncDevice() override   { return true; }
+
+    bool readSector(uint32_t sector, uint8_t* dst) override {
+        return readSectors(sector, dst, 1);
+    }
+
+    bool readSectors(uint32_t sector, uint8_t* dst, size_t ns) override {
+        if (sector + ns > CARD_SECTORS) return false;
+        card_time(ns);
+        memcpy(dst, &data[sector * 512], ns * 512);
+        return true;
+    }
+
+    bool writeSector(uint32_t sector, const uint8_t* src) override {
+        return writeSectors(sector, src, 1);
+    }
+
+    bool writeSectors(uint32_t sector, const uint8_t* src, size_t ns) override {
+        if (sector + ns > CARD_SECTORS) return false;
+        card_time(ns);
+        memcpy(&data[sector * 512], src, ns * 512);
+        return true;
+    }
+
+private:
+    void card_time(size_t ns) {
+        commands++;
+        std::this_thread::sleep_for(std::chrono::microseconds(100 + ns * 7));
+    }
+};
+
+// SdFat's side of it: one sector of volume cache, which a FAT lookup every
+// cluster throws out again, and the parser asking for a few bytes at a time
+// with the card held like every caller of SdFat does
+class Volume {
+public:
+    explicit Volume(FsBlockDeviceInterface* device) : _device(device) {}
+
+    bool read(uint32_t offset, uint8_t* dst, size_t len) {
+        filesystem.lock();
+        bool ok = read_locked(offset, dst, len);
+        filesystem.unlock();
+        return ok;
+    }
+
+private:
+    FsBlockDeviceInterface* _device;
+    uint8_t                 _sector[512];
+    uint32_t                _cached = 0xFFFFFFFF;
+
+    bool read_locked(uint32_t offset, uint8_t* dst, size_t len) {
+        while (len > 0) {
+            uint32_t sector = TRACK_SECTOR + offset / 512;
+
+            if (sector != _cached && !_device->readSector(sector, _sector)) return false;
+            _cached = sector;
+
+            size_t at   = offset % 512;
+            size_t part = std::min(len, 512 - at);
+            memcpy(dst, _sector + at, part);
+
+            dst += part; offset += part; len -= part;
+
+            if (offset % 4096 == 0) fat();
+        }
+
+        return true;
+    }
+
+    void fat() {
+        _device->readSector(FAT_SECTOR, _sector);
+        _cached = FAT_SECTOR;
+    }
+};
+
+// Walks the whole track like the FLAC/tag parsers do, 4 byte header, a
+// few bytes of body, with a bit of parsing time in between
+static bool parse(Volume& volume, const RamCard& ram, uint32_t& took_ms) {
+    uint8_t  buffer[64];
+    uint32_t start = millis();
+    bool     ok    = true;
+
+    for (uint32_t offset = 0; offset + sizeof(buffer) <= TRACK_SECTORS * 512; ) {
+        size_t len = 4 + offset % 37;
+
+        ok = ok && volume.read(offset, buffer, len);
+        ok = ok && memcmp(buffer, &ram.data[TRACK_SECTOR * 512 + offset], len) == 0;
+
+        std::this_thread::sleep_for(std::chrono::microseconds(2));
+        offset += len;
+    }
+
+    took_ms = millis() - start;
+    return ok;
+}
+
+int run_readahead(int argc, char** argv) {
+    (void)argc; (void)argv;
+
+    static RamCard ram;
+    for (size_t i = 0; i < ram.data.size(); i++)
+        ram.data[i] = (uint8_t)(i * 131 + (i >> 9));
+
+    // The simulated card goes in the slot and gets mounted the way the board
+    // does it, any directory will do for the files
+    SdFatHost::set_root(std::filesystem::temp_directory_path().c_str());
+    SdFatHost::set_card(&ram);
+
+    if (!filesystem.init()) {
+        Serial.printf("can't mount the simulated card\n");
+        return 1;
+    }
+
+    FsBlockDeviceInterface* cache   = filesystem.get_sdfs().blockDevice();
+    bool                    mounted = cache && cache != filesystem.get_sdfs().card();
+
+    // Straight on the card first, then through what the volume reads with
+    uint32_t direct_ms, cached_ms;
+
+    ram.commands = 0;
+    Volume plain(&ram);
+    bool ok = parse(plain, ram, direct_ms);
+    uint32_t direct_commands = ram.commands;
+
+    filesystem.reset_cache_stats();
+    ram.commands = 0;
+    Volume through(cache);
+    ok = ok && mounted && parse(through, ram, cached_ms);
+    uint32_t cached_commands = ram.commands;
+
+    ReadCacheStats stats = filesystem.get_cache_stats();
+    uint32_t lookups = stats.hits + stats.misses;
+
+    Serial.printf("Parse, straight          : %u ms, %u commands\n", (unsigned)direct_ms, (unsigned)direct_commands);
+    Serial.printf("Parse, read cache        : %u ms, %u commands\n", (unsigned)cached_ms, (unsigned)cached_commands);
+    Serial.printf("Hits/misses              : %u / %u (%.1f %%)\n", (unsigned)stats.hits, (unsigned)stats.misses,
+        lookups ? 100.0f * stats.hits / lookups : 0.0f);
+    Serial.printf("Read ahead/used          : %u / %u\n", (unsigned)stats.prefetched, (unsigned)stats.prefetch_used);
+
+    // A refill spanning windows goes straight to the card
+    std::vector<uint8_t> big(32 * 512);
+    filesystem.lock();
+    ok = ok && cache->readSectors(TRACK_SECTOR, big.data(), 32);
+    filesystem.unlock();
+
+    bool bypassed = filesystem.get_cache_stats().bypassed == stats.bypassed + 1 &&
+                    memcmp(big.data(), &ram.data[TRACK_SECTOR * 512], big.size()) == 0;
+
+    // A write has to show up in the next read, not the stale window
+    uint8_t sector[512], back[512];
+    memset(sector, 0xA5, sizeof(sector));
+
+    filesystem.lock();
+    cache->readSector(FAT_SECTOR, back);
+    cache->writeSector(FAT_SECTOR, sector);
+    cache->readSector(FAT_SECTOR, back);
+    filesystem.unlock();
+
+    bool coherent = memcmp(sector, back, sizeof(sector)) == 0;
+
+    // Last window of the card is shorter, nothing past the end is asked for
+    filesystem.lock();
+    ok = ok && cache->readSector(CARD_SECTORS - 1, back);
+    filesystem.unlock();
+
+    ok = ok && memcmp(back, &ram.data[(CARD_SECTORS - 1) * 512], 512) == 0;
+
+    bool fewer   = cached_commands * 4 < direct_commands;
+    bool hit     = lookups && stats.hits * 10 >= lookups * 9;
+    bool ahead   = stats.prefetch_used > 0;
+
+    Serial.printf("Mounted through cache    : %s\n", mounted ? "ok" : "FAILED");
+    Serial.printf("Bytes match              : %s\n", ok ? "ok" : "FAILED");
+    Serial.printf("Fewer commands           : %s\n", fewer ? "ok" : "FAILED");
+    Serial.printf("Hit rate >= 90 %%         : %s\n", hit ? "ok" : "FAILED");
+    Serial.printf("Read ahead used          : %s\n", ahead ? "ok" : "FAILED");
+    Serial.printf("Big reads bypass         : %s\n", bypassed ? "ok" : "FAILED");
+    Serial.printf("Writes invalidate        : %s\n", coherent ? "ok" : "FAILED");
+
+    // The prefetch task may still be on its way to the card, it stays held
+    // until the process is gone
+    filesystem.lock();
+
+    return mounted && ok && fewer && hit && ahead && bypassed && coherent ? 0 : 1;
+}
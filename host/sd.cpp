@@ -0,0 +1,275 @@
+#include "host.h"
+
+#include "malkuth_fs.h"
+
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <thread>
+#include <vector>
+
+extern MalkuthFs filesystem;
+
+#define SD_WORK_FILE "/sd.bin"
+#define SD_FILE_SIZE (4 * 1024 * 1024)
+
+struct Worker {
+    SdClass     priority;
+    size_t      piece;      // bytes per hold
+    uint8_t     pieces;     // holds per round
+    uint32_t    idle_ms;    // between rounds
+
+    uint32_t    requests    = 0;
+    uint32_t    late        = 0;
+    uint64_t    wait_total  = 0;
+    uint32_t    wait_max    = 0;
+};
+
+static std::atomic<bool>    running(false);
+static std::atomic<int>     inside(0);
+static std::atomic<int>     overlaps(0);
+
+// The desktop reads from the page cache, the card needs about this long
+// (a 16 KB piece is ~2 ms at 75 MHz with the SdFat overhead)
+static void card_time(size_t bytes) {
+    std::this_thread::sleep_for(std::chrono::microseconds(bytes / 8));
+}
+
+static void work(Worker* worker, bool classed) {
+    std::vector<uint8_t> buffer(worker->piece);
+    FsFile file;
+
+    filesystem.lock(worker->priority);
+    file.open(SD_WORK_FILE, O_RDONLY);
+    filesystem.unlock();
+
+    uint32_t offset = 0;
+    SdClass  asked  = classed ? worker->priority : SdClass::UI;
+
+    while (running) {
+        for (uint8_t i = 0; i < worker->pieces && running; i++) {
+            uint32_t start = micros();
+            filesystem.lock(asked);
+            uint32_t wait = micros() - start;
+
+            if (++inside != 1) overlaps++;
+
+            file.seek(offset);
+            file.read(buffer.data(), buffer.size());
+            card_time(buffer.size());
+            offset = (offset + worker->piece) % (SD_FILE_SIZE - worker->piece);
+
+            inside--;
+            filesystem.unlock();
+
+            worker->requests++;
+            worker->wait_total += wait;
+            if (wait > worker->wait_max)                    worker->wait_max = wait;
+            if (wait > SD_DEADLINE_AUDIO_MS * 1000)         worker->late++;
+        }
+
+        if (worker->idle_ms) delay(worker->idle_ms);
+    }
+
+    filesystem.lock(worker->priority);
+    file.close();
+    filesystem.unlock();
+}
+
+// Audio refills every few ms, the UI loads a thumbnail now and then, the
+// background hammers the card as fast as it gets it
+static void contend(bool classed, uint32_t seconds, std::vector<Worker>& workers) {
+    filesystem.reset_stats();
+    running = true;
+
+    std::vector<std::thread> threads;
+    for (Worker& worker : workers)
+        threads.emplace_back(work, &worker, classed);
+
+    delay(seconds * 1000);
+    running = false;
+
+    for (std::thread& thread : threads)
+        thread.join();
+}
+
+// Rows are named after their class, numbered when a class has several
+static void print(const char* title, const std::vector<Worker>& workers) {
+    static const char* names[] = { "audio", "ui", "background" };
+    static_assert(sizeof(names) / sizeof(names[0]) == (size_t)SdClass::COUNT, "a name for every SdClass");
+
+    uint8_t total[(size_t)SdClass::COUNT] = {}, seen[(size_t)SdClass::COUNT] = {};
+    for (const Worker& worker : workers)
+        total[(size_t)worker.priority]++;
+
+    Serial.printf("%s\n", title);
+    for (const Worker& worker : workers) {
+        size_t class_index = (size_t)worker.priority;
+        char   name[24];
+
+        if (total[class_index] > 1) snprintf(name, sizeof(name), "%s %u", names[class_index], ++seen[class_index]);
+        else                        snprintf(name, sizeof(name), "%s", names[class_index]);
+
+        Serial.printf("  %-12s : %6u requests, wait avg %6u us, max %6u us, over %u ms %u\n",
+            name, (unsigned)worker.requests,
+            (unsigned)(worker.requests ? worker.wait_total / worker.requests : 0),
+            (unsigned)worker.wait_max, SD_DEADLINE_AUDIO_MS, (unsigned)worker.late);
+    }
+}
+
+// read()/write() split big transfers into SD_MAX_REQUEST pieces, the bytes
+// have to come out the same as one plain read
+static bool roundtrip() {
+    std::vector<uint8_t> data(SD_MAX_REQUEST * 5 + 123);
+    std::vector<uint8_t> back(data.size());
+
+    for (size_t i = 0; i < data.size(); i++)
+        data[i] = (uint8_t)(i * 31 + (i >> 9));
+
+    FsFile file;
+
+    filesystem.lock();
+    bool ok = file.open("/sd_roundtrip.bin", O_RDWR | O_CREAT | O_TRUNC);
+    filesystem.unlock();
+
+    ok = ok && filesystem.write(file, data.data(), data.size(), SdClass::UI) == data.size();
+
+    filesystem.lock();
+    file.seek(0);
+    filesystem.unlock();
+
+    ok = ok && filesystem.read(file, back.data(), back.size(), SdClass::UI) == back.size();
+    ok = ok && back == data;
+
+    // Past the end is a short read, not an error
+    ok = ok && filesystem.read(file, back.data(), back.size(), SdClass::UI) == 0;
+
+    filesystem.lock();
+    file.close();
+    filesystem.get_sdfs().remove("/sd_roundtrip.bin");
+    filesystem.unlock();
+
+    return ok;
+}
+
+// read_extent() has to give the same bytes as file.read() from any position
+// and with any size, straight off the card for a contiguous file and through
+// SdFat for a fragmented one
+static bool extents() {
+    std::vector<uint8_t> data(SD_MAX_REQUEST * 3 + 777);
+    for (size_t i = 0; i < data.size(); i++)
+        data[i] = (uint8_t)(i * 13 + (i >> 10));
+
+    bool ok = true;
+
+    for (const char* path : { "/sd_contiguous.bin", "/sd_fragmented.bin" }) {
+        bool fragmented = strstr(path, "fragmented") != nullptr;
+        FsFile file;
+
+        filesystem.lock();
+        ok = ok && file.open(path, O_RDWR | O_CREAT | O_TRUNC);
+        ok = ok && file.write(data.data(), data.size()) == data.size();
+        if (fragmented) SdFatHost::fragment(path);
+        filesystem.unlock();
+
+        SdExtent extent = filesystem.get_extent(file);
+        ok = ok && (extent.sectors == 0) == fragmented;
+
+        filesystem.reset_extent_stats();
+        uint32_t reads = SdFatHost::card_reads();
+
+        // Unaligned start, odd sizes (the ring wraps), the short tail
+        std::vector<uint8_t> back(data.size());
+        uint64_t position = 1000;
+        size_t   sizes[]  = { 4096, 333, SD_MAX_REQUEST, 512, 7000 };
+
+        filesystem.lock();
+        file.seek(position);
+        for (size_t i = 0; ok && position < data.size(); i++) {
+            int res = filesystem.read_extent(file, extent, &back[position],
+                std::min(sizes[i % 5], data.size() - (size_t)position));
+
+            ok = ok && res > 0 && file.position() == position + res;
+            position += res > 0 ? res : 0;
+        }
+        ok = ok && filesystem.read_extent(file, extent, back.data(), 100) == 0;
+        file.close();
+        filesystem.get_sdfs().remove(path);
+        filesystem.unlock();
+
+        ok = ok && memcmp(&back[1000], &data[1000], data.size() - 1000) == 0;
+
+        SdExtentStats stats = filesystem.get_extent_stats();
+        bool raw = SdFatHost::card_reads() != reads && stats.raw_reads > 0;
+        ok = ok && raw != fragmented;
+
+        Serial.printf("%-25s: %u raw reads (%u KB), %u through SdFat\n",
+            fragmented ? "Extent read, fragmented" : "Extent read, contiguous",
+            (unsigned)stats.raw_reads, (unsigned)(stats.raw_bytes / 1024), (unsigned)stats.fallback_reads);
+    }
+
+    return ok;
+}
+
+int run_sd(int argc, char** argv) {
+    if (argc < 3) return 1;
+
+    const char* dir     = argv[2];
+    uint32_t    seconds = atoi(option(argc, argv, "--seconds", "2"));
+
+    std::filesystem::create_directories(dir);
+    {
+        std::ofstream out(std::string(dir) + SD_WORK_FILE, std::ios::binary);
+        std::vector<char> block(64 * 1024, 0x5A);
+        for (size_t done = 0; done < SD_FILE_SIZE; done += block.size())
+            out.write(block.data(), block.size());
+    }
+
+    SdFatHost::set_root(dir);
+    if (!filesystem.init()) { Serial.printf("%s is not a directory\n", dir); return 1; }
+
+    bool ok = roundtrip();
+    Serial.printf("Pieced read/write        : %s\n", ok ? "ok" : "FAILED");
+
+    bool raw = extents();
+    Serial.printf("Contiguous fast path     : %s\n", raw ? "ok" : "FAILED");
+
+    std::vector<Worker> flat = {
+        { SdClass::AUDIO,      16 * 1024, 1, 8  },     // reader
+        { SdClass::UI,         16 * 1024, 8, 30 },     // thumbnails
+        { SdClass::BACKGROUND, 4 * 1024,  1, 0  },     // scanner
+        { SdClass::BACKGROUND, 16 * 1024, 1, 0  },     // cover task
+        { SdClass::BACKGROUND, 16 * 1024, 1, 0  },
+    };
+    std::vector<Worker> classed = flat;
+
+    contend(false, seconds, flat);
+    print("One class for everyone:", flat);
+
+    contend(true, seconds, classed);
+    print("Audio > UI > background:", classed);
+
+    SdClassStats audio = filesystem.get_stats(SdClass::AUDIO);
+    SdClassStats ui    = filesystem.get_stats(SdClass::UI);
+
+    Serial.printf("Arbiter (audio)          : %u requests, %u missed, hold max %u us\n",
+        (unsigned)audio.requests, (unsigned)audio.missed, (unsigned)audio.hold_max);
+    Serial.printf("Arbiter (ui)             : %u requests, %u missed, hold max %u us\n",
+        (unsigned)ui.requests, (unsigned)ui.missed, (unsigned)ui.hold_max);
+
+    // Nobody shares the card, the arbiter saw what the workers did (plus
+    // their open and close) and audio only ever waits for the hold that's
+    // running and the one already let through, not the whole line
+    bool exclusive = overlaps == 0;
+    bool counted   = audio.requests == classed[0].requests + 2 && ui.requests == classed[1].requests + 2;
+    bool bounded   = classed[0].wait_total < flat[0].wait_total / 2 && classed[0].late == 0;
+
+    Serial.printf("Exclusive                : %s\n", exclusive ? "ok" : "FAILED");
+    Serial.printf("Stats match              : %s\n", counted ? "ok" : "FAILED");
+    Serial.printf("Audio first              : %s\n", bounded ? "ok" : "FAILED");
+
+    std::filesystem::remove(std::string(dir) + SD_WORK_FILE);
+
+    return ok && raw && exclusive && counted && bounded ? 0 : 1;
+}
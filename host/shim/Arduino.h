@@ -0,0 +1,250 @@
+#pragma once
+
+// Just enough of the ESP32 Arduino core for the sketch's own modules to build
+// and run on a desktop. Time is wall clock, PSRAM is the heap and the
+// FreeRTOS calls run on std::thread (see host_rtos.h)
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <ctype.h>
+#include <math.h>
+
+#include <algorithm>
+#include <functional>
+#include <string>
+
+#include "host_rtos.h"
+#include "pgmspace.h"
+
+typedef uint8_t byte;
+
+#define HIGH    1
+#define LOW     0
+#define INPUT   0
+#define OUTPUT  1
+#define INPUT_PULLUP 2
+
+uint32_t millis();
+uint32_t micros();
+void     delay(uint32_t ms);
+
+inline void pinMode(uint8_t, uint8_t)       {}
+inline void digitalWrite(uint8_t, uint8_t)  {}
+inline int  digitalRead(uint8_t)            { return LOW; }
+inline void analogWrite(uint8_t, int)       {}
+
+inline long map(long x, long in_min, long in_max, long out_min, long out_max) {
+    return (x - in_min) * (out_max - out_min) / (in_max - in_min) + out_min;
+}
+
+#define constrain(amt, low, high) ((amt) < (low) ? (low) : ((amt) > (high) ? (high) : (amt)))
+
+inline bool     psramFound()            { return true; }
+inline uint32_t getCpuFrequencyMhz()    { return 240; }
+
+// Cycles at the pretend 240 MHz, so stats read the same as on the board
+struct EspClass {
+    uint32_t getCycleCount();
+    uint32_t getFreePsram()  { return 8 * 1024 * 1024; }
+    uint32_t getPsramSize()  { return 8 * 1024 * 1024; }
+};
+extern EspClass ESP;
+
+///
+/// Memory
+///
+
+#define MALLOC_CAP_8BIT      (1 << 0)
+#define MALLOC_CAP_32BIT     (1 << 1)
+#define MALLOC_CAP_DMA       (1 << 2)
+#define MALLOC_CAP_INTERNAL  (1 << 3)
+#define MALLOC_CAP_SPIRAM    (1 << 4)
+
+inline void* heap_caps_malloc(size_t size, uint32_t)                { return malloc(size); }
+inline void* heap_caps_realloc(void* ptr, size_t size, uint32_t)    { return realloc(ptr, size); }
+inline void  heap_caps_free(void* ptr)                              { free(ptr); }
+inline void* heap_caps_aligned_alloc(size_t align, size_t size, uint32_t) {
+    return aligned_alloc(align, (size + align - 1) / align * align);
+}
+
+inline size_t heap_caps_get_free_size(uint32_t)             { return 0; }
+inline size_t heap_caps_get_minimum_free_size(uint32_t)     { return 0; }
+inline size_t heap_caps_get_largest_free_block(uint32_t)    { return 0; }
+
+///
+/// Print / Serial
+///
+
+class Print {
+public:
+    virtual ~Print() {}
+
+    virtual size_t write(uint8_t ch) = 0;
+    virtual size_t write(const uint8_t* buffer, size_t size) {
+        size_t n = 0;
+        while (size--) n += write(*buffer++);
+        return n;
+    }
+
+    size_t print(const char* string)    { return write((const uint8_t*)string, strlen(string)); }
+    size_t print(char ch)               { return write((uint8_t)ch); }
+    size_t print(int value)             { return printf("%d", value); }
+    size_t print(unsigned value)        { return printf("%u", value); }
+    size_t print(long value)            { return printf("%ld", value); }
+    size_t print(unsigned long value)   { return printf("%lu", value); }
+    size_t print(double value)          { return printf("%.2f", value); }
+
+    size_t println()                    { return print("\r\n"); }
+    template <typename T>
+    size_t println(T value)             { return print(value) + println(); }
+
+    size_t printf(const char* format, ...) __attribute__((format(printf, 2, 3))) {
+        char    local[256];
+        va_list args;
+
+        va_start(args, format);
+        int length = vsnprintf(local, sizeof(local), format, args);
+        va_end(args);
+        if (length < 0) return 0;
+
+        if ((size_t)length < sizeof(local))
+            return write((const uint8_t*)local, length);
+
+        std::string big(length + 1, '\0');
+        va_start(args, format);
+        vsnprintf(&big[0], big.size(), format, args);
+        va_end(args);
+        return write((const uint8_t*)big.data(), length);
+    }
+};
+
+class Stream : public Print {
+public:
+    virtual int available() = 0;
+    virtual int read() = 0;
+    virtual int peek() = 0;
+
+    virtual size_t readBytes(uint8_t* buffer, size_t length) {
+        size_t n = 0;
+        while (n < length) {
+            int ch = read();
+            if (ch < 0) break;
+            buffer[n++] = (uint8_t)ch;
+        }
+        return n;
+    }
+};
+
+class HostSerial : public Stream {
+public:
+    void begin(unsigned long) {}
+    operator bool() const { return true; }
+
+    size_t write(uint8_t ch) override { return fputc(ch, stdout) == EOF ? 0 : 1; }
+    size_t write(const uint8_t* buffer, size_t size) override { return fwrite(buffer, 1, size, stdout); }
+
+    int available() override { return 0; }
+    int read() override      { return -1; }
+    int peek() override      { return -1; }
+};
+extern HostSerial Serial;
+
+///
+/// String
+///
+
+class String {
+private:
+    std::string _s;
+
+public:
+    String() {}
+    String(const char* s) : _s(s ? s : "") {}
+    String(const std::string& s) : _s(s) {}
+    String(char c) : _s(1, c) {}
+    String(int value)           : _s(std::to_string(value)) {}
+    String(unsigned value)      : _s(std::to_string(value)) {}
+    String(long value)          : _s(std::to_string(value)) {}
+    String(unsigned long value) : _s(std::to_string(value)) {}
+    String(float value, unsigned decimals = 2) {
+        char buf[32];
+        snprintf(buf, sizeof(buf), "%.*f", decimals, value);
+        _s = buf;
+    }
+
+    const char*  c_str()  const { return _s.c_str(); }
+    unsigned int length() const { return _s.length(); }
+    bool         isEmpty() const { return _s.empty(); }
+    bool         reserve(unsigned int size) { _s.reserve(size); return true; }
+
+    char  charAt(unsigned int index) const { return index < _s.size() ? _s[index] : 0; }
+    char  operator[](unsigned int index) const { return charAt(index); }
+    char& operator[](unsigned int index) { return _s[index]; }
+
+    String& operator+=(const String& other) { _s += other._s; return *this; }
+    String& operator+=(const char* other)   { _s += other ? other : ""; return *this; }
+    String& operator+=(char ch)             { _s += ch; return *this; }
+    bool    concat(const String& other)     { _s += other._s; return true; }
+
+    friend String operator+(String a, const String& b) { a += b; return a; }
+    friend String operator+(String a, const char* b)   { a += b; return a; }
+    friend String operator+(const char* a, const String& b) { String s(a); s += b; return s; }
+    friend String operator+(String a, char b)          { a += b; return a; }
+
+    bool operator==(const String& other) const { return _s == other._s; }
+    bool operator==(const char* other) const   { return _s == (other ? other : ""); }
+    bool operator!=(const String& other) const { return _s != other._s; }
+    bool operator!=(const char* other) const   { return !(*this == other); }
+    bool operator<(const String& other) const  { return _s < other._s; }
+    bool equals(const String& other) const     { return _s == other._s; }
+    bool equalsIgnoreCase(const String& other) const { return strcasecmp(c_str(), other.c_str()) == 0; }
+
+    bool startsWith(const String& prefix) const { return _s.compare(0, prefix._s.size(), prefix._s) == 0; }
+    bool endsWith(const String& suffix) const {
+        return _s.size() >= suffix._s.size() &&
+               _s.compare(_s.size() - suffix._s.size(), suffix._s.size(), suffix._s) == 0;
+    }
+
+    int indexOf(char ch, unsigned int from = 0) const {
+        size_t at = _s.find(ch, from);
+        return at == std::string::npos ? -1 : (int)at;
+    }
+    int indexOf(const String& string, unsigned int from = 0) const {
+        size_t at = _s.find(string._s, from);
+        return at == std::string::npos ? -1 : (int)at;
+    }
+    int lastIndexOf(char ch) const {
+        size_t at = _s.rfind(ch);
+        return at == std::string::npos ? -1 : (int)at;
+    }
+
+    String substring(unsigned int from) const { return from < _s.size() ? String(_s.substr(from)) : String(); }
+    String substring(unsigned int from, unsigned int to) const {
+        if (from > to) std::swap(from, to);
+        if (from >= _s.size()) return String();
+        return String(_s.substr(from, std::min<size_t>(to, _s.size()) - from));
+    }
+
+    void remove(unsigned int index) { if (index < _s.size()) _s.erase(index); }
+    void remove(unsigned int index, unsigned int count) { if (index < _s.size()) _s.erase(index, count); }
+    void replace(const String& from, const String& to) {
+        if (from._s.empty()) return;
+        for (size_t at = 0; (at = _s.find(from._s, at)) != std::string::npos; at += to._s.size())
+            _s.replace(at, from._s.size(), to._s);
+    }
+
+    void toLowerCase() { for (auto& c : _s) c = tolower((uint8_t)c); }
+    void toUpperCase() { for (auto& c : _s) c = toupper((uint8_t)c); }
+    void trim() {
+        size_t start = _s.find_first_not_of(" \t\r\n");
+        size_t end   = _s.find_last_not_of(" \t\r\n");
+        _s = start == std::string::npos ? std::string() : _s.substr(start, end - start + 1);
+    }
+
+    long  toInt() const   { return strtol(c_str(), nullptr, 10); }
+    float toFloat() const { return strtof(c_str(), nullptr); }
+};
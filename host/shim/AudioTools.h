@@ -0,0 +1,64 @@
+#pragma once
+
+// Only the output end of arduino-audio-tools: AudioInfo and an I2SStream
+// that writes what would have gone to the DAC into a WAV file. Decoders and
+// the player stay on the board
+
+#include "Arduino.h"
+
+struct AudioInfo {
+    int sample_rate     = 44100;
+    int channels        = 2;
+    int bits_per_sample = 16;
+
+    AudioInfo() {}
+    AudioInfo(int rate, int ch, int bits) : sample_rate(rate), channels(ch), bits_per_sample(bits) {}
+
+    bool operator==(const AudioInfo& o) const {
+        return sample_rate == o.sample_rate && channels == o.channels && bits_per_sample == o.bits_per_sample;
+    }
+    bool operator!=(const AudioInfo& o) const { return !(*this == o); }
+};
+
+enum RxTxMode { UNDEFINED_MODE, TX_MODE, RX_MODE, RXTX_MODE };
+
+struct I2SConfig : public AudioInfo {
+    RxTxMode rx_tx_mode   = TX_MODE;
+    int      buffer_size  = 512;
+    int      buffer_count = 6;
+    int      pin_bck      = -1;
+    int      pin_ws       = -1;
+    int      pin_data     = -1;
+};
+
+class I2SStream : public Print {
+private:
+    AudioInfo _info;
+    FILE*     _wav  = nullptr;
+    uint64_t  _data = 0;
+
+    void header();
+
+public:
+    virtual ~I2SStream() { end(); }
+
+    I2SConfig defaultConfig(RxTxMode mode = TX_MODE) {
+        I2SConfig cfg;
+        cfg.rx_tx_mode = mode;
+        return cfg;
+    }
+
+    bool begin(I2SConfig cfg) { setAudioInfo(cfg); return true; }
+    bool begin()              { return true; }
+    void end();
+
+    virtual void      setAudioInfo(AudioInfo info) { _info = info; }
+    virtual AudioInfo audioInfo() { return _info; }
+
+    size_t write(uint8_t ch) override { return write(&ch, 1); }
+    size_t write(const uint8_t* buffer, size_t size) override;
+
+    // Host only, everything written from here on lands in path. The header
+    // is filled in on end() from the AudioInfo at that point
+    bool openWav(const char* path);
+};
@@ -0,0 +1,44 @@
+#pragma once
+
+// A touch panel the host driver presses itself, see FT6236Host
+
+#include "Arduino.h"
+
+#include <atomic>
+
+struct TS_Point {
+    int16_t x = 0;
+    int16_t y = 0;
+    int16_t z = 0;
+
+    TS_Point() {}
+    TS_Point(int16_t x, int16_t y, int16_t z) : x(x), y(y), z(z) {}
+};
+
+namespace FT6236Host {
+    // Held until release(), z is 0 while nothing touches the panel
+    inline std::atomic<uint32_t>& point() {
+        static std::atomic<uint32_t> packed(0);
+        return packed;
+    }
+
+    inline void press(int16_t x, int16_t y) { point() = ((uint32_t)(uint16_t)x << 16) | (uint16_t)y | 0x8000u; }
+    inline void release()                   { point() = 0; }
+}
+
+class FT6236 {
+public:
+    bool begin(uint8_t threshold = 128, int8_t sda = -1, int8_t scl = -1) {
+        (void)threshold; (void)sda; (void)scl;
+        return true;
+    }
+
+    uint8_t touched() { return FT6236Host::point() ? 1 : 0; }
+
+    TS_Point getPoint() {
+        uint32_t packed = FT6236Host::point();
+        if (!packed) return TS_Point();
+
+        return TS_Point((int16_t)(packed >> 16), (int16_t)(packed & 0x7FFF), 1);
+    }
+};
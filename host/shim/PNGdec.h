@@ -0,0 +1,50 @@
+#pragma once
+
+// PNGdec's interface on top of libpng. The whole image is decoded to RGBA up
+// front and handed to the callback a row at a time, the way PNGdec would
+
+#include "Arduino.h"
+
+#include <vector>
+
+#define PNG_SUCCESS             0
+#define PNG_INVALID_PARAMETER   1
+#define PNG_DECODE_ERROR        2
+#define PNG_MEM_ERROR           3
+#define PNG_QUIT_EARLY          8
+
+#define PNG_RGB565_LITTLE_ENDIAN 0
+#define PNG_RGB565_BIG_ENDIAN    1
+
+typedef struct png_draw_tag {
+    int      y;
+    int      iWidth;
+    int      iPitch;
+    int      iHasAlpha;
+    void*    pUser;
+    uint8_t* pPixels;   // RGBA, 4 bytes a pixel
+} PNGDRAW;
+
+typedef int (PNG_DRAW_CALLBACK)(PNGDRAW* pDraw);
+
+class PNG {
+private:
+    std::vector<uint8_t> _rgba;
+    int                  _width    = 0;
+    int                  _height   = 0;
+    bool                 _alpha    = false;
+    PNG_DRAW_CALLBACK*   _callback = nullptr;
+
+public:
+    int  openFLASH(uint8_t* data, int size, PNG_DRAW_CALLBACK* callback);
+    int  openRAM(uint8_t* data, int size, PNG_DRAW_CALLBACK* callback) { return openFLASH(data, size, callback); }
+    int  decode(void* user, int options);
+    void close();
+
+    int  getWidth() const  { return _width; }
+    int  getHeight() const { return _height; }
+    int  hasAlpha() const  { return _alpha; }
+
+    // Alpha is blended onto background (0x00RRGGBB)
+    void getLineAsRGB565(PNGDRAW* draw, uint16_t* pixels, int endianness, uint32_t background);
+};
@@ -0,0 +1,72 @@
+#pragma once
+
+// No bus on the desktop, the card and the panel are files and memory. The
+// class still counts what goes over it: every call and every byte clocked,
+// the bytes coming back are a running counter and the ones going out are
+// hashed, so a driver can be checked for moving every byte once and in order
+
+#include "Arduino.h"
+
+#define MSBFIRST    1
+#define LSBFIRST    0
+#define SPI_MODE0   0
+
+struct SPISettings {
+    SPISettings() {}
+    SPISettings(uint32_t clock, uint8_t order, uint8_t mode) { (void)clock; (void)order; (void)mode; }
+};
+
+class SPIClass {
+private:
+    uint64_t _calls  = 0;
+    uint64_t _chunks = 0;     // FIFO fills, the S3 moves 64 bytes per fill
+    uint64_t _bytes  = 0;
+    uint8_t  _next   = 0;
+    uint32_t _sent   = 2166136261u;   // FNV-1a
+
+    void sent(uint8_t data) { _sent = (_sent ^ data) * 16777619u; }
+
+public:
+    void    begin(int8_t sck = -1, int8_t miso = -1, int8_t mosi = -1, int8_t ss = -1) { (void)sck; (void)miso; (void)mosi; (void)ss; }
+    void    end() {}
+    void    beginTransaction(SPISettings settings) { (void)settings; }
+    void    endTransaction() {}
+
+    uint8_t transfer(uint8_t data) {
+        _calls++;
+        _chunks++;
+        _bytes++;
+        sent(data);
+        return _next++;
+    }
+
+    void    transferBytes(const uint8_t* out, uint8_t* in, uint32_t size) {
+        _calls++;
+        _chunks += (size + 63) / 64;
+        _bytes  += size;
+        for (uint32_t i = 0; i < size; i++) {
+            sent(out ? out[i] : 0xFF);
+            if (in) in[i] = _next;
+            _next++;
+        }
+    }
+
+    void    writeBytes(const uint8_t* data, uint32_t size) {
+        _calls++;
+        _chunks += (size + 63) / 64;
+        _bytes  += size;
+        for (uint32_t i = 0; i < size; i++) {
+            sent(data[i]);
+            _next++;
+        }
+    }
+
+    // Calls into the driver and bytes clocked since the last reset
+    uint64_t calls() const     { return _calls; }
+    uint64_t chunks() const    { return _chunks; }
+    uint64_t bytes() const     { return _bytes; }
+    uint32_t sent_hash() const { return _sent; }
+    void     reset() { _calls = 0; _chunks = 0; _bytes = 0; _next = 0; _sent = 2166136261u; }
+};
+
+extern SPIClass SPI;
@@ -0,0 +1,176 @@
+#pragma once
+
+// SdFat's FsFile/SdFs over a directory on the desktop, "/" on the card is
+// whatever SdFatHost::set_root points at. Directory order is readdir's,
+// which is as unsorted as a FAT directory
+
+#include "Arduino.h"
+
+#include <fcntl.h>
+#include <memory>
+
+#ifndef O_READ
+    #define O_READ  O_RDONLY
+#endif
+#ifndef O_WRITE
+    #define O_WRITE O_WRONLY
+#endif
+#ifndef O_AT_END
+    #define O_AT_END O_APPEND
+#endif
+
+typedef int oflag_t;
+
+#define DEDICATED_SPI   1
+#define SHARED_SPI      0
+#define SD_SCK_MHZ(mhz) ((uint32_t)(mhz) * 1000000)
+
+#define LS_A    1
+#define LS_DATE 2
+#define LS_SIZE 4
+#define LS_R    8
+
+class SdSpiBaseClass;
+
+struct SdSpiConfig {
+    uint8_t         cs_pin;
+    uint8_t         options;
+    uint32_t        max_sck;
+    SdSpiBaseClass* spi;
+
+    SdSpiConfig(uint8_t cs, uint8_t opt, uint32_t sck, SdSpiBaseClass* port = nullptr)
+        : cs_pin(cs), options(opt), max_sck(sck), spi(port) {}
+};
+
+class SdSpiBaseClass {
+public:
+    virtual ~SdSpiBaseClass() {}
+    virtual void    activate() {}
+    virtual void    begin(SdSpiConfig config) { (void)config; }
+    virtual void    deactivate() {}
+    virtual uint8_t receive() { return 0xFF; }
+    virtual uint8_t receive(uint8_t* buf, size_t count) { memset(buf, 0xFF, count); return 0; }
+    virtual void    send(uint8_t data) { (void)data; }
+    virtual void    send(const uint8_t* buf, size_t count) { (void)buf; (void)count; }
+    virtual void    setSckSpeed(uint32_t maxSck) { (void)maxSck; }
+};
+
+
+// SdFat's block device interface (what a volume reads its sectors through),
+// on like the board's build_opt.h sets it
+#define USE_BLOCK_DEVICE_INTERFACE 1
+
+class FsBlockDeviceInterface {
+public:
+    virtual ~FsBlockDeviceInterface() {}
+
+    virtual bool     isBusy() = 0;
+    virtual uint32_t sectorCount() = 0;
+    virtual bool     readSector(uint32_t sector, uint8_t* dst) = 0;
+    virtual bool     readSectors(uint32_t sector, uint8_t* dst, size_t ns) = 0;
+    virtual bool     syncDevice() = 0;
+    virtual bool     writeSector(uint32_t sector, const uint8_t* src) = 0;
+    virtual bool     writeSectors(uint32_t sector, const uint8_t* src, size_t ns) = 0;
+};
+
+namespace SdFatHost {
+    // Everything the sketch opens lands under here, has to be set before
+    // SdFs::begin
+    void        set_root(const char* path);
+    const char* root();
+
+    // Files get laid out one after the other on a made up card the first
+    // time their range is asked for, a fragmented one has none
+    void        fragment(const char* path);
+    uint32_t    card_reads();
+
+    // SdCard hands every sector call to device instead of the made up card,
+    // nullptr goes back to that. Has to be set before SdFs::cardBegin
+    void        set_card(FsBlockDeviceInterface* device);
+}
+
+// The made up card, sectors outside every file come back zero. Read only,
+// files are written through FsFile
+class SdCard : public FsBlockDeviceInterface {
+public:
+    bool     isBusy() override;
+    uint32_t sectorCount() override;
+    bool     readSector(uint32_t sector, uint8_t* dst) override { return readSectors(sector, dst, 1); }
+    bool     readSectors(uint32_t sector, uint8_t* dst, size_t ns) override;
+    bool     syncDevice() override;
+    bool     writeSector(uint32_t sector, const uint8_t* src) override { return writeSectors(sector, src, 1); }
+    bool     writeSectors(uint32_t sector, const uint8_t* src, size_t ns) override;
+};
+
+// Only the mount, files still come straight from the host directory. begin()
+// reads the boot sector through the device like SdFat does
+class FsVolume {
+private:
+    FsBlockDeviceInterface* _device = nullptr;
+
+public:
+    bool begin(FsBlockDeviceInterface* device);
+    FsBlockDeviceInterface* blockDevice() { return _device; }
+};
+
+class FsFile : public Stream {
+private:
+    struct State;
+    std::shared_ptr<State> _state;
+
+    bool open_host(const std::string& host_path, const char* name, oflag_t oflag);
+
+public:
+    FsFile() {}
+
+    bool open(const char* path, oflag_t oflag = O_RDONLY);
+    bool open(FsFile* dir, const char* path, oflag_t oflag = O_RDONLY);
+    bool openNext(FsFile* dir, oflag_t oflag = O_RDONLY);
+    bool close();
+
+    bool isOpen() const;
+    bool isDir() const;
+    bool isFile() const { return isOpen() && !isDir(); }
+    explicit operator bool() const { return isOpen(); }
+
+    size_t getName(char* name, size_t size);
+
+    int     read(void* buffer, size_t count);
+    int     read() override;
+    int     peek() override;
+    int     available() override;
+    size_t  readBytes(uint8_t* buffer, size_t length) override { int n = read(buffer, length); return n > 0 ? n : 0; }
+
+    size_t  write(uint8_t ch) override { return write(&ch, 1); }
+    size_t  write(const uint8_t* buffer, size_t size) override;
+    size_t  write(const void* buffer, size_t size) { return write((const uint8_t*)buffer, size); }
+    bool    sync() { return isOpen(); }
+
+    bool     seek(uint64_t position);
+    bool     seekSet(uint64_t position) { return seek(position); }
+    bool     seekCur(int64_t offset)    { return seek(position() + offset); }
+    bool     seekEnd(int64_t offset = 0) { return seek(size() + offset); }
+    uint64_t position() const;
+    uint64_t curPosition() const { return position(); }
+    uint64_t size() const;
+    uint64_t fileSize() const { return size(); }
+    void     rewind();
+
+    bool getModifyDateTime(uint16_t* date, uint16_t* time);
+    bool truncate(uint64_t length);
+    bool contiguousRange(uint32_t* bgnSector, uint32_t* endSector);
+};
+
+class SdFs : public FsVolume {
+public:
+    bool   begin(SdSpiConfig config);
+    bool   cardBegin(SdSpiConfig config);
+    SdCard* card();
+
+    FsFile open(const char* path, oflag_t oflag = O_RDONLY);
+    bool   exists(const char* path);
+    bool   mkdir(const char* path, bool parents = true);
+    bool   remove(const char* path);
+    bool   rmdir(const char* path);
+    bool   rename(const char* from, const char* to);
+};
@@ -0,0 +1,124 @@
+#pragma once
+
+// The part of TFT_eSPI the display task uses, drawing into an RGB565
+// framebuffer instead of an ILI9488. Pixels are kept the way the panel gets
+// them (byte swapped), same as sprite memory on the board, so images and
+// sprites land in it unchanged
+
+#include "Arduino.h"
+
+#include <vector>
+
+#ifndef TFT_WIDTH
+    #define TFT_WIDTH  320
+#endif
+#ifndef TFT_HEIGHT
+    #define TFT_HEIGHT 480
+#endif
+
+#define TFT_BLACK       0x0000
+#define TFT_NAVY        0x000F
+#define TFT_DARKGREEN   0x03E0
+#define TFT_MAROON      0x7800
+#define TFT_DARKGREY    0x7BEF
+#define TFT_LIGHTGREY   0xD69A
+#define TFT_BLUE        0x001F
+#define TFT_GREEN       0x07E0
+#define TFT_CYAN        0x07FF
+#define TFT_RED         0xF800
+#define TFT_MAGENTA     0xF81F
+#define TFT_YELLOW      0xFFE0
+#define TFT_ORANGE      0xFDA0
+#define TFT_WHITE       0xFFFF
+#define TFT_TRANSPARENT 0x0120
+
+#define TL_DATUM 0
+#define TC_DATUM 1
+#define TR_DATUM 2
+#define ML_DATUM 3
+#define MC_DATUM 4
+#define MR_DATUM 5
+#define BL_DATUM 6
+#define BC_DATUM 7
+#define BR_DATUM 8
+
+#define CP437_SWITCH 1
+#define UTF8_SWITCH  2
+#define PSRAM_ENABLE 3
+
+class TFT_eSPI {
+protected:
+    int16_t     _width  = TFT_WIDTH;
+    int16_t     _height = TFT_HEIGHT;
+    uint16_t*   _pixels = nullptr;
+    bool        _swap   = false;
+
+    // What reached the panel (not sprites), for frame cost
+    uint32_t    _pushes = 0;
+    uint64_t    _pushed = 0;
+    uint32_t    _last   = 0;
+
+    void pushed_rect(int32_t w, int32_t h);
+
+    void fill_span(int32_t x, int32_t y, int32_t w, uint16_t color);
+
+public:
+    TFT_eSPI(int16_t w = TFT_WIDTH, int16_t h = TFT_HEIGHT) : _width(w), _height(h) {}
+    virtual ~TFT_eSPI();
+
+    void init();
+    void begin() { init(); }
+    void setRotation(uint8_t rotation);
+    void setAttribute(uint8_t id, uint8_t value) { (void)id; (void)value; }
+    void setSwapBytes(bool swap) { _swap = swap; }
+    bool getSwapBytes() const    { return _swap; }
+
+    int16_t width()  const { return _width; }
+    int16_t height() const { return _height; }
+
+    void startWrite() {}
+    void endWrite() {}
+
+    void fillScreen(uint16_t color) { fillRect(0, 0, _width, _height, color); }
+    void fillRect(int32_t x, int32_t y, int32_t w, int32_t h, uint16_t color);
+    void fillRoundRect(int32_t x, int32_t y, int32_t w, int32_t h, int32_t radius, uint16_t color);
+    void drawPixel(int32_t x, int32_t y, uint16_t color) { fillRect(x, y, 1, 1, color); }
+
+    void pushImage(int32_t x, int32_t y, int32_t w, int32_t h, const uint16_t* data);
+    void pushImage(int32_t x, int32_t y, int32_t w, int32_t h, const uint16_t* data, uint16_t transparent);
+
+    uint16_t alphaBlend(uint8_t alpha, uint16_t fg, uint16_t bg);
+    uint16_t color565(uint8_t r, uint8_t g, uint8_t b) {
+        return ((r & 0xF8) << 8) | ((g & 0xFC) << 3) | (b >> 3);
+    }
+
+    // Host only, the framebuffer in panel byte order
+    const uint16_t* framebuffer() const { return _pixels; }
+    uint32_t        pushes() const      { return _pushes; }
+    uint64_t        pushed() const      { return _pushed; }
+    uint32_t        lastPush() const    { return _last; }   // micros()
+    bool            savePng(const char* path) const;
+};
+
+class TFT_eSprite : public TFT_eSPI {
+private:
+    TFT_eSPI* _parent;
+
+public:
+    explicit TFT_eSprite(TFT_eSPI* parent) : TFT_eSPI(0, 0), _parent(parent) {}
+
+    void  setColorDepth(int8_t bits) { (void)bits; }
+    void* createSprite(int16_t w, int16_t h, uint8_t frames = 1);
+    void  deleteSprite();
+    bool  created() const { return _pixels != nullptr; }
+
+    void  fillSprite(uint16_t color) { fillScreen(color); }
+    void* getPointer() { return _pixels; }
+
+    void  pushSprite(int32_t x, int32_t y) { _parent->pushImage(x, y, _width, _height, _pixels); }
+};
+
+namespace TftHost {
+    // The panel the display task initialised last, there is only one
+    TFT_eSPI* screen();
+}
@@ -0,0 +1,29 @@
+#include "Arduino.h"
+#include "SPI.h"
+
+#include <chrono>
+#include <thread>
+
+using Clock = std::chrono::steady_clock;
+
+static const Clock::time_point boot = Clock::now();
+
+uint32_t millis() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(Clock::now() - boot).count();
+}
+
+uint32_t micros() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - boot).count();
+}
+
+void delay(uint32_t ms) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+}
+
+uint32_t EspClass::getCycleCount() {
+    return (uint32_t)(std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - boot).count() * 240 / 1000);
+}
+
+EspClass   ESP;
+HostSerial Serial;
+SPIClass   SPI;
@@ -0,0 +1,52 @@
+#include "AudioTools.h"
+
+static void put_le(FILE* file, uint32_t value, int bytes) {
+    for (int i = 0; i < bytes; i++)
+        fputc((value >> (i * 8)) & 0xFF, file);
+}
+
+bool I2SStream::openWav(const char* path) {
+    end();
+
+    _wav  = fopen(path, "wb");
+    _data = 0;
+    if (!_wav) return false;
+
+    header();
+    return true;
+}
+
+void I2SStream::header() {
+    uint32_t data  = _data > 0xFFFFFFDB ? 0xFFFFFFDB : (uint32_t)_data;
+    uint32_t frame = _info.channels * (_info.bits_per_sample / 8);
+
+    fseek(_wav, 0, SEEK_SET);
+    fwrite("RIFF", 1, 4, _wav);
+    put_le(_wav, 36 + data, 4);
+    fwrite("WAVEfmt ", 1, 8, _wav);
+    put_le(_wav, 16, 4);
+    put_le(_wav, 1, 2);
+    put_le(_wav, _info.channels, 2);
+    put_le(_wav, _info.sample_rate, 4);
+    put_le(_wav, _info.sample_rate * frame, 4);
+    put_le(_wav, frame, 2);
+    put_le(_wav, _info.bits_per_sample, 2);
+    fwrite("data", 1, 4, _wav);
+    put_le(_wav, data, 4);
+}
+
+void I2SStream::end() {
+    if (!_wav) return;
+
+    header();
+    fclose(_wav);
+    _wav = nullptr;
+}
+
+size_t I2SStream::write(const uint8_t* buffer, size_t size) {
+    if (!_wav) return size;
+
+    size_t n = fwrite(buffer, 1, size, _wav);
+    _data   += n;
+    return n;
+}
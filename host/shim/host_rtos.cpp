@@ -0,0 +1,225 @@
+#include "Arduino.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// portMAX_DELAY waits forever, anything else is a deadline in ms
+template <typename Predicate>
+static bool wait_for(std::condition_variable& cv, std::unique_lock<std::mutex>& lock, TickType_t wait, Predicate ready) {
+    if (wait == portMAX_DELAY) {
+        cv.wait(lock, ready);
+        return true;
+    }
+    return cv.wait_for(lock, std::chrono::milliseconds(wait), ready);
+}
+
+///
+/// Queue
+///
+
+struct HostQueue {
+    std::mutex              lock;
+    std::condition_variable changed;
+
+    std::vector<uint8_t>    items;
+    UBaseType_t             length;
+    UBaseType_t             item_size;
+    UBaseType_t             head  = 0;
+    UBaseType_t             count = 0;
+};
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t item_size) {
+    HostQueue* queue = new HostQueue();
+    queue->items.resize((size_t)length * item_size);
+    queue->length    = length;
+    queue->item_size = item_size;
+    return queue;
+}
+
+void vQueueDelete(QueueHandle_t queue) {
+    delete queue;
+}
+
+BaseType_t xQueueSend(QueueHandle_t queue, const void* item, TickType_t wait) {
+    std::unique_lock<std::mutex> lock(queue->lock);
+
+    if (!wait_for(queue->changed, lock, wait, [&] { return queue->count < queue->length; }))
+        return pdFALSE;
+
+    UBaseType_t slot = (queue->head + queue->count) % queue->length;
+    memcpy(&queue->items[(size_t)slot * queue->item_size], item, queue->item_size);
+    queue->count++;
+
+    queue->changed.notify_all();
+    return pdTRUE;
+}
+
+BaseType_t xQueueReceive(QueueHandle_t queue, void* item, TickType_t wait) {
+    std::unique_lock<std::mutex> lock(queue->lock);
+
+    if (!wait_for(queue->changed, lock, wait, [&] { return queue->count > 0; }))
+        return pdFALSE;
+
+    memcpy(item, &queue->items[(size_t)queue->head * queue->item_size], queue->item_size);
+    queue->head = (queue->head + 1) % queue->length;
+    queue->count--;
+
+    queue->changed.notify_all();
+    return pdTRUE;
+}
+
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t queue) {
+    std::lock_guard<std::mutex> lock(queue->lock);
+    return queue->count;
+}
+
+UBaseType_t uxQueueSpacesAvailable(QueueHandle_t queue) {
+    std::lock_guard<std::mutex> lock(queue->lock);
+    return queue->length - queue->count;
+}
+
+///
+/// Semaphore
+///
+
+// Counting semaphore, a mutex is one that starts given and remembers who
+// holds it so the recursive kind can be taken again by its owner
+struct HostSemaphore {
+    std::mutex              lock;
+    std::condition_variable changed;
+
+    bool            is_mutex;
+    UBaseType_t     count;
+    std::thread::id owner;
+    UBaseType_t     depth = 0;
+};
+
+static SemaphoreHandle_t create_semaphore(bool is_mutex, UBaseType_t count) {
+    HostSemaphore* semaphore = new HostSemaphore();
+    semaphore->is_mutex = is_mutex;
+    semaphore->count    = count;
+    return semaphore;
+}
+
+SemaphoreHandle_t xSemaphoreCreateMutex()           { return create_semaphore(true, 1); }
+SemaphoreHandle_t xSemaphoreCreateRecursiveMutex()  { return create_semaphore(true, 1); }
+SemaphoreHandle_t xSemaphoreCreateBinary()          { return create_semaphore(false, 0); }
+
+void vSemaphoreDelete(SemaphoreHandle_t semaphore) {
+    delete semaphore;
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t semaphore, TickType_t wait) {
+    std::unique_lock<std::mutex> lock(semaphore->lock);
+    std::thread::id self = std::this_thread::get_id();
+
+    if (semaphore->is_mutex && semaphore->depth > 0 && semaphore->owner == self) {
+        semaphore->depth++;
+        return pdTRUE;
+    }
+
+    if (!wait_for(semaphore->changed, lock, wait, [&] { return semaphore->count > 0; }))
+        return pdFALSE;
+
+    semaphore->count--;
+    if (semaphore->is_mutex) {
+        semaphore->owner = self;
+        semaphore->depth = 1;
+    }
+    return pdTRUE;
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t semaphore) {
+    std::lock_guard<std::mutex> lock(semaphore->lock);
+
+    if (semaphore->is_mutex) {
+        if (semaphore->depth == 0 || semaphore->owner != std::this_thread::get_id())
+            return pdFALSE;
+        if (--semaphore->depth > 0)
+            return pdTRUE;
+    }
+
+    semaphore->count++;
+    semaphore->changed.notify_one();
+    return pdTRUE;
+}
+
+///
+/// Task
+///
+
+struct HostTask {
+    std::mutex              lock;
+    std::condition_variable changed;
+    uint32_t                notified = 0;
+};
+
+static thread_local HostTask* current_task = nullptr;
+
+// Plain std::threads (the host tests' own) get one made when they first ask,
+// freed when the thread ends
+static thread_local std::unique_ptr<HostTask> adopted_task;
+
+BaseType_t xTaskCreate(TaskFunction_t function, const char* name, uint32_t stack, void* parameters, UBaseType_t priority, TaskHandle_t* handle) {
+    (void)name; (void)stack; (void)priority;
+
+    HostTask* task = new HostTask();
+    if (handle) *handle = task;
+
+    std::thread([function, parameters, task] {
+        current_task = task;
+        function(parameters);
+    }).detach();
+
+    return pdPASS;
+}
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t function, const char* name, uint32_t stack, void* parameters, UBaseType_t priority, TaskHandle_t* handle, BaseType_t core) {
+    (void)core;
+    return xTaskCreate(function, name, stack, parameters, priority, handle);
+}
+
+// A task deleting itself just never returns, threads can't be killed from
+// the outside so deleting another one does nothing
+void vTaskDelete(TaskHandle_t task) {
+    if (task && task != current_task) return;
+    while (true) std::this_thread::sleep_for(std::chrono::hours(1));
+}
+
+void vTaskDelay(TickType_t ticks) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(ticks ? ticks : 1));
+}
+
+TickType_t xTaskGetTickCount() {
+    return millis();
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle() {
+    if (!current_task) {
+        adopted_task.reset(new HostTask());
+        current_task = adopted_task.get();
+    }
+    return current_task;
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clear, TickType_t wait) {
+    HostTask* task = xTaskGetCurrentTaskHandle();
+    std::unique_lock<std::mutex> lock(task->lock);
+
+    wait_for(task->changed, lock, wait, [&] { return task->notified > 0; });
+
+    uint32_t value = task->notified;
+    if (value) task->notified = clear ? 0 : value - 1;
+    return value;
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task) {
+    std::lock_guard<std::mutex> lock(task->lock);
+    task->notified++;
+    task->changed.notify_one();
+    return pdPASS;
+}
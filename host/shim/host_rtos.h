@@ -0,0 +1,62 @@
+#pragma once
+
+// The FreeRTOS calls the sketch makes, on std::thread. A tick is a
+// millisecond, priorities and cores are ignored
+
+#include <stdint.h>
+#include <stddef.h>
+
+typedef uint32_t    TickType_t;
+typedef int         BaseType_t;
+typedef unsigned    UBaseType_t;
+typedef uint8_t     StackType_t;
+
+struct HostQueue;
+struct HostSemaphore;
+struct HostTask;
+
+typedef HostQueue*      QueueHandle_t;
+typedef HostSemaphore*  SemaphoreHandle_t;
+typedef HostTask*       TaskHandle_t;
+typedef void (*TaskFunction_t)(void*);
+
+#define pdTRUE      1
+#define pdFALSE     0
+#define pdPASS      pdTRUE
+#define pdFAIL      pdFALSE
+
+#define configTICK_RATE_HZ  1000
+#define portTICK_PERIOD_MS  1
+#define portMAX_DELAY       ((TickType_t)0xFFFFFFFF)
+#define pdMS_TO_TICKS(ms)   ((TickType_t)(ms))
+
+QueueHandle_t   xQueueCreate(UBaseType_t length, UBaseType_t item_size);
+void            vQueueDelete(QueueHandle_t queue);
+BaseType_t      xQueueSend(QueueHandle_t queue, const void* item, TickType_t wait);
+BaseType_t      xQueueReceive(QueueHandle_t queue, void* item, TickType_t wait);
+UBaseType_t     uxQueueMessagesWaiting(QueueHandle_t queue);
+UBaseType_t     uxQueueSpacesAvailable(QueueHandle_t queue);
+#define xQueueSendToBack xQueueSend
+
+SemaphoreHandle_t xSemaphoreCreateMutex();
+SemaphoreHandle_t xSemaphoreCreateRecursiveMutex();
+SemaphoreHandle_t xSemaphoreCreateBinary();
+void              vSemaphoreDelete(SemaphoreHandle_t semaphore);
+BaseType_t        xSemaphoreTake(SemaphoreHandle_t semaphore, TickType_t wait);
+BaseType_t        xSemaphoreGive(SemaphoreHandle_t semaphore);
+#define xSemaphoreTakeRecursive xSemaphoreTake
+#define xSemaphoreGiveRecursive xSemaphoreGive
+
+BaseType_t  xTaskCreate(TaskFunction_t function, const char* name, uint32_t stack, void* parameters, UBaseType_t priority, TaskHandle_t* handle);
+BaseType_t  xTaskCreatePinnedToCore(TaskFunction_t function, const char* name, uint32_t stack, void* parameters, UBaseType_t priority, TaskHandle_t* handle, BaseType_t core);
+void        vTaskDelete(TaskHandle_t task);
+void        vTaskDelay(TickType_t ticks);
+TickType_t  xTaskGetTickCount();
+TaskHandle_t xTaskGetCurrentTaskHandle();
+
+uint32_t    ulTaskNotifyTake(BaseType_t clear, TickType_t wait);
+BaseType_t  xTaskNotifyGive(TaskHandle_t task);
+
+inline UBaseType_t uxTaskGetStackHighWaterMark(TaskHandle_t)    { return 0; }
+inline void        vTaskList(char* buffer)                      { buffer[0] = '\0'; }
+inline void        vTaskGetRunTimeStats(char* buffer)           { buffer[0] = '\0'; }
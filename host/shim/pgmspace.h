@@ -0,0 +1,10 @@
+#pragma once
+
+// Flash is just memory on the desktop
+
+#include <stdint.h>
+#include <string.h>
+
+#define PROGMEM
+#define pgm_read_byte(addr) (*(const uint8_t*)(addr))
+#define memcpy_P(dest, src, n) memcpy((dest), (src), (n))
@@ -0,0 +1,72 @@
+#include "PNGdec.h"
+
+#include <png.h>
+
+int PNG::openFLASH(uint8_t* data, int size, PNG_DRAW_CALLBACK* callback) {
+    close();
+
+    png_image image;
+    memset(&image, 0, sizeof(image));
+    image.version = PNG_IMAGE_VERSION;
+
+    if (!png_image_begin_read_from_memory(&image, data, size))
+        return PNG_INVALID_PARAMETER;
+
+    _alpha        = (image.format & PNG_FORMAT_FLAG_ALPHA) != 0;
+    image.format  = PNG_FORMAT_RGBA;
+
+    _rgba.resize(PNG_IMAGE_SIZE(image));
+    if (!png_image_finish_read(&image, nullptr, _rgba.data(), 0, nullptr)) {
+        png_image_free(&image);
+        _rgba.clear();
+        return PNG_DECODE_ERROR;
+    }
+
+    _width    = image.width;
+    _height   = image.height;
+    _callback = callback;
+    return PNG_SUCCESS;
+}
+
+int PNG::decode(void* user, int options) {
+    (void)options;
+    if (_rgba.empty() || !_callback) return PNG_INVALID_PARAMETER;
+
+    PNGDRAW draw;
+    draw.iWidth    = _width;
+    draw.iPitch    = _width * 4;
+    draw.iHasAlpha = _alpha;
+    draw.pUser     = user;
+
+    for (int y = 0; y < _height; y++) {
+        draw.y       = y;
+        draw.pPixels = _rgba.data() + (size_t)y * draw.iPitch;
+
+        if (_callback(&draw) == 0) return PNG_QUIT_EARLY;
+    }
+
+    return PNG_SUCCESS;
+}
+
+void PNG::close() {
+    _rgba.clear();
+    _rgba.shrink_to_fit();
+    _width    = 0;
+    _height   = 0;
+    _callback = nullptr;
+}
+
+void PNG::getLineAsRGB565(PNGDRAW* draw, uint16_t* pixels, int endianness, uint32_t background) {
+    uint8_t bg[3] = { (uint8_t)(background >> 16), (uint8_t)(background >> 8), (uint8_t)background };
+
+    for (int x = 0; x < draw->iWidth; x++) {
+        const uint8_t* src = draw->pPixels + x * 4;
+        uint8_t        rgb[3];
+
+        for (int c = 0; c < 3; c++)
+            rgb[c] = (uint8_t)((src[c] * src[3] + bg[c] * (255 - src[3])) / 255);
+
+        uint16_t color = ((rgb[0] & 0xF8) << 8) | ((rgb[1] & 0xFC) << 3) | (rgb[2] >> 3);
+        pixels[x]      = endianness == PNG_RGB565_BIG_ENDIAN ? (uint16_t)((color >> 8) | (color << 8)) : color;
+    }
+}
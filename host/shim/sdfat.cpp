@@ -0,0 +1,339 @@
+#include "SdFat.h"
+
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <set>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+static std::string sd_root = ".";
+
+void SdFatHost::set_root(const char* path) {
+    sd_root = path;
+    while (sd_root.size() > 1 && sd_root.back() == '/')
+        sd_root.pop_back();
+}
+
+const char* SdFatHost::root() {
+    return sd_root.c_str();
+}
+
+static std::string host_path(const char* path) {
+    if (!path || !*path) return sd_root;
+    return sd_root + (path[0] == '/' ? "" : "/") + path;
+}
+
+// The made up card: first sector of every file that asked for its range,
+// with a free sector after each so nothing is accidentally contiguous
+struct CardExtent {
+    std::string path;
+    uint32_t    sectors;
+};
+
+static std::mutex                           card_lock;
+static std::map<uint32_t, CardExtent>       card_extents;
+static std::map<std::string, uint32_t>      card_firsts;
+static std::set<std::string>                card_fragmented;
+static uint32_t                             card_next   = 0x8000;
+static std::atomic<uint32_t>                card_count(0);
+static FsBlockDeviceInterface*              card_device = nullptr;
+
+// 32 GB, plenty of room behind card_next
+#define CARD_SECTORS 0x4000000
+
+void SdFatHost::fragment(const char* path) {
+    std::lock_guard<std::mutex> hold(card_lock);
+    card_fragmented.insert(host_path(path));
+}
+
+uint32_t SdFatHost::card_reads() {
+    return card_count;
+}
+
+void SdFatHost::set_card(FsBlockDeviceInterface* device) {
+    card_device = device;
+}
+
+bool SdCard::isBusy() {
+    return card_device && card_device->isBusy();
+}
+
+uint32_t SdCard::sectorCount() {
+    return card_device ? card_device->sectorCount() : CARD_SECTORS;
+}
+
+bool SdCard::syncDevice() {
+    return card_device ? card_device->syncDevice() : true;
+}
+
+bool SdCard::writeSectors(uint32_t sector, const uint8_t* src, size_t ns) {
+    return card_device && card_device->writeSectors(sector, src, ns);
+}
+
+bool SdCard::readSectors(uint32_t sector, uint8_t* dst, size_t ns) {
+    if (card_device) return card_device->readSectors(sector, dst, ns);
+
+    std::lock_guard<std::mutex> hold(card_lock);
+    card_count++;
+
+    memset(dst, 0, ns * 512);
+
+    auto it = card_extents.upper_bound(sector);
+    if (it == card_extents.begin()) return true;
+    --it;
+
+    uint32_t skip = sector - it->first;
+    if (skip >= it->second.sectors) return true;
+
+    int fd = ::open(it->second.path.c_str(), O_RDONLY);
+    if (fd < 0) return false;
+
+    ssize_t n = pread(fd, dst, std::min<uint64_t>(ns, it->second.sectors - skip) * 512, (off_t)skip * 512);
+    ::close(fd);
+
+    return n >= 0;
+}
+
+///
+/// FsFile
+///
+
+struct FsFile::State {
+    int         fd      = -1;
+    DIR*        dir     = nullptr;
+    std::string path;
+    std::string name;
+
+    ~State() {
+        if (fd >= 0) ::close(fd);
+        if (dir)     closedir(dir);
+    }
+};
+
+bool FsFile::open_host(const std::string& path, const char* name, oflag_t oflag) {
+    close();
+
+    struct stat st;
+    bool exists = stat(path.c_str(), &st) == 0;
+
+    auto state  = std::make_shared<State>();
+    state->path = path;
+    state->name = name;
+
+    if (exists && S_ISDIR(st.st_mode)) {
+        state->dir = opendir(path.c_str());
+        if (!state->dir) return false;
+    } else {
+        state->fd = ::open(path.c_str(), oflag, 0644);
+        if (state->fd < 0) return false;
+    }
+
+    _state = state;
+    return true;
+}
+
+bool FsFile::open(const char* path, oflag_t oflag) {
+    const char* name = strrchr(path, '/');
+    return open_host(host_path(path), name ? name + 1 : path, oflag);
+}
+
+bool FsFile::open(FsFile* dir, const char* path, oflag_t oflag) {
+    if (!dir || !dir->isDir()) return false;
+    return open_host(dir->_state->path + "/" + path, path, oflag);
+}
+
+bool FsFile::openNext(FsFile* dir, oflag_t oflag) {
+    if (!dir || !dir->isDir()) return false;
+
+    while (struct dirent* entry = readdir(dir->_state->dir)) {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+            continue;
+
+        if (open_host(dir->_state->path + "/" + entry->d_name, entry->d_name, oflag))
+            return true;
+    }
+
+    return false;
+}
+
+bool FsFile::close() {
+    _state.reset();
+    return true;
+}
+
+bool FsFile::isOpen() const { return (bool)_state; }
+bool FsFile::isDir() const  { return _state && _state->dir; }
+
+size_t FsFile::getName(char* name, size_t size) {
+    if (!_state || size == 0) return 0;
+
+    snprintf(name, size, "%s", _state->name.c_str());
+    return strlen(name);
+}
+
+int FsFile::read(void* buffer, size_t count) {
+    if (!_state || _state->fd < 0) return -1;
+    return ::read(_state->fd, buffer, count);
+}
+
+int FsFile::read() {
+    uint8_t ch;
+    return read(&ch, 1) == 1 ? ch : -1;
+}
+
+int FsFile::peek() {
+    uint64_t at = position();
+    int      ch = read();
+    seek(at);
+    return ch;
+}
+
+int FsFile::available() {
+    uint64_t left = size() - position();
+    return left > INT32_MAX ? INT32_MAX : (int)left;
+}
+
+size_t FsFile::write(const uint8_t* buffer, size_t size) {
+    if (!_state || _state->fd < 0) return 0;
+
+    ssize_t n = ::write(_state->fd, buffer, size);
+    return n > 0 ? n : 0;
+}
+
+bool FsFile::seek(uint64_t position) {
+    if (!_state || _state->fd < 0) return false;
+    return lseek(_state->fd, position, SEEK_SET) == (off_t)position;
+}
+
+uint64_t FsFile::position() const {
+    if (!_state || _state->fd < 0) return 0;
+    return lseek(_state->fd, 0, SEEK_CUR);
+}
+
+uint64_t FsFile::size() const {
+    struct stat st;
+    if (!_state || stat(_state->path.c_str(), &st) != 0) return 0;
+    return st.st_size;
+}
+
+void FsFile::rewind() {
+    if (!_state) return;
+
+    if (_state->dir) rewinddir(_state->dir);
+    else             seek(0);
+}
+
+// FAT packs them as year since 1980 / month / day and h / m / s/2
+bool FsFile::getModifyDateTime(uint16_t* date, uint16_t* time) {
+    struct stat st;
+    if (!_state || stat(_state->path.c_str(), &st) != 0) return false;
+
+    struct tm tm;
+    localtime_r(&st.st_mtime, &tm);
+
+    *date = (uint16_t)(((tm.tm_year - 80) << 9) | ((tm.tm_mon + 1) << 5) | tm.tm_mday);
+    *time = (uint16_t)((tm.tm_hour << 11) | (tm.tm_min << 5) | (tm.tm_sec / 2));
+    return true;
+}
+
+bool FsFile::truncate(uint64_t length) {
+    return _state && _state->fd >= 0 && ftruncate(_state->fd, length) == 0;
+}
+
+bool FsFile::contiguousRange(uint32_t* bgnSector, uint32_t* endSector) {
+    uint64_t bytes = size();
+    if (!isFile() || bytes == 0) return false;
+
+    std::lock_guard<std::mutex> hold(card_lock);
+    if (card_fragmented.count(_state->path)) return false;
+
+    uint32_t sectors = (bytes + 511) / 512;
+    auto     first   = card_firsts.find(_state->path);
+
+    // Grown since, SdFat would have moved it as well
+    if (first != card_firsts.end() && card_extents[first->second].sectors != sectors) {
+        card_extents.erase(first->second);
+        card_firsts.erase(first);
+        first = card_firsts.end();
+    }
+
+    if (first == card_firsts.end()) {
+        first = card_firsts.emplace(_state->path, card_next).first;
+        card_extents[card_next] = { _state->path, sectors };
+        card_next += sectors + 1;
+    }
+
+    *bgnSector = first->second;
+    *endSector = first->second + sectors - 1;
+    return true;
+}
+
+///
+/// SdFs
+///
+
+static bool root_is_dir() {
+    struct stat st;
+    return stat(sd_root.c_str(), &st) == 0 && S_ISDIR(st.st_mode);
+}
+
+bool FsVolume::begin(FsBlockDeviceInterface* device) {
+    uint8_t sector[512];
+
+    _device = device;
+    return device && device->readSector(0, sector) && root_is_dir();
+}
+
+bool SdFs::begin(SdSpiConfig config) {
+    (void)config;
+    return root_is_dir();
+}
+
+bool SdFs::cardBegin(SdSpiConfig config) {
+    (void)config;
+    return true;
+}
+
+SdCard* SdFs::card() {
+    static SdCard card;
+    return &card;
+}
+
+FsFile SdFs::open(const char* path, oflag_t oflag) {
+    FsFile file;
+    file.open(path, oflag);
+    return file;
+}
+
+bool SdFs::exists(const char* path) {
+    struct stat st;
+    return stat(host_path(path).c_str(), &st) == 0;
+}
+
+bool SdFs::mkdir(const char* path, bool parents) {
+    std::string full = host_path(path);
+
+    if (parents) {
+        for (size_t at = sd_root.size() + 1; (at = full.find('/', at)) != std::string::npos; at++)
+            ::mkdir(full.substr(0, at).c_str(), 0755);
+    }
+
+    return ::mkdir(full.c_str(), 0755) == 0 || exists(path);
+}
+
+bool SdFs::remove(const char* path) {
+    return ::unlink(host_path(path).c_str()) == 0;
+}
+
+bool SdFs::rmdir(const char* path) {
+    return ::rmdir(host_path(path).c_str()) == 0;
+}
+
+bool SdFs::rename(const char* from, const char* to) {
+    return ::rename(host_path(from).c_str(), host_path(to).c_str()) == 0;
+}
@@ -0,0 +1,173 @@
+#include "TFT_eSPI.h"
+
+#include <png.h>
+
+#define SWAP565(color) (uint16_t)(((color) >> 8) | ((color) << 8))
+
+static TFT_eSPI* current_screen = nullptr;
+
+TFT_eSPI* TftHost::screen() {
+    return current_screen;
+}
+
+///
+/// TFT_eSPI
+///
+
+TFT_eSPI::~TFT_eSPI() {
+    if (current_screen == this) current_screen = nullptr;
+    free(_pixels);
+}
+
+void TFT_eSPI::init() {
+    free(_pixels);
+    _pixels = (uint16_t*)calloc((size_t)_width * _height, sizeof(uint16_t));
+    current_screen = this;
+}
+
+// Only portrait and landscape swap the sides, what was drawn stays put
+void TFT_eSPI::setRotation(uint8_t rotation) {
+    int16_t w = std::min(_width, _height);
+    int16_t h = std::max(_width, _height);
+
+    if (rotation & 1) std::swap(w, h);
+    if (w == _width) return;
+
+    _width  = w;
+    _height = h;
+}
+
+void TFT_eSPI::pushed_rect(int32_t w, int32_t h) {
+    if (this != current_screen) return;
+
+    _pushes++;
+    _pushed += (uint64_t)std::max<int32_t>(w, 0) * std::max<int32_t>(h, 0);
+    _last    = micros();
+}
+
+void TFT_eSPI::fill_span(int32_t x, int32_t y, int32_t w, uint16_t color) {
+    if (!_pixels || y < 0 || y >= _height) return;
+
+    int32_t x0 = std::max<int32_t>(x, 0);
+    int32_t x1 = std::min<int32_t>(x + w, _width);
+    if (x1 <= x0) return;
+
+    std::fill(_pixels + (size_t)y * _width + x0, _pixels + (size_t)y * _width + x1, SWAP565(color));
+}
+
+void TFT_eSPI::fillRect(int32_t x, int32_t y, int32_t w, int32_t h, uint16_t color) {
+    for (int32_t row = y; row < y + h; row++)
+        fill_span(x, row, w, color);
+
+    pushed_rect(w, h);
+}
+
+// Every row is inset by how far the corner circle is from the side there
+void TFT_eSPI::fillRoundRect(int32_t x, int32_t y, int32_t w, int32_t h, int32_t radius, uint16_t color) {
+    radius = std::max<int32_t>(0, std::min(radius, std::min(w, h) / 2));
+
+    for (int32_t row = 0; row < h; row++) {
+        int32_t inset = 0;
+        int32_t dy    = row < radius ? radius - row : (row >= h - radius ? row - (h - radius - 1) : 0);
+
+        if (dy > 0) {
+            float dx = sqrtf((float)radius * radius - (float)(dy - 0.5f) * (dy - 0.5f));
+            inset    = radius - (int32_t)(dx + 0.5f);
+        }
+
+        fill_span(x + inset, y + row, w - 2 * inset, color);
+    }
+
+    pushed_rect(w, h);
+}
+
+void TFT_eSPI::pushImage(int32_t x, int32_t y, int32_t w, int32_t h, const uint16_t* data) {
+    for (int32_t row = 0; row < h; row++) {
+        int32_t py = y + row;
+        if (!_pixels || py < 0 || py >= _height) continue;
+
+        for (int32_t col = 0; col < w; col++) {
+            int32_t px = x + col;
+            if (px < 0 || px >= _width) continue;
+
+            uint16_t color = data[(size_t)row * w + col];
+            _pixels[(size_t)py * _width + px] = _swap ? SWAP565(color) : color;
+        }
+    }
+
+    pushed_rect(w, h);
+}
+
+// Same as TFT_eSPI, the transparent colour is given the usual way round
+void TFT_eSPI::pushImage(int32_t x, int32_t y, int32_t w, int32_t h, const uint16_t* data, uint16_t transparent) {
+    if (!_swap) transparent = SWAP565(transparent);
+
+    for (int32_t row = 0; row < h; row++) {
+        int32_t py = y + row;
+        if (!_pixels || py < 0 || py >= _height) continue;
+
+        for (int32_t col = 0; col < w; col++) {
+            int32_t  px    = x + col;
+            uint16_t color = data[(size_t)row * w + col];
+            if (px < 0 || px >= _width || color == transparent) continue;
+
+            _pixels[(size_t)py * _width + px] = _swap ? SWAP565(color) : color;
+        }
+    }
+
+    pushed_rect(w, h);
+}
+
+uint16_t TFT_eSPI::alphaBlend(uint8_t alpha, uint16_t fg, uint16_t bg) {
+    uint32_t rxb = bg & 0xF81F;
+    rxb += ((fg & 0xF81F) - rxb) * (alpha >> 2) >> 6;
+    uint32_t xgx = bg & 0x07E0;
+    xgx += ((fg & 0x07E0) - xgx) * alpha >> 8;
+
+    return (rxb & 0xF81F) | (xgx & 0x07E0);
+}
+
+bool TFT_eSPI::savePng(const char* path) const {
+    if (!_pixels) return false;
+
+    std::vector<uint8_t> rgb((size_t)_width * _height * 3);
+    for (size_t i = 0; i < (size_t)_width * _height; i++) {
+        uint16_t color = SWAP565(_pixels[i]);
+
+        rgb[i * 3 + 0] = ((color >> 11) & 0x1F) * 255 / 31;
+        rgb[i * 3 + 1] = ((color >> 5)  & 0x3F) * 255 / 63;
+        rgb[i * 3 + 2] = ( color        & 0x1F) * 255 / 31;
+    }
+
+    png_image image;
+    memset(&image, 0, sizeof(image));
+    image.version = PNG_IMAGE_VERSION;
+    image.width   = _width;
+    image.height  = _height;
+    image.format  = PNG_FORMAT_RGB;
+
+    return png_image_write_to_file(&image, path, 0, rgb.data(), 0, nullptr) != 0;
+}
+
+///
+/// TFT_eSprite
+///
+
+void* TFT_eSprite::createSprite(int16_t w, int16_t h, uint8_t frames) {
+    (void)frames;
+
+    deleteSprite();
+    _pixels = (uint16_t*)calloc((size_t)w * h, sizeof(uint16_t));
+    if (!_pixels) return nullptr;
+
+    _width  = w;
+    _height = h;
+    return _pixels;
+}
+
+void TFT_eSprite::deleteSprite() {
+    free(_pixels);
+    _pixels = nullptr;
+    _width  = 0;
+    _height = 0;
+}
@@ -0,0 +1,117 @@
+#include "host.h"
+
+#include "malkuth_fs.h"
+
+#include <vector>
+
+// What the ESP32-S3 Arduino driver costs per call into it (bus lock, register
+// setup, waiting on the done bit) and per 64 byte FIFO fill, on top of the
+// bits themselves at SPI_SPEED. Ballpark figures, --call-us and --fill-us
+// override them
+#define SPI_CALL_US     1.0
+#define SPI_FILL_US     0.25
+
+// ExfatSpi the way it was before the bulk transfers, one SPI.transfer per
+// byte
+class ByteSpi : public ExfatSpi {
+public:
+    using ExfatSpi::ExfatSpi;
+    using ExfatSpi::receive;
+    using ExfatSpi::send;
+
+    uint8_t receive(uint8_t* buf, size_t count) {
+        for (size_t i = 0; i < count; i++)
+            buf[i] = SPI.transfer(0XFF);
+        return 0;
+    }
+
+    void send(const uint8_t* buf, size_t count) {
+        for (size_t i = 0; i < count; i++)
+            SPI.transfer(buf[i]);
+    }
+};
+
+// What SdFat's SdSpiCard does around the data of a CMD18/CMD25: the command
+// and the stop go out a byte at a time, every sector waits for its token and
+// ends with two CRC bytes, only the 512 bytes in between are a bulk call
+template <typename Spi>
+static void sectors(Spi& spi, uint8_t* data, size_t count, bool write) {
+    uint8_t command[6] = { 0x52, 0, 0, 0, 0, 0x01 };
+
+    spi.activate();
+    for (uint8_t byte : command) spi.send(byte);
+    spi.receive();
+
+    for (size_t i = 0; i < count; i++) {
+        uint8_t* sector = data + i * 512;
+
+        if (write) {
+            spi.send(0xFC);
+            spi.send(sector, 512);
+            spi.send(0xFF);
+            spi.send(0xFF);
+            spi.receive();
+        } else {
+            spi.receive();
+            spi.receive(sector, 512);
+            spi.receive();
+            spi.receive();
+        }
+    }
+
+    for (uint8_t byte : command) spi.send(byte);
+    spi.receive();
+    spi.deactivate();
+}
+
+struct Result {
+    double   mbps;
+    uint64_t calls;
+    uint32_t hash;
+};
+
+template <typename Spi>
+static Result measure(Spi& spi, std::vector<uint8_t>& data, bool write, double call_us, double fill_us) {
+    SPI.reset();
+    sectors(spi, data.data(), data.size() / 512, write);
+
+    double us = SPI.calls() * call_us + SPI.chunks() * fill_us + SPI.bytes() * 8.0 / (SPI_SPEED / 1e6);
+    return { data.size() / us, SPI.calls(), SPI.sent_hash() };
+}
+
+int run_spi(int argc, char** argv) {
+    const char* call = option(argc, argv, "--call-us", nullptr);
+    const char* fill = option(argc, argv, "--fill-us", nullptr);
+
+    double call_us = call ? atof(call) : SPI_CALL_US;
+    double fill_us = fill ? atof(fill) : SPI_FILL_US;
+
+    ByteSpi  before(2, 42, 40, 41);
+    ExfatSpi after(2, 42, 40, 41);
+    bool     ok = true;
+
+    Serial.printf("Mock bus                 : %.0f MHz, %.2f us/call, %.2f us/FIFO fill\n", SPI_SPEED / 1e6, call_us, fill_us);
+
+    for (bool write : { false, true }) {
+        for (size_t size : { 512, 1024, 4096, 16384, 32768 }) {
+            std::vector<uint8_t> a(size), b(size);
+            for (size_t i = 0; i < size; i++)
+                a[i] = b[i] = (uint8_t)(i * 7 + (i >> 8));
+
+            Result old_way = measure(before, a, write, call_us, fill_us);
+            Result bulk    = measure(after,  b, write, call_us, fill_us);
+
+            // Same bytes in the buffer (reads) or on the wire (writes), and
+            // faster for it
+            bool same = a == b && old_way.hash == bulk.hash;
+            ok = ok && same && bulk.mbps > old_way.mbps;
+
+            Serial.printf("%s %5u bytes        : %5.2f -> %5.2f MB/s, %6llu -> %4llu calls %s\n",
+                write ? "Write" : "Read ", (unsigned)size, old_way.mbps, bulk.mbps,
+                (unsigned long long)old_way.calls, (unsigned long long)bulk.calls, same ? "" : "MISMATCH");
+        }
+    }
+
+    Serial.printf("Bulk transfers           : %s\n", ok ? "ok" : "FAILED");
+    return ok ? 0 : 1;
+}
@@ -0,0 +1 @@
+-DUSE_BLOCK_DEVICE_INTERFACE=1
@@ -6,6 +6,9 @@
 
 #include "malkuth_display.h"
 #include "malkuth_audio.h"
+#include "malkuth_library.h"
+#include "malkuth_cover.h"
+#include "malkuth_scanner.h"
 
 #include "fonts/Koruri-Regular12.h"
 #include "fonts/Koruri-Regular8.h"
@@ -61,12 +64,39 @@ namespace Theme {
     constexpr size_t    IMG_PLAYER_SIZE = sizeof(PlayerBg_b);
 
 }
+////////////////////////////////////////////////////////////////////
+//                            Widgets                             //
+////////////////////////////////////////////////////////////////////
+// Things that get redrawn in place, a new draw with the same id replaces
+// the old one instead of piling on top of it
+namespace Widget {
+    constexpr uint16_t STATUS       = 1;    // Also where notifications go
+    constexpr uint16_t VOLUME       = 2;
+
+    constexpr uint16_t TITLE        = 10;
+    constexpr uint16_t ARTIST       = 11;
+    constexpr uint16_t PLAY         = 12;
+    constexpr uint16_t ELAPSED      = 13;
+    constexpr uint16_t DURATION     = 14;
+    constexpr uint16_t COVER        = 15;
+
+    constexpr uint16_t FILES_COUNT  = 20;
+    constexpr uint16_t FILES_PATH   = 21;
+    constexpr uint16_t FILES_SELECT = 22;
+    constexpr uint16_t FILES_NOW    = 23;
+    constexpr uint16_t FILES_UP     = 24;
+    constexpr uint16_t FILES_DOWN   = 25;
+}
+
 ////////////////////////////////////////////////////////////////////
 //                        Global Variables                        //
 ////////////////////////////////////////////////////////////////////
 MalkuthDisplay  display;
 MalkuthFs       filesystem;
 MalkuthAudio    audio;
+MalkuthLibrary  library;
+MalkuthCovers   covers;
+MalkuthScanner  scanner;
 
 AudioMetadata   metadata;
 
@@ -97,7 +127,7 @@ char current_directory[128]  = "/";
 char selected_directory[128] = "";
 String  current_audiopath    = "";
 
-std::vector<String> files;
+const MalkuthDirCache::Listing* files = nullptr;
 uint16_t            previous_index      = 0;
 uint16_t            files_count         = 0;
 constexpr uint8_t   VISIBLE_ITEMS       = 5;
@@ -120,10 +150,11 @@ void page_boot();
 void page_settings();
 void page_player();
 void page_files();
-void page_files_listing(uint8_t index);
+void page_files_listing(uint16_t index, bool rescan = true);
 
 void show_statusbar();
 void show_menubar(Page active);
+void show_cover();
 void show_notification(const char* text, uint16_t color, uint16_t delay_ms);
 
 void check_keypress();
@@ -136,10 +167,6 @@ void stop_player_timer();
 void format_duration(char* out, size_t len, float seconds);
 String format_elipsis(const String& text, uint8_t length);
 
-bool is_audio_file(const String& f);
-bool is_image_file(const String& f);
-bool is_directory(const String& f);
-
 ////////////////////////////////////////////////////////////////////
 //                         Actual Program                         //
 ////////////////////////////////////////////////////////////////////
@@ -153,11 +180,16 @@ void setup() {
 
     if (!filesystem.init())
         display.text(Anchor::BOTTOM_CENTER, false, "SD Card is failed to be mounted!", Theme::FONT_SMALL, Theme::C_ERROR, 0, -10);
-    else
+    else {
         display.text(Anchor::BOTTOM_CENTER, false, "SD Card is successfully mounted!", Theme::FONT_SMALL, Theme::C_SUCCESS, 0, -10);
+        library.begin(filesystem);
+        covers.begin(filesystem);
+        scanner.begin(filesystem, library);
+    }
 
-    audio.set_sdfs(filesystem.get_sdfs());
-    // display.set_sdfs(filesystem.get_sdfs());
+    audio.set_filesystem(filesystem);
+    audio.set_library(library);
+    display.set_filesystem(filesystem);
 
     if (!audio.init())
         display.text(Anchor::BOTTOM_CENTER, false, "Audio is failed to be intialized!", Theme::FONT_SMALL, Theme::C_ERROR, 0, -30);
@@ -167,11 +199,10 @@ void setup() {
     // Initial value
     display.set_brightness(current_brightness);
     audio.set_volume(current_volume);
+    audio.set_gapless(true);
 }
 
 void loop() {
-    audio.loop();
-
     check_metadata();
     check_keypress();
     display.check_buttons();
@@ -223,40 +254,33 @@ void page_boot() {
 //                           Page Player                          //
 ////////////////////////////////////////////////////////////////////
 void page_player() {
-    // TODO : Maybe i will fix later (Cover image loading)
-    //
-    // if (audio.get_covertype() == ImageType::NONE)
-    //     display.object(Anchor::MIDDLE_CENTER, 200, 200, Theme::C_CARD, 10, 0, -80);
-    //     display.image(ImageType::FLASH, PlayerBg, sizeof(BootBg));
-    // else
-    //     display.image(audio.get_covertype(), audio.get_coverpath(), 200, 200, 60, 40);
-
     display.image(ImageType::FLASH, Theme::IMG_PLAYER, Theme::IMG_PLAYER_SIZE);
+    show_cover();
 
     show_statusbar();
     show_menubar(current_page);
 
     // Artist and title text
-    display.text(Anchor::MIDDLE_CENTER, true, metadata.title.c_str(), Theme::FONT_HUGE, Theme::C_TEXT_PRIMARY, 0, 50);
-    display.text(Anchor::MIDDLE_CENTER, true, metadata.artist.c_str(), Theme::FONT_LARGE, Theme::C_TEXT_PRIMARY, 0, 80);
+    display.text(Widget::TITLE, Anchor::MIDDLE_CENTER, true, metadata.title.c_str(), Theme::FONT_HUGE, Theme::C_TEXT_PRIMARY, 0, 50);
+    display.text(Widget::ARTIST, Anchor::MIDDLE_CENTER, true, metadata.artist.c_str(), Theme::FONT_LARGE, Theme::C_TEXT_PRIMARY, 0, 80);
 
     // Duration text
     format_duration(time_buf, sizeof(time_buf), metadata.duration);
     display.object(Anchor::BOTTOM_RIGHT, 30, 12, Theme::C_ACCENT_DARK, 5, -20, -113);
-    display.text(Anchor::BOTTOM_RIGHT, true, time_buf, Theme::FONT_SMALL, Theme::C_WHITE, -20, -110);
+    display.text(Widget::DURATION, Anchor::BOTTOM_RIGHT, true, time_buf, Theme::FONT_SMALL, Theme::C_WHITE, -20, -110);
 
     // Button for Play/Pause
     display.button(Anchor::BOTTOM_CENTER, 35, 35, Theme::C_ACCENT_MUTED, -1, 0, -80, [](void*){
         audio.toggle();        
         display.object(Anchor::BOTTOM_CENTER, 35, 35, Theme::C_ACCENT_MUTED, -1, 0, -80);
-        display.text(Anchor::BOTTOM_CENTER, true, 
+        display.text(Widget::PLAY, Anchor::BOTTOM_CENTER, true, 
             audio.get_status() ? "||" : "▶", 
             Theme::FONT_LARGE, Theme::C_WHITE, 
             audio.get_status() ? -1 : 2, 
             audio.get_status() ? -85 : -82
         );
     });
-    display.text(Anchor::BOTTOM_CENTER, true, 
+    display.text(Widget::PLAY, Anchor::BOTTOM_CENTER, true, 
             audio.get_status() ? "||" : "▶", 
             Theme::FONT_LARGE, Theme::C_WHITE, 
             audio.get_status() ? -1 : 2, 
@@ -294,18 +318,36 @@ void check_metadata(){
         }
 
         if (current_page == Page::PLAYER) {
+            show_cover();
             display.image(ImageType::FLASH, Theme::IMG_PLAYER, Theme::IMG_PLAYER_SIZE, 320, 85, 0, 280);
-            display.text(Anchor::MIDDLE_CENTER, true, metadata.title.c_str(), Theme::FONT_HUGE, Theme::C_TEXT_PRIMARY, 0, 50);
-            display.text(Anchor::MIDDLE_CENTER, true, metadata.artist.c_str(), Theme::FONT_LARGE, Theme::C_TEXT_PRIMARY, 0, 80);
+            display.text(Widget::TITLE, Anchor::MIDDLE_CENTER, true, metadata.title.c_str(), Theme::FONT_HUGE, Theme::C_TEXT_PRIMARY, 0, 50);
+            display.text(Widget::ARTIST, Anchor::MIDDLE_CENTER, true, metadata.artist.c_str(), Theme::FONT_LARGE, Theme::C_TEXT_PRIMARY, 0, 80);
 
             // Duration text
             format_duration(time_buf, sizeof(time_buf), metadata.duration);
             display.object(Anchor::BOTTOM_RIGHT, 30, 12, Theme::C_ACCENT_DARK, 5, -20, -113);
-            display.text(Anchor::BOTTOM_RIGHT, true, time_buf, Theme::FONT_SMALL, Theme::C_WHITE, -20, -110);
+            display.text(Widget::DURATION, Anchor::BOTTOM_RIGHT, true, time_buf, Theme::FONT_SMALL, Theme::C_WHITE, -20, -110);
         }
 
         if (current_page == Page::FILES && (strcmp(current_directory, selected_directory) == 0))
-            page_files_listing(start_idx);
+            page_files_listing(start_idx, false);
+    }
+
+    // The cover task finished a thumbnail, the card placeholder gets swapped
+    if (covers.get_update()) {
+        covers.yeah_i_have_updated();
+
+        if (current_page == Page::PLAYER && audio.is_actually_audio())
+            show_cover();
+    }
+
+    // The scanner parsed more tracks, rows showing file names may have
+    // titles by now
+    if (scanner.get_update()) {
+        scanner.yeah_i_have_updated();
+
+        if (current_page == Page::FILES)
+            page_files_listing(start_idx, false);
     }
 }
 ////////////////////////////////////////////////////////////////////
@@ -365,7 +407,7 @@ void check_progress(){
         display.bar(Anchor::BOTTOM_CENTER, 280, 10, Theme::C_CARD, Theme::C_ACCENT, 5, 0, -130, progress, nullptr);
     });
     display.object(Anchor::BOTTOM_LEFT, 30, 12, Theme::C_ACCENT_DARK, 5, 21, -113);
-    display.text(Anchor::BOTTOM_LEFT, true, time_buf, Theme::FONT_SMALL, Theme::C_WHITE, 20, -110);
+    display.text(Widget::ELAPSED, Anchor::BOTTOM_LEFT, true, time_buf, Theme::FONT_SMALL, Theme::C_WHITE, 20, -110);
 }
 
 ////////////////////////////////////////////////////////////////////
@@ -394,16 +436,22 @@ void page_files() {
     page_files_listing(0);
 }
 
-void page_files_listing(uint8_t index) {
+void page_files_listing(uint16_t index, bool rescan) {
     display.buttons_clear_temp();
 
-    // Refresh the view 
+    // Refresh the view, the display composes all of this in one go so
+    // nothing flickers in between
     display.object(Anchor::TOP_CENTER, 320, 240, TFT_BLACK, 0, 0, 120);
     display.object(Anchor::BOTTOM_RIGHT, 30, 30, Theme::C_BLACK, -1, -60, -80);
     display.object(Anchor::BOTTOM_RIGHT, 30, 30, Theme::C_BLACK, -1, -20, -80);
+    display.remove(Widget::FILES_UP);
+    display.remove(Widget::FILES_DOWN);
+    display.remove(Widget::FILES_NOW);
     
-    files       = filesystem.get_directory_files(current_directory);
-    files_count = files.size();
+    // Scrolling pages through the cached listing, only entering a directory
+    // goes to the card (and only if the directory changed since)
+    files       = filesystem.get_directory(current_directory, rescan);
+    files_count = files ? files->count() : 0;
 
     start_idx   = index;
     end_idx     = start_idx + VISIBLE_ITEMS;
@@ -414,14 +462,15 @@ void page_files_listing(uint8_t index) {
     // List files and directory
     snprintf(idx_buf, sizeof(idx_buf), "%02u/%02u", end_idx, files_count);
     display.object(Anchor::TOP_RIGHT, 50, 30, Theme::C_BLACK, 0, -20, 38);
-    display.text(Anchor::TOP_RIGHT, true, idx_buf, Theme::FONT_LARGE, Theme::C_WHITE, -20, 42);
+    display.text(Widget::FILES_COUNT, Anchor::TOP_RIGHT, true, idx_buf, Theme::FONT_LARGE, Theme::C_WHITE, -20, 42);
     
     for (uint8_t i = 0; i < VISIBLE_ITEMS; ++i) {
-        uint8_t idx = start_idx + i;
+        uint16_t idx = start_idx + i;
         if (idx >= files_count) break;
 
         int16_t y_offset = 75 + ((i + 1) * 45);
-        const String& file = files[idx];
+        String    file = (*files)[idx];
+        EntryType type = files->type(idx);
 
         String displayed_text = format_elipsis(file, MAX_VISIBLE_STRING);
 
@@ -432,12 +481,12 @@ void page_files_listing(uint8_t index) {
             currently_played ? Theme::C_ACCENT_MUTED: Theme::C_ACCENT_EXMUTED, 
             currently_played ? 0 : 10, 
             0, y_offset, 
-        [file, start_idx, idx](void*) {
-            if (is_directory(file)) {
+        [file, type, start_idx, idx](void*) {
+            if (type == EntryType::DIRECTORY) {
                 strncat(current_directory, file.c_str(), sizeof(current_directory) - strlen(current_directory) - 1);
                 previous_index = start_idx;
                 page_files_listing(0);
-            } else if (is_audio_file(file)){
+            } else if (type == EntryType::AUDIO){
                 // if (strcmp(selected_directory, current_directory) == 0)
                 //     audio.set_index(idx);
                 // else
@@ -448,6 +497,7 @@ void page_files_listing(uint8_t index) {
                 else {
                     strcpy(selected_directory, current_directory);
                     audio.process_directory(selected_directory);
+                    scanner.scan(selected_directory);
 
                     audio.set_index(idx);
                 }
@@ -458,27 +508,45 @@ void page_files_listing(uint8_t index) {
             display.object(Anchor::TOP_LEFT, 10, 40, Theme::C_ACCENT, 0, 0, y_offset);
         }
 
-        if (is_audio_file(file))
+        if (type == EntryType::AUDIO)
             display.text(Anchor::TOP_LEFT, true, "", Theme::FONT_ICON_SMALL, Theme::C_TEXT_PRIMARY, 20, 82 + (i + 1) * 45); // Audio Icon
-        else if (is_image_file(file))
+        else if (type == EntryType::IMAGE)
             display.text(Anchor::TOP_LEFT, true, "", Theme::FONT_ICON_SMALL, Theme::C_TEXT_PRIMARY, 20, 82 + (i + 1) * 45); // Image Icon
-        else if (is_directory(file))
+        else if (type == EntryType::DIRECTORY)
             display.text(Anchor::TOP_LEFT, true, "", Theme::FONT_ICON_SMALL, Theme::C_TEXT_PRIMARY, 20, 82 + (i + 1) * 45); // Folder Icon
         else
             display.text(Anchor::TOP_LEFT, true, "", Theme::FONT_ICON_SMALL, Theme::C_TEXT_PRIMARY, 20, 82 + (i + 1) * 45); // File Icon
 
-        display.text(Anchor::TOP_LEFT, true, displayed_text.c_str(), Theme::FONT_LARGE, Theme::C_TEXT_PRIMARY, 45, 84 + (i + 1) * 45);
+        // Tracks the scanner (or the player) already parsed get title, artist
+        // and duration, everything else just its name
+        AudioMetadata track;
+        bool tagged = type == EntryType::AUDIO && library.get((String(current_directory) + file).c_str(), track);
+
+        if (tagged) {
+            if (track.title != "")
+                displayed_text = format_elipsis(track.title, MAX_VISIBLE_STRING);
+
+            char length[12];
+            format_duration(length, sizeof(length), track.duration > 0 ? track.duration : 0);
+
+            display.text(Anchor::TOP_LEFT, true, displayed_text.c_str(), Theme::FONT_LARGE, Theme::C_TEXT_PRIMARY, 45, 78 + (i + 1) * 45);
+            display.text(Anchor::TOP_LEFT, true, format_elipsis(track.artist, MAX_VISIBLE_STRING).c_str(), Theme::FONT_SMALL, Theme::C_TEXT_MUTED, 45, 98 + (i + 1) * 45);
+            display.text(Anchor::TOP_RIGHT, true, length, Theme::FONT_SMALL, Theme::C_TEXT_MUTED, -20, 98 + (i + 1) * 45);
+        } else {
+            display.text(Anchor::TOP_LEFT, true, displayed_text.c_str(), Theme::FONT_LARGE, Theme::C_TEXT_PRIMARY, 45, 84 + (i + 1) * 45);
+        }
     }
 
-    display.text(Anchor::BOTTOM_LEFT, true, format_elipsis(String(current_directory), 78).c_str(), Theme::FONT_SMALL, Theme::C_TEXT_MUTED, 0, -116);
+    display.text(Widget::FILES_PATH, Anchor::BOTTOM_LEFT, true, format_elipsis(String(current_directory), 78).c_str(), Theme::FONT_SMALL, Theme::C_TEXT_MUTED, 0, -116);
 
     // Select the directory
     bool selected = (strcmp(selected_directory, current_directory) == 0);
     display.button(Anchor::BOTTOM_LEFT, 85, 30, selected ? Theme::C_ACCENT : Theme::C_ACCENT_DARK, 10, 20, -80, [](void*) {
         strcpy(selected_directory, current_directory);
         audio.process_directory(selected_directory);
+        scanner.scan(selected_directory);
     }, nullptr, true);
-    display.text(Anchor::BOTTOM_LEFT, true, "Select", Theme::FONT_LARGE, selected ? Theme::C_BG : Theme::C_TEXT_PRIMARY, 33, -81);
+    display.text(Widget::FILES_SELECT, Anchor::BOTTOM_LEFT, true, "Select", Theme::FONT_LARGE, selected ? Theme::C_BG : Theme::C_TEXT_PRIMARY, 33, -81);
 
     // Return to the selected directory
     display.object(Anchor::BOTTOM_CENTER, 85, 30, Theme::C_BLACK, 0, 0, -80);
@@ -487,23 +555,23 @@ void page_files_listing(uint8_t index) {
             strcpy(current_directory, selected_directory);
             page_files_listing(0);
         }, nullptr, true);
-        display.text(Anchor::BOTTOM_CENTER, true, "Now", Theme::FONT_LARGE, Theme::C_TEXT_PRIMARY, 0, -81);
+        display.text(Widget::FILES_NOW, Anchor::BOTTOM_CENTER, true, "Now", Theme::FONT_LARGE, Theme::C_TEXT_PRIMARY, 0, -81);
     }
 
     // Scroll up
     if (start_idx > 0) {
         display.button(Anchor::BOTTOM_RIGHT, true, 30, 30, Theme::C_ACCENT, -1, -60, -80, [start_idx](void*) {
-            page_files_listing(start_idx - 1);
+            page_files_listing(start_idx - 1, false);
         }, nullptr, true);
-        display.text(Anchor::BOTTOM_RIGHT, true, "▲", Theme::FONT_LARGE, Theme::C_BLACK, -63, -80);
+        display.text(Widget::FILES_UP, Anchor::BOTTOM_RIGHT, true, "▲", Theme::FONT_LARGE, Theme::C_BLACK, -63, -80);
     }
 
     // Scroll down
     if (end_idx < files_count) {
         display.button(Anchor::BOTTOM_RIGHT, true, 30, 30, Theme::C_ACCENT, -1, -20, -80, [start_idx](void*) {
-            page_files_listing(start_idx + 1);
+            page_files_listing(start_idx + 1, false);
         }, nullptr, true);
-        display.text(Anchor::BOTTOM_RIGHT, true, "▼", Theme::FONT_LARGE, Theme::C_BLACK, -23, -80);
+        display.text(Widget::FILES_DOWN, Anchor::BOTTOM_RIGHT, true, "▼", Theme::FONT_LARGE, Theme::C_BLACK, -23, -80);
     }
 }
 
@@ -545,7 +613,7 @@ void page_settings() {
                 
                 snprintf(vol_buf, sizeof(vol_buf), "Vol: %-3d%%", audio.get_volume());
                 display.object(Anchor::TOP_RIGHT, 80, 26, Theme::C_ACCENT_EXMUTED, 10, -5, 5);
-                display.text(Anchor::TOP_RIGHT, true, vol_buf, Theme::FONT_MEDIUM, Theme::C_TEXT_PRIMARY, -10, 9);
+                display.text(Widget::VOLUME, Anchor::TOP_RIGHT, true, vol_buf, Theme::FONT_MEDIUM, Theme::C_TEXT_PRIMARY, -10, 9);
             }
         }, nullptr);
 
@@ -586,6 +654,86 @@ void page_settings() {
         Serial.print(runtime_buf);
         if (runtime_buf[0] != '\0' && runtime_buf[strlen(runtime_buf)-1] != '\n') Serial.println();
 
+        Serial.println("=========== DISPLAY INFO ===========");
+        Serial.printf("Command size             : %u bytes\n", (unsigned)sizeof(DisplayCommand));
+        Serial.printf("Commands handled         : %u\n", (unsigned)display.get_commands_handled());
+        Serial.printf("Scene nodes              : %u\n", (unsigned)display.get_scene_nodes());
+        Serial.printf("Composed pixels          : %u\n", (unsigned)display.get_composed_pixels());
+
+        Serial.println("=========== COVER INFO ===========");
+        Serial.printf("Thumbnail hits           : %u\n", (unsigned)covers.get_hits());
+        Serial.printf("Thumbnails made / failed : %u / %u\n", (unsigned)covers.get_generated(), (unsigned)covers.get_failed());
+        Serial.printf("Last thumbnail           : %u us\n", (unsigned)covers.get_last_us());
+
+        Serial.println("=========== SCANNER INFO ===========");
+        Serial.printf("Library tracks           : %u\n", (unsigned)library.count());
+        Serial.printf("Scanned audio files      : %u\n", (unsigned)scanner.get_files());
+        Serial.printf("Parsed / from library    : %u / %u\n", (unsigned)scanner.get_parsed(), (unsigned)scanner.get_cached());
+        Serial.printf("Fragmented               : %u\n", (unsigned)scanner.get_fragmented());
+        Serial.printf("Last full scan           : %u ms\n", (unsigned)scanner.get_last_ms());
+        Serial.printf("Scan running             : %s\n", scanner.is_busy() ? "yes" : "no");
+
+        // Since the last dump, a missed one got the card after its deadline
+        static const char* SD_CLASSES[] = { "Audio", "UI", "Background" };
+
+        Serial.println("=========== SD ARBITER ===========");
+        for (uint8_t i = 0; i < (uint8_t)SdClass::COUNT; i++) {
+            SdClassStats sd = filesystem.get_stats((SdClass)i);
+
+            Serial.printf("%-10s requests/missed: %u / %u\n", SD_CLASSES[i], (unsigned)sd.requests, (unsigned)sd.missed);
+            Serial.printf("%-10s wait avg/max   : %u / %u us\n", SD_CLASSES[i],
+                (unsigned)(sd.requests ? sd.wait_total / sd.requests : 0), (unsigned)sd.wait_max);
+            Serial.printf("%-10s hold max       : %u us\n", SD_CLASSES[i], (unsigned)sd.hold_max);
+        }
+        filesystem.reset_stats();
+
+        // Sector reads only, the audio refills bypass it
+        ReadCacheStats cache = filesystem.get_cache_stats();
+        uint32_t lookups = cache.hits + cache.misses;
+
+        Serial.println("=========== READ CACHE ===========");
+        Serial.printf("Hits/misses              : %u / %u\n", (unsigned)cache.hits, (unsigned)cache.misses);
+        Serial.printf("Hit rate                 : %.1f %%\n", lookups ? 100.0f * cache.hits / lookups : 0.0f);
+        Serial.printf("Bypassed                 : %u\n", (unsigned)cache.bypassed);
+        Serial.printf("Read ahead/used          : %u / %u\n", (unsigned)cache.prefetched, (unsigned)cache.prefetch_used);
+        filesystem.reset_cache_stats();
+
+        // Contiguous tracks skip the FAT, unaligned heads and the last few
+        // bytes of a track still go through SdFat
+        SdExtentStats extent = filesystem.get_extent_stats();
+
+        Serial.println("=========== CONTIGUOUS READ ===========");
+        Serial.printf("Raw sector reads         : %u (%llu KB)\n", (unsigned)extent.raw_reads, (unsigned long long)(extent.raw_bytes / 1024));
+        Serial.printf("Through SdFat            : %u\n", (unsigned)extent.fallback_reads);
+        filesystem.reset_extent_stats();
+
+        float fixed_cycles, float_cycles;
+        MalkuthGain::benchmark(4096, fixed_cycles, float_cycles);
+
+        Serial.println("=========== AUDIO INFO ===========");
+        Serial.printf("Gain (Q31)               : %ld\n", (long)audio.get_gain());
+        Serial.printf("Gain, fixed point        : %.2f cycles/sample\n", fixed_cycles);
+        Serial.printf("Gain, float              : %.2f cycles/sample\n", float_cycles);
+
+        // Per stage cost of what played since the last dump, 1000000 us/s is
+        // exactly real time
+        AudioProfile profile = audio.get_profile();
+
+        Serial.printf("Format                   : %u Hz, %u bit, %u ch\n", (unsigned)profile.sample_rate, (unsigned)profile.bits, (unsigned)profile.channels);
+        Serial.printf("Profiled audio           : %.1f s\n", profile.seconds);
+        Serial.printf("Read                     : %.0f us/s\n", profile.read);
+        Serial.printf("Decode                   : %.0f us/s\n", profile.decode);
+        Serial.printf("Convert                  : %.0f us/s\n", profile.convert);
+        Serial.printf("Write (DMA wait)         : %.0f us/s\n", profile.write);
+        Serial.printf("Headroom (audio task)    : %.1f %%\n", 100.0f - (profile.decode + profile.convert) / 10000.0f);
+        audio.print_stats(Serial, false);
+
+        // Same numbers for a spreadsheet, between the markers
+        Serial.println("----------- AUDIO CSV -----------");
+        audio.print_stats(Serial, true);
+        Serial.println("---------------------------------");
+        audio.reset_profile();
+
         UBaseType_t hw = uxTaskGetStackHighWaterMark(NULL);
         Serial.println("=========== STACK INFO ===========");
         Serial.printf("Current task stack high-water mark: %u words (~%u bytes)\n",
@@ -605,6 +753,9 @@ void page_settings() {
             if (!filesystem.init()) {
                 show_notification("Failed to mount!", Theme::C_ERROR, 2000);
             } else {
+                library.begin(filesystem);
+                covers.begin(filesystem);
+                scanner.begin(filesystem, library);
                 show_notification("Successfully mounted!", Theme::C_SUCCESS, 2000);
             }
         } else {
@@ -635,13 +786,13 @@ void show_statusbar(){
 
     display.object(Anchor::TOP_LEFT, 115, 26, Theme::C_ACCENT_EXMUTED, 10, 5, 5);
     if (!audio.get_status())
-        display.text(Anchor::TOP_LEFT, true, "Paused...", Theme::FONT_MEDIUM, Theme::C_TEXT_PRIMARY, 10, 9);
+        display.text(Widget::STATUS, Anchor::TOP_LEFT, true, "Paused...", Theme::FONT_MEDIUM, Theme::C_TEXT_PRIMARY, 10, 9);
     else
-        display.text(Anchor::TOP_LEFT, true, "おかえり~~~ :3", Theme::FONT_MEDIUM, Theme::C_TEXT_PRIMARY, 10, 9);
+        display.text(Widget::STATUS, Anchor::TOP_LEFT, true, "おかえり~~~ :3", Theme::FONT_MEDIUM, Theme::C_TEXT_PRIMARY, 10, 9);
 
     snprintf(vol_buf, sizeof(vol_buf), "Vol: %-3d%%", audio.get_volume());
     display.object(Anchor::TOP_RIGHT, 80, 26, Theme::C_ACCENT_EXMUTED, 10, -5, 5);
-    display.text(Anchor::TOP_RIGHT, true, vol_buf, Theme::FONT_MEDIUM, Theme::C_TEXT_PRIMARY, -10, 9);
+    display.text(Widget::VOLUME, Anchor::TOP_RIGHT, true, vol_buf, Theme::FONT_MEDIUM, Theme::C_TEXT_PRIMARY, -10, 9);
 }
 
 void show_menubar(Page active) {
@@ -661,6 +812,17 @@ void show_menubar(Page active) {
     tab(Anchor::BOTTOM_RIGHT,  Page::SETTINGS,  "",   -10, -30);   // Gear Icon
 }
 
+// Thumbnail of the current track, a plain card until the cover task has
+// made it (once per album), then just a blit
+void show_cover() {
+    static char thumb[48];
+
+    if (covers.get(audio.get_audiopath(), thumb, sizeof(thumb)))
+        display.image(Widget::COVER, ImageType::THUMB, thumb, COVER_SIZE, COVER_SIZE, 60, 40);
+    else
+        display.object(Widget::COVER, Anchor::TOP_CENTER, COVER_SIZE, COVER_SIZE, Theme::C_CARD, Theme::R_MEDIUM, 0, 40);
+}
+
 static void notif_timeout(TimerHandle_t xTimer) {
     if (current_page == Page::SETTINGS || current_page == Page::FILES)
         display.object(Anchor::TOP_LEFT, 200, 26, Theme::C_BLACK, 0, 5, 5);
@@ -678,7 +840,7 @@ void show_notification(const char* text, uint16_t color, uint16_t delay_ms) {
     else                width = 115;
 
     display.object(Anchor::TOP_LEFT, width, 26, Theme::C_ACCENT_EXMUTED, 10, 5, 5);
-    display.text(Anchor::TOP_LEFT, true, text, Theme::FONT_MEDIUM, color, 10, 9);
+    display.text(Widget::STATUS, Anchor::TOP_LEFT, true, text, Theme::FONT_MEDIUM, color, 10, 9);
 
     if (delay_ms == 0)
         return;
@@ -755,7 +917,7 @@ void check_keypress(){
             audio.toggle();
             if (current_page == Page::PLAYER){
                 display.object(Anchor::BOTTOM_CENTER, 35, 35, Theme::C_ACCENT_MUTED, -1, 0, -80);
-                display.text(Anchor::BOTTOM_CENTER, true, 
+                display.text(Widget::PLAY, Anchor::BOTTOM_CENTER, true, 
                     audio.get_status() ? "||" : "▶", 
                     Theme::FONT_LARGE, Theme::C_WHITE, 
                     audio.get_status() ? -1 : 2, 
@@ -775,7 +937,7 @@ void check_keypress(){
             
             snprintf(vol_buf, sizeof(vol_buf), "Vol: %-3d%%", audio.get_volume());
             display.object(Anchor::TOP_RIGHT, 80, 26, Theme::C_ACCENT_EXMUTED, 10, -5, 5);
-            display.text(Anchor::TOP_RIGHT, true, vol_buf, Theme::FONT_MEDIUM, Theme::C_TEXT_PRIMARY, -10, 9);
+            display.text(Widget::VOLUME, Anchor::TOP_RIGHT, true, vol_buf, Theme::FONT_MEDIUM, Theme::C_TEXT_PRIMARY, -10, 9);
 
             if (current_page == Page::SETTINGS)
                 display.bar(Anchor::TOP_CENTER, SLIDER_WIDTH, SLIDER_HEIGHT, Theme::C_TEXT_MUTED, Theme::C_ACCENT, 10, 0, 180, current_volume, nullptr);
@@ -791,7 +953,7 @@ void check_keypress(){
             audio.set_volume(current_volume);
             snprintf(vol_buf, sizeof(vol_buf), "Vol: %-3d%%", audio.get_volume());
             display.object(Anchor::TOP_RIGHT, 80, 26, Theme::C_ACCENT_EXMUTED, 10, -5, 5);
-            display.text(Anchor::TOP_RIGHT, true, vol_buf, Theme::FONT_MEDIUM, Theme::C_TEXT_PRIMARY, -10, 9);
+            display.text(Widget::VOLUME, Anchor::TOP_RIGHT, true, vol_buf, Theme::FONT_MEDIUM, Theme::C_TEXT_PRIMARY, -10, 9);
 
             if (current_page == Page::SETTINGS)
                 display.bar(Anchor::TOP_CENTER, SLIDER_WIDTH, SLIDER_HEIGHT, Theme::C_TEXT_MUTED, Theme::C_ACCENT, 10, 0, 180, current_volume, nullptr);
@@ -857,15 +1019,3 @@ String format_elipsis(const String& text, uint8_t length){
     return text.substring(0, front) + ellipsis +
            text.substring(text.length() - back);
 }
-
-bool is_audio_file(const String& f) {
-    return f.endsWith(".mp3") || f.endsWith(".wav") || f.endsWith(".flac") || f.endsWith(".aac");
-}
-
-bool is_image_file(const String& f) {
-    return f.endsWith(".png") || f.endsWith(".jpg") || f.endsWith(".jpeg");
-}
-
-bool is_directory(const String& f) {
-    return f.endsWith("/");
-}
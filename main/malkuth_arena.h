@@ -0,0 +1,154 @@
+#pragma once
+
+#include <Arduino.h>
+#include <atomic>
+
+/// Where a string sits in a MalkuthTextArena and the slot keeping track of it
+struct TextRef {
+    uint16_t offset;
+    uint16_t slot;
+};
+
+/// Strings riding along with display commands, so a command only carries a
+/// 4 byte TextRef instead of a whole buffer.
+/// Producers push under the lock but may send their command after letting
+/// go of it, so commands can reach the queue in another order than their
+/// strings went in. Every push therefore takes the next slot, a string is
+/// done once the display task is finished with its command (or the command
+/// never made it into the queue) and the oldest slots are dropped as soon as
+/// they are all done, in push order. Whoever marks one done moves them on,
+/// without taking the lock.
+class MalkuthTextArena {
+private:
+    struct Slot {
+        uint16_t            from;   // head before the push
+        uint16_t            end;
+        std::atomic<bool>   done;
+    };
+
+    char*                   _data = nullptr;
+    uint16_t                _size = 0;
+    uint16_t                _head = 0;          // producers, under the lock
+
+    Slot*                   _slots      = nullptr;
+    uint16_t                _slot_count = 0;
+    std::atomic<uint16_t>   _slot_head{0};      // producers, under the lock
+    std::atomic<uint16_t>   _slot_tail{0};
+
+    SemaphoreHandle_t       _lock = nullptr;
+
+    // Where the oldest string still in use starts, head if there is none.
+    // Only ever behind the real one, slots are reused under the lock
+    uint16_t tail() const {
+        uint16_t slot = _slot_tail.load();
+        return slot == _slot_head.load(std::memory_order_relaxed) ? _head : _slots[slot].from;
+    }
+
+    // Offset for size contiguous bytes, the end of the ring is skipped when
+    // it is too short. head may never catch up with tail, that means empty
+    bool reserve(uint16_t size, uint16_t& offset) {
+        if ((_slot_head.load(std::memory_order_relaxed) + 1) % _slot_count == _slot_tail.load())
+            return false;
+
+        uint16_t tail = this->tail();
+
+        if (_head >= tail) {
+            if (_head + size < _size || (_head + size == _size && tail != 0)) {
+                offset = _head;
+                return true;
+            }
+            if (size < tail) {
+                offset = 0;
+                return true;
+            }
+            return false;
+        }
+
+        if (_head + size < tail) {
+            offset = _head;
+            return true;
+        }
+        return false;
+    }
+
+    // Drops the oldest slots for as long as they are done
+    void advance() {
+        uint16_t slot = _slot_tail.load();
+
+        while (slot != _slot_head.load() && _slots[slot].done.load()) {
+            if (_slot_tail.compare_exchange_weak(slot, (slot + 1) % _slot_count))
+                slot = (slot + 1) % _slot_count;
+        }
+    }
+
+public:
+    ~MalkuthTextArena() {
+        if (_data) heap_caps_free(_data);
+        if (_lock) vSemaphoreDelete(_lock);
+        delete[] _slots;
+    }
+
+    // slots bounds the strings in flight
+    bool init(uint16_t size, uint16_t slots) {
+        _data  = (char*)heap_caps_malloc(size, MALLOC_CAP_8BIT);
+        _slots = new Slot[slots + 1];
+        _lock  = xSemaphoreCreateMutex();
+        if (!_data || !_lock) return false;
+
+        _size       = size;
+        _head       = 0;
+        _slot_count = slots + 1;
+        _slot_head.store(0);
+        _slot_tail.store(0);
+        return true;
+    }
+
+    void lock()   { xSemaphoreTake(_lock, portMAX_DELAY); }
+    void unlock() { xSemaphoreGive(_lock); }
+
+    // Copies at most max_length characters, waits up to timeout for the
+    // display task to free enough room. Under the lock
+    bool push(const char* string, size_t max_length, TextRef& ref, TickType_t timeout) {
+        size_t length = strnlen(string, max_length);
+        if (length + 1 >= _size) return false;
+
+        uint16_t   size  = length + 1;
+        TickType_t start = xTaskGetTickCount();
+
+        while (!reserve(size, ref.offset)) {
+            if (xTaskGetTickCount() - start >= timeout) return false;
+            vTaskDelay(1);
+        }
+
+        memcpy(_data + ref.offset, string, length);
+        _data[ref.offset + length] = '\0';
+
+        ref.slot = _slot_head.load(std::memory_order_relaxed);
+
+        Slot& slot = _slots[ref.slot];
+        slot.from  = _head;
+        slot.end   = (ref.offset + size) % _size;
+        slot.done.store(false);
+
+        _head = slot.end;
+        _slot_head.store((ref.slot + 1) % _slot_count);
+        return true;
+    }
+
+    // The command never made it into the queue, no lock needed either
+    void cancel(const TextRef& ref) {
+        _slots[ref.slot].done.store(true);
+        advance();
+    }
+
+    // Nothing pushed that isn't done
+    bool empty() const { return _slot_tail.load() == _slot_head.load(); }
+
+    const char* get(const TextRef& ref) const { return _data + ref.offset; }
+
+    // Display task, in whatever order the commands came in
+    void release(const TextRef& ref) {
+        _slots[ref.slot].done.store(true);
+        advance();
+    }
+};
@@ -1,4 +1,5 @@
 #include "malkuth_audio.h"
+#include "malkuth_library.h"
 
 MalkuthAudio* MalkuthAudio::self = nullptr;
 
@@ -9,7 +10,14 @@ bool MalkuthAudio::init(uint8_t pin_bck, uint8_t pin_ws, uint8_t pin_data){
         
     self = this;
 
-    _source     = new AudioSourceVector<FsFile>(&file_to_stream_cb);
+    _player_lock = xSemaphoreCreateRecursiveMutex();
+
+    if (!_ring.init(RING_SIZE, RING_SIZE_FALLBACK)) {
+      Serial.println("Audio ring buffer allocation failed");
+      return false;
+    }
+
+    _source     = new AudioSourceVector<RingBufferStream>(&file_to_stream_cb);
     _player     = new AudioPlayer(*_source, _i2s, _decoder);
 
     config.pin_bck  = pin_bck;
@@ -17,6 +25,7 @@ bool MalkuthAudio::init(uint8_t pin_bck, uint8_t pin_ws, uint8_t pin_data){
     config.pin_data = pin_data;
     config.buffer_size = 1024 * 16;
     config.buffer_count = 6;
+    _i2s.dma.set_capacity(config.buffer_size * config.buffer_count);
 
     _player->setMetadataCallback(&metadata_print_cb);
     _player->getStreamCopy().copyN(5);
@@ -37,9 +46,161 @@ bool MalkuthAudio::init(uint8_t pin_bck, uint8_t pin_ws, uint8_t pin_data){
       Serial.println("I2S failed to start");
       return false;
     }
+
+    xTaskCreate(
+        task_reader,
+        "Malkuth: SD Reader",
+        6144,
+        this,
+        3,
+        &_taskhandle_reader
+    );
+
+    xTaskCreate(
+        task_audio,
+        "Malkuth: Audio",
+        24000,
+        this,
+        2,
+        &_taskhandle_audio
+    );
+
     return true;
 }
 
+void MalkuthAudio::task_audio(void* parameters) {
+    MalkuthAudio* self = static_cast<MalkuthAudio*>(parameters);
+
+    while (true) {
+        self->loop();
+        vTaskDelay(1);
+    }
+}
+
+void MalkuthAudio::task_reader(void* parameters) {
+    MalkuthAudio* self = static_cast<MalkuthAudio*>(parameters);
+
+    while (true) {
+        // Nothing to do (ring full, no track, EOF), sleep until poked or
+        // until the decoder had time to drain some of it
+        if (self->refill() == 0)
+            ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(10));
+    }
+}
+
+size_t MalkuthAudio::refill() {
+    size_t   total    = 0;
+    uint32_t deadline = 0;
+
+    // As long as what's left in the ring lasts, capped at the class default.
+    // Never 0, lock() reads that as the default and an empty ring is the
+    // most urgent refill there is
+    if (_byte_rate) {
+        uint64_t left_ms = (uint64_t)_ring.available() * 1000 / _byte_rate;
+        deadline = left_ms == 0 ? 1 : std::min<uint64_t>(left_ms, SD_DEADLINE_AUDIO_MS);
+    }
+
+    _fs->lock(SdClass::AUDIO, deadline);
+
+    if (_audio_file.isOpen() && !_stream.is_eof() && _ring.space() >= READ_CHUNK) {
+        uint8_t* span;
+        size_t len = std::min(_ring.write_span(&span), READ_CHUNK);
+
+        uint32_t start = MalkuthStageStats::now();
+        int res = _fs->read_extent(_audio_file, _audio_extent, span, len);
+        _stats_read.record_since(start);
+        if (res > 0) {
+            _ring.commit(res);
+            total = res;
+        } else {
+            _stream.set_eof(true);
+        }
+    }
+
+    _fs->unlock();
+
+    if (total == 0 && _stream.is_eof())
+        prefetch();
+
+    return total;
+}
+
+// Runs on the reader once the current track is fully read, so the open and
+// the tag parsing of the next one never land between two tracks
+void MalkuthAudio::prefetch() {
+    if (!_gapless) return;
+
+    _fs->lock(SdClass::AUDIO);
+
+    if (_next_file.isOpen() || _next_index < 0 || _next_index >= (int32_t)_playlist.size()) {
+        _fs->unlock();
+        return;
+    }
+
+    const char* path = _playlist[_next_index].c_str();
+
+    // Non audio entries get skipped by the player the usual way
+    if (!is_audio_path(path) || !_next_file.open(path)) {
+        _next_index = -1;
+        _fs->unlock();
+        return;
+    }
+
+    _next_extent = _fs->get_extent(_next_file);
+
+    if (!_library || !_library->get(path, _next_file, _next_track)) {
+        _next_track = get_metadata(_next_file, path);
+        _next_track.fragmented = !_next_extent.sectors;
+
+        if (_library)
+            _library->put(path, _next_file, _next_track);
+    }
+
+    _next_trim = gapless_trim(_next_file, path, _next_track);
+    strncpy(_next_path, path, sizeof(_next_path) - 1);
+
+    _fs->unlock();
+}
+
+// Where the music actually starts and how long it is, without the encoder
+// delay/padding (MP3) or whatever the last block was padded with (FLAC)
+MalkuthAudio::Trim MalkuthAudio::gapless_trim(FsFile& file, const char* path, const AudioMetadata& metadata) {
+    Trim trim;
+
+    String name = String(path);
+    name.toLowerCase();
+
+    if (name.endsWith(".flac")) {
+        if (metadata.total_samples)
+            trim.length = metadata.total_samples;
+    }
+    else if (name.endsWith(".mp3")) {
+        Mp3SeekInfo info;
+
+        if (mp3_seekinfo(file, info) && info.has_lame && info.frames) {
+            uint64_t total = (uint64_t)info.frames * mp3_sampleframe(info.header);
+
+            // Info frame itself decodes to a frame of silence, skip it
+            trim.start = info.audio_start;
+            trim.skip  = info.delay + MP3_DECODER_DELAY;
+
+            if (total > (uint64_t)info.delay + info.padding)
+                trim.length = total - info.delay - info.padding;
+        }
+    }
+
+    file.seek(0);
+    return trim;
+}
+
+void MalkuthAudio::lock() {
+    xSemaphoreTakeRecursive(_player_lock, portMAX_DELAY);
+}
+
+void MalkuthAudio::unlock() {
+    xSemaphoreGiveRecursive(_player_lock);
+}
+
 void MalkuthAudio::metadata_print_cb(MetaDataType type, const char* str, int len){
     return self->metadata_print(type, str, len);
 }
@@ -51,45 +212,113 @@ void MalkuthAudio::metadata_print(MetaDataType type, const char* str, int len){
     // Serial.println(str);
 }
 
-FsFile* MalkuthAudio::file_to_stream_cb(const char* path, FsFile& old_file){
-    return self->file_to_stream(path, old_file);
-}
-
-FsFile* MalkuthAudio::file_to_stream(const char* path, FsFile& old_file){
-    if (old_file.isOpen()) {
-      old_file.close();
-    }
-    reset();
-
+bool MalkuthAudio::is_audio_path(const char* path) {
     String path_str = String(path);
     String filename = path_str.substring(path_str.lastIndexOf('/') + 1);
     filename.toLowerCase();
 
     const char* file_extension[] = { ".mp3", ".flac", ".wav" };
-    bool is_supported = false;
     
     for (const char* ext : file_extension) {
-      if (filename.endsWith(ext)) {
-        is_supported = true;
-        break;
-      }
+      if (filename.endsWith(ext))
+        return true;
     }
 
+    return false;
+}
+
+RingBufferStream* MalkuthAudio::file_to_stream_cb(const char* path, RingBufferStream& old_file){
+    return self->file_to_stream(path, old_file);
+}
+
+// Runs on the audio task (inside _player), holding the card for the whole
+// switch also means the reader can't be halfway through a refill while the
+// ring gets thrown away
+RingBufferStream* MalkuthAudio::file_to_stream(const char* path, RingBufferStream& old_file){
+    (void)old_file;
+
+    _fs->lock(SdClass::AUDIO);
+
+    // Same track coming back for a seek, the UI has nothing new to show
+    bool seeking = _seek_percent >= 0.0f && strcmp(path, _current_audiopath) == 0;
+    bool update  = _please_update;
+
+    if (_audio_file.isOpen()) {
+      _audio_file.close();
+    }
+    _ring.reset();
+    _stream.begin(&_ring);
+
+    reset();
+    if (seeking) _please_update = update;
+
+    _source->setTimeoutAutoNext(TIMEOUT_AUTONEXT);
+
+    _next_index = -1;
+    for (size_t i = 0; i < _playlist.size(); i++) {
+        if (_playlist[i] == path) {
+            _next_index = i + 1;
+            break;
+        }
+    }
+
+    bool prefetched = _next_file.isOpen() && strcmp(path, _next_path) == 0;
+    if (!prefetched && _next_file.isOpen())
+        _next_file.close();
+
     // Skipping non audio file (trick)
-    if (!is_supported) {
-        _audio_file.open("");
+    if (!is_audio_path(path)) {
+        _stream.set_eof(true);
         _current_track.title  = "";
         _current_track.artist = "";
         _current_track.album  = "";
         _not_a_music = true;
-        return &_audio_file;
+
+        _fs->unlock();
+        return &_stream;
+    }
+
+    Trim trim;
+
+    if (prefetched) {
+        _audio_file     = _next_file;
+        _audio_extent   = _next_extent;
+        _current_track  = _next_track;
+        trim            = _next_trim;
+        _next_file.close();
     }
+    else {
+        if (!_audio_file.open(path)) {
+            _stream.set_eof(true);
+            _current_track.title  = "";
+            _current_track.artist = "";
+            _current_track.album  = "";
+            _not_a_music = true;
+
+            _fs->unlock();
+            return &_stream;
+        }
+
+        _audio_extent = _fs->get_extent(_audio_file);
 
-    FsFile meta_file;
+        // Library hit is one record read, otherwise parse the tags once from
+        // the very same handle and remember them for next time
+        if (!_library || !_library->get(path, _audio_file, _current_track)) {
+            _current_track = get_metadata(_audio_file, path);
+            _current_track.fragmented = !_audio_extent.sectors;
 
-    if (meta_file.open(path)) {
-        _current_track = get_metadata(meta_file, path);
-        meta_file.close();
+            if (_library)
+                _library->put(path, _audio_file, _current_track);
+        }
+
+        if (_gapless)
+            trim = gapless_trim(_audio_file, path, _current_track);
+    }
+
+    // A seek does its own positioning
+    if (!seeking || !seek(_seek_percent, trim)) {
+        _audio_file.seek(trim.start);
+        _i2s.trim(trim.skip, trim.length);
     }
 
     if (_current_track.title.isEmpty())  
@@ -102,18 +331,15 @@ FsFile* MalkuthAudio::file_to_stream(const char* path, FsFile& old_file){
     if (_current_track.album.isEmpty())  
         _current_track.album   = "Unknown Album";
 
-    if (!_audio_file.open(path)) {
-        _audio_file.open("");
-        _current_track.title  = "";
-        _current_track.artist = "";
-        _current_track.album  = "";
-        _not_a_music = true;
-      return &_audio_file;
-    }
-
     strncpy(_current_audiopath, path, sizeof(_current_audiopath));
     _not_a_music = false;
-    return &_audio_file;
+
+    _byte_rate = _current_track.duration > 0 ? _audio_file.size() / _current_track.duration : 0;
+
+    _fs->unlock();
+    xTaskNotifyGive(_taskhandle_reader);
+
+    return &_stream;
 }
 
 AudioMetadata MalkuthAudio::get_metadata_flac_vorbis(FsFile& file, uint32_t size) { 
@@ -184,7 +410,11 @@ AudioMetadata MalkuthAudio::get_metadata_flac(FsFile& file) {
         metadata.total_samples = total_samples;
         metadata.sample_rate  = sample_rate;
       } else if (block_type == 4) {
-        metadata = get_metadata_flac_vorbis(file, block_size);
+        AudioMetadata tags = get_metadata_flac_vorbis(file, block_size);
+
+        metadata.title    = tags.title;
+        metadata.artist   = tags.artist;
+        metadata.album    = tags.album;
         metadata.duration = temp_duration;
         return metadata;
       } else {
@@ -197,6 +427,166 @@ AudioMetadata MalkuthAudio::get_metadata_flac(FsFile& file) {
     return metadata;
 }
 
+// MalkuthFlac finds the frame, the decoder is restarted right on it
+bool MalkuthAudio::seek_flac(float percent, const Trim& trim) {
+    MalkuthFlac::StreamInfo             info;
+    std::vector<MalkuthFlac::SeekPoint> table;
+
+    if (!MalkuthFlac::streaminfo(_audio_file, info, table) || info.total_samples == 0)
+        return false;
+
+    uint64_t target = (uint64_t)(info.total_samples * percent);
+    if (target >= info.total_samples) target = info.total_samples - 1;
+
+    uint64_t offset, sample;
+    if (!MalkuthFlac::locate(_audio_file, info, table, target, offset, sample))
+        return false;
+
+    // The decoder wants to see a stream start, so hand it the header again
+    // and continue straight from the frame
+    static const uint8_t header[8] = { 'f', 'L', 'a', 'C', 0x80, 0x00, 0x00, 0x22 };
+    _ring.write(header, sizeof(header));
+    _ring.write(info.raw, sizeof(info.raw));
+
+    _audio_file.seek(offset);
+    _i2s.seekTo(target, target - sample, trim.length);
+
+    return true;
+}
+
+// Straight to a byte offset, then onto the next real frame header. Helix
+// doesn't care where the stream starts as long as it's on a frame
+bool MalkuthAudio::seek_mp3(float percent, const Trim& trim) {
+    Mp3SeekInfo info;
+    if (!mp3_seekinfo(_audio_file, info)) return false;
+
+    uint32_t size         = _audio_file.size();
+    uint32_t target       = info.audio_start;
+    int      sample_frame = mp3_sampleframe(info.header);
+
+    // Frames into the track, Xing and VBRI both go by time
+    uint64_t frame        = info.frames ? (uint64_t)(info.frames * percent)
+                                        : (uint64_t)(_current_track.duration * percent * mp3_samplerate(info.header)) / sample_frame;
+
+    if (info.mode == Mp3SeekInfo::Mode::XING) {
+        // TOC entry n is where n percent of the file starts, in 1/256 of it
+        float    fa    = percent * 100.0f;
+        int      a     = constrain((int)fa, 0, 99);
+        float    fb    = info.toc[a];
+        float    fc    = a < 99 ? info.toc[a + 1] : 256.0f;
+        float    fx    = fb + (fc - fb) * (fa - a);
+        uint32_t bytes = info.bytes ? info.bytes : size - info.first_frame;
+
+        target = info.first_frame + (uint32_t)(fx / 256.0f * bytes);
+    }
+    else if (info.mode == Mp3SeekInfo::Mode::VBRI) {
+        // Every entry covers the same amount of time
+        float fa = percent * info.vbri.size();
+        int   a  = constrain((int)fa, 0, (int)info.vbri.size() - 1);
+
+        target = info.audio_start;
+        for (int i = 0; i < a; i++)
+            target += info.vbri[i];
+        target += (uint32_t)(info.vbri[a] * (fa - a));
+    }
+    else {
+        // Constant size frames, the padding bit only moves it by a byte
+        int      sample_rate  = mp3_samplerate(info.header);
+        int      bitrate      = mp3_bitrate(info.header);
+        float    frame_bytes  = bitrate ? (float)(sample_frame / 8) * bitrate / sample_rate : 0.0f;
+
+        if (frame_bytes > 0.0f) {
+            uint32_t frames = (size - info.audio_start) / frame_bytes;
+            frame  = (uint32_t)(frames * percent);
+            target = info.audio_start + (uint32_t)(frame * frame_bytes);
+        } else {
+            target = info.audio_start + (uint32_t)((size - info.audio_start) * percent);
+        }
+    }
+
+    uint32_t offset;
+    if (target >= size || !mp3_resync(_audio_file, target, info.header, offset))
+        return false;
+
+    // From the top the first trim.skip decoded samples are delay, the
+    // padding stays put at the end and seekTo still cuts it off
+    uint64_t decoded = frame * sample_frame;
+    uint64_t sample  = decoded > trim.skip ? decoded - trim.skip : 0;
+
+    _audio_file.seek(offset);
+    _i2s.seekTo(sample, 0, trim.length);
+
+    return true;
+}
+
+// PCM only needs the byte offset rounded down to a whole frame. The
+// decoder still wants a header first, it gets a plain 44 byte one covering
+// whatever is left of the data chunk
+bool MalkuthAudio::seek_wav(float percent, const Trim& trim) {
+    char     id[4];
+    uint32_t size;
+    uint8_t  fmt[16];
+    bool     has_fmt = false;
+
+    _audio_file.seek(0);
+    if (_audio_file.read(id, 4) != 4 || strncmp(id, "RIFF", 4)) return false;
+
+    _audio_file.seek(12);
+    while (_audio_file.read(id, 4) == 4 && _audio_file.read(&size, 4) == 4) {
+        if (strncmp(id, "fmt ", 4) == 0 && size >= 16) {
+            if (_audio_file.read(fmt, 16) != 16) return false;
+            _audio_file.seek(_audio_file.position() + size - 16 + (size & 1));
+            has_fmt = true;
+            continue;
+        }
+
+        if (strncmp(id, "data", 4) != 0) {
+            _audio_file.seek(_audio_file.position() + size + (size & 1));
+            continue;
+        }
+
+        if (!has_fmt) return false;
+
+        uint16_t format      = fmt[0] | (fmt[1] << 8);
+        uint16_t block_align = fmt[12] | (fmt[13] << 8);
+        if (format != 1 || block_align == 0) return false;
+
+        uint64_t data_offset = _audio_file.position();
+        uint64_t frames      = std::min<uint64_t>(size, _audio_file.size() - data_offset) / block_align;
+        uint64_t target      = std::min<uint64_t>((uint64_t)(frames * percent), frames);
+        uint32_t left        = (frames - target) * block_align;
+
+        uint8_t  header[44];
+        uint32_t riff_size = 36 + left, fmt_size = 16;
+
+        memcpy(header,      "RIFF", 4);
+        memcpy(header + 4,  &riff_size, 4);
+        memcpy(header + 8,  "WAVEfmt ", 8);
+        memcpy(header + 16, &fmt_size, 4);
+        memcpy(header + 20, fmt, 16);
+        memcpy(header + 36, "data", 4);
+        memcpy(header + 40, &left, 4);
+        _ring.write(header, sizeof(header));
+
+        _audio_file.seek(data_offset + target * block_align);
+        _i2s.seekTo(target, 0, trim.length);
+        return true;
+    }
+
+    return false;
+}
+
+bool MalkuthAudio::seek(float percent, const Trim& trim) {
+    String ext = String(_current_audiopath);
+    ext.toLowerCase();
+
+    if (ext.endsWith(".flac")) return seek_flac(percent, trim);
+    if (ext.endsWith(".mp3"))  return seek_mp3(percent, trim);
+    if (ext.endsWith(".wav"))  return seek_wav(percent, trim);
+
+    return false;
+}
+
 AudioMetadata MalkuthAudio::get_metadata_mp3v1(FsFile& file) {
     AudioMetadata metadata;
 
@@ -223,24 +613,12 @@ AudioMetadata MalkuthAudio::get_metadata_mp3v1(FsFile& file) {
     return metadata;
 }
 
+// v2.4 footer included
 bool MalkuthAudio::mp3_id3skip(FsFile& file) {
-    file.seek(0);
-    uint8_t hdr[10];
-    if (file.read(hdr, 10) != 10) return false;
-
-    if (memcmp(hdr, "ID3", 3) != 0) {
-        file.seek(0);
-        return false;
-    }
+    uint32_t size = MalkuthId3::tag_size(file);
 
-    uint32_t size =
-        ((hdr[6] & 0x7F) << 21) |
-        ((hdr[7] & 0x7F) << 14) |
-        ((hdr[8] & 0x7F) << 7)  |
-        (hdr[9] & 0x7F);
-
-    file.seek(10 + size);
-    return true;
+    file.seek(size);
+    return size > 0;
 }
 
 bool MalkuthAudio::mp3_frameheader(FsFile& file, uint32_t& hdr) {
@@ -283,19 +661,37 @@ int MalkuthAudio::mp3_xing_offset(uint32_t hdr) {
         return mono ? 13 : 21;
 }
 
-float MalkuthAudio::get_metadata_mp3_duration(FsFile& file) {
+int MalkuthAudio::mp3_framelength(uint32_t hdr) {
+    int bitrate     = mp3_bitrate(hdr);
+    int sample_rate = mp3_samplerate(hdr);
+    int padding     = (hdr >> 9) & 1;
+
+    if (!bitrate || !sample_rate) return 0;
+
+    return (mp3_sampleframe(hdr) / 8 * bitrate) / sample_rate + padding;
+}
+
+// First frame and its Xing / Info or VBRI header, the tables are kept so
+// seeking doesn't have to come back here
+bool MalkuthAudio::mp3_seekinfo(FsFile& file, Mp3SeekInfo& info) {
     mp3_id3skip(file);
 
     uint32_t hdr;
-    if (!mp3_frameheader(file, hdr)) return -1;
+    if (!mp3_resync(file, file.curPosition(), 0, info.first_frame)) return false;
 
-    int sample_rate  = mp3_samplerate(hdr);
-    int sample_frame = mp3_sampleframe(hdr);
-    if (!sample_rate) return -1;
+    file.seek(info.first_frame);
+    if (!mp3_frameheader(file, hdr) || !mp3_samplerate(hdr)) return false;
+
+    info.header      = hdr;
+    info.audio_start = info.first_frame;
+    info.mode        = Mp3SeekInfo::Mode::CBR;
+    info.frames      = 0;
+    info.bytes       = 0;
+    info.has_lame    = false;
+    info.vbri.clear();
 
     // ---- Xing / Info ----
-    int off = mp3_xing_offset(hdr);
-    file.seek(file.curPosition() + off);
+    file.seek(info.first_frame + 4 + mp3_xing_offset(hdr));
 
     char tag[4];
     file.read(tag, 4);
@@ -306,44 +702,132 @@ float MalkuthAudio::get_metadata_mp3_duration(FsFile& file) {
         flags = __builtin_bswap32(flags);
 
         if (flags & 0x01) {
-            uint32_t frames;
-            file.read(&frames, 4);
-            frames = __builtin_bswap32(frames);
+            file.read(&info.frames, 4);
+            info.frames = __builtin_bswap32(info.frames);
+        }
+        if (flags & 0x02) {
+            file.read(&info.bytes, 4);
+            info.bytes = __builtin_bswap32(info.bytes);
+        }
+        if ((flags & 0x04) && file.read(info.toc, 100) == 100) {
+            info.mode = Mp3SeekInfo::Mode::XING;
+        }
+        if (flags & 0x08) {
+            file.seek(file.curPosition() + 4);
+        }
 
-            return (float)(frames * sample_frame) / sample_rate;
+        // LAME tag right after, the one with the encoder delay and padding
+        uint8_t lame[24];
+        if (file.read(lame, 24) == 24 &&
+            (!memcmp(lame, "LAME", 4) || !memcmp(lame, "Lavc", 4) || !memcmp(lame, "Lavf", 4))
+        ){
+            info.has_lame = true;
+            info.delay    = (lame[21] << 4) | (lame[22] >> 4);
+            info.padding  = ((lame[22] & 0x0F) << 8) | lame[23];
         }
+
+        info.audio_start = info.first_frame + mp3_framelength(hdr);
+        return true;
     }
 
-    // ---- VBRI ----
-    file.seek(file.curPosition() + 32);
+    // ---- VBRI (always 32 bytes after the header) ----
+    file.seek(info.first_frame + 36);
     file.read(tag, 4);
 
     if (!memcmp(tag, "VBRI", 4)) {
-        file.seek(file.curPosition() + 10);
-        uint32_t frames;
-        file.read(&frames, 4);
-        frames = __builtin_bswap32(frames);
+        uint8_t vbri[22];
+        if (file.read(vbri, 22) != 22) return true;
+
+        info.bytes    = ((uint32_t)vbri[6]  << 24) | (vbri[7]  << 16) | (vbri[8]  << 8) | vbri[9];
+        info.frames   = ((uint32_t)vbri[10] << 24) | (vbri[11] << 16) | (vbri[12] << 8) | vbri[13];
+
+        uint16_t entries    = (vbri[14] << 8) | vbri[15];
+        uint16_t scale      = (vbri[16] << 8) | vbri[17];
+        uint16_t entry_size = (vbri[18] << 8) | vbri[19];
+
+        if (entries > 0 && entry_size >= 1 && entry_size <= 4) {
+            info.vbri.reserve(entries);
+
+            uint8_t entry[4];
+            for (uint16_t i = 0; i < entries; i++) {
+                if (file.read(entry, entry_size) != entry_size) break;
+
+                uint32_t value = 0;
+                for (int b = 0; b < entry_size; b++)
+                    value = (value << 8) | entry[b];
+                info.vbri.push_back(value * scale);
+            }
+
+            if (info.vbri.size() == entries)
+                info.mode = Mp3SeekInfo::Mode::VBRI;
+        }
+
+        info.audio_start = info.first_frame + mp3_framelength(hdr);
+    }
+
+    return true;
+}
+
+// Next header that looks like the stream's first one, and is followed by
+// another one exactly a frame later (a lone 0xFFE is too easy to hit)
+bool MalkuthAudio::mp3_resync(FsFile& file, uint32_t from, uint32_t header, uint32_t& offset) {
+    static constexpr uint32_t MASK   = 0xFFFE0C00;  // sync, version, layer, sample rate
+    static constexpr size_t   CHUNK  = 512;
+    static constexpr uint32_t WINDOW = 1024 * 16;
+
+    uint8_t buf[CHUNK + 4];
+
+    for (uint32_t pos = from; pos < from + WINDOW; pos += CHUNK) {
+        file.seek(pos);
+        int got = file.read(buf, sizeof(buf));
+        if (got < 4) return false;
+
+        for (size_t i = 0; i < CHUNK && i + 4 <= (size_t)got; i++) {
+            if (buf[i] != 0xFF || (buf[i + 1] & 0xE0) != 0xE0) continue;
+
+            uint32_t hdr = (buf[i] << 24) | (buf[i + 1] << 16) | (buf[i + 2] << 8) | buf[i + 3];
+            if (header && (hdr & MASK) != (header & MASK)) continue;
+
+            int length = mp3_framelength(hdr);
+            if (length <= 4) continue;
+
+            uint32_t next;
+            file.seek(pos + i + length);
+            if (!mp3_frameheader(file, next) || (next & MASK) != (hdr & MASK)) continue;
 
-        return (float)(frames * sample_frame) / sample_rate;
+            offset = pos + i;
+            return true;
+        }
     }
 
+    return false;
+}
+
+float MalkuthAudio::get_metadata_mp3_duration(FsFile& file) {
+    Mp3SeekInfo info;
+    if (!mp3_seekinfo(file, info)) return -1;
+
+    uint32_t hdr     = info.header;
+    int sample_rate  = mp3_samplerate(hdr);
+    int sample_frame = mp3_sampleframe(hdr);
+
+    // ---- Xing / Info / VBRI ----
+    if (info.frames)
+        return (float)((uint64_t)info.frames * sample_frame) / sample_rate;
+
     // ---- CBR fallback ----
     int bitrate = mp3_bitrate(hdr);
     if (bitrate > 0) {
-        return (float)file.size() * 8.0f / bitrate;
+        return (float)(file.size() - info.audio_start) * 8.0f / bitrate;
     }
 
-    file.seek(0);
-    mp3_id3skip(file);
+    file.seek(info.audio_start);
 
     uint32_t count = 0;
     while (mp3_frameheader(file, hdr)) {
-        int br = mp3_bitrate(hdr);
-        int sr = mp3_samplerate(hdr);
-        if (!br || !sr) break;
+        int frameLen = mp3_framelength(hdr);
+        if (!frameLen) break;
 
-        int padding = (hdr >> 9) & 1;
-        int frameLen = (144 * br) / sr + padding;
         file.seek(file.curPosition() + frameLen - 4);
         count++;
     }
@@ -351,114 +835,16 @@ float MalkuthAudio::get_metadata_mp3_duration(FsFile& file) {
     return (float)(count * sample_frame) / sample_rate;
 }
 
-// Idk what does it do exactly, but basically just extract metadata
+// Tags are parsed into fixed buffers on the stack, the Strings are only
+// made once at the end
 AudioMetadata MalkuthAudio::get_metadata_mp3(FsFile& file) {
-    AudioMetadata metadata;
-
-    file.seek(0);
-    char header[10];
-    if (file.read(header, 10) != 10 || strncmp(header, "ID3", 3)) {
-      metadata.duration = get_metadata_mp3_duration(file);
-      return metadata;
-    }
-
-    uint32_t tagsize = ((header[6] & 0x7F) << 21) | ((header[7] & 0x7F) << 14) | ((header[8] & 0x7F) << 7) | (header[9] & 0x7F);
-
-    size_t pos = 10;
-    while (pos < tagsize + 10 && pos + 10 < file.size()) {
-      char frame[4];
-      if (file.read((uint8_t*)frame, 4) != 4 || frame[0] == 0) break;
-
-      uint32_t fsize;
-      file.read(&fsize, 4);
-      fsize = __builtin_bswap32(fsize);
-      file.seek(file.position() + 2);  // skip flags
-
-      if (fsize > 512) {
-        pos += 10 + fsize;
-        file.seek(pos);
-        continue;
-      }
-
-      char* data = new char[fsize + 1];
-      file.read((char*)data, fsize);
-      data[fsize] = 0;
-
-      uint8_t enc_byte = (uint8_t)data[0];
-      int enc = enc_byte;
-      char* text_start = data + 1;
-      size_t avail_bytes = fsize - 1;
-      bool little_endian = false;
-      if (enc == 1 && avail_bytes >= 2) {
-        uint8_t bom1 = (uint8_t)text_start[0];
-        uint8_t bom2 = (uint8_t)text_start[1];
-        if ((bom1 == 0xFF && bom2 == 0xFE) || (bom1 == 0xFE && bom2 == 0xFF)) {
-          little_endian = (bom2 == 0xFE);
-          text_start += 2;
-          avail_bytes -= 2;
-        }
-      }
-
-      size_t text_bytes;
-      if (enc == 3) {
-        text_bytes = avail_bytes;
-      } else {
-        int unit_size = (enc == 0) ? 1 : 2;
-        size_t num_units = avail_bytes / unit_size;
-        size_t units_to_term = 0;
-        const uint8_t* p = (const uint8_t*)text_start;
-        if (unit_size == 1) {
-          while (units_to_term < num_units && p[units_to_term] != 0) ++units_to_term;
-        } else {
-          while (units_to_term < num_units && (p[2 * units_to_term] != 0 || p[2 * units_to_term + 1] != 0)) ++units_to_term;
-        }
-        text_bytes = units_to_term * unit_size;
-      }
-
-      String value;
-      if (enc == 3) {
-        value = String(text_start, text_bytes);
-      } else if (enc == 0) {
-        value = "";
-        const uint8_t* p = (const uint8_t*)text_start;
-        for (size_t i = 0; i < text_bytes; ++i) {
-          uint32_t ch = p[i];
-          if (ch == 0) break;
-          if (ch < 128) {
-            value += (char)ch;
-          } else {
-            value += (char)(0xC0 | (ch >> 6));
-            value += (char)(0x80 | (ch & 0x3F));
-          }
-        }
-      } else {  // UTF-16 (enc 1 or 2)
-        value = "";
-        const uint8_t* p = (const uint8_t*)text_start;
-        for (size_t i = 0; i < text_bytes / 2; ++i) {
-          uint8_t b1 = p[2 * i];
-          uint8_t b2 = p[2 * i + 1];
-          uint16_t ch = little_endian ? (b2 << 8 | b1) : (b1 << 8 | b2);
-          if (ch == 0) break;
-          if (ch < 0x80) {
-            value += (char)ch;
-          } else if (ch < 0x800) {
-            value += (char)(0xC0 | (ch >> 6));
-            value += (char)(0x80 | (ch & 0x3F));
-          } else {
-            value += (char)(0xE0 | (ch >> 12));
-            value += (char)(0x80 | ((ch >> 6) & 0x3F));
-            value += (char)(0x80 | (ch & 0x3F));
-          }
-        }
-      }
+    AudioMetadata    metadata;
+    MalkuthId3::Tags tags;
 
-      if      (strncmp(frame, "TIT2", 4) == 0) metadata.title  = value;
-      else if (strncmp(frame, "TPE1", 4) == 0) metadata.artist = value;
-      else if (strncmp(frame, "TALB", 4) == 0) metadata.album  = value;
-
-      delete[] data;
-      pos += 10 + fsize;
-      file.seek(pos);
+    if (MalkuthId3::read_tags(file, tags)) {
+        if (tags.title[0])  metadata.title  = tags.title;
+        if (tags.artist[0]) metadata.artist = tags.artist;
+        if (tags.album[0])  metadata.album  = tags.album;
     }
 
     metadata.duration = get_metadata_mp3_duration(file);
@@ -547,7 +933,11 @@ AudioMetadata MalkuthAudio::get_metadata(FsFile& file, const char* path){
 }
 
 AudioMetadata MalkuthAudio::get_metadata(){
-    return _current_track;
+    lock();
+    AudioMetadata metadata = _current_track;
+    unlock();
+
+    return metadata;
 }
 
 void MalkuthAudio::reset(){
@@ -559,21 +949,51 @@ void MalkuthAudio::reset(){
     _current_track.title.clear();
     _current_track.album.clear();
     _current_track.duration = 0;
-    
-    memset(_cover_path, 0, sizeof(_cover_path));
 }
 
 size_t MalkuthAudio::loop() {
-    // return _copier->copy();
-    return _player->copy();
+    lock();
+
+    // Everything is in the ring already, so once it runs dry there's nothing
+    // to wait for and no reason to fade, the next file is open by now
+    if (_gapless && !_end_of_track && _stream.is_eof()) {
+        _end_of_track = true;
+        _player->setAutoFade(false);
+        _source->setTimeoutAutoNext(GAPLESS_TIMEOUT);
+    }
+    else if (_end_of_track && !_stream.is_eof()) {
+        _end_of_track = false;
+        _player->setAutoFade(true);
+    }
+
+    // Decoding is whatever of the copy wasn't spent in CustomI2S
+    uint64_t output = _i2s.stats_convert.total() + _i2s.stats_write.total();
+    uint32_t start  = MalkuthStageStats::now();
+
+    size_t res = _player->copy();
+
+    uint32_t copy = MalkuthStageStats::now() - start;
+    output = _i2s.stats_convert.total() + _i2s.stats_write.total() - output;
+
+    if (res > 0)
+        _stats_decode.record(copy > output ? copy - output : 0);
+    unlock();
+
+    return res;
 }
 
 size_t MalkuthAudio::loop_all() {
-    return _player->copyAll();
+    lock();
+    size_t res = _player->copyAll();
+    unlock();
+
+    return res;
 }
 
 void MalkuthAudio::toggle(bool active) {
+  lock();
   if (!active) {
+    _i2s.dma.restart();
     _player->play();
     _playing = true;
   }
@@ -581,10 +1001,13 @@ void MalkuthAudio::toggle(bool active) {
     _player->stop();
     _playing = false;
   }
+  unlock();
 }
 
 void MalkuthAudio::toggle() {
+  lock();
   if (!_playing) {
+    _i2s.dma.restart();
     _player->play();
     _playing = true;
   }
@@ -592,29 +1015,96 @@ void MalkuthAudio::toggle() {
     _player->stop();
     _playing = false;
   }
+  unlock();
 }
 
 void MalkuthAudio::next() {
+    lock();
     _player->next(); 
+    unlock();
 }
 
 void MalkuthAudio::previous() {
+    lock();
     _player->previous(); 
+    unlock();
 }
 
 uint8_t MalkuthAudio::get_volume() {
     return _volume;
 }
 
+int32_t MalkuthAudio::get_gain() {
+    return _i2s.gain.get();
+}
+
+AudioProfile MalkuthAudio::get_profile() {
+    AudioProfile profile;
+
+    lock();
+    AudioInfo info = _i2s.audioInfo();
+
+    profile.sample_rate = info.sample_rate;
+    profile.bits        = _i2s.sourceBits();
+    profile.channels    = info.channels;
+
+    if (info.sample_rate > 0)
+        profile.seconds = (float)_i2s.frames_out / info.sample_rate;
+
+    if (profile.seconds > 0.0f) {
+        profile.read    = MalkuthStageStats::to_us(_stats_read.total())         / profile.seconds;
+        profile.decode  = MalkuthStageStats::to_us(_stats_decode.total())       / profile.seconds;
+        profile.convert = MalkuthStageStats::to_us(_i2s.stats_convert.total())  / profile.seconds;
+        profile.write   = MalkuthStageStats::to_us(_i2s.stats_write.total())    / profile.seconds;
+    }
+    unlock();
+
+    return profile;
+}
+
+void MalkuthAudio::reset_profile() {
+    lock();
+    _stats_read.reset();
+    _stats_decode.reset();
+    _i2s.stats_convert.reset();
+    _i2s.stats_write.reset();
+    _i2s.dma.reset();
+    _i2s.frames_out = 0;
+    unlock();
+}
+
+void MalkuthAudio::print_stats(Print& out, bool csv) {
+    const MalkuthStageStats* stages[] = { &_stats_read, &_stats_decode, &_i2s.stats_convert, &_i2s.stats_write };
+
+    lock();
+    if (csv) {
+        MalkuthStageStats::print_csv_header(out);
+        for (auto* stage : stages)
+            stage->print_csv(out);
+        _i2s.dma.print_csv(out);
+    } else {
+        for (auto* stage : stages)
+            stage->print(out);
+        _i2s.dma.print(out);
+    }
+    unlock();
+}
+
 bool MalkuthAudio::get_status(){
-    if (_player->isActive())
-        return true;
-    else
-        return false;
+    lock();
+    bool active = _player->isActive();
+    unlock();
+
+    return active;
 }
 
-void MalkuthAudio::set_sdfs(SdFs& sd){
-    _sd = &sd;
+void MalkuthAudio::set_filesystem(MalkuthFs& fs){
+    _fs = &fs;
+    _sd = &fs.get_sdfs();
+}
+
+void MalkuthAudio::set_library(MalkuthLibrary& library){
+    _library = &library;
 }
 
 void MalkuthAudio::set_volume(uint8_t percent){
@@ -623,56 +1113,83 @@ void MalkuthAudio::set_volume(uint8_t percent){
 
     _volume = percent;
 
-    float real_percent = (float)_volume / 100.0f;
-    _player->setVolume(real_percent);
+    // The player stays at unity, the gain stage in front of I2S does the
+    // scaling in fixed point
+    lock();
+    _player->setVolume(1.0f);
+    _i2s.gain.set_percent(_volume);
+    unlock();
+}
+
+void MalkuthAudio::set_gapless(bool gapless){
+    lock();
+    _gapless = gapless;
+
+    if (!_gapless) {
+        _fs->lock();
+        if (_next_file.isOpen())
+            _next_file.close();
+        _fs->unlock();
+    }
+    unlock();
 }
 
 void MalkuthAudio::set_path(const char* path){
+    lock();
     _player->setPath(path);
+    unlock();
 }
 
 void MalkuthAudio::set_index(int16_t index){
+    lock();
     _player->setIndex(index);
+    unlock();
 }
 
 void MalkuthAudio::process_directory(const char* path){
+    lock();
+
     _player->stop();
     _source->clear();
 
-    // SdFile dir;
-    // SdFile entry;
-
-    // dir.open(path);
+    // Good moment to fold whatever got indexed in the last directory
+    if (_library)
+        _library->flush();
 
-    // _image_type = ImageType::NONE;
-    // while (entry.openNext(&dir, O_RDONLY)){
-    //     char filename[256];
+    _fs->lock();
 
-    //     entry.getName(filename, sizeof(filename));
+    _playlist.clear();
+    _next_index = -1;
+    if (_next_file.isOpen())
+        _next_file.close();
 
-    //     String full_path = String(path) + String(filename);
+    String prefix = path;
+    if (!prefix.endsWith("/")) prefix += "/";
 
-    //     process_albumcover(full_path);
-    //     entry.close();
-    // }
+    // Directories stay in so the indices line up with the Files page
+    bool found = _fs->for_each_entry(path, MalkuthFs::BROWSE_ORDER, [&](const DirEntry& entry) {
+        String item = prefix + entry.name;
+        if (entry.type == EntryType::DIRECTORY) item += "/";
 
-    // dir.close();
-    NamePrinter directory = NamePrinter(*_source, path);
+        _source->addName(item.c_str());
+        _playlist.push_back(item);
+        return true;
+    });
+    _fs->unlock();
 
-    _audio_file = _sd->open(path, O_READ);
-    if (!_audio_file) {
+    if (!found) {
+        unlock();
         return;
     }
 
-    _audio_file.ls(&directory, LS_A);
-    _audio_file.close();
-
     if (!_player->begin()){
       Serial.println("Player failed to start");
+      unlock();
       return;      
     }
 
     set_volume(_volume);
+    unlock();
 }
 
 bool MalkuthAudio::get_update(){
@@ -687,18 +1204,10 @@ void MalkuthAudio::yeah_i_have_updated(){
     _please_update = false;
 }
 
-char* MalkuthAudio::get_coverpath(){
-    return _cover_path;
-}
-
 char* MalkuthAudio::get_audiopath(){
     return _current_audiopath;
 }
 
-ImageType MalkuthAudio::get_covertype(){
-    return _image_type;
-}
-
 char* MalkuthAudio::get_file_extension(){
     String filename = String(_current_audiopath);
     if (filename.endsWith(".mp3"))        return "mp3";
@@ -707,69 +1216,31 @@ char* MalkuthAudio::get_file_extension(){
     else return "Not supported";
 }
 
+// Reselecting the current index makes the player restart the decoder the
+// same way it does on a track change, file_to_stream does the actual seek
 void MalkuthAudio::set_position(uint8_t percent){
-    // TODO : Audio PLayback
-    // if (_not_a_music) return;
-    // if (percent > 100) percent = 100;
+    if (_not_a_music) return;
+    if (percent > 100) percent = 100;
 
-    // String ext = String(_current_audiopath);
-    // ext.toLowerCase();
-    // if (!ext.endsWith(".flac")) return;
+    lock();
 
-    // if (_current_track.duration <= 0.0f) return;
-
-    // float targetSeconds = (_current_track.duration * percent) / 100.0f;
-    // uint32_t data_start = _current_track.data_offset;
-    // uint32_t file_size  = _audio_file.size();
-
-    // if (file_size <= data_start) return;
-
-    // float bytesPerSecond = (float)(file_size - data_start) / _current_track.duration;
-
-    // uint32_t targetByte = data_start + (uint32_t)(bytesPerSecond * targetSeconds);
+    if (_current_track.duration <= 0.0f) {
+        unlock();
+        return;
+    }
 
-    // if (targetByte >= file_size)
-    //     targetByte = file_size - 1;
+    bool playing   = _playing;
+    _seek_percent  = percent / 100.0f;
 
-    // _player->stop();
-    // _i2s.resetBytesWritten();
+    _player->setIndex(_source->index());
+    if (!playing) _player->stop();
 
-    // _audio_file.seek(targetByte);
-    // _decoder_flac.flush();
+    _seek_percent  = -1.0f;
 
-    // _player->play();
+    unlock();
 }
 
 
 bool MalkuthAudio::is_actually_audio(){
     return (!_not_a_music);
 }
-
-void MalkuthAudio::process_albumcover(String path) {
-    if (path.endsWith("AlbumArtSmall.jpg")) {
-        if (_cover_priority < CoverPriority::SMALL_COVER) {
-            strcpy(_cover_path, path.c_str());
-            _image_type = ImageType::JPG;
-            _cover_priority = CoverPriority::SMALL_COVER;
-        }
-        return;
-    }
-
-    else if (path.endsWith("Cover.jpg") || path.endsWith("cover.jpg")) {
-        if (_cover_priority < CoverPriority::COVER_JPG) {
-            strcpy(_cover_path, path.c_str());
-            _image_type = ImageType::JPG;
-            _cover_priority = CoverPriority::COVER_JPG;
-        }
-        return;
-    }
-
-    else if (path.endsWith("Cover.png") || path.endsWith("cover.png")) {
-        if (_cover_priority < CoverPriority::COVER_PNG) {
-            strcpy(_cover_path, path.c_str());
-            _image_type = ImageType::PNG;
-            _cover_priority = CoverPriority::COVER_PNG;
-        }
-        return;
-    }
-}
\ No newline at end of file
@@ -1,3 +1,5 @@
+#pragma once
+
 #define USE_EXPERIMENTAL 1
 
 #include <AudioTools.h>
@@ -10,43 +12,69 @@
 #include "AudioTools/AudioLibs/Concurrency.h" 
 
 #include <SdFat.h>
+#include <vector>
 
 #include "malkuth_helper.h"
+#include "malkuth_buffer.h"
+#include "malkuth_fs.h"
+#include "malkuth_i2s.h"
+#include "malkuth_id3.h"
+#include "malkuth_flac.h"
 
 typedef struct {
     String artist;
     String title;
     String album;
 
-    float duration;    
-    uint64_t total_samples;
-    uint32_t sample_rate;
-    uint32_t data_offset;
+    float duration          = 0.0f;
+    uint64_t total_samples  = 0;
+    uint32_t sample_rate    = 0;
+    uint32_t data_offset    = 0;
+
+    // Not in one piece on the card, read through the FAT. Not something the
+    // tags know, whoever has the file open fills it in
+    bool     fragmented     = false;
 } AudioMetadata;
 
-class CustomI2S : public I2SStream {
+class MalkuthLibrary;
+
+// What the player actually reads from, the compressed bytes of the current
+// track are pushed into the ring by the reader task so decoding never waits
+// on the SD card
+class RingBufferStream : public Stream {
 public:
-  uint64_t bytes_written = 0;
+  void begin(MalkuthRingBuffer* ring) {
+    _ring = ring;
+    _eof  = false;
+  }
 
-  size_t write(const uint8_t* buffer, size_t size) override {
-    size_t res      = I2SStream::write(buffer, size);
-    bytes_written  += res;
+  void set_eof(bool eof) { _eof = eof; }
+  bool is_eof()          { return _eof; }
 
-    return res;
+  int available() override {
+    return _ring ? (int)_ring->available() : 0;
   }
-  float getAudioCurrentTime() {
-    auto info = audioInfo();
 
-    if (info.sample_rate == 0) return 0.0f;
+  int read() override {
+    uint8_t data;
+    return readBytes(&data, 1) == 1 ? data : -1;
+  }
 
-    int byte_rate = info.sample_rate * info.channels * (info.bits_per_sample / 8);
-    
-    return byte_rate > 0 ? (float)bytes_written / byte_rate : 0.0f;
+  int peek() override {
+    return _ring ? _ring->peek() : -1;
   }
 
-  void resetBytesWritten() {
-    bytes_written = 0;
+  size_t readBytes(uint8_t* buffer, size_t length) override {
+    return _ring ? _ring->read(buffer, length) : 0;
   }
+
+  size_t write(uint8_t) override {
+    return 0;
+  }
+
+private:
+  MalkuthRingBuffer*  _ring = nullptr;
+  volatile bool       _eof  = true;
 };
 
 // MP3 duration estimation
@@ -64,10 +92,29 @@ static const int bitrateTable[2][16] = {
     {0,8,16,24,32,40,48,56,64,80,96,112,128,144,160,0}
 };
 
+// Where the pipeline's time goes, in microseconds per second of audio that
+// made it to I2S. read runs on the reader task, decode and convert on the
+// audio task, as long as those stay well under 1000000 playback keeps up.
+// write is mostly time blocked on full DMA buffers, i.e. idle
+typedef struct {
+    uint32_t sample_rate    = 0;
+    uint8_t  bits           = 0;
+    uint8_t  channels       = 0;
+    float    seconds        = 0.0f;     // audio written since the reset
+
+    float    read           = 0.0f;
+    float    decode         = 0.0f;
+    float    convert        = 0.0f;
+    float    write          = 0.0f;
+} AudioProfile;
+
 class MalkuthAudio {
 private:
     FsFile          _audio_file;
+    SdExtent        _audio_extent;
     SdFs*           _sd;
+    MalkuthFs*      _fs;
+    MalkuthLibrary* _library = nullptr;
     bool            _playing                = false;
     uint8_t         _volume                 = 10;
     static float    _current_duration;
@@ -75,13 +122,36 @@ private:
 
     uint32_t data_start = 0;
 
-    AudioSourceVector<FsFile>*  _source;
-    AudioPlayer*                _player;
+    AudioSourceVector<RingBufferStream>*  _source;
+    AudioPlayer*                          _player;
+
+    // The reader task is the only one reading the track from the card, the
+    // audio task only decodes whatever is already sitting in the ring
+    static constexpr size_t RING_SIZE          = 1024 * 256;
+    static constexpr size_t RING_SIZE_FALLBACK = 1024 * 32;
+    static constexpr size_t READ_CHUNK         = 1024 * 16;
+
+    MalkuthRingBuffer   _ring;
+    RingBufferStream    _stream;
+
+    // Average bytes per second of the current track (0 if unknown), how
+    // long the ring lasts is the deadline of the next refill
+    uint32_t            _byte_rate          = 0;
+
+    // The reader and the audio task each only record into their own
+    MalkuthStageStats   _stats_read         = MalkuthStageStats("read");
+    MalkuthStageStats   _stats_decode       = MalkuthStageStats("decode");
+
+    TaskHandle_t        _taskhandle_audio   = nullptr;
+    TaskHandle_t        _taskhandle_reader  = nullptr;
+    SemaphoreHandle_t   _player_lock        = nullptr;
 
-    // TODO :  Multiprocessing on Audio
-    // BufferRTOS<uint8_t>  _buffer_audio;
-    // QueueStream<uint8_t> _queue_audio;
-    // StreamCopy*          _copier; 
+    static void task_audio(void* parameters);
+    static void task_reader(void* parameters);
+    size_t      refill();
+
+    void lock();
+    void unlock();
 
     CustomI2S _i2s;
 
@@ -97,24 +167,13 @@ private:
 
     static MalkuthAudio* self;
 
-    enum class CoverPriority {
-        NONE = 0,
-        COVER_PNG   = 1,
-        COVER_JPG   = 2,
-        SMALL_COVER = 3
-    };
-    CoverPriority _cover_priority = CoverPriority::NONE;
-    char      _cover_path[128] = {};
-    ImageType _image_type;
-
-    static FsFile*  file_to_stream_cb(const char* path, FsFile& old_file);
-    FsFile*         file_to_stream(const char* path, FsFile& old_file);
+    static bool               is_audio_path(const char* path);
+    static RingBufferStream*  file_to_stream_cb(const char* path, RingBufferStream& old_file);
+    RingBufferStream*         file_to_stream(const char* path, RingBufferStream& old_file);
 
     static void  metadata_print_cb(MetaDataType type, const char* str, int len);
     void         metadata_print(MetaDataType type, const char* str, int len);
 
-    static AudioMetadata get_metadata(FsFile& file, const char* path);
-
     static AudioMetadata get_metadata_flac(FsFile& file);
     static AudioMetadata get_metadata_flac_vorbis(FsFile& file, uint32_t size);
 
@@ -128,28 +187,86 @@ private:
     static int   mp3_samplerate(uint32_t hdr);
     static int   mp3_bitrate(uint32_t hdr);
     static int   mp3_xing_offset(uint32_t hdr);
+    static int   mp3_framelength(uint32_t hdr);
 
     static AudioMetadata get_metadata_wav(FsFile& file);
 
-public:
-  // MalkuthAudio():
-  //   _buffer_audio(1024 * 10),
-  //   _queue_audio(_buffer_audio)
-  // {}
+    // Seeking, the request is only remembered here and applied by
+    // file_to_stream when the player reopens the same track
+    float _seek_percent = -1.0f;
+
+    // Whatever the first frame tells about where the rest of them are
+    struct Mp3SeekInfo {
+        enum class Mode { CBR, XING, VBRI };
+
+        Mode     mode        = Mode::CBR;
+        uint32_t header      = 0;
+        uint32_t first_frame = 0;   // Xing / VBRI frame included
+        uint32_t audio_start = 0;   // first frame with actual audio
+        uint32_t frames      = 0;
+        uint32_t bytes       = 0;
+        uint8_t  toc[100];
+        std::vector<uint32_t> vbri; // byte size of every VBRI entry
+
+        bool     has_lame    = false;
+        uint16_t delay       = 0;   // encoder delay / padding, in samples
+        uint16_t padding     = 0;
+    };
+
+    static bool mp3_seekinfo(FsFile& file, Mp3SeekInfo& info);
+    static bool mp3_resync(FsFile& file, uint32_t from, uint32_t header, uint32_t& offset);
 
+    // Where a track starts on the card and which of its decoded samples
+    // are the actual audio (gapless), a seek keeps the padding cut off
+    struct Trim {
+        uint32_t start  = 0;
+        uint64_t skip   = 0;
+        uint64_t length = CustomI2S::UNLIMITED;
+    };
+
+    bool seek_flac(float percent, const Trim& trim);
+    bool seek_mp3(float percent, const Trim& trim);
+    bool seek_wav(float percent, const Trim& trim);
+
+    // Gapless, the reader opens and parses the next entry as soon as the
+    // current one is fully in the ring, the switch then only swaps handles
+    static constexpr int      TIMEOUT_AUTONEXT  = 500;
+    static constexpr int      GAPLESS_TIMEOUT   = 10;
+    static constexpr uint16_t MP3_DECODER_DELAY = 529;
+
+    bool                _gapless        = false;
+    bool                _end_of_track   = false;
+    std::vector<String> _playlist;
+    int32_t             _next_index     = -1;
+    FsFile              _next_file;
+    SdExtent            _next_extent;
+    AudioMetadata       _next_track;
+    Trim                _next_trim;
+    char                _next_path[255] = {};
+
+    void prefetch();
+    Trim gapless_trim(FsFile& file, const char* path, const AudioMetadata& metadata);
+    bool seek(float percent, const Trim& trim);
+
+public:
     bool init(uint8_t pin_bck = 8, uint8_t pin_ws = 17, uint8_t pin_data = 18);
     void reset();
   
     AudioMetadata get_metadata();
 
+    // Tags and duration of any track, the caller holds the MalkuthFs lock
+    // (the scanner parses with it too)
+    static AudioMetadata get_metadata(FsFile& file, const char* path);
+
     void process_directory(const char* path);
-    void process_albumcover(String path);
 
-    void set_sdfs(SdFs& sd);
+    void set_filesystem(MalkuthFs& fs);
+    void set_library(MalkuthLibrary& library);
     void set_volume(uint8_t percent);
     void set_path(const char* path);
     void set_index(int16_t index);
     void set_position(uint8_t percent);
+    void set_gapless(bool gapless);
 
     size_t loop();
     size_t loop_all();
@@ -162,12 +279,18 @@ public:
     void toggle(bool active);
 
     uint8_t get_volume();
+    int32_t get_gain();
+
+    AudioProfile get_profile();
+    void         reset_profile();
+
+    // Per stage min/avg/max, the histograms and the DMA fill estimate,
+    // csv is one line per stage plus a "dma" line
+    void         print_stats(Print& out, bool csv);
     bool    get_update();
     bool    get_status();
     float   get_position();
-    char*   get_coverpath();
     char*   get_audiopath();
-    ImageType get_covertype();
     char*   get_file_extension();
 
     bool    is_actually_audio();
@@ -0,0 +1,106 @@
+#pragma once
+
+#include <Arduino.h>
+#include <atomic>
+
+/// Lock-free single producer / single consumer byte ring.
+/// The producer (SD reader task) and the consumer (decoder) never touch the
+/// same index, so the only thing they share is two atomics.
+/// Capacity is rounded down to a power of two so the indices can run free.
+class MalkuthRingBuffer {
+private:
+    uint8_t*            _data     = nullptr;
+    size_t              _capacity = 0;
+    size_t              _mask     = 0;
+
+    std::atomic<size_t> _head{0};   // producer side
+    std::atomic<size_t> _tail{0};   // consumer side
+
+public:
+    ~MalkuthRingBuffer() {
+        if (_data) heap_caps_free(_data);
+    }
+
+    // Tries PSRAM first, falls back to internal RAM with whatever fits
+    bool init(size_t capacity, size_t fallback_capacity) {
+        size_t size = 1;
+        while ((size << 1) <= capacity) size <<= 1;
+
+        _data = (uint8_t*)heap_caps_malloc(size, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+        if (!_data) {
+            size = 1;
+            while ((size << 1) <= fallback_capacity) size <<= 1;
+            _data = (uint8_t*)heap_caps_malloc(size, MALLOC_CAP_8BIT);
+        }
+        if (!_data) return false;
+
+        _capacity = size;
+        _mask     = size - 1;
+        reset();
+        return true;
+    }
+
+    // Only safe while neither side is in the middle of an operation
+    void reset() {
+        _head.store(0, std::memory_order_relaxed);
+        _tail.store(0, std::memory_order_release);
+    }
+
+    size_t capacity() const { return _capacity; }
+
+    size_t available() const {
+        return _head.load(std::memory_order_acquire) - _tail.load(std::memory_order_relaxed);
+    }
+
+    size_t space() const {
+        return _capacity - (_head.load(std::memory_order_relaxed) - _tail.load(std::memory_order_acquire));
+    }
+
+    /// Producer: contiguous writable region, fill it then commit()
+    size_t write_span(uint8_t** ptr) {
+        size_t head   = _head.load(std::memory_order_relaxed);
+        size_t offset = head & _mask;
+        size_t len    = std::min(space(), _capacity - offset);
+
+        *ptr = _data + offset;
+        return len;
+    }
+
+    void commit(size_t len) {
+        _head.store(_head.load(std::memory_order_relaxed) + len, std::memory_order_release);
+    }
+
+    size_t write(const uint8_t* data, size_t len) {
+        size_t done = 0;
+        while (done < len) {
+            uint8_t* span;
+            size_t n = std::min(write_span(&span), len - done);
+            if (n == 0) break;
+
+            memcpy(span, data + done, n);
+            commit(n);
+            done += n;
+        }
+        return done;
+    }
+
+    /// Consumer
+    size_t read(uint8_t* data, size_t len) {
+        size_t tail  = _tail.load(std::memory_order_relaxed);
+        size_t count = std::min(available(), len);
+
+        size_t offset = tail & _mask;
+        size_t first  = std::min(count, _capacity - offset);
+
+        memcpy(data, _data + offset, first);
+        memcpy(data + first, _data, count - first);
+
+        _tail.store(tail + count, std::memory_order_release);
+        return count;
+    }
+
+    int peek() const {
+        if (available() == 0) return -1;
+        return _data[_tail.load(std::memory_order_relaxed) & _mask];
+    }
+};
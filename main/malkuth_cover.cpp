@@ -0,0 +1,547 @@
+#include "malkuth_cover.h"
+#include "malkuth_id3.h"
+
+#define COVER_TEMP  COVER_DIR "/cover.tmp"
+
+// Best first, the lookup is case insensitive like the card is. Anything
+// decodes once now, so the tiny AlbumArtSmall.jpg is only a last resort
+static const char* FOLDER_COVERS[] = {
+    "cover.jpg",
+    "cover.jpeg",
+    "folder.jpg",
+    "front.jpg",
+    "cover.png",
+    "folder.png",
+    "albumartsmall.jpg",
+};
+
+static uint32_t fnv(uint32_t hash, const uint8_t* data, size_t size) {
+    while (size--) {
+        hash ^= *data++;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static uint32_t read_be32(const uint8_t* bytes) {
+    return ((uint32_t)bytes[0] << 24) | ((uint32_t)bytes[1] << 16) | ((uint32_t)bytes[2] << 8) | bytes[3];
+}
+
+// Smallest thumbnail index whose source pixel is at or after from
+static int32_t first_at(int32_t from, int32_t crop) {
+    if (from <= 0) return 0;
+    return ((int64_t)from * COVER_SIZE + crop - 1) / crop;
+}
+
+///
+/// Private Function
+///
+
+void MalkuthCovers::task_covers(void* parameters) {
+    MalkuthCovers* self = static_cast<MalkuthCovers*>(parameters);
+    Request request;
+
+    while (true) {
+        if (xQueueReceive(self->_queue, &request, portMAX_DELAY) != pdTRUE) continue;
+
+        self->make(request.track);
+
+        self->_please_update = true;
+        self->_done++;
+    }
+}
+
+// Only trust the bytes, mime types in tags are whatever the tagger felt like
+bool MalkuthCovers::sniff(FsFile& file, Source& source) {
+    uint8_t magic[4];
+
+    if (source.size < sizeof(magic)) return false;
+
+    file.seek(source.offset);
+    if (file.read(magic, sizeof(magic)) != sizeof(magic)) return false;
+
+    if (magic[0] == 0xFF && magic[1] == 0xD8 && magic[2] == 0xFF)
+        source.type = ImageType::JPG;
+    else if (magic[0] == 0x89 && magic[1] == 'P' && magic[2] == 'N' && magic[3] == 'G')
+        source.type = ImageType::PNG;
+    else
+        return false;
+
+    return true;
+}
+
+// APIC (PIC on v2.2), the front cover if there is one, otherwise the first
+// picture. Pictures under unsynchronisation can't be decoded in place
+bool MalkuthCovers::find_id3(FsFile& file, Source& source) {
+    file.seek(0);
+
+    MalkuthId3 id3(file);
+    if (!id3.begin()) return false;
+
+    MalkuthId3::Frame frame;
+    bool found = false;
+
+    while (id3.next(frame)) {
+        bool v22 = strcmp(frame.id, "PIC") == 0;
+        if ((!v22 && strcmp(frame.id, "APIC") != 0) || frame.opaque) continue;
+
+        uint8_t encoding, type;
+        if (id3.read(&encoding, 1) != 1 || encoding > 3) continue;
+
+        // Image format on v2.2, a mime type after that
+        if (v22) {
+            uint8_t format[3];
+            if (id3.read(format, sizeof(format)) != sizeof(format)) continue;
+        } else {
+            id3.read_string(0, nullptr, 0);
+        }
+
+        if (id3.read(&type, 1) != 1) continue;
+        id3.read_string(encoding, nullptr, 0);
+
+        uint32_t offset, size;
+        if (!id3.region(offset, size) || size == 0) continue;
+        if (found && type != 3) continue;
+
+        source.offset = offset;
+        source.size   = size;
+        found         = true;
+
+        if (type == 3) break;
+    }
+
+    return found && sniff(file, source);
+}
+
+// PICTURE metadata block, same preference as the ID3 one
+bool MalkuthCovers::find_flac(FsFile& file, Source& source) {
+    file.seek(0);
+
+    char sig[4];
+    if (file.read(sig, 4) != 4 || strncmp(sig, "fLaC", 4) != 0) return false;
+
+    bool found = false;
+    bool last  = false;
+
+    while (!last) {
+        uint8_t header[4];
+        if (file.read(header, 4) != 4) break;
+
+        last = header[0] & 0x80;
+        uint8_t  block_type = header[0] & 0x7F;
+        uint32_t block_size = ((uint32_t)header[1] << 16) | (header[2] << 8) | header[3];
+        uint64_t block_end  = file.position() + block_size;
+
+        if (block_type == 6 && block_size >= 32) {
+            uint8_t field[4];
+            uint32_t type;
+
+            if (file.read(field, 4) != 4) break;
+            type = read_be32(field);
+
+            // mime and description, then width, height, depth and colours
+            if (file.read(field, 4) != 4) break;
+            file.seekCur(read_be32(field));
+            if (file.read(field, 4) != 4) break;
+            file.seekCur(read_be32(field) + 16);
+            if (file.read(field, 4) != 4) break;
+
+            uint32_t size = read_be32(field);
+            if (size && file.position() + size <= block_end && (!found || type == 3)) {
+                source.offset = file.position();
+                source.size   = size;
+                found         = true;
+
+                if (type == 3) break;
+            }
+        }
+
+        file.seek(block_end);
+    }
+
+    return found && sniff(file, source);
+}
+
+bool MalkuthCovers::find_folder(const char* track, Source& source) {
+    const char* slash = strrchr(track, '/');
+    if (!slash) return false;
+
+    size_t dir_len = slash - track + 1;
+    if (dir_len + 1 > sizeof(source.path)) return false;
+
+    char dir[sizeof(source.path)];
+    memcpy(dir, track, dir_len);
+    dir[dir_len] = '\0';
+
+    size_t best = sizeof(FOLDER_COVERS) / sizeof(FOLDER_COVERS[0]);
+
+    _fs->for_each_entry(dir, DirOrder::RAW, [&](const DirEntry& entry) {
+        if (entry.type != EntryType::IMAGE) return true;
+
+        for (size_t i = 0; i < best; i++) {
+            if (strcasecmp(entry.name, FOLDER_COVERS[i]) == 0 &&
+                dir_len + strlen(entry.name) < sizeof(source.path)
+            ){
+                snprintf(source.path, sizeof(source.path), "%s%s", dir, entry.name);
+                best = i;
+                break;
+            }
+        }
+        return best != 0;
+    });
+
+    if (best == sizeof(FOLDER_COVERS) / sizeof(FOLDER_COVERS[0])) return false;
+
+    FsFile file;
+    if (!file.open(source.path, O_RDONLY)) return false;
+
+    source.offset = 0;
+    source.size   = file.size();
+
+    bool found = sniff(file, source);
+    file.close();
+
+    return found;
+}
+
+// Picture size and its last KB, the tail is entropy coded data so two
+// pictures from the same encoder don't end up sharing a key
+uint32_t MalkuthCovers::key(FsFile& file, const Source& source) {
+    uint8_t  tail[1024];
+    uint32_t length = std::min<uint32_t>(source.size, sizeof(tail));
+
+    uint32_t hash = fnv(2166136261u, (const uint8_t*)&source.size, sizeof(source.size));
+
+    file.seek(source.offset + source.size - length);
+    int got = file.read(tail, length);
+
+    return fnv(hash, tail, got > 0 ? got : 0);
+}
+
+void MalkuthCovers::thumb_path(uint32_t key, char* path, size_t size) {
+    snprintf(path, size, COVER_DIR "/%08lx.rgb", (unsigned long)key);
+}
+
+// The biggest centred square of a width x height picture
+void MalkuthCovers::crop(uint16_t width, uint16_t height) {
+    _crop_size = std::max<int32_t>(std::min(width, height), 1);
+    _crop_x    = (width  - _crop_size) / 2;
+    _crop_y    = (height - _crop_size) / 2;
+}
+
+// Nearest neighbour, every thumbnail pixel whose source pixel falls into
+// this block is picked out of it
+void MalkuthCovers::put(int32_t x, int32_t y, uint16_t w, uint16_t h, const uint16_t* pixels, uint16_t stride) {
+    int32_t u0 = first_at(x - _crop_x, _crop_size);
+    int32_t u1 = std::min<int32_t>(first_at(x + w - _crop_x, _crop_size), COVER_SIZE);
+    int32_t v0 = first_at(y - _crop_y, _crop_size);
+    int32_t v1 = std::min<int32_t>(first_at(y + h - _crop_y, _crop_size), COVER_SIZE);
+
+    for (int32_t v = v0; v < v1; v++) {
+        const uint16_t* row = pixels + (_crop_y + v * _crop_size / COVER_SIZE - y) * stride;
+        uint16_t*       out = _pixels + v * COVER_SIZE;
+
+        for (int32_t u = u0; u < u1; u++)
+            out[u] = row[_crop_x + u * _crop_size / COVER_SIZE - x];
+    }
+}
+
+// Reads of the cover task's decoder, one JD_SZBUF chunk per lock
+void MalkuthCovers::lock_jpg(void* user, bool take) {
+    MalkuthCovers* covers = static_cast<MalkuthCovers*>(user);
+
+    if (take) covers->_fs->lock(SdClass::BACKGROUND);
+    else      covers->_fs->unlock();
+}
+
+bool MalkuthCovers::render_jpg(void* user, uint16_t y, uint16_t w, uint16_t* row) {
+    MalkuthCovers* covers = static_cast<MalkuthCovers*>(user);
+
+    memcpy(covers->_pixels + y * COVER_SIZE, row, w * sizeof(uint16_t));
+    return true;
+}
+
+int MalkuthCovers::render_png(PNGDRAW* png_draw) {
+    MalkuthCovers* covers = static_cast<MalkuthCovers*>(png_draw->pUser);
+    int32_t y = png_draw->y;
+
+    // Rows no thumbnail pixel comes from aren't even converted
+    if (first_at(y - covers->_crop_y, covers->_crop_size) == first_at(y + 1 - covers->_crop_y, covers->_crop_size))
+        return 1;
+
+    covers->_png->getLineAsRGB565(png_draw, covers->_line, PNG_RGB565_BIG_ENDIAN, 0xffffffff);
+    covers->put(0, y, png_draw->iWidth, 1, covers->_line, png_draw->iWidth);
+    return 1;
+}
+
+// Fit-to-box straight into the thumbnail, the decoder picks the DCT scale
+// and resamples the rest bilinear
+bool MalkuthCovers::decode_jpg(FsFile& file, const Source& source) {
+    _jpg.setSwapBytes(true);
+
+    _fs->lock(SdClass::BACKGROUND);
+    file.seek(source.offset);
+    _fs->unlock();
+
+    return _jpg.drawJpgFit(file, source.size, COVER_SIZE, COVER_SIZE, render_jpg, this) == JDR_OK;
+}
+
+// PNGdec wants the whole file in memory, PSRAM holds it for the decode.
+// The card is only held for the read (piece by piece), inflating doesn't
+// need it
+bool MalkuthCovers::decode_png(FsFile& file, const Source& source) {
+    if (source.size > COVER_MAX_PNG) return false;
+
+    uint8_t* data = (uint8_t*)heap_caps_malloc(source.size, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    _png = new PNG();
+
+    bool ok   = false;
+    bool read = false;
+
+    if (data) {
+        _fs->lock(SdClass::BACKGROUND);
+        file.seek(source.offset);
+        _fs->unlock();
+
+        read = _fs->read(file, data, source.size, SdClass::BACKGROUND) == source.size;
+    }
+
+    if (read && _png && _png->openRAM(data, source.size, render_png) == PNG_SUCCESS) {
+        crop(_png->getWidth(), _png->getHeight());
+
+        _line = (uint16_t*)heap_caps_malloc(_png->getWidth() * sizeof(uint16_t), MALLOC_CAP_8BIT);
+        if (_line)
+            ok = _png->decode(this, 0) == PNG_SUCCESS;
+
+        _png->close();
+    }
+
+    heap_caps_free(_line);
+    heap_caps_free(data);
+    delete _png;
+
+    _line = nullptr;
+    _png  = nullptr;
+
+    return ok;
+}
+
+// Written next to the cache and renamed, a half written thumbnail never
+// shows up under its key. Only the cover task gets here
+bool MalkuthCovers::generate(const Source& source, const char* path) {
+    const size_t bytes = COVER_SIZE * COVER_SIZE * sizeof(uint16_t);
+    uint32_t     start = micros();
+
+    _pixels = (uint16_t*)heap_caps_malloc(bytes, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    if (!_pixels) return false;
+
+    memset(_pixels, 0, bytes);
+
+    FsFile file;
+
+    _fs->lock(SdClass::BACKGROUND);
+    bool ok = file.open(source.path, O_RDONLY);
+    _fs->unlock();
+
+    if (ok)
+        ok = source.type == ImageType::JPG ? decode_jpg(file, source) : decode_png(file, source);
+
+    Header header;
+    memcpy(header.magic, "MKTH", 4);
+    header.width    = COVER_SIZE;
+    header.height   = COVER_SIZE;
+    header.key      = source.key;
+    header.reserved = 0;
+
+    // The pixels go out piece by piece, only the temp file's own name is
+    // touched until the rename
+    FsFile out;
+
+    _fs->lock(SdClass::BACKGROUND);
+    if (file.isOpen()) file.close();
+
+    ok = ok &&
+         out.open(COVER_TEMP, O_RDWR | O_CREAT | O_TRUNC) &&
+         out.write(&header, sizeof(header)) == sizeof(header);
+    _fs->unlock();
+
+    ok = ok && _fs->write(out, _pixels, bytes, SdClass::BACKGROUND) == bytes;
+
+    _fs->lock(SdClass::BACKGROUND);
+    if (out.isOpen()) {
+        out.close();
+
+        SdFs& sd = _fs->get_sdfs();
+        if (ok) {
+            sd.remove(path);
+            ok = sd.rename(COVER_TEMP, path);
+        } else {
+            sd.remove(COVER_TEMP);
+        }
+    }
+    _fs->unlock();
+
+    heap_caps_free(_pixels);
+    _pixels = nullptr;
+
+    if (ok) {
+        _generated++;
+        _last_us = micros() - start;
+    } else {
+        _failed++;
+    }
+
+    return ok;
+}
+
+// Under the lock, the tag walk and the key are a few small reads
+bool MalkuthCovers::find(const char* track, uint8_t index, Source& source) {
+    source = Source();
+
+    bool found = false;
+    if (index == 0) {
+        strcpy(source.path, track);
+        if (!ends_with_nocase(track, ".mp3") && !ends_with_nocase(track, ".flac")) return false;
+    } else if (!find_folder(track, source)) {
+        return false;
+    }
+
+    FsFile file;
+    if (!file.open(source.path, O_RDONLY)) return false;
+
+    if (index != 0)                            found = true;
+    else if (ends_with_nocase(track, ".mp3"))  found = find_id3(file, source);
+    else                                       found = find_flac(file, source);
+
+    if (found) source.key = key(file, source);
+
+    file.close();
+    return found;
+}
+
+bool MalkuthCovers::is_bad(uint32_t key) {
+    for (uint32_t bad : _bad)
+        if (bad == key && key != 0) return true;
+    return false;
+}
+
+void MalkuthCovers::request(const char* track) {
+    Request request;
+    strcpy(request.track, track);
+
+    if (xQueueSend(_queue, &request, 0) == pdTRUE)
+        _requested++;
+}
+
+// Embedded first, a picture that can't be decoded (progressive JPEG, PNG
+// too big, ...) is remembered as bad and the folder one is made instead.
+// The same track can be queued twice, the second one just finds the file
+void MalkuthCovers::make(const char* track) {
+    Source source;
+    char   path[48];
+
+    for (uint8_t i = 0; i < 2; i++) {
+        _fs->lock(SdClass::BACKGROUND);
+        bool found  = find(track, i, source) && !is_bad(source.key);
+        if (found) thumb_path(source.key, path, sizeof(path));
+        bool exists = found && _fs->get_sdfs().exists(path);
+        _fs->unlock();
+
+        if (!found) continue;
+        if (exists || generate(source, path)) return;
+
+        _fs->lock(SdClass::BACKGROUND);
+        _bad[_bad_next] = source.key;
+        _bad_next = (_bad_next + 1) % COVER_BAD_KEYS;
+        _fs->unlock();
+    }
+}
+
+///
+/// Public Function
+///
+
+bool MalkuthCovers::begin(MalkuthFs& fs) {
+    _fs = &fs;
+
+    _fs->lock();
+    SdFs& sd = _fs->get_sdfs();
+
+    if (!sd.exists(COVER_DIR))
+        sd.mkdir(COVER_DIR);
+
+    _ready = sd.exists(COVER_DIR);
+    _fs->unlock();
+
+    _jpg.setFileSystem(&sd, lock_jpg, this);
+    _jpg.setProfile(COVER_JPG_PROFILE);
+
+    // Below the display and the audio reader, it only gets the idle time
+    if (!_queue) {
+        _queue = xQueueCreate(COVER_QUEUE_LENGTH, sizeof(Request));
+
+        xTaskCreate(
+            task_covers,
+            "Malkuth: Covers",
+            8192,
+            this,
+            1,
+            &_taskhandle_covers
+        );
+    }
+
+    return _ready;
+}
+
+// The first picture that isn't known to be bad decides, the folder isn't
+// even listed when the track has a good one
+bool MalkuthCovers::get(const char* track, char* path, size_t size) {
+    if (!_ready || !track || strlen(track) >= sizeof(Source::path)) return false;
+
+    Source source;
+    bool   ok = false;
+
+    _fs->lock();
+
+    for (uint8_t i = 0; i < 2; i++) {
+        if (!find(track, i, source) || is_bad(source.key)) continue;
+
+        thumb_path(source.key, path, size);
+        ok = _fs->get_sdfs().exists(path);
+
+        if (ok) _hits++;
+        else    request(track);
+        break;
+    }
+
+    _fs->unlock();
+    return ok;
+}
+
+bool MalkuthCovers::get_update() {
+    return _please_update;
+}
+
+void MalkuthCovers::yeah_i_have_updated() {
+    _please_update = false;
+}
+
+bool MalkuthCovers::is_busy() {
+    return _requested != _done;
+}
+
+uint32_t MalkuthCovers::get_hits() {
+    return _hits;
+}
+
+uint32_t MalkuthCovers::get_generated() {
+    return _generated;
+}
+
+uint32_t MalkuthCovers::get_failed() {
+    return _failed;
+}
+
+uint32_t MalkuthCovers::get_last_us() {
+    return _last_us;
+}
@@ -0,0 +1,151 @@
+#pragma once
+
+#include <Arduino.h>
+#include <SdFat.h>
+#include <PNGdec.h>
+
+#include "malkuth_helper.h"
+#include "malkuth_fs.h"
+
+#include "src/TJpg_Decoder/TJpg_Decoder.h"
+
+#ifndef COVER_DIR
+    #define COVER_DIR "/.malkuth/covers"
+#endif
+
+// Thumbnails are square, the player page shows them at this size
+#ifndef COVER_SIZE
+    #define COVER_SIZE 200
+#endif
+
+// PNG covers are inflated from PSRAM, bigger ones are skipped
+#ifndef COVER_MAX_PNG
+    #define COVER_MAX_PNG (1024 * 1024)
+#endif
+
+// Decode profile of the cover task, see TJpg_Decoder.h
+#ifndef COVER_JPG_PROFILE
+    #define COVER_JPG_PROFILE TJPG_PROFILE_FAST_INTERNAL
+#endif
+
+// Tracks waiting for a thumbnail, get() just asks again later when it's full
+#ifndef COVER_QUEUE_LENGTH
+    #define COVER_QUEUE_LENGTH 4
+#endif
+
+// Pictures that didn't decode, remembered so they aren't tried on every get()
+#ifndef COVER_BAD_KEYS
+    #define COVER_BAD_KEYS 16
+#endif
+
+/// Cover art of a track as a COVER_SIZE square RGB565 thumbnail on the card.
+///
+/// The picture comes from the track itself (ID3 APIC/PIC, FLAC PICTURE,
+/// front cover first) or from a cover image next to it. It is decoded once,
+/// centre cropped (JPEGs fit-to-box: DCT scaled, then bilinear, PNGs nearest
+/// neighbour) and written to COVER_DIR/<key>.rgb in panel byte order.
+/// The key only depends on the picture, so a whole album shares one file and
+/// showing it again is a plain blit (ImageType::THUMB).
+/// Making one runs on its own low priority task with its own decoder, which
+/// only takes the MalkuthFs lock per read, so the display and the audio
+/// reader keep getting the card in between.
+class MalkuthCovers {
+public:
+    struct Header {
+        char     magic[4];
+        uint16_t width;
+        uint16_t height;
+        uint32_t key;
+        uint32_t reserved;
+    };
+    static_assert(sizeof(Header) == 16, "thumbnail header layout changed");
+
+private:
+    struct Source {
+        ImageType type      = ImageType::NONE;
+        char      path[256] = {};
+        uint32_t  offset    = 0;    // where the picture starts in that file
+        uint32_t  size      = 0;
+        uint32_t  key       = 0;
+    };
+
+    struct Request {
+        char track[sizeof(Source::path)];
+    };
+
+    MalkuthFs*  _fs     = nullptr;
+    bool        _ready  = false;
+
+    TJpg_Decoder    _jpg;
+    QueueHandle_t   _queue              = NULL;
+    TaskHandle_t    _taskhandle_covers  = NULL;
+
+    bool              _please_update  = false;
+    uint32_t          _requested      = 0;
+    uint32_t          _done           = 0;
+
+    uint32_t    _bad[COVER_BAD_KEYS]  = {};
+    uint8_t     _bad_next             = 0;
+
+    uint32_t    _hits       = 0;
+    uint32_t    _generated  = 0;
+    uint32_t    _failed     = 0;
+    uint32_t    _last_us    = 0;
+
+    // Centre crop of a decoded PNG
+    uint16_t*   _pixels     = nullptr;
+    uint16_t*   _line       = nullptr;
+    PNG*        _png        = nullptr;
+    int32_t     _crop_x     = 0;
+    int32_t     _crop_y     = 0;
+    int32_t     _crop_size  = 0;
+
+    static void task_covers(void* parameters);
+
+    static bool sniff(FsFile& file, Source& source);
+    static bool find_id3(FsFile& file, Source& source);
+    static bool find_flac(FsFile& file, Source& source);
+    bool        find_folder(const char* track, Source& source);
+
+    static uint32_t key(FsFile& file, const Source& source);
+    static void     thumb_path(uint32_t key, char* path, size_t size);
+
+    // index 0 is the picture in the track, 1 the one next to it
+    bool find(const char* track, uint8_t index, Source& source);
+    bool is_bad(uint32_t key);
+    void request(const char* track);
+    void make(const char* track);
+
+    bool decode_jpg(FsFile& file, const Source& source);
+    bool decode_png(FsFile& file, const Source& source);
+    bool generate(const Source& source, const char* path);
+
+    void crop(uint16_t width, uint16_t height);
+    void put(int32_t x, int32_t y, uint16_t w, uint16_t h, const uint16_t* pixels, uint16_t stride);
+
+    static void lock_jpg(void* user, bool take);
+    static bool render_jpg(void* user, uint16_t y, uint16_t w, uint16_t* row);
+    static int  render_png(PNGDRAW* png_draw);
+
+public:
+    bool begin(MalkuthFs& fs);
+
+    // Thumbnail of the track's cover, only ever a lookup. False if the track
+    // has no usable cover or it isn't made yet, the missing one is queued and
+    // get_update() says when it's worth asking again
+    bool get(const char* track, char* path, size_t size);
+
+    // A queued thumbnail got made (or turned out impossible)
+    bool get_update();
+    void yeah_i_have_updated();
+
+    // Something is queued or being made
+    bool is_busy();
+
+    uint32_t get_hits();
+    uint32_t get_generated();
+    uint32_t get_failed();
+
+    // How long the last thumbnail took to make
+    uint32_t get_last_us();
+};
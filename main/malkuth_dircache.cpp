@@ -0,0 +1,181 @@
+#include "malkuth_dircache.h"
+#include "malkuth_helper.h"
+
+///
+/// Listing
+///
+
+// Both blocks double when full, a listing is built once and then only read
+bool MalkuthDirCache::Listing::append(const char* name, EntryType type) {
+    bool   is_dir = type == EntryType::DIRECTORY;
+    size_t length = 1 + strlen(name) + (is_dir ? 1 : 0) + 1;
+
+    if (_count == UINT16_MAX) return false;
+
+    if (_names_used + length > _names_cap) {
+        size_t cap = _names_cap ? _names_cap : 1024;
+        while (_names_used + length > cap) cap *= 2;
+
+        char* names = (char*)heap_caps_realloc(_names, cap, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+        if (!names) names = (char*)heap_caps_realloc(_names, cap, MALLOC_CAP_8BIT);
+        if (!names) return false;
+
+        _names     = names;
+        _names_cap = cap;
+    }
+
+    if (_count == _count_cap) {
+        uint32_t cap = _count_cap ? (uint32_t)_count_cap * 2 : 64;
+        if (cap > UINT16_MAX) cap = UINT16_MAX;
+
+        uint32_t* offsets = (uint32_t*)heap_caps_realloc(_offsets, cap * sizeof(uint32_t), MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+        if (!offsets) offsets = (uint32_t*)heap_caps_realloc(_offsets, cap * sizeof(uint32_t), MALLOC_CAP_8BIT);
+        if (!offsets) return false;
+
+        _offsets   = offsets;
+        _count_cap = cap;
+    }
+
+    char* dst = _names + _names_used;
+    *dst++ = (char)type;
+    strcpy(dst, name);
+    if (is_dir) strcat(dst, "/");
+
+    _offsets[_count++] = _names_used + 1;
+    _names_used += length;
+    return true;
+}
+
+void MalkuthDirCache::Listing::release() {
+    if (_names)   heap_caps_free(_names);
+    if (_offsets) heap_caps_free(_offsets);
+
+    _names      = nullptr;
+    _offsets    = nullptr;
+    _names_used = _names_cap = 0;
+    _count      = _count_cap = 0;
+}
+
+///
+/// Private Function
+///
+
+// The root has no entry of its own, it just stays at 0
+void MalkuthDirCache::read_stamp(FsFile& dir, Listing& listing) {
+    listing._size = dir.size();
+    listing._date = 0;
+    listing._time = 0;
+    dir.getModifyDateTime(&listing._date, &listing._time);
+}
+
+MalkuthDirCache::Listing* MalkuthDirCache::find(const char* path, uint32_t hash) {
+    for (auto* listing : _listings)
+        if (listing->_hash == hash && listing->_path == path)
+            return listing;
+
+    return nullptr;
+}
+
+bool MalkuthDirCache::load(FsFile& dir, Listing& listing) {
+    bool ok = true;
+
+    listing.release();
+    read_stamp(dir, listing);
+
+    MalkuthDirSort sort;
+    sort.run(*_sd, dir, _order, [&](const DirEntry& entry) {
+        ok = listing.append(entry.name, entry.type);
+        return ok;
+    });
+
+    return ok;
+}
+
+void MalkuthDirCache::evict(const Listing* keep) {
+    while (used() > _budget) {
+        auto oldest = _listings.end();
+
+        for (auto it = _listings.begin(); it != _listings.end(); ++it) {
+            if (*it == keep) continue;
+            if (oldest == _listings.end() || (*it)->_last_used < (*oldest)->_last_used)
+                oldest = it;
+        }
+
+        if (oldest == _listings.end()) return;
+
+        (*oldest)->release();
+        delete *oldest;
+        _listings.erase(oldest);
+    }
+}
+
+///
+/// Public Function
+///
+
+MalkuthDirCache::~MalkuthDirCache() {
+    clear();
+}
+
+const MalkuthDirCache::Listing* MalkuthDirCache::get(const char* path, bool recheck) {
+    uint32_t hash    = hash_path(path);
+    Listing* listing = find(path, hash);
+
+    if (listing && !recheck) {
+        listing->_last_used = ++_tick;
+        _hits++;
+        return listing;
+    }
+
+    FsFile dir;
+    if (!dir.open(path, O_RDONLY) || !dir.isDir()) {
+        if (dir.isOpen()) dir.close();
+        return nullptr;
+    }
+
+    if (listing) {
+        Listing now;
+        read_stamp(dir, now);
+
+        if (now._size == listing->_size && now._date == listing->_date && now._time == listing->_time) {
+            dir.close();
+            listing->_last_used = ++_tick;
+            _hits++;
+            return listing;
+        }
+    }
+    else {
+        listing = new Listing();
+        listing->_hash = hash;
+        listing->_path = path;
+        _listings.push_back(listing);
+    }
+
+    _misses++;
+
+    // Whatever didn't fit is still shown, it just isn't complete
+    load(dir, *listing);
+    dir.close();
+
+    listing->_last_used = ++_tick;
+    evict(listing);
+
+    return listing;
+}
+
+void MalkuthDirCache::clear() {
+    for (auto* listing : _listings) {
+        listing->release();
+        delete listing;
+    }
+
+    _listings.clear();
+}
+
+size_t MalkuthDirCache::used() const {
+    size_t total = 0;
+    for (auto* listing : _listings)
+        total += listing->bytes();
+
+    return total;
+}
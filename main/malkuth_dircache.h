@@ -0,0 +1,104 @@
+#pragma once
+
+#include <Arduino.h>
+#include <SdFat.h>
+#include <vector>
+
+#include "malkuth_dirsort.h"
+
+// Names and offsets of every cached directory together, a 2000 file folder
+// with 30 character names is around 70 KB
+#ifndef DIRCACHE_BUDGET
+    #define DIRCACHE_BUDGET (1024 * 256)
+#endif
+
+/// Directory listings kept between Files page redraws, keyed by path.
+/// Every listing is one block of NUL terminated names, each behind its
+/// EntryType byte, plus one offset per entry, both in PSRAM, so a page of
+/// it is just pointer maths. Entries are kept in the order they were
+/// loaded with, see set_source.
+/// A listing is trusted until a recheck finds the directory's size or modify
+/// stamp changed. FAT doesn't always touch those when a file is added, but
+/// a remount drops everything anyway.
+/// Callers hold the MalkuthFs lock, a Listing stays valid until the next
+/// call into the cache.
+class MalkuthDirCache {
+public:
+    class Listing {
+        friend class MalkuthDirCache;
+
+    private:
+        uint32_t    _hash       = 0;
+        String      _path;
+        uint16_t    _date       = 0;
+        uint16_t    _time       = 0;
+        uint64_t    _size       = 0;
+        uint32_t    _last_used  = 0;
+
+        char*       _names      = nullptr;
+        size_t      _names_used = 0;
+        size_t      _names_cap  = 0;
+
+        uint32_t*   _offsets    = nullptr;
+        uint16_t    _count      = 0;
+        uint16_t    _count_cap  = 0;
+
+        bool append(const char* name, EntryType type);
+        void release();
+
+    public:
+        uint16_t count() const { return _count; }
+
+        // Directories end with '/'
+        const char* operator[](uint16_t index) const { return _names + _offsets[index]; }
+
+        EntryType type(uint16_t index) const { return (EntryType)_names[_offsets[index] - 1]; }
+
+        // Up to count names starting at start, returns how many there were
+        uint16_t page(uint16_t start, uint16_t count, const char** out) const {
+            uint16_t n = 0;
+            while (n < count && start + n < _count) {
+                out[n] = (*this)[start + n];
+                n++;
+            }
+            return n;
+        }
+
+        size_t bytes() const { return _names_cap + (size_t)_count_cap * sizeof(uint32_t); }
+    };
+
+private:
+    std::vector<Listing*>   _listings;
+    size_t                  _budget = 0;
+    uint32_t                _tick   = 0;
+
+    SdFs*                   _sd     = nullptr;
+    DirOrder                _order  = DirOrder::RAW;
+
+    uint32_t                _hits   = 0;
+    uint32_t                _misses = 0;
+
+    static void read_stamp(FsFile& dir, Listing& listing);
+
+    Listing* find(const char* path, uint32_t hash);
+    bool     load(FsFile& dir, Listing& listing);
+    void     evict(const Listing* keep);
+
+public:
+    explicit MalkuthDirCache(size_t budget = 0) : _budget(budget) {}
+    ~MalkuthDirCache();
+
+    // Has to come before the first get. The card is needed for directories
+    // too big to sort in RAM, cached listings keep whatever order they had
+    void set_source(SdFs& sd, DirOrder order) { _sd = &sd; _order = order; }
+
+    // nullptr if path can't be opened as a directory. Without recheck
+    // whatever is cached is used as is, that costs no card access at all
+    const Listing* get(const char* path, bool recheck);
+
+    void clear();
+
+    uint32_t hits()   const { return _hits; }
+    uint32_t misses() const { return _misses; }
+    size_t   used()   const;
+};
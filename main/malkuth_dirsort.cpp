@@ -0,0 +1,357 @@
+#include "malkuth_dirsort.h"
+
+#include <algorithm>
+#include <vector>
+
+/// One sorted run on the card, read back a sector at a time
+struct MalkuthDirSort::Run {
+    FsFile      file;
+    uint8_t     buffer[512];
+    uint16_t    pos = 0;
+    uint16_t    len = 0;
+
+    EntryType   type;
+    char        name[256];
+
+    int read_byte() {
+        if (pos == len) {
+            int n = file.read(buffer, sizeof(buffer));
+            if (n <= 0) return -1;
+
+            len = n;
+            pos = 0;
+        }
+        return buffer[pos++];
+    }
+
+    // Record is [type][length][name without NUL]
+    bool next() {
+        int type_byte = read_byte();
+        int length    = read_byte();
+        if (type_byte < 0 || length < 0) return false;
+
+        for (int i = 0; i < length; i++) {
+            int c = read_byte();
+            if (c < 0) return false;
+            name[i] = c;
+        }
+
+        name[length] = '\0';
+        type = (EntryType)type_byte;
+        return true;
+    }
+};
+
+///
+/// Private Function
+///
+
+// Chunk record is [type][name][NUL], offsets point at the type byte
+bool MalkuthDirSort::add(const char* name, EntryType type) {
+    size_t length = strlen(name);
+    size_t need   = length + 2 + sizeof(uint16_t);
+
+    if (_used + (size_t)_count * sizeof(uint16_t) + need > _budget)
+        return false;
+
+    uint16_t offset = _used;
+
+    _chunk[_used++] = (uint8_t)type;
+    memcpy(_chunk + _used, name, length + 1);
+    _used += length + 1;
+
+    _count++;
+    offsets()[0] = offset;
+    return true;
+}
+
+void MalkuthDirSort::sort_chunk() {
+    uint16_t* begin = offsets();
+
+    std::sort(begin, begin + _count, [this](uint16_t a, uint16_t b) {
+        return compare(
+            _order,
+            (EntryType)_chunk[a], (const char*)_chunk + a + 1,
+            (EntryType)_chunk[b], (const char*)_chunk + b + 1
+        ) < 0;
+    });
+}
+
+bool MalkuthDirSort::emit_chunk(const DirVisitor& visit) {
+    uint16_t* index = offsets();
+
+    for (uint16_t i = 0; i < _count; i++) {
+        DirEntry entry = { (const char*)_chunk + index[i] + 1, (EntryType)_chunk[index[i]] };
+        if (!visit(entry)) return false;
+    }
+
+    return true;
+}
+
+bool MalkuthDirSort::write_run(uint16_t id) {
+    char   path[48];
+    FsFile file;
+
+    run_path(id, path, sizeof(path));
+    if (!file.open(path, O_RDWR | O_CREAT | O_TRUNC)) return false;
+
+    sort_chunk();
+
+    uint16_t* index = offsets();
+    bool      ok    = true;
+
+    for (uint16_t i = 0; i < _count && ok; i++) {
+        const char* name   = (const char*)_chunk + index[i] + 1;
+        uint8_t     head[2] = { _chunk[index[i]], (uint8_t)strlen(name) };
+
+        ok = file.write(head, 2) == 2 && file.write(name, head[1]) == head[1];
+    }
+
+    file.close();
+    return ok;
+}
+
+// Smallest head goes out first, into another run when output >= 0,
+// otherwise to the visitor
+bool MalkuthDirSort::merge(const uint16_t* runs, uint8_t count, int32_t output, const DirVisitor& visit) {
+    Run*   readers = new Run[count];
+    bool*  live    = new bool[count];
+    FsFile out;
+    bool   ok      = true;
+
+    if (output >= 0) {
+        char path[48];
+        run_path(output, path, sizeof(path));
+        ok = out.open(path, O_RDWR | O_CREAT | O_TRUNC);
+    }
+
+    for (uint8_t i = 0; i < count && ok; i++) {
+        char path[48];
+        run_path(runs[i], path, sizeof(path));
+
+        live[i] = readers[i].file.open(path, O_RDONLY) && readers[i].next();
+    }
+
+    while (ok) {
+        int8_t best = -1;
+
+        for (uint8_t i = 0; i < count; i++) {
+            if (!live[i]) continue;
+
+            if (best < 0 || compare(_order, readers[i].type, readers[i].name, readers[best].type, readers[best].name) < 0)
+                best = i;
+        }
+
+        if (best < 0) break;
+
+        Run& run = readers[best];
+
+        if (output >= 0) {
+            uint8_t head[2] = { (uint8_t)run.type, (uint8_t)strlen(run.name) };
+            ok = out.write(head, 2) == 2 && out.write(run.name, head[1]) == head[1];
+        }
+        else {
+            DirEntry entry = { run.name, run.type };
+            if (!visit(entry)) break;
+        }
+
+        live[best] = run.next();
+    }
+
+    for (uint8_t i = 0; i < count; i++) {
+        if (readers[i].file.isOpen()) readers[i].file.close();
+        remove_run(runs[i]);
+    }
+
+    if (out.isOpen()) out.close();
+
+    delete[] readers;
+    delete[] live;
+    return ok;
+}
+
+void MalkuthDirSort::remove_run(uint16_t id) {
+    char path[48];
+    run_path(id, path, sizeof(path));
+    _sd->remove(path);
+}
+
+void MalkuthDirSort::release() {
+    if (_chunk) heap_caps_free(_chunk);
+
+    _chunk = nullptr;
+    _used  = 0;
+    _count = 0;
+}
+
+void MalkuthDirSort::run_path(uint16_t id, char* path, size_t size) {
+    snprintf(path, size, DIRSORT_DIR "/sort%u.tmp", id);
+}
+
+// The scratch directory is ours, nobody browsing the root wants to see it
+bool MalkuthDirSort::scratch(const char* name, bool is_dir) {
+    return is_dir && strcmp(name, DIRSORT_DIR + 1) == 0;
+}
+
+void MalkuthDirSort::raw(FsFile& dir, const DirVisitor& visit) {
+    FsFile entry;
+    char   filename[256];
+
+    dir.rewind();
+    while (entry.openNext(&dir, O_RDONLY)) {
+        entry.getName(filename, sizeof(filename));
+        bool is_dir = entry.isDir();
+        entry.close();
+
+        if (scratch(filename, is_dir)) continue;
+
+        DirEntry item = { filename, entry_type(filename, is_dir) };
+
+        if (!visit(item)) return;
+    }
+}
+
+///
+/// Public Function
+///
+
+void MalkuthDirSort::run(SdFs& sd, FsFile& dir, DirOrder order, const DirVisitor& visit) {
+    if (order == DirOrder::RAW) {
+        raw(dir, visit);
+        return;
+    }
+
+    _sd       = &sd;
+    _order    = order;
+    _used     = 0;
+    _count    = 0;
+    _next_run = 0;
+
+    _chunk = (uint8_t*)heap_caps_malloc(_budget, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    if (!_chunk)
+        _chunk = (uint8_t*)heap_caps_malloc(_budget, MALLOC_CAP_8BIT);
+
+    if (!_chunk) {
+        raw(dir, visit);
+        return;
+    }
+
+    std::vector<uint16_t> runs;
+    FsFile entry;
+    char   filename[256];
+    bool   ok = true;
+
+    dir.rewind();
+    while (ok && entry.openNext(&dir, O_RDONLY)) {
+        entry.getName(filename, sizeof(filename));
+        bool is_dir = entry.isDir();
+        entry.close();
+
+        if (scratch(filename, is_dir)) continue;
+
+        EntryType type = entry_type(filename, is_dir);
+
+        if (add(filename, type)) continue;
+
+        // Chunk is full, park it on the card sorted and start the next one
+        if (runs.empty() && !sd.exists(DIRSORT_DIR))
+            sd.mkdir(DIRSORT_DIR);
+
+        uint16_t id = _next_run++;
+        ok = write_run(id);
+        runs.push_back(id);
+
+        _used  = 0;
+        _count = 0;
+        add(filename, type);
+    }
+
+    // Everything fit, which is most directories
+    if (ok && runs.empty()) {
+        sort_chunk();
+        emit_chunk(visit);
+        release();
+        return;
+    }
+
+    if (ok && _count > 0) {
+        uint16_t id = _next_run++;
+        ok = write_run(id);
+        runs.push_back(id);
+    }
+
+    release();
+
+    while (ok && runs.size() > DIRSORT_FAN_IN) {
+        uint16_t id = _next_run++;
+        ok = merge(runs.data(), DIRSORT_FAN_IN, id, visit);
+
+        runs.erase(runs.begin(), runs.begin() + DIRSORT_FAN_IN);
+        runs.push_back(id);
+    }
+
+    if (ok) {
+        merge(runs.data(), runs.size(), -1, visit);
+        return;
+    }
+
+    // Card is full or read-only, leftovers go and the raw order has to do
+    for (uint16_t id : runs)
+        remove_run(id);
+
+    raw(dir, visit);
+}
+
+int MalkuthDirSort::natural_compare(const char* a, const char* b) {
+    const char* start_a = a;
+    const char* start_b = b;
+
+    while (*a && *b) {
+        if (isdigit((uint8_t)*a) && isdigit((uint8_t)*b)) {
+            while (*a == '0') a++;
+            while (*b == '0') b++;
+
+            const char* end_a = a;
+            const char* end_b = b;
+            while (isdigit((uint8_t)*end_a)) end_a++;
+            while (isdigit((uint8_t)*end_b)) end_b++;
+
+            if (end_a - a != end_b - b) return (end_a - a) < (end_b - b) ? -1 : 1;
+
+            int diff = strncmp(a, b, end_a - a);
+            if (diff) return diff;
+
+            a = end_a;
+            b = end_b;
+            continue;
+        }
+
+        int ca = tolower((uint8_t)*a);
+        int cb = tolower((uint8_t)*b);
+        if (ca != cb) return ca - cb;
+
+        a++;
+        b++;
+    }
+
+    if (*a || *b) return *a ? 1 : -1;
+
+    // Only case or leading zeros differ, keep it deterministic
+    return strcmp(start_a, start_b);
+}
+
+int MalkuthDirSort::compare(DirOrder order, EntryType type_a, const char* a, EntryType type_b, const char* b) {
+    uint8_t group_a, group_b;
+
+    if (order == DirOrder::GROUPED) {
+        group_a = (uint8_t)type_a;
+        group_b = (uint8_t)type_b;
+    }
+    else {
+        group_a = type_a == EntryType::DIRECTORY ? 0 : 1;
+        group_b = type_b == EntryType::DIRECTORY ? 0 : 1;
+    }
+
+    if (group_a != group_b) return group_a < group_b ? -1 : 1;
+    return natural_compare(a, b);
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <Arduino.h>
+#include <SdFat.h>
+#include <functional>
+
+#include "malkuth_helper.h"
+
+// Sorted runs of directories too big for DIRSORT_BUDGET go here
+#ifndef DIRSORT_DIR
+    #define DIRSORT_DIR "/.malkuth"
+#endif
+
+// RAM for one sorted chunk of names, a bigger directory is sorted in
+// chunks on the card and merged back
+#ifndef DIRSORT_BUDGET
+    #define DIRSORT_BUDGET (1024 * 16)
+#endif
+
+// Runs merged at once, each one holds a sector sized read buffer
+#ifndef DIRSORT_FAN_IN
+    #define DIRSORT_FAN_IN 8
+#endif
+
+enum class DirOrder : uint8_t {
+    RAW,        // whatever order the FAT/exFAT directory has
+    NATURAL,    // directories first, then "track 2" before "track 10"
+    GROUPED     // directories, audio, images, the rest, each one natural
+};
+
+// Return false to stop the walk
+using DirVisitor = std::function<bool(const DirEntry&)>;
+
+/// Streams the entries of a directory in a given order without ever holding
+/// more than DIRSORT_BUDGET bytes of names.
+/// Small directories (the usual case) are sorted in one chunk in RAM. Bigger
+/// ones are cut into sorted runs written to DIRSORT_DIR, merged
+/// DIRSORT_FAN_IN at a time until one pass can feed the visitor.
+/// The caller holds the MalkuthFs lock for the whole walk.
+class MalkuthDirSort {
+private:
+    struct Run;
+
+    SdFs*       _sd         = nullptr;
+    uint8_t*    _chunk      = nullptr;
+    size_t      _budget     = 0;
+    size_t      _used       = 0;        // names grow from the front
+    uint16_t    _count      = 0;        // offsets grow from the back
+    DirOrder    _order      = DirOrder::NATURAL;
+    uint16_t    _next_run   = 0;
+
+    uint16_t*   offsets() { return (uint16_t*)(_chunk + _budget) - _count; }
+
+    bool    add(const char* name, EntryType type);
+    void    sort_chunk();
+    bool    emit_chunk(const DirVisitor& visit);
+    bool    write_run(uint16_t id);
+    bool    merge(const uint16_t* runs, uint8_t count, int32_t output, const DirVisitor& visit);
+    void    remove_run(uint16_t id);
+    void    release();
+
+    static void run_path(uint16_t id, char* path, size_t size);
+    static bool scratch(const char* name, bool is_dir);
+    static void raw(FsFile& dir, const DirVisitor& visit);
+
+public:
+    // Offsets into a chunk are 16 bit (and have to stay aligned)
+    explicit MalkuthDirSort(size_t budget = DIRSORT_BUDGET) : _budget((budget > 0xFFFE ? 0xFFFE : budget) & ~(size_t)1) {}
+    ~MalkuthDirSort() { release(); }
+
+    // Every entry goes to visit until it returns false. Without RAM for a
+    // chunk or room on the card for runs, the raw order is all there is
+    void run(SdFs& sd, FsFile& dir, DirOrder order, const DirVisitor& visit);
+
+    // < 0, 0, > 0 like strcmp, digit runs compare as numbers
+    static int natural_compare(const char* a, const char* b);
+    static int compare(DirOrder order, EntryType type_a, const char* a, EntryType type_b, const char* b);
+};
@@ -1,5 +1,6 @@
 #include "malkuth_display.h"
 #include "malkuth_helper.h"
+#include "malkuth_cover.h"
 
 ///
 /// Private Function
@@ -15,20 +16,62 @@ void MalkuthDisplay::task_display(void* parameters) {
     self->_tft.setAttribute(UTF8_SWITCH, true);
     self->_tft.setAttribute(PSRAM_ENABLE, true);
 
+    self->_fonts.begin(self->_tft);
+
     self->set_brightness(self->_brightness);
     self->_ts_exist = self->_ts.begin(40, 16, 15);
 
+    self->_dirty.set_bounds({ 0, 0, (uint16_t)self->_tft.width(), (uint16_t)self->_tft.height() });
+    self->_scene.reserve(32);
+
+    const TickType_t settle  = pdMS_TO_TICKS(SCENE_SETTLE_MS);
+    const TickType_t latency = pdMS_TO_TICKS(SCENE_MAX_LATENCY_MS);
+
     while (true) {
-        xQueueReceive(self->_queue_display, &cmd, portMAX_DELAY);
-        self->handle_command(self, cmd);
-        vTaskDelay(1);
+        // Commands come in bursts, compose once the burst is over (or has
+        // been going on for long enough)
+        TickType_t wait = portMAX_DELAY;
+        if (!self->_dirty.empty()) {
+            TickType_t age = xTaskGetTickCount() - self->_dirty_since;
+            wait = (age >= latency) ? 0 : std::min(settle, latency - age);
+        }
+
+        // Take everything already queued in one wakeup
+        bool received = xQueueReceive(self->_queue_display, &cmd, wait) == pdTRUE;
+        if (received) {
+            do {
+                self->handle_command(self, cmd);
+                self->release_command(self, cmd);
+                self->_commands_handled++;
+            } while (xQueueReceive(self->_queue_display, &cmd, 0) == pdTRUE);
+        }
+
+        if (self->_dirty.empty()) continue;
+
+        if (!received || xTaskGetTickCount() - self->_dirty_since >= latency)
+            compose(self);
     }
 }
 
 void MalkuthDisplay::handle_command(MalkuthDisplay* self, const DisplayCommand& cmd) {
+  switch (cmd.type) {
+    case DisplayType::CLEAR:
+        scene_clear(self);
+        return;
+    case DisplayType::REMOVE:
+        scene_remove(self, cmd.widget);
+        return;
+    default:
+        break;
+  }
+
+  SceneNode node;
+  if (scene_node(self, cmd, node) && scene_add(self, node)) return;
+
+  // Not something the scene can hold (or it is full), straight to the panel
   switch (cmd.type) {
     case DisplayType::IMAGE: 
-        draw_image(self, cmd); 
+        draw_image(self, cmd, node.text.c_str()); 
         break;
     case DisplayType::TEXT: 
         draw_text(self, cmd); 
@@ -39,8 +82,23 @@ void MalkuthDisplay::handle_command(MalkuthDisplay* self, const DisplayCommand&
     case DisplayType::BAR:
         draw_bar(self, cmd);
         break;
-    case DisplayType::CLEAR: 
-        self->_tft.fillScreen(self->_bg_color); 
+    default:
+        break;
+  }
+}
+
+// Commands come in whatever order producers sent them, the arena takes the
+// strings back in any order
+void MalkuthDisplay::release_command(MalkuthDisplay* self, const DisplayCommand& cmd) {
+  switch (cmd.type) {
+    case DisplayType::TEXT:
+        self->_arena.release(cmd.payload.text.string);
+        break;
+    case DisplayType::IMAGE:
+        if (cmd.payload.image.type != ImageType::FLASH)
+            self->_arena.release(cmd.payload.image.path);
+        break;
+    default:
         break;
   }
 }
@@ -87,7 +145,7 @@ int16_t MalkuthDisplay::calculate_anchor_y(Anchor anchor, uint16_t height){
     }
 }
 
-void MalkuthDisplay::draw_image(MalkuthDisplay* self, const DisplayCommand& cmd) {
+void MalkuthDisplay::draw_image(MalkuthDisplay* self, const DisplayCommand& cmd, const char* path) {
     switch (cmd.payload.image.type) {
         case ImageType::FLASH:
             draw_png_flash(self, cmd);
@@ -98,15 +156,32 @@ void MalkuthDisplay::draw_image(MalkuthDisplay* self, const DisplayCommand& cmd)
             break;
             
         case ImageType::JPG:
-            TODO("Render JPG from sd card");
-            // draw_jpg(self, cmd);
+            draw_jpg(self, cmd, path);
+            break;
+
+        case ImageType::THUMB:
+            draw_thumb(self, cmd);
+            break;
+
+        default:
             break;
     }
 }
 
 void MalkuthDisplay::draw_png_flash(MalkuthDisplay *self, const DisplayCommand&cmd) {
     const auto& img = cmd.payload.image;
-    
+
+    // Inflate once, every draw after that is a straight blit from PSRAM
+    MalkuthImageCache::Entry* entry = self->_image_cache.find(img.data);
+    if (!entry)
+        entry = cache_png_flash(self, cmd);
+
+    if (entry) {
+        draw_cached(self, *entry, cmd);
+        return;
+    }
+
+    // Doesn't fit (or no PSRAM), decode straight to the panel like before
     if (img.size_x != 0) {
 
       self->_constrain_x_start  = img.offset_x; 
@@ -135,6 +210,80 @@ void MalkuthDisplay::draw_png_flash(MalkuthDisplay *self, const DisplayCommand&c
     }
 }
 
+MalkuthImageCache::Entry* MalkuthDisplay::cache_png_flash(MalkuthDisplay* self, const DisplayCommand& cmd) {
+    const auto& img = cmd.payload.image;
+
+    if (self->_png.openFLASH((uint8_t*)img.data, img.data_size, render_png_cache) != PNG_SUCCESS)
+        return nullptr;
+
+    MalkuthImageCache::Entry* entry = self->_image_cache.insert(
+        img.data, self->_png.getWidth(), self->_png.getHeight()
+    );
+
+    if (!entry) {
+        self->_png.close();
+        return nullptr;
+    }
+
+    self->_cache_fill = entry;
+    int res = self->_png.decode(self, 0);
+    self->_png.close();
+    self->_cache_fill = nullptr;
+
+    if (res != PNG_SUCCESS) {
+        self->_image_cache.remove(img.data);
+        return nullptr;
+    }
+
+    return entry;
+}
+
+// Whole image, or the sub-rect of it sitting at the same place on screen
+void MalkuthDisplay::draw_cached(MalkuthDisplay* self, const MalkuthImageCache::Entry& entry, const DisplayCommand& cmd) {
+    const auto& img = cmd.payload.image;
+    TFT_eSPI&   tft = self->_tft;
+
+    uint16_t x = 0, y = 0;
+    uint16_t w = entry.width, h = entry.height;
+
+    if (img.size_x != 0) {
+        if (img.offset_x >= entry.width || img.offset_y >= entry.height) return;
+
+        x = img.offset_x;
+        y = img.offset_y;
+        w = std::min<uint16_t>(img.size_x, entry.width  - x);
+        h = std::min<uint16_t>(img.size_y, entry.height - y);
+    }
+
+    tft.startWrite();
+
+    if (w == entry.width) {
+        tft.pushImage(x, y, w, h, entry.pixels + (uint32_t)y * entry.width);
+    }
+    else {
+        for (uint16_t row = y; row < y + h; row++)
+            tft.pushImage(x, row, w, 1, entry.pixels + (uint32_t)row * entry.width + x);
+    }
+
+    tft.endWrite();
+}
+
+int MalkuthDisplay::render_png_cache(PNGDRAW* png_draw) {
+    MalkuthDisplay* self = static_cast<MalkuthDisplay*>(png_draw->pUser);
+    auto* entry = self->_cache_fill;
+
+    if (!entry || png_draw->y >= entry->height) return 0;
+
+    self->_png.getLineAsRGB565(
+        png_draw, 
+        entry->pixels + (uint32_t)png_draw->y * entry->width, 
+        PNG_RGB565_BIG_ENDIAN, 
+        0xffffffff
+    );
+
+    return 1;
+}
+
 int MalkuthDisplay::render_png(PNGDRAW* png_draw) {
     MalkuthDisplay* self = static_cast<MalkuthDisplay*>(png_draw->pUser);
     uint16_t line_buffer[MAX_IMAGE_WIDTH];
@@ -169,50 +318,120 @@ int MalkuthDisplay::render_png_constrained(PNGDRAW* png_draw) {
     return 1;
 }
 
-// void MalkuthDisplay::draw_jpg(MalkuthDisplay *self, const DisplayCommand&cmd){
-//     const auto& img = cmd.payload.image;
+// Header check and one read of the pixels, the card is only touched when
+// the path changes. Scene nodes still showing the old thumbnail go first,
+// their pixels are about to be overwritten
+bool MalkuthDisplay::load_thumb(MalkuthDisplay* self, const char* path) {
+    uint32_t key = hash_path(path);
+    if (self->_thumb && self->_thumb_key == key) return true;
+    if (!self->_fs) return false;
+
+    auto& scene = self->_scene;
+    for (auto it = scene.begin(); it != scene.end();) {
+        if (it->cmd.type == DisplayType::IMAGE && it->cmd.payload.image.type == ImageType::THUMB) {
+            scene_dirty(self, it->bounds);
+            it = scene.erase(it);
+        } else {
+            ++it;
+        }
+    }
 
-//     _jpg_self = self;
-//     FsFile _file = self->_sd->open(img.path, O_READ);
+    self->_thumb_key = 0;
 
-//     self->_jpg_state.dst_x = img.offset_x;
-//     self->_jpg_state.dst_y = img.offset_y;
-//     self->_jpg_state.dst_w = img.size_x;
-//     self->_jpg_state.dst_h = img.size_y;
+    MalkuthCovers::Header header;
+    FsFile file;
 
-//     self->_jpg.setCallback(render_jpg);
+    self->_fs->lock();
 
-//     // Pick closest scale
-//     uint8_t scale = 1;
-//     uint16_t w, h;
-// ;
-//     self->_jpg.getJpgSize(&w, &h, _file);
+    bool ok = file.open(path, O_RDONLY) &&
+              file.read(&header, sizeof(header)) == sizeof(header) &&
+              memcmp(header.magic, "MKTH", 4) == 0 &&
+              header.width  > 0 && header.width  <= self->_tft.width() &&
+              header.height > 0 && header.height <= self->_tft.height();
 
-//     Serial.printf("width = %d, height = %d\n", w, h);
+    self->_fs->unlock();
 
-//     if (w > img.size_x * 4) scale = 4;
-//     else if (w > img.size_x * 2) scale = 2;
+    size_t bytes = (size_t)header.width * header.height * sizeof(uint16_t);
 
-//     self->_jpg.setJpgScale(scale);
+    if (ok && (header.width != self->_thumb_width || header.height != self->_thumb_height)) {
+        heap_caps_free(self->_thumb);
+        self->_thumb = (uint16_t*)heap_caps_malloc(bytes, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
 
-//     self->_tft.startWrite();
-//     self->_jpg.drawJpg(0, 0, _file);
-//     self->_tft.endWrite();
-// }
+        self->_thumb_width  = self->_thumb ? header.width  : 0;
+        self->_thumb_height = self->_thumb ? header.height : 0;
+    }
 
-void MalkuthDisplay::draw_text(MalkuthDisplay* self, const DisplayCommand& cmd) {
+    // Pixels piece by piece, a refill can get the card in between
+    ok = ok && self->_thumb && self->_fs->read(file, self->_thumb, bytes, SdClass::UI) == bytes;
+
+    self->_fs->lock();
+    if (file.isOpen()) file.close();
+    self->_fs->unlock();
+
+    if (ok) self->_thumb_key = key;
+    return ok;
+}
+
+// Thumbnails sit at offset, size only clips them
+bool MalkuthDisplay::thumb_box(MalkuthDisplay* self, const DisplayCommand& cmd, SceneRect& box) {
+    const auto& img = cmd.payload.image;
+
+    if (!load_thumb(self, self->_arena.get(img.path))) return false;
+
+    box = {
+        (int16_t)img.offset_x, (int16_t)img.offset_y,
+        img.size_x ? std::min(img.size_x, self->_thumb_width)  : self->_thumb_width,
+        img.size_y ? std::min(img.size_y, self->_thumb_height) : self->_thumb_height
+    };
+
+    return !box.empty();
+}
+
+void MalkuthDisplay::draw_thumb(MalkuthDisplay* self, const DisplayCommand& cmd) {
+    SceneRect box;
+    if (!thumb_box(self, cmd, box)) return;
+
+    TFT_eSPI& tft = self->_tft;
+    tft.startWrite();
+
+    if (box.w == self->_thumb_width) {
+        tft.pushImage(box.x, box.y, box.w, box.h, self->_thumb);
+    }
+    else {
+        for (uint16_t row = 0; row < box.h; row++)
+            tft.pushImage(box.x, box.y + row, box.w, 1, self->_thumb + (uint32_t)row * self->_thumb_width);
+    }
+
+    tft.endWrite();
+}
+
+// Fills the whole size_x x size_y box, the rows go to the panel as they
+// come out of the decoder
+void MalkuthDisplay::draw_jpg(MalkuthDisplay *self, const DisplayCommand&cmd, const char* path){
+    SceneRect box;
+    if (!image_box(self, cmd, box)) return;
+
+    self->_jpg_box = box;
+
+    self->_tft.startWrite();
+    self->_jpg.drawJpgFit(path, box.w, box.h, render_jpg, self);
+    self->_tft.endWrite();
+}
+
+// Where a text command lands, the padded box it owns and the line it sits on
+bool MalkuthDisplay::text_box(MalkuthDisplay* self, const DisplayCommand& cmd, const char* string, MalkuthFontCache::Face*& face, SceneRect& box, SceneRect& ink) {
   const auto& txt = cmd.payload.text;
-  if (txt.string == nullptr || txt.string[0] == '\0') {
-    return;
+  if (string[0] == '\0') {
+    return false;
   }
 
   TFT_eSPI& tft = self->_tft;
-  TFT_eSprite spr(&tft);
+  face = self->_fonts.face(txt.typeface);
 
-  spr.loadFont(txt.typeface);
+  if (!face) return false;
 
-  int16_t tw = spr.textWidth(txt.string);
-  int16_t th = spr.fontHeight();
+  int16_t tw = self->_fonts.text_width(*face, string);
+  int16_t th = self->_fonts.font_height(*face);
 
   const uint8_t padding = 4;
   uint16_t sprite_w = tw + 2 * padding;
@@ -223,25 +442,47 @@ void MalkuthDisplay::draw_text(MalkuthDisplay* self, const DisplayCommand& cmd)
   if (sprite_h > tft.height())
     sprite_h = tft.height();
 
-  spr.createSprite(sprite_w, sprite_h);
-  spr.setTextColor(txt.color, self->_bg_color, false);
+  box.x = txt.offset_x + self->calculate_anchor_x(txt.anchor, sprite_w);
+  box.y = txt.offset_y + self->calculate_anchor_y(txt.anchor, sprite_h);
+  box.w = sprite_w;
+  box.h = sprite_h;
 
-  spr.fillSprite(TFT_TRANSPARENT);
-  spr.setTextDatum(MC_DATUM);
-  spr.setTextWrap(false, true);
-  
-  spr.drawString(txt.string, sprite_w / 2, sprite_h / 2);
+  ink.x = box.x + sprite_w / 2 - tw / 2;
+  ink.y = box.y + sprite_h / 2 - th / 2;
+  ink.w = tw;
+  ink.h = th;
+
+  return true;
+}
 
-  int16_t dest_x = txt.offset_x + self->calculate_anchor_x(txt.anchor, sprite_w);
-  int16_t dest_y = txt.offset_y + self->calculate_anchor_y(txt.anchor, sprite_h);;
+void MalkuthDisplay::draw_text(MalkuthDisplay* self, const DisplayCommand& cmd) {
+  const auto& txt = cmd.payload.text;
+
+  TFT_eSPI& tft = self->_tft;
+  MalkuthFontCache::Face* face;
+  SceneRect box, ink;
+
+  const char* string = self->_arena.get(txt.string);
+
+  if (!text_box(self, cmd, string, face, box, ink)) return;
+
+  uint16_t* canvas = self->_fonts.canvas(box.w, box.h);
+  if (!canvas) return;
+
+  // Glyphs come out of the cache already blended, composing is a copy
+  std::fill(canvas, canvas + box.w * box.h, (uint16_t)((TFT_TRANSPARENT >> 8) | (TFT_TRANSPARENT << 8)));
+
+  self->_fonts.draw(
+    *face, string, 
+    txt.color, self->_bg_color, 
+    canvas, box.w, box.h, 
+    ink.x - box.x, ink.y - box.y
+  );
 
   if (!txt.transparent)
-    spr.pushSprite(dest_x, dest_y, self->_bg_color);
+    tft.pushImage(box.x, box.y, box.w, box.h, canvas, self->_bg_color);
   else
-    spr.pushSprite(dest_x, dest_y, TFT_TRANSPARENT);
-
-  spr.unloadFont();
-  spr.deleteSprite();
+    tft.pushImage(box.x, box.y, box.w, box.h, canvas, (uint16_t)TFT_TRANSPARENT);
 }
 
 void MalkuthDisplay::draw_object(MalkuthDisplay* self, const DisplayCommand& cmd) {
@@ -280,54 +521,394 @@ void MalkuthDisplay::draw_bar(MalkuthDisplay* self, const DisplayCommand& cmd) {
     }
 }
 
-// bool MalkuthDisplay::render_jpg(int16_t x, int16_t y, uint16_t w, uint16_t h, uint16_t* bitmap) {
-//     if (!_jpg_self) return false;
+///
+/// Scene
+///
+
+// The part of a rounded rect that is solid from top to bottom
+static SceneRect opaque_part(const SceneRect& rect, uint16_t radius) {
+    if (radius * 2 >= rect.w) return SceneRect();
+    return { (int16_t)(rect.x + radius), rect.y, (uint16_t)(rect.w - radius * 2), rect.h };
+}
+
+bool MalkuthDisplay::image_box(MalkuthDisplay* self, const DisplayCommand& cmd, SceneRect& box) {
+    const auto& img = cmd.payload.image;
+    if (img.type == ImageType::THUMB) return thumb_box(self, cmd, box);
+
+    // Fit-to-box, the box is the size it gets
+    if (img.type == ImageType::JPG) {
+        if (!self->_fs || !img.size_x || !img.size_y) return false;
+
+        box = { (int16_t)img.offset_x, (int16_t)img.offset_y, img.size_x, img.size_y };
+        return true;
+    }
+
+    if (img.type != ImageType::FLASH || !img.data) return false;
+
+    uint16_t width, height;
+
+    MalkuthImageCache::Entry* entry = self->_image_cache.find(img.data);
+    if (!entry)
+        entry = cache_png_flash(self, cmd);
+
+    if (entry) {
+        width  = entry->width;
+        height = entry->height;
+    }
+    else {
+        if (self->_png.openFLASH((uint8_t*)img.data, img.data_size, render_png_compose) != PNG_SUCCESS)
+            return false;
+
+        width  = self->_png.getWidth();
+        height = self->_png.getHeight();
+        self->_png.close();
+    }
+
+    box = { 0, 0, width, height };
+
+    // Sub-rect redraws sit at the same place on screen as in the image
+    if (img.size_x != 0)
+        box = box.intersect({ (int16_t)img.offset_x, (int16_t)img.offset_y, img.size_x, img.size_y });
+
+    return !box.empty();
+}
+
+bool MalkuthDisplay::scene_node(MalkuthDisplay* self, const DisplayCommand& cmd, SceneNode& node) {
+    node.widget = cmd.widget;
+    node.shape  = 0;
+    node.cmd    = cmd;
+
+    switch (cmd.type) {
+        case DisplayType::IMAGE: {
+            // compose() decodes long after the arena slot is released
+            if (cmd.payload.image.type == ImageType::JPG || cmd.payload.image.type == ImageType::THUMB)
+                node.text = self->_arena.get(cmd.payload.image.path);
 
-//     auto& s = _jpg_self->_jpg_state;
+            if (!image_box(self, cmd, node.bounds)) return false;
 
-//     // Offset shift
-//     int16_t draw_x = s.dst_x + x;
-//     int16_t draw_y = s.dst_y + y;
+            node.ink   = node.bounds;
+            node.cover = node.bounds;
+            return true;
+        }
 
-//     // Clipping
-//     int16_t clip_x2 = s.dst_x + s.dst_w;
-//     int16_t clip_y2 = s.dst_y + s.dst_h;
+        case DisplayType::TEXT: {
+            MalkuthFontCache::Face* face;
+            const char* string = self->_arena.get(cmd.payload.text.string);
 
-//     // If completely outside
-//     if (draw_x >= clip_x2 || draw_y >= clip_y2) return true;
-//     if (draw_x + w <= s.dst_x || draw_y + h <= s.dst_y) return true;
+            if (!text_box(self, cmd, string, face, node.bounds, node.ink)) return false;
 
-//     // Partial clipping
-//     int16_t skip_x = 0;
-//     int16_t skip_y = 0;
+            node.text  = string;
+
+            node.cover = cmd.payload.text.transparent ? SceneRect() : node.bounds;
+            return true;
+        }
 
-//     if (draw_x < s.dst_x) {
-//         skip_x = s.dst_x - draw_x;
-//         draw_x = s.dst_x;
-//         w -= skip_x;
-//     }
+        case DisplayType::OBJECT: {
+            const auto& obj = cmd.payload.object;
+            if (obj.size_x == 0 || obj.size_y == 0) return false;
+
+            uint16_t w = std::min<uint16_t>(obj.size_x, self->_tft.width());
+            uint16_t h = std::min<uint16_t>(obj.size_y, self->_tft.height());
+
+            uint8_t radius = obj.roundness;
+            if (obj.roundness < 0)
+                radius = std::min(obj.size_x, h) / 2;
+
+            node.bounds = {
+                (int16_t)(obj.offset_x + self->calculate_anchor_x(obj.anchor, w)),
+                (int16_t)(obj.offset_y + self->calculate_anchor_y(obj.anchor, h)),
+                w, h
+            };
+            node.ink   = node.bounds;
+            node.cover = opaque_part(node.bounds, radius);
+            node.shape = 0x100 | (uint8_t)obj.roundness;
+            return true;
+        }
 
-//     if (draw_y < s.dst_y) {
-//         skip_y = s.dst_y - draw_y;
-//         draw_y = s.dst_y;
-//         h -= skip_y;
-//     }
+        case DisplayType::BAR: {
+            const auto& bar = cmd.payload.bar;
+            if (bar.size_x == 0 || bar.size_y == 0) return false;
 
-//     if (draw_x + w > clip_x2) w = clip_x2 - draw_x;
-//     if (draw_y + h > clip_y2) h = clip_y2 - draw_y;
+            node.bounds = { bar.offset_x, bar.offset_y, bar.size_x, bar.size_y };
+            node.ink    = node.bounds;
+            node.cover  = opaque_part(node.bounds, bar.roundness);
+            node.shape  = 0x100 | (uint8_t)bar.roundness;
+            return true;
+        }
 
-//     if (w == 0 || h == 0) return true;
+        default:
+            return false;
+    }
+}
 
-//     _jpg_self->_tft.pushImage(
-//         draw_x,
-//         draw_y,
-//         w,
-//         h,
-//         bitmap + skip_y * w + skip_x
-//     );
+bool MalkuthDisplay::scene_add(MalkuthDisplay* self, const SceneNode& node) {
+    if (node.widget) scene_remove(self, node.widget);
 
-//     return 1;
-// }
+    // Whatever the new node hides completely is never going to show again,
+    // this is what keeps "erase then redraw" from piling up
+    auto& scene = self->_scene;
+    scene.erase(std::remove_if(scene.begin(), scene.end(), [&](const SceneNode& below) {
+        if (node.shape && node.shape == below.shape && node.bounds == below.bounds) return true;
+        return node.cover.contains(below.ink);
+    }), scene.end());
+
+    if (scene.size() >= SCENE_MAX_NODES) {
+        Serial.println("Display scene is full, drawing straight to the panel");
+        return false;
+    }
+
+    scene.push_back(node);
+    scene_dirty(self, node.bounds);
+    return true;
+}
+
+void MalkuthDisplay::scene_remove(MalkuthDisplay* self, uint16_t widget) {
+    if (!widget) return;
+
+    auto& scene = self->_scene;
+    for (auto it = scene.begin(); it != scene.end(); ++it) {
+        if (it->widget == widget) {
+            scene_dirty(self, it->bounds);
+            scene.erase(it);
+            return;
+        }
+    }
+}
+
+void MalkuthDisplay::scene_clear(MalkuthDisplay* self) {
+    self->_scene.clear();
+    self->_dirty.clear();
+    scene_dirty(self, { 0, 0, (uint16_t)self->_tft.width(), (uint16_t)self->_tft.height() });
+}
+
+void MalkuthDisplay::scene_dirty(MalkuthDisplay* self, const SceneRect& rect) {
+    if (self->_dirty.empty())
+        self->_dirty_since = xTaskGetTickCount();
+
+    self->_dirty.add(rect);
+}
+
+void MalkuthDisplay::compose(MalkuthDisplay* self) {
+    for (uint8_t i = 0; i < self->_dirty.count(); i++)
+        compose_rect(self, self->_dirty[i]);
+
+    self->_dirty.clear();
+}
+
+// Everything under rect goes into one sprite and out with one pushImage.
+// Without room for the whole rect it goes out in horizontal bands instead
+void MalkuthDisplay::compose_rect(MalkuthDisplay* self, const SceneRect& rect) {
+    TFT_eSprite& frame = self->_frame;
+    const auto&  scene = self->_scene;
+
+    uint16_t band = rect.h;
+    while (band > 0 && !frame.createSprite(rect.w, band))
+        band /= 2;
+
+    if (band == 0) return;
+
+    for (int32_t y = rect.y; y < rect.bottom(); y += band) {
+        SceneRect area = { rect.x, (int16_t)y, rect.w, (uint16_t)std::min<int32_t>(band, rect.bottom() - y) };
+        self->_compose_area = area;
+
+        // Nothing under the topmost node covering the whole area can show
+        size_t first   = 0;
+        bool   covered = false;
+        for (size_t i = scene.size(); i-- > 0;) {
+            if (scene[i].cover.contains(area)) {
+                first   = i;
+                covered = true;
+                break;
+            }
+        }
+
+        if (!covered)
+            frame.fillSprite(self->_bg_color);
+
+        for (size_t i = first; i < scene.size(); i++) {
+            if (scene[i].bounds.intersects(area))
+                compose_node(self, scene[i]);
+        }
+
+        self->_tft.startWrite();
+        self->_tft.pushImage(area.x, area.y, area.w, area.h, (uint16_t*)frame.getPointer());
+        self->_tft.endWrite();
+
+        self->_composed_pixels += area.area();
+    }
+
+    frame.deleteSprite();
+}
+
+void MalkuthDisplay::compose_node(MalkuthDisplay* self, const SceneNode& node) {
+    TFT_eSprite&     frame = self->_frame;
+    const SceneRect& area  = self->_compose_area;
+
+    int16_t x = node.bounds.x - area.x;
+    int16_t y = node.bounds.y - area.y;
+
+    switch (node.cmd.type) {
+        case DisplayType::IMAGE:
+            compose_image(self, node);
+            break;
+
+        case DisplayType::TEXT: {
+            const auto& txt = node.cmd.payload.text;
+
+            MalkuthFontCache::Face* face = self->_fonts.face(txt.typeface);
+            if (!face) break;
+
+            if (!txt.transparent)
+                frame.fillRect(x, y, node.bounds.w, node.bounds.h, self->_bg_color);
+
+            self->_fonts.draw(
+                *face, node.text.c_str(),
+                txt.color, self->_bg_color,
+                (uint16_t*)frame.getPointer(), frame.width(), frame.height(),
+                node.ink.x - area.x, node.ink.y - area.y
+            );
+            break;
+        }
+
+        case DisplayType::OBJECT: {
+            const auto& obj = node.cmd.payload.object;
+
+            uint8_t radius = obj.roundness;
+            if (obj.roundness < 0)
+                radius = std::min(obj.size_x, node.bounds.h) / 2;
+
+            frame.fillRoundRect(x, y, node.bounds.w, node.bounds.h, radius, obj.color);
+            break;
+        }
+
+        case DisplayType::BAR: {
+            const auto& bar = node.cmd.payload.bar;
+
+            uint16_t fill_w = map(bar.value, 0, 100, 0, bar.size_x);
+
+            frame.fillRoundRect(x, y, bar.size_x, bar.size_y, bar.roundness, bar.color_bg);
+            if (bar.value > 0)
+                frame.fillRoundRect(x, y, fill_w, bar.size_y, bar.roundness, bar.color_fill);
+            break;
+        }
+
+        default:
+            break;
+    }
+}
+
+void MalkuthDisplay::compose_image(MalkuthDisplay* self, const SceneNode& node) {
+    const auto&      img   = node.cmd.payload.image;
+    const SceneRect& area  = self->_compose_area;
+    TFT_eSprite&     frame = self->_frame;
+
+    SceneRect clip = node.bounds.intersect(area);
+    if (clip.empty()) return;
+
+    if (img.type == ImageType::THUMB) {
+        uint16_t* pixels = (uint16_t*)frame.getPointer();
+
+        for (int32_t row = clip.y; row < clip.bottom(); row++) {
+            memcpy(
+                pixels + (row - area.y) * frame.width() + (clip.x - area.x),
+                self->_thumb + (row - node.bounds.y) * self->_thumb_width + (clip.x - node.bounds.x),
+                clip.w * sizeof(uint16_t)
+            );
+        }
+        return;
+    }
+
+    // Decoded again for every area it's in, only the rows inside are kept
+    if (img.type == ImageType::JPG) {
+        self->_compose_clip = clip;
+        self->_jpg_box      = node.bounds;
+
+        self->_jpg.drawJpgFit(node.text.c_str(), node.bounds.w, node.bounds.h, render_jpg_compose, self);
+        return;
+    }
+
+    MalkuthImageCache::Entry* entry = self->_image_cache.find(img.data);
+    if (!entry)
+        entry = cache_png_flash(self, node.cmd);
+
+    if (entry) {
+        uint16_t* pixels = (uint16_t*)frame.getPointer();
+
+        for (int32_t row = clip.y; row < clip.bottom(); row++) {
+            memcpy(
+                pixels + (row - area.y) * frame.width() + (clip.x - area.x),
+                entry->pixels + row * entry->width + clip.x,
+                clip.w * sizeof(uint16_t)
+            );
+        }
+        return;
+    }
+
+    // Too big for the cache, inflate it again and keep the rows in the area
+    self->_compose_clip = clip;
+
+    if (self->_png.openFLASH((uint8_t*)img.data, img.data_size, render_png_compose) == PNG_SUCCESS) {
+        self->_png.decode(self, 0);
+        self->_png.close();
+    }
+}
+
+int MalkuthDisplay::render_png_compose(PNGDRAW* png_draw) {
+    MalkuthDisplay* self = static_cast<MalkuthDisplay*>(png_draw->pUser);
+
+    const SceneRect& clip = self->_compose_clip;
+    const SceneRect& area = self->_compose_area;
+
+    if (png_draw->y < clip.y)         return 1;
+    if (png_draw->y >= clip.bottom()) return 0;
+
+    uint16_t line_buffer[MAX_IMAGE_WIDTH];
+    self->_png.getLineAsRGB565(png_draw, line_buffer, PNG_RGB565_BIG_ENDIAN, 0xffffffff);
+
+    TFT_eSprite& frame = self->_frame;
+    uint16_t*    dst   = (uint16_t*)frame.getPointer() + (png_draw->y - area.y) * frame.width() + (clip.x - area.x);
+
+    memcpy(dst, line_buffer + clip.x, clip.w * sizeof(uint16_t));
+    return 1;
+}
+
+void MalkuthDisplay::lock_jpg(void* user, bool take) {
+    MalkuthDisplay* self = static_cast<MalkuthDisplay*>(user);
+
+    if (take) self->_fs->lock();
+    else      self->_fs->unlock();
+}
+
+bool MalkuthDisplay::render_jpg(void* user, uint16_t y, uint16_t w, uint16_t* row) {
+    MalkuthDisplay* self = static_cast<MalkuthDisplay*>(user);
+
+    self->_tft.pushImage(self->_jpg_box.x, self->_jpg_box.y + y, w, 1, row);
+    return true;
+}
+
+// Rows above the clip are dropped, the one below it ends the decode
+bool MalkuthDisplay::render_jpg_compose(void* user, uint16_t y, uint16_t w, uint16_t* row) {
+    MalkuthDisplay* self = static_cast<MalkuthDisplay*>(user);
+
+    const SceneRect& clip = self->_compose_clip;
+    const SceneRect& area = self->_compose_area;
+    int32_t          line = self->_jpg_box.y + y;
+
+    if (line < clip.y)         return true;
+    if (line >= clip.bottom()) return false;
+
+    // Only the part of the clip the decoded row covers, a fitted picture can
+    // come out narrower than its node
+    int32_t from = std::max<int32_t>(clip.x, self->_jpg_box.x);
+    int32_t to   = std::min<int32_t>(clip.right(), self->_jpg_box.x + w);
+    if (from >= to) return true;
+
+    TFT_eSprite& frame = self->_frame;
+    uint16_t*    dst   = (uint16_t*)frame.getPointer() + (line - area.y) * frame.width() + (from - area.x);
+
+    memcpy(dst, row + (from - self->_jpg_box.x), (to - from) * sizeof(uint16_t));
+    return true;
+}
 
 void MalkuthDisplay::set_brightness(uint8_t percent) {
   if (percent > 100)
@@ -341,7 +922,8 @@ void MalkuthDisplay::set_brightness(uint8_t percent) {
 /// Public Function
 ///
 void MalkuthDisplay::init() {
-    _queue_display = xQueueCreate(64, sizeof(DisplayCommand));
+    _queue_display = xQueueCreate(DISPLAY_QUEUE_LENGTH, sizeof(DisplayCommand));
+    _arena.init(TEXT_ARENA_SIZE, TEXT_ARENA_SLOTS);
 
     xTaskCreate(
         task_display,
@@ -354,7 +936,8 @@ void MalkuthDisplay::init() {
 }
 
 void MalkuthDisplay::init(const uint8_t core) {
-    _queue_display = xQueueCreate(64, sizeof(DisplayCommand));
+    _queue_display = xQueueCreate(DISPLAY_QUEUE_LENGTH, sizeof(DisplayCommand));
+    _arena.init(TEXT_ARENA_SIZE, TEXT_ARENA_SLOTS);
 
     xTaskCreatePinnedToCore(
         task_display,
@@ -525,31 +1108,41 @@ void MalkuthDisplay::_buttons_check() {
     if (check(_buttons_temp))   return;
 }
 
+// While the queue has room the command goes in under the lock too, which
+// keeps strings and commands in the same order. A full queue is waited on
+// without the lock so it only blocks this producer, a command that doesn't
+// make it gives its string back
+void MalkuthDisplay::send(DisplayCommand& cmd, TextRef& ref, const char* string) {
+    _arena.lock();
+
+    bool pushed = _arena.push(string ? string : "", MAX_TEXT_LENGTH - 1, ref, 50);
+    bool sent   = pushed && xQueueSend(_queue_display, &cmd, 0) == pdTRUE;
+
+    _arena.unlock();
+
+    if (pushed && !sent && xQueueSend(_queue_display, &cmd, 50) != pdTRUE)
+        _arena.cancel(ref);
+}
+
 void MalkuthDisplay::text(
   Anchor anchor, const bool transparent,
   const char* string, const uint8_t* typeface,
   const uint16_t color
 ){
+  text(0, anchor, transparent, string, typeface, color, 0, 0);
+}
 
-  DisplayCommand cmd{
-    .type = DisplayType::TEXT,
-    .payload = { .text = {
-        .offset_x = 0,
-        .offset_y = 0,
-        .typeface = typeface,
-        .color = color,
-        .transparent = transparent,
-        .anchor = anchor,
-    }}
-  };    
-  
-  strncpy(cmd.payload.text.string, string, MAX_TEXT_LENGTH - 1);
-  cmd.payload.text.string[MAX_TEXT_LENGTH -  1] = '\0';
-
-  xQueueSend(_queue_display, &cmd, 50);
+void MalkuthDisplay::text(
+    Anchor anchor, const bool transparent,
+    const char* string, const uint8_t* typeface,
+    const uint16_t color,
+    const int16_t offset_x, const int16_t offset_y
+){
+    text(0, anchor, transparent, string, typeface, color, offset_x, offset_y);
 }
 
 void MalkuthDisplay::text(
+    uint16_t widget,
     Anchor anchor, const bool transparent,
     const char* string, const uint8_t* typeface,
     const uint16_t color,
@@ -558,6 +1151,7 @@ void MalkuthDisplay::text(
 
     DisplayCommand cmd{
         .type = DisplayType::TEXT,
+        .widget = widget,
         .payload = { .text = {
             .offset_x = offset_x,
             .offset_y = offset_y,
@@ -568,10 +1162,7 @@ void MalkuthDisplay::text(
         }}
     };
 
-    strncpy(cmd.payload.text.string, string, MAX_TEXT_LENGTH - 1);
-    cmd.payload.text.string[MAX_TEXT_LENGTH -  1] = '\0';
-
-    xQueueSend(_queue_display, &cmd, 50);
+    send(cmd, cmd.payload.text.string, string);
 }
 
 void MalkuthDisplay::image(
@@ -579,21 +1170,7 @@ void MalkuthDisplay::image(
     const uint8_t*  image,
     const size_t    data_size
 ){
-    DisplayCommand cmd = {
-      .type = DisplayType::IMAGE,
-      .payload = { .image = {
-        .type = type,
-        .data_size = data_size,
-        .data = image,
-        .path = NULL,
-        .size_x = 0,
-        .size_y = 0,
-        .offset_x = 0,
-        .offset_y = 0,
-      }}
-    };
-
-    xQueueSend(_queue_display, &cmd, 50);
+    this->image(type, image, data_size, 0, 0, 0, 0);
 }
 
 void MalkuthDisplay::image(
@@ -604,19 +1181,21 @@ void MalkuthDisplay::image(
     const uint16_t size_x,   const uint16_t size_y,
     const uint16_t offset_x, const uint16_t offset_y
 ){
+    // Only flash images come as data, the rest are paths on the card
+    if (type != ImageType::FLASH) return;
+
     DisplayCommand cmd = {
       .type = DisplayType::IMAGE,
       .payload = { .image = {
-        .type = type,
-        .data_size = data_size,
-        .data = image,
-        .path = NULL,
+        .data_size = (uint32_t)data_size,
         .size_x = size_x,
         .size_y = size_y,
         .offset_x = offset_x,
         .offset_y = offset_y,
+        .type = type,
       }}
     };
+    cmd.payload.image.data = image;
 
     xQueueSend(_queue_display, &cmd, 50);
 }
@@ -628,23 +1207,33 @@ void MalkuthDisplay::image(
     const uint16_t size_x, const uint16_t size_y,
     const int16_t offset_x, const int16_t offset_y
 ){
+    image(0, type, path, size_x, size_y, offset_x, offset_y);
+}
+
+void MalkuthDisplay::image(
+    uint16_t        widget,
+    const ImageType type,
+    const char*     path,
+
+    const uint16_t size_x, const uint16_t size_y,
+    const int16_t offset_x, const int16_t offset_y
+){
+    if (type == ImageType::FLASH) return;
+
     DisplayCommand cmd = {
       .type = DisplayType::IMAGE,
+      .widget = widget,
       .payload = { .image = {
-            .type = type,
             .data_size = 0,
-            .data = NULL,
             .size_x = size_x,
             .size_y = size_y,
-            .offset_x = offset_x,
-            .offset_y = offset_y,
+            .offset_x = (uint16_t)offset_x,
+            .offset_y = (uint16_t)offset_y,
+            .type = type,
         }}
     };
 
-    strncpy(cmd.payload.image.path, path, MAX_TEXT_LENGTH - 1);
-    cmd.payload.image.path[MAX_TEXT_LENGTH -  1] = '\0';
-
-    xQueueSend(_queue_display, &cmd, 50);
+    send(cmd, cmd.payload.image.path, path);
 }
 
 void MalkuthDisplay::object(
@@ -669,12 +1258,22 @@ void MalkuthDisplay::object(
 }
 
 void MalkuthDisplay::object(
+    Anchor anchor,
+    const uint16_t size_x, const uint16_t size_y,
+    const uint16_t color, const uint8_t roundness,
+    const int16_t offset_x, const int16_t offset_y) {
+    object(0, anchor, size_x, size_y, color, roundness, offset_x, offset_y);
+}
+
+void MalkuthDisplay::object(
+    uint16_t widget,
     Anchor anchor,
     const uint16_t size_x, const uint16_t size_y,
     const uint16_t color, const uint8_t roundness,
     const int16_t offset_x, const int16_t offset_y) {
     DisplayCommand cmd = {
       .type = DisplayType::OBJECT,
+      .widget = widget,
       .payload = { .object = {
         .offset_x = offset_x,
         .offset_y = offset_y,
@@ -740,6 +1339,11 @@ void MalkuthDisplay::clear(){
     xQueueSend(_queue_display, &clear_cmd, 50);
 }
 
+void MalkuthDisplay::remove(uint16_t widget){
+    DisplayCommand remove_cmd{ .type = DisplayType::REMOVE, .widget = widget };
+    xQueueSend(_queue_display, &remove_cmd, 50);
+}
+
 uint32_t MalkuthDisplay::get_free_resources() {
   return uxTaskGetStackHighWaterMark(_taskhandle_display);
 }
@@ -748,6 +1352,34 @@ uint32_t MalkuthDisplay::get_free_queue() {
   return uxQueueSpacesAvailable(_queue_display);
 }
 
+uint32_t MalkuthDisplay::get_cache_hits() {
+  return _image_cache.hits();
+}
+
+uint32_t MalkuthDisplay::get_cache_misses() {
+  return _image_cache.misses();
+}
+
+size_t MalkuthDisplay::get_cache_used() {
+  return _image_cache.used();
+}
+
+size_t MalkuthDisplay::get_cache_budget() {
+  return _image_cache.budget();
+}
+
+uint32_t MalkuthDisplay::get_scene_nodes() {
+  return _scene.size();
+}
+
+uint32_t MalkuthDisplay::get_composed_pixels() {
+  return _composed_pixels;
+}
+
+uint32_t MalkuthDisplay::get_commands_handled() {
+  return _commands_handled;
+}
+
 uint8_t MalkuthDisplay::get_brightness() {
     return _brightness;
 }
@@ -761,9 +1393,12 @@ TouchData MalkuthDisplay::get_touchdata() {
   };
 }
 
-// void MalkuthDisplay::set_sdfs(SdFs& sd){
-//     _sd = &sd;
-// }
+void MalkuthDisplay::set_filesystem(MalkuthFs& fs){
+    _fs = &fs;
+
+    _jpg.setFileSystem(&fs.get_sdfs(), lock_jpg, this);
+    _jpg.setSwapBytes(true);
+}
 
 uint16_t MalkuthDisplay::rgb888_to_rgb565(const uint32_t color) {
   return ((color >> 16) & 0xF8) << 8 |
@@ -6,6 +6,13 @@
 #include <SdFat.h>
 
 #include "malkuth_helper.h"
+#include "malkuth_fs.h"
+#include "malkuth_imagecache.h"
+#include "malkuth_font.h"
+#include "malkuth_scene.h"
+#include "malkuth_arena.h"
+
+#include "src/TJpg_Decoder/TJpg_Decoder.h"
 
 #ifndef MAX_IMAGE_WIDTH
     #define MAX_IMAGE_WIDTH 320
@@ -15,6 +22,46 @@
     #define MAX_TEXT_LENGTH 128
 #endif
 
+// Commands are small now, strings wait in the arena next to the queue
+#ifndef DISPLAY_QUEUE_LENGTH
+    #define DISPLAY_QUEUE_LENGTH 128
+#endif
+
+#ifndef TEXT_ARENA_SIZE
+    #define TEXT_ARENA_SIZE 2048
+#endif
+
+// Strings in flight: one per queued command, the one being drawn and a few
+// producers between push and send
+#ifndef TEXT_ARENA_SLOTS
+    #define TEXT_ARENA_SLOTS (DISPLAY_QUEUE_LENGTH + 8)
+#endif
+
+// Decoded flash images kept in PSRAM, a full 320x480 background is 300 KB
+#ifndef IMAGE_CACHE_BUDGET
+    #define IMAGE_CACHE_BUDGET (1024 * 1024)
+#endif
+
+// Blended glyph tiles, a 24px glyph is around 1 KB per colour pair
+#ifndef FONT_CACHE_BUDGET
+    #define FONT_CACHE_BUDGET (1024 * 128)
+#endif
+
+// Retained draws kept for recomposing, past this they go straight to the panel
+#ifndef SCENE_MAX_NODES
+    #define SCENE_MAX_NODES 256
+#endif
+
+// How long the display task waits for more commands before composing,
+// and how stale a dirty area is allowed to get while commands keep coming
+#ifndef SCENE_SETTLE_MS
+    #define SCENE_SETTLE_MS 5
+#endif
+
+#ifndef SCENE_MAX_LATENCY_MS
+    #define SCENE_MAX_LATENCY_MS 33
+#endif
+
 #ifndef PIN_BL
     #define PIN_BL 3
 #endif
@@ -25,7 +72,8 @@ enum class DisplayType : uint8_t {
     OBJECT,
     BAR,
 
-    CLEAR
+    CLEAR,
+    REMOVE
 };
 
 // Anchor value (wrapper) (using the value from tft_espi one as the base)
@@ -49,6 +97,7 @@ struct TouchData {
 
 struct DisplayCommand {
     DisplayType type;
+    uint16_t    widget = 0; // 0 = no id, otherwise replaces the last draw with the same id
 
     union {
         struct {
@@ -61,20 +110,22 @@ struct DisplayCommand {
         } object;
 
         struct {
-            ImageType       type;
-            size_t          data_size;
-            const uint8_t*  data;
-            char            path[MAX_TEXT_LENGTH];
+            union {
+                const uint8_t*  data;   // FLASH
+                TextRef         path;   // everything else
+            };
+            uint32_t        data_size;
 
             uint16_t    size_x, size_y;
             uint16_t    offset_x, offset_y;
+            ImageType   type;
         } image;
         
         struct {
             int16_t offset_x, offset_y;
 
-            char            string[MAX_TEXT_LENGTH];
             const uint8_t*  typeface;
+            TextRef         string;
             uint16_t        color;
             bool            transparent;
             Anchor          anchor;
@@ -93,6 +144,22 @@ struct DisplayCommand {
     } payload;
 };
 
+// 24 bytes on the board, the host build has 8 byte pointers
+static_assert(sizeof(DisplayCommand) <= 16 + 2 * sizeof(void*), "DisplayCommand should stay small enough to copy around");
+
+// A draw the display task keeps around so any part of the screen can be
+// composed again from scratch
+struct SceneNode {
+    uint16_t        widget  = 0;
+    uint16_t        shape   = 0;    // same non-zero shape at the same place = fully hidden
+    SceneRect       bounds;     // every pixel it can touch
+    SceneRect       ink;        // what has to be covered for it to be gone
+    SceneRect       cover;      // where it is fully opaque
+
+    DisplayCommand  cmd;
+    String          text;       // or a JPG/THUMB path, the arena copy is gone once the command is done
+};
+
 struct Button {
     int16_t     offset_x, offset_y;
     uint16_t    size_x, size_y;
@@ -104,10 +171,16 @@ struct Button {
 
 class MalkuthDisplay {
 private:
-    TFT_eSPI _tft;
+    TFT_eSPI    _tft;
+    TFT_eSprite _frame  = TFT_eSprite(&_tft);
     FT6236   _ts    = FT6236();
     PNG      _png;
-    // SdFs*    _sd;
+    MalkuthFs* _fs = nullptr;
+
+    // JPEGs off the card, fit-to-box and one row at a time, this task's
+    // own decoder so the cover task can decode at the same time
+    TJpg_Decoder _jpg;
+    SceneRect    _jpg_box;
 
     uint8_t  _brightness = 50;
     uint16_t _bg_color = TFT_BLACK;
@@ -118,6 +191,25 @@ private:
     uint16_t  _constrain_width, _constrain_height;
     uint16_t  _constrain_counter = 1;
 
+    MalkuthImageCache         _image_cache = MalkuthImageCache(IMAGE_CACHE_BUDGET);
+    MalkuthImageCache::Entry* _cache_fill  = nullptr;
+
+    MalkuthFontCache          _fonts       = MalkuthFontCache(FONT_CACHE_BUDGET);
+
+    // The cover thumbnail on screen, read off the card again only when a
+    // different one shows up
+    uint16_t*                 _thumb        = nullptr;
+    uint16_t                  _thumb_width  = 0;
+    uint16_t                  _thumb_height = 0;
+    uint32_t                  _thumb_key    = 0;
+
+    std::vector<SceneNode>    _scene;
+    MalkuthDirtyRegion        _dirty;
+    TickType_t                _dirty_since = 0;
+    SceneRect                 _compose_area;
+    SceneRect                 _compose_clip;
+    uint32_t                  _composed_pixels = 0;
+
     bool     _ts_exist;
     uint16_t _ts_x = 0;
     uint16_t _ts_y = 0;
@@ -126,7 +218,9 @@ private:
     bool    _touch_active = false;
     const   Button* _active_button = nullptr;
 
-    QueueHandle_t _queue_display        = nullptr;
+    QueueHandle_t    _queue_display     = nullptr;
+    MalkuthTextArena _arena;
+    std::atomic<uint32_t> _commands_handled{0};
     TaskHandle_t  _taskhandle_display   = nullptr;
 
     std::vector<Button> _buttons;
@@ -135,22 +229,50 @@ private:
     static void task_display(void* parameters);
 
     static void handle_command(MalkuthDisplay* self, const DisplayCommand& cmd);
+    static void release_command(MalkuthDisplay* self, const DisplayCommand& cmd);
+
+    void send(DisplayCommand& cmd, TextRef& ref, const char* string);
 
     int16_t calculate_anchor_x(Anchor anchor, uint16_t width);
     int16_t calculate_anchor_y(Anchor anchor, uint16_t height);
 
     static void draw_png_flash(MalkuthDisplay *self, const DisplayCommand&cmd);
-    // static void draw_jpg(MalkuthDisplay *self, const DisplayCommand&cmd);
-    
-    // static bool render_jpg(int16_t x, int16_t y, uint16_t w, uint16_t h, uint16_t* bitmap);
+    static void draw_jpg(MalkuthDisplay *self, const DisplayCommand&cmd, const char* path);
+
+    static void lock_jpg(void* user, bool take);
+    static bool render_jpg(void* user, uint16_t y, uint16_t w, uint16_t* row);
+    static bool render_jpg_compose(void* user, uint16_t y, uint16_t w, uint16_t* row);
     static int  render_png(PNGDRAW* png_draw);
     static int  render_png_constrained(PNGDRAW* png_draw);
+    static int  render_png_cache(PNGDRAW* png_draw);
+
+    static MalkuthImageCache::Entry* cache_png_flash(MalkuthDisplay* self, const DisplayCommand& cmd);
+    static void draw_cached(MalkuthDisplay* self, const MalkuthImageCache::Entry& entry, const DisplayCommand& cmd);
+
+    static bool load_thumb(MalkuthDisplay* self, const char* path);
+    static bool thumb_box(MalkuthDisplay* self, const DisplayCommand& cmd, SceneRect& box);
+    static void draw_thumb(MalkuthDisplay* self, const DisplayCommand& cmd);
     
-    static void draw_image(MalkuthDisplay* self, const DisplayCommand& cmd);
+    static void draw_image(MalkuthDisplay* self, const DisplayCommand& cmd, const char* path);
     static void draw_text(MalkuthDisplay* self, const DisplayCommand& cmd);
     static void draw_object(MalkuthDisplay* self, const DisplayCommand& cmd);
     static void draw_bar(MalkuthDisplay* self, const DisplayCommand& cmd);
 
+    static bool text_box(MalkuthDisplay* self, const DisplayCommand& cmd, const char* string, MalkuthFontCache::Face*& face, SceneRect& box, SceneRect& ink);
+    static bool image_box(MalkuthDisplay* self, const DisplayCommand& cmd, SceneRect& box);
+
+    static bool scene_node(MalkuthDisplay* self, const DisplayCommand& cmd, SceneNode& node);
+    static bool scene_add(MalkuthDisplay* self, const SceneNode& node);
+    static void scene_remove(MalkuthDisplay* self, uint16_t widget);
+    static void scene_clear(MalkuthDisplay* self);
+    static void scene_dirty(MalkuthDisplay* self, const SceneRect& rect);
+
+    static void compose(MalkuthDisplay* self);
+    static void compose_rect(MalkuthDisplay* self, const SceneRect& rect);
+    static void compose_node(MalkuthDisplay* self, const SceneNode& node);
+    static void compose_image(MalkuthDisplay* self, const SceneNode& node);
+    static int  render_png_compose(PNGDRAW* png_draw);
+
     void _buttons_check();
 
 public:
@@ -173,6 +295,13 @@ public:
             const ImageType type,
             const char*     path,
 
+            const uint16_t size_x, const uint16_t size_y,
+            const int16_t offset_x, const int16_t offset_y
+    ),   image(
+            uint16_t widget,
+            const ImageType type,
+            const char*     path,
+
             const uint16_t size_x, const uint16_t size_y,
             const int16_t offset_x, const int16_t offset_y
     );
@@ -186,6 +315,12 @@ public:
             const char* string, const uint8_t* typeface,
             const uint16_t color,
             const int16_t offset_x, const int16_t offset_y
+    ),   text(
+            uint16_t widget,
+            Anchor anchor, bool transparent,
+            const char* string, const uint8_t* typeface,
+            const uint16_t color,
+            const int16_t offset_x, const int16_t offset_y
     ),   text( // only for testing though
             uint8_t implementation, Anchor anchor, 
             const char* string, const uint8_t* typeface,
@@ -204,8 +339,17 @@ public:
             const uint16_t size_x,  const uint16_t size_y, 
             const uint16_t color,   const uint8_t roundness,
             const int16_t offset_x,  const int16_t offset_y
+    ),   object(
+            uint16_t widget,
+            Anchor anchor, 
+            const uint16_t size_x,  const uint16_t size_y, 
+            const uint16_t color,   const uint8_t roundness,
+            const int16_t offset_x,  const int16_t offset_y
     );
 
+    // Drops a widget, whatever was under it shows up again
+    void remove(uint16_t widget);
+
     void button(
             Anchor anchor,
             const uint16_t size_x,  const uint16_t size_y,
@@ -251,10 +395,22 @@ public:
     uint32_t get_free_resources();
     uint32_t get_free_queue();
 
+    uint32_t get_cache_hits();
+    uint32_t get_cache_misses();
+    size_t   get_cache_used();
+    size_t   get_cache_budget();
+
+    uint32_t get_scene_nodes();
+    uint32_t get_composed_pixels();
+
+    // Every command the display task has been through, drawn or not
+    uint32_t get_commands_handled();
+
     TouchData   get_touchdata();
     uint8_t     get_brightness();
 
-    // void set_sdfs(SdFs& sd); // TODO: Cover Image loading from SD Card
+    // Where ImageType::THUMB paths are read from
+    void set_filesystem(MalkuthFs& fs);
     void set_brightness(uint8_t percent);
 
     uint16_t rgb888_to_rgb565(const uint32_t color);
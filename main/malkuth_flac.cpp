@@ -0,0 +1,282 @@
+#include "malkuth_flac.h"
+
+#include <array>
+
+// STREAMINFO plus the SEEKTABLE (if the encoder wrote one), everything
+// else is skipped without reading it
+bool MalkuthFlac::streaminfo(FsFile& file, StreamInfo& info, std::vector<SeekPoint>& table) {
+    bool has_info = false;
+
+    table.clear();
+
+    file.seek(0);
+    char sig[4];
+    if (file.read(sig, 4) != 4 || strncmp(sig, "fLaC", 4) != 0) {
+      return false;
+    }
+
+    bool last_block = false;
+    while (!last_block) {
+      uint8_t header[4];
+      if (file.read(header, 4) != 4) return false;
+
+      last_block = header[0] & 0x80;
+      uint8_t block_type = header[0] & 0x7F;
+      uint32_t block_size = (header[1] << 16) | (header[2] << 8) | header[3];
+
+      if (block_type == 0 && block_size == 34) {
+        uint8_t* buf = info.raw;
+
+        if (file.read(buf, 34) != 34) return false;
+
+        info.min_block     = (buf[0] << 8) | buf[1];
+        info.max_block     = (buf[2] << 8) | buf[3];
+        info.max_frame     = ((uint32_t)buf[7] << 16) | (buf[8] << 8) | buf[9];
+        info.sample_rate   = ((uint32_t)buf[10] << 12) | (buf[11] << 4) | ((buf[12] >> 4) & 0x0F);
+        info.channels      = ((buf[12] & 0x0E) >> 1) + 1;
+        info.bps           = (((buf[12] & 0x01) << 4) | ((buf[13] >> 4) & 0x0F)) + 1;
+        info.total_samples = ((uint64_t)(buf[13] & 0x0F) << 32) | ((uint64_t)buf[14] << 24) | ((uint64_t)buf[15] << 16) | ((uint64_t)buf[16] << 8) | buf[17];
+        has_info = true;
+      } else if (block_type == 3) {
+        uint8_t point[18];
+
+        table.reserve(block_size / 18);
+        for (uint32_t i = 0; i < block_size / 18; i++) {
+          if (file.read(point, 18) != 18) return false;
+
+          uint64_t sample = 0, offset = 0;
+          for (int b = 0; b < 8; b++) {
+            sample = (sample << 8) | point[b];
+            offset = (offset << 8) | point[8 + b];
+          }
+
+          // Placeholder points are all ones
+          if (sample == 0xFFFFFFFFFFFFFFFFULL) continue;
+          table.push_back({ sample, offset });
+        }
+        file.seek(file.position() + block_size % 18);
+      } else {
+        file.seek(file.position() + block_size);
+      }
+    }
+
+    info.data_offset = file.position();
+    return has_info;
+}
+
+static uint8_t crc8(const uint8_t* data, size_t len) {
+    uint8_t crc = 0;
+
+    while (len--) {
+        crc ^= *data++;
+        for (int i = 0; i < 8; i++)
+            crc = (crc & 0x80) ? (crc << 1) ^ 0x07 : (crc << 1);
+    }
+
+    return crc;
+}
+
+// Frame header at buf[0], gives back the first sample it holds
+bool MalkuthFlac::frameheader(const uint8_t* buf, size_t len, const StreamInfo& info, uint64_t& sample, uint32_t& block) {
+    if (len < 6) return false;
+    if (buf[0] != 0xFF || (buf[1] & 0xFE) != 0xF8) return false;
+
+    bool    variable   = buf[1] & 0x01;
+    uint8_t block_code = buf[2] >> 4;
+    uint8_t rate_code  = buf[2] & 0x0F;
+    uint8_t channel    = buf[3] >> 4;
+    uint8_t size_code  = (buf[3] >> 1) & 0x07;
+
+    if (block_code == 0 || rate_code == 0x0F || channel > 10 || size_code == 3 || (buf[3] & 0x01))
+        return false;
+
+    // Whatever the header states has to agree with STREAMINFO
+    static const uint8_t bps_table[8] = { 0, 8, 12, 0, 16, 20, 24, 32 };
+    if (size_code != 0 && bps_table[size_code] != info.bps) return false;
+    if (channel < 8 && channel + 1 != info.channels)          return false;
+    if (channel >= 8 && info.channels != 2)                   return false;
+
+    // UTF-8 like coded frame / sample number
+    size_t   pos = 4;
+    uint8_t  lead = buf[pos++];
+    uint64_t number;
+    int      extra;
+
+    if      (!(lead & 0x80))          { number = lead;        extra = 0; }
+    else if ((lead & 0xE0) == 0xC0)   { number = lead & 0x1F; extra = 1; }
+    else if ((lead & 0xF0) == 0xE0)   { number = lead & 0x0F; extra = 2; }
+    else if ((lead & 0xF8) == 0xF0)   { number = lead & 0x07; extra = 3; }
+    else if ((lead & 0xFC) == 0xF8)   { number = lead & 0x03; extra = 4; }
+    else if ((lead & 0xFE) == 0xFC)   { number = lead & 0x01; extra = 5; }
+    else if (lead == 0xFE)            { number = 0;           extra = 6; }
+    else return false;
+
+    if (pos + extra > len) return false;
+    for (int i = 0; i < extra; i++) {
+        if ((buf[pos] & 0xC0) != 0x80) return false;
+        number = (number << 6) | (buf[pos++] & 0x3F);
+    }
+
+    if      (block_code == 1) block = 192;
+    else if (block_code <= 5) block = 576 << (block_code - 2);
+    else if (block_code == 6) { if (pos + 1 > len) return false; block = buf[pos] + 1; pos += 1; }
+    else if (block_code == 7) { if (pos + 2 > len) return false; block = ((buf[pos] << 8) | buf[pos + 1]) + 1; pos += 2; }
+    else                      block = 256 << (block_code - 8);
+
+    if      (rate_code == 12) pos += 1;
+    else if (rate_code == 13 || rate_code == 14) pos += 2;
+
+    if (pos + 1 > len) return false;
+    if (crc8(buf, pos) != buf[pos]) return false;
+    if (info.max_block && block > info.max_block) return false;
+
+    // Fixed blocksize streams count frames, not samples
+    sample = variable ? number : number * info.max_block;
+
+    return info.total_samples == 0 || sample + block <= info.total_samples;
+}
+
+// Frame header starting in [from, end), expect is the sample it has to
+// start on or ANY
+static constexpr uint64_t ANY = UINT64_MAX;
+
+static bool scan(FsFile& file, uint64_t from, uint64_t end, const MalkuthFlac::StreamInfo& info, uint64_t expect,
+                 uint64_t& offset, uint64_t& sample, uint32_t& block) {
+    static constexpr size_t CHUNK    = 512;
+    static constexpr size_t MAX_HDR  = 16;
+
+    uint8_t buf[CHUNK + MAX_HDR];
+
+    for (uint64_t pos = from; pos < end; pos += CHUNK) {
+        file.seek(pos);
+        int got = file.read(buf, sizeof(buf));
+        if (got < 2) return false;
+
+        size_t scan = std::min((size_t)got, CHUNK);
+        for (size_t i = 0; i < scan && i + 1 < (size_t)got && pos + i < end; i++) {
+            if (buf[i] != 0xFF || (buf[i + 1] & 0xFE) != 0xF8) continue;
+
+            if (MalkuthFlac::frameheader(buf + i, got - i, info, sample, block) && (expect == ANY || sample == expect)) {
+                offset = pos + i;
+                return true;
+            }
+        }
+    }
+
+    return false;
+}
+
+// CRC-16 of [from, to - 2) against the footer sitting at to - 2, i.e.
+// whether a whole frame lies between the two
+static bool frame_crc(FsFile& file, uint64_t from, uint64_t to) {
+    static const auto table = [] {
+        std::array<uint16_t, 256> t;
+        for (int i = 0; i < 256; i++) {
+            uint16_t crc = i << 8;
+            for (int b = 0; b < 8; b++)
+                crc = (crc & 0x8000) ? (crc << 1) ^ 0x8005 : (crc << 1);
+            t[i] = crc;
+        }
+        return t;
+    }();
+
+    if (to < from + 2) return false;
+
+    uint8_t  buf[512];
+    uint16_t crc = 0;
+
+    file.seek(from);
+    for (uint64_t left = to - from - 2; left > 0;) {
+        int got = file.read(buf, std::min<uint64_t>(left, sizeof(buf)));
+        if (got <= 0) return false;
+
+        for (int i = 0; i < got; i++)
+            crc = (crc << 8) ^ table[(crc >> 8) ^ buf[i]];
+        left -= got;
+    }
+
+    if (file.read(buf, 2) != 2) return false;
+    return crc == ((buf[0] << 8) | buf[1]);
+}
+
+// First valid frame starting at or after `from` (and before `limit`). Sample
+// data is full of 0xFFF8 and a CRC-8 lets one in 256 of those through, so a
+// header only counts once the next frame starts on the right sample and the
+// CRC-16 of everything in between checks out
+bool MalkuthFlac::nextframe(FsFile& file, uint64_t from, uint64_t limit, const StreamInfo& info, uint64_t& offset, uint64_t& sample, uint32_t& block) {
+    uint64_t window = info.max_frame ? (uint64_t)info.max_frame * 2 : 1024 * 64;
+    uint64_t reach  = info.max_frame ? (uint64_t)info.max_frame + 1 : 1024 * 64;
+    uint64_t end    = std::min(limit, from + window);
+
+    while (scan(file, from, end, info, ANY, offset, sample, block)) {
+        uint64_t next_offset, next_sample;
+        uint32_t next_block;
+
+        // The last one has nothing after it, it has to end the stream and
+        // the file instead
+        if (sample + block == info.total_samples && file.size() - offset <= reach &&
+            frame_crc(file, offset, file.size()))
+            return true;
+
+        for (uint64_t after = offset + 1;
+             scan(file, after, std::min(file.size(), offset + reach), info, sample + block, next_offset, next_sample, next_block);
+             after = next_offset + 1) {
+            if (frame_crc(file, offset, next_offset)) return true;
+        }
+
+        from = offset + 1;
+    }
+
+    return false;
+}
+
+// Seektable narrows it down to a couple of frames, bisecting on frame sync
+// does the rest (or all of it when there's no table)
+bool MalkuthFlac::locate(FsFile& file, const StreamInfo& info, const std::vector<SeekPoint>& table, uint64_t target, uint64_t& offset, uint64_t& sample) {
+    if (target >= info.total_samples) return false;
+
+    uint64_t lo_offset = info.data_offset, lo_sample = 0;
+    uint64_t hi_offset = file.size(), hi_sample = info.total_samples;
+
+    for (const auto& point : table) {
+        if (point.sample <= target) {
+            lo_sample = point.sample;
+            lo_offset = info.data_offset + point.offset;
+        } else {
+            hi_sample = point.sample;
+            hi_offset = info.data_offset + point.offset;
+            break;
+        }
+    }
+
+    uint64_t found_offset, found_sample;
+    uint32_t block;
+
+    for (int i = 0; i < 32 && hi_offset - lo_offset > 1; i++) {
+        uint64_t guess = lo_offset + (hi_offset - lo_offset) / 2;
+
+        // Interpolate while the bracket is large, plain halving once it's not
+        if (i < 8 && hi_sample > lo_sample)
+            guess = lo_offset + (uint64_t)((double)(hi_offset - lo_offset) * (target - lo_sample) / (hi_sample - lo_sample));
+        guess = constrain(guess, lo_offset + 1, hi_offset - 1);
+
+        if (!nextframe(file, guess, hi_offset, info, found_offset, found_sample, block)) {
+            hi_offset = guess;
+            continue;
+        }
+
+        if (found_sample > target) {
+            hi_offset = guess;
+            hi_sample = found_sample;
+            continue;
+        }
+
+        lo_offset = found_offset;
+        lo_sample = found_sample;
+        if (target < found_sample + block) break;
+    }
+
+    offset = lo_offset;
+    sample = lo_sample;
+    return true;
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <Arduino.h>
+#include <SdFat.h>
+#include <vector>
+
+/// FLAC layout straight off the card: STREAMINFO, the SEEKTABLE and frame
+/// headers. Nothing is decoded here, locate() only finds the frame a sample
+/// is in so the decoder can be started on it.
+class MalkuthFlac {
+public:
+    struct StreamInfo {
+        uint8_t  raw[34];
+        uint16_t min_block;
+        uint16_t max_block;
+        uint32_t max_frame;
+        uint32_t sample_rate;
+        uint8_t  channels;
+        uint8_t  bps;
+        uint64_t total_samples;
+        uint64_t data_offset;
+    };
+
+    struct SeekPoint {
+        uint64_t sample;
+        uint64_t offset;
+    };
+
+    static bool streaminfo(FsFile& file, StreamInfo& info, std::vector<SeekPoint>& table);
+    static bool frameheader(const uint8_t* buf, size_t len, const StreamInfo& info, uint64_t& sample, uint32_t& block);
+    static bool nextframe(FsFile& file, uint64_t from, uint64_t limit, const StreamInfo& info, uint64_t& offset, uint64_t& sample, uint32_t& block);
+
+    // Offset of the frame holding target, and the first sample of that frame
+    static bool locate(FsFile& file, const StreamInfo& info, const std::vector<SeekPoint>& table, uint64_t target, uint64_t& offset, uint64_t& sample);
+};
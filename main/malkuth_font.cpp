@@ -0,0 +1,281 @@
+#include "malkuth_font.h"
+
+#define SWAP565(color) (uint16_t)(((color) >> 8) | ((color) << 8))
+
+///
+/// Private Function
+///
+
+uint32_t MalkuthFontCache::read32(const uint8_t* ptr) {
+    return ((uint32_t)ptr[0] << 24) | ((uint32_t)ptr[1] << 16) | ((uint32_t)ptr[2] << 8) | ptr[3];
+}
+
+uint32_t MalkuthFontCache::decode_utf8(const char*& string) {
+    uint8_t c = *string++;
+
+    if (c < 0x80) return c;
+
+    int      extra;
+    uint32_t code;
+
+    if      ((c & 0xE0) == 0xC0) { code = c & 0x1F; extra = 1; }
+    else if ((c & 0xF0) == 0xE0) { code = c & 0x0F; extra = 2; }
+    else if ((c & 0xF8) == 0xF0) { code = c & 0x07; extra = 3; }
+    else return 0;
+
+    while (extra--) {
+        if ((*string & 0xC0) != 0x80) return 0;
+        code = (code << 6) | (*string++ & 0x3F);
+    }
+
+    return code;
+}
+
+// vlw glyphs are stored sorted by code point
+int32_t MalkuthFontCache::find(const Face& face, uint32_t code) {
+    int32_t lo = 0, hi = (int32_t)face.count - 1;
+
+    while (lo <= hi) {
+        int32_t  mid   = (lo + hi) / 2;
+        uint32_t value = read32(face.data + 24 + mid * 28);
+
+        if      (value == code) return mid;
+        else if (value <  code) lo = mid + 1;
+        else                    hi = mid - 1;
+    }
+
+    return -1;
+}
+
+void MalkuthFontCache::metrics(const Face& face, uint32_t index, Glyph& glyph) {
+    const uint8_t* entry = face.data + 24 + index * 28;
+
+    glyph.height    = read32(entry + 4);
+    glyph.width     = read32(entry + 8);
+    glyph.x_advance = read32(entry + 12);
+    glyph.dy        = (int16_t)read32(entry + 16);
+    glyph.dx        = (int8_t)read32(entry + 20);
+}
+
+const MalkuthFontCache::Glyph* MalkuthFontCache::render(Face& face, uint8_t face_id, uint32_t code, uint16_t fg, uint16_t bg) {
+    uint64_t key = ((uint64_t)face_id << 56) | ((uint64_t)(code & 0xFFFFFF) << 32) | ((uint32_t)fg << 16) | bg;
+
+    auto it = _tiles.find(key);
+    if (it != _tiles.end()) {
+        _lru.splice(_lru.begin(), _lru, it->second.lru);
+        _hits++;
+        return &it->second.glyph;
+    }
+
+    _misses++;
+
+    int32_t index = find(face, code);
+    if (index < 0) return nullptr;
+
+    Glyph glyph;
+    metrics(face, index, glyph);
+
+    size_t size = (size_t)glyph.width * glyph.height * sizeof(uint16_t);
+    glyph.pixels = nullptr;
+
+    if (size > 0) {
+        while (!_lru.empty() && _used + size > _budget)
+            evict();
+
+        glyph.pixels = (uint16_t*)heap_caps_malloc(size, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+        if (!glyph.pixels) return nullptr;
+
+        // Exactly what drawGlyph would have put on the sprite
+        const uint8_t* alpha = face.data + face.offsets[index];
+        for (size_t i = 0; i < (size_t)glyph.width * glyph.height; i++) {
+            uint8_t a = alpha[i];
+
+            if      (a == 0)    glyph.pixels[i] = SWAP565(KEY);
+            else if (a == 0xFF) glyph.pixels[i] = SWAP565(fg);
+            else                glyph.pixels[i] = SWAP565(_tft->alphaBlend(a, fg, bg));
+        }
+
+        _used += size;
+    }
+
+    _lru.push_front(key);
+    Tile& tile = _tiles[key];
+    tile.glyph = glyph;
+    tile.lru   = _lru.begin();
+
+    return &tile.glyph;
+}
+
+void MalkuthFontCache::evict() {
+    uint64_t key = _lru.back();
+    _lru.pop_back();
+
+    auto it = _tiles.find(key);
+    if (it == _tiles.end()) return;
+
+    const Glyph& glyph = it->second.glyph;
+    if (glyph.pixels) {
+        _used -= (size_t)glyph.width * glyph.height * sizeof(uint16_t);
+        heap_caps_free(glyph.pixels);
+    }
+
+    _tiles.erase(it);
+}
+
+///
+/// Public Function
+///
+
+MalkuthFontCache::~MalkuthFontCache() {
+    while (!_lru.empty())
+        evict();
+
+    for (auto* face : _faces)
+        delete face;
+
+    if (_canvas) heap_caps_free(_canvas);
+}
+
+void MalkuthFontCache::begin(TFT_eSPI& tft) {
+    _tft = &tft;
+}
+
+// Header and metrics parsed once, the same way TFT_eSPI's loadFont does
+MalkuthFontCache::Face* MalkuthFontCache::face(const uint8_t* typeface) {
+    if (!typeface) return nullptr;
+
+    for (auto* face : _faces)
+        if (face->data == typeface) return face;
+
+    // Tile keys only have room for that many
+    if (_faces.size() >= 256) return nullptr;
+
+    Face* face = new Face;
+
+    face->data        = typeface;
+    face->count       = read32(typeface);
+    face->ascent      = read32(typeface + 16);
+    face->descent     = read32(typeface + 20);
+    face->max_ascent  = face->ascent;
+    face->max_descent = face->descent;
+    face->bitmaps     = 24 + face->count * 28;
+    face->offsets.resize(face->count);
+
+    uint32_t bitmap = face->bitmaps;
+    for (uint32_t i = 0; i < face->count; i++) {
+        const uint8_t* entry = typeface + 24 + i * 28;
+
+        uint32_t code   = read32(entry);
+        uint16_t height = read32(entry + 4);
+        uint16_t width  = read32(entry + 8);
+        int16_t  dy     = (int16_t)read32(entry + 16);
+
+        // Leave the UTF coding space out of the extents
+        if ((code > 0x20 && code < 0x7F) || code > 0xA0) {
+            if (dy > face->max_ascent)                   face->max_ascent  = dy;
+            if (height - dy > face->max_descent)         face->max_descent = height - dy;
+        }
+
+        face->offsets[i] = bitmap;
+        bitmap += width * height;
+    }
+
+    face->y_advance   = face->max_ascent + face->max_descent;
+    face->space_width = (face->ascent + face->descent) * 2 / 7;
+
+    _faces.push_back(face);
+    return face;
+}
+
+int16_t MalkuthFontCache::text_width(Face& face, const char* string) {
+    int16_t width = 0;
+
+    while (*string) {
+        uint32_t code = decode_utf8(string);
+        if (!code) continue;
+
+        if (code == 0x20) {
+            width += face.space_width;
+            continue;
+        }
+
+        int32_t index = find(face, code);
+        if (index < 0) {
+            width += face.space_width + 1;
+            continue;
+        }
+
+        Glyph glyph;
+        metrics(face, index, glyph);
+
+        if (width == 0 && glyph.dx < 0) width -= glyph.dx;
+
+        if (*string) width += glyph.x_advance;
+        else         width += glyph.dx + glyph.width;
+    }
+
+    return width;
+}
+
+uint16_t* MalkuthFontCache::canvas(uint16_t width, uint16_t height) {
+    size_t size = (size_t)width * height;
+
+    if (size > _canvas_size) {
+        if (_canvas) heap_caps_free(_canvas);
+
+        _canvas = (uint16_t*)heap_caps_malloc(size * sizeof(uint16_t), MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+        if (!_canvas)
+            _canvas = (uint16_t*)heap_caps_malloc(size * sizeof(uint16_t), MALLOC_CAP_8BIT);
+
+        _canvas_size = _canvas ? size : 0;
+    }
+
+    return _canvas;
+}
+
+void MalkuthFontCache::draw(
+    Face& face, const char* string,
+    uint16_t fg, uint16_t bg,
+    uint16_t* target, uint16_t target_w, uint16_t target_h,
+    int16_t x, int16_t y
+){
+    uint8_t face_id = 0;
+    while (face_id < _faces.size() && _faces[face_id] != &face) face_id++;
+
+    int16_t  cursor_x = x;
+    uint16_t hole     = SWAP565(KEY);
+
+    while (*string) {
+        uint32_t code = decode_utf8(string);
+        if (code < 0x21) {
+            if (code == 0x20) cursor_x += face.space_width;
+            continue;
+        }
+
+        const Glyph* glyph = render(face, face_id, code, fg, bg);
+        if (!glyph) {
+            cursor_x += face.space_width + 1;
+            continue;
+        }
+
+        int16_t gx = cursor_x + glyph->dx;
+        int16_t gy = y + face.max_ascent - glyph->dy;
+
+        for (uint16_t row = 0; row < glyph->height; row++) {
+            int16_t ty = gy + row;
+            if (ty < 0 || ty >= target_h) continue;
+
+            const uint16_t* src = glyph->pixels + row * glyph->width;
+            uint16_t*       dst = target + ty * target_w;
+
+            for (uint16_t col = 0; col < glyph->width; col++) {
+                int16_t tx = gx + col;
+                if (tx < 0 || tx >= target_w || src[col] == hole) continue;
+
+                dst[tx] = src[col];
+            }
+        }
+
+        cursor_x += glyph->x_advance;
+    }
+}
@@ -0,0 +1,95 @@
+#pragma once
+
+#include <Arduino.h>
+#include <TFT_eSPI.h>
+
+#include <list>
+#include <unordered_map>
+#include <vector>
+
+/// Smooth (.vlw) fonts without TFT_eSPI's loadFont/unloadFont round trip.
+/// Every typeface is parsed once, and every glyph is blended once per
+/// fg/bg colour pair into an RGB565 tile kept in PSRAM (least recently used
+/// tiles go first). Text is then just the tiles copied next to each other.
+class MalkuthFontCache {
+public:
+    struct Face {
+        const uint8_t*  data;
+        uint32_t        count;
+        uint32_t        bitmaps;        // offset of the first bitmap
+
+        uint16_t        y_advance;
+        uint16_t        ascent;
+        uint16_t        descent;
+        uint16_t        max_ascent;
+        uint16_t        max_descent;
+        uint16_t        space_width;
+
+        std::vector<uint32_t> offsets;  // bitmap offset of every glyph
+    };
+
+    struct Glyph {
+        uint16_t    width;
+        uint16_t    height;
+        uint16_t    x_advance;
+        int16_t     dy;
+        int16_t     dx;
+        uint16_t*   pixels;             // byte swapped, KEY where alpha is 0
+    };
+
+    // Holes in a tile, the same colour the old sprite path was filled with
+    static constexpr uint16_t KEY = TFT_TRANSPARENT;
+
+private:
+    struct Tile {
+        Glyph                       glyph;
+        std::list<uint64_t>::iterator lru;
+    };
+
+    TFT_eSPI*                           _tft    = nullptr;
+    std::vector<Face*>                  _faces;
+    std::unordered_map<uint64_t, Tile>  _tiles;
+    std::list<uint64_t>                 _lru;       // front is the most recent
+
+    size_t      _budget = 0;
+    size_t      _used   = 0;
+    uint32_t    _hits   = 0;
+    uint32_t    _misses = 0;
+
+    uint16_t*   _canvas      = nullptr;
+    size_t      _canvas_size = 0;
+
+    static uint32_t read32(const uint8_t* ptr);
+    static uint32_t decode_utf8(const char*& string);
+
+    int32_t   find(const Face& face, uint32_t code);
+    void      metrics(const Face& face, uint32_t index, Glyph& glyph);
+    const Glyph* render(Face& face, uint8_t face_id, uint32_t code, uint16_t fg, uint16_t bg);
+    void      evict();
+
+public:
+    MalkuthFontCache(size_t budget = 0) : _budget(budget) {}
+    ~MalkuthFontCache();
+
+    void begin(TFT_eSPI& tft);
+
+    Face*    face(const uint8_t* typeface);
+    int16_t  text_width(Face& face, const char* string);
+    int16_t  font_height(const Face& face) { return face.y_advance; }
+
+    // Scratch RGB565 surface for whatever is being composed right now
+    uint16_t* canvas(uint16_t width, uint16_t height);
+
+    // Same placement as drawString at TFT_eSPI's top left, glyph holes are
+    // left untouched on the target
+    void draw(
+        Face& face, const char* string,
+        uint16_t fg, uint16_t bg,
+        uint16_t* target, uint16_t target_w, uint16_t target_h,
+        int16_t x, int16_t y
+    );
+
+    uint32_t hits()   const { return _hits; }
+    uint32_t misses() const { return _misses; }
+    size_t   used()   const { return _used; }
+};
@@ -1,10 +1,88 @@
 #include "malkuth_fs.h"
 
+static const uint32_t DEADLINES_MS[] = {
+    SD_DEADLINE_AUDIO_MS,
+    SD_DEADLINE_UI_MS,
+    SD_DEADLINE_BACKGROUND_MS,
+};
+
+///
+/// Private Function
+///
+
+void MalkuthFs::create_lock(){
+    if (_lock) return;
+
+    _lock       = xSemaphoreCreateRecursiveMutex();
+    _queue_lock = xSemaphoreCreateMutex();
+
+    for (Waiter& waiter : _waiters)
+        waiter.wake = xSemaphoreCreateBinary();
+}
+
+// Best waiter that isn't already handed the card. Audio always comes first,
+// then anything else already past its deadline, so a busy card can't starve
+// the scanner forever, then the lowest class. Earliest deadline among equals.
+// Needs the queue lock
+int8_t MalkuthFs::pick(){
+    uint32_t now       = micros();
+    int8_t   best      = -1;
+    uint8_t  best_rank = 0;
+
+    for (int8_t i = 0; i < SD_MAX_WAITERS; i++) {
+        const Waiter& waiter = _waiters[i];
+        if (!waiter.used || waiter.next) continue;
+
+        // 0 audio, 1 late, the other classes after that
+        bool    late    = (int32_t)(now - waiter.deadline) > 0;
+        uint8_t rank    = waiter.priority == SdClass::AUDIO ? 0 : late ? 1 : 1 + (uint8_t)waiter.priority;
+        bool    earlier = best >= 0 && (int32_t)(waiter.deadline - _waiters[best].deadline) < 0;
+
+        if (best < 0 || rank < best_rank || (rank == best_rank && earlier)) {
+            best      = i;
+            best_rank = rank;
+        }
+    }
+
+    return best;
+}
+
+// With the block device interface the card is started on its own and the
+// volume mounted through the cache, SdFs::begin() does the same minus that
+bool MalkuthFs::mount(SdSpiConfig config){
+#if USE_BLOCK_DEVICE_INTERFACE
+    return _sd.cardBegin(config) &&
+           _cache.begin(_sd.card(), lock_cache, this) &&
+           _sd.FsVolume::begin(&_cache);
+#else
+    return _sd.begin(config);
+#endif
+}
+
+// The read ahead task is background work like the scanner
+void MalkuthFs::lock_cache(void* user, bool take){
+    MalkuthFs* self = static_cast<MalkuthFs*>(user);
+
+    if (take) self->lock(SdClass::BACKGROUND);
+    else      self->unlock();
+}
+
+///
+/// Public Function
+///
+
 bool MalkuthFs::init(){
+    create_lock();
+
     _exfat_spi = new ExfatSpi(2, 42, 40, 41);
     _pin_cs = 2;
 
-    _state = _sd.begin(SdSpiConfig(_pin_cs, DEDICATED_SPI, SPI_SPEED, _exfat_spi));
+    lock();
+    _dircache.clear();
+    _dircache.set_source(_sd, BROWSE_ORDER);
+    _state = mount(SdSpiConfig(_pin_cs, DEDICATED_SPI, SPI_SPEED, _exfat_spi));
+    unlock();
+
     if (!_state)
         return false;
     else
@@ -12,22 +90,235 @@ bool MalkuthFs::init(){
 }
 
 bool MalkuthFs::init(uint8_t pin_cs, uint8_t pin_mosi, uint8_t pin_miso, uint8_t pin_clk){
+    create_lock();
+
     _exfat_spi = new ExfatSpi(pin_cs, pin_mosi, pin_miso, pin_clk);
     _pin_cs = pin_cs;
 
-    _state = _sd.begin(SdSpiConfig(pin_cs, DEDICATED_SPI, SPI_SPEED, _exfat_spi));
+    lock();
+    _dircache.clear();
+    _dircache.set_source(_sd, BROWSE_ORDER);
+    _state = mount(SdSpiConfig(pin_cs, DEDICATED_SPI, SPI_SPEED, _exfat_spi));
+    unlock();
+
     if (!_state)
         return false;
     else
         return true;
 }
 
-SdFs& MalkuthFs::get_sdfs(){
-    return _sd;
+void MalkuthFs::lock(SdClass priority, uint32_t deadline_ms){
+    TaskHandle_t self = xTaskGetCurrentTaskHandle();
+
+    if (_owner == self) {
+        xSemaphoreTakeRecursive(_lock, portMAX_DELAY);
+        _depth++;
+        return;
+    }
+
+    uint32_t since    = micros();
+    uint32_t deadline = since + (deadline_ms ? deadline_ms : DEADLINES_MS[(uint8_t)priority]) * 1000;
+    int8_t   slot     = -1;
+
+    // A free card is taken right away, otherwise wait in line until unlock()
+    // hands it over. All slots taken only happens with more tasks than
+    // SD_MAX_WAITERS, those just come back a tick later
+    while (true) {
+        xSemaphoreTake(_queue_lock, portMAX_DELAY);
+
+        bool taken = !_busy;
+        if (taken) {
+            _busy = true;
+        } else {
+            for (int8_t i = 0; i < SD_MAX_WAITERS; i++) {
+                if (_waiters[i].used) continue;
+
+                _waiters[i].used     = true;
+                _waiters[i].next     = false;
+                _waiters[i].priority = priority;
+                _waiters[i].deadline = deadline;
+                slot = i;
+                break;
+            }
+        }
+
+        xSemaphoreGive(_queue_lock);
+
+        if (taken || slot >= 0) break;
+        vTaskDelay(1);
+    }
+
+    if (slot >= 0) {
+        xSemaphoreTake(_waiters[slot].wake, portMAX_DELAY);
+
+        xSemaphoreTake(_queue_lock, portMAX_DELAY);
+        _waiters[slot].used = false;
+        xSemaphoreGive(_queue_lock);
+    }
+
+    // Nobody else can be on it by now, it only makes the card ours
+    xSemaphoreTakeRecursive(_lock, portMAX_DELAY);
+
+    uint32_t now  = micros();
+    uint32_t wait = now - since;
+
+    SdClassStats& stats = _stats[(uint8_t)priority];
+    stats.requests++;
+    stats.wait_total += wait;
+    if (wait > stats.wait_max)              stats.wait_max = wait;
+    if ((int32_t)(now - deadline) > 0)      stats.missed++;
+
+    _owner   = self;
+    _depth   = 1;
+    _holder  = priority;
+    _granted = now;
 }
 
-FsFile& MalkuthFs::get_file(){
-    return _file;
+void MalkuthFs::unlock(){
+    if (_owner != xTaskGetCurrentTaskHandle() || --_depth > 0) {
+        xSemaphoreGiveRecursive(_lock);
+        return;
+    }
+
+    uint32_t hold = micros() - _granted;
+
+    SdClassStats& stats = _stats[(uint8_t)_holder];
+    if (hold > stats.hold_max) stats.hold_max = hold;
+
+    _owner = nullptr;
+    xSemaphoreGiveRecursive(_lock);
+
+    // Straight to the best one waiting, the card stays busy in between
+    xSemaphoreTake(_queue_lock, portMAX_DELAY);
+
+    int8_t next = pick();
+    if (next >= 0) {
+        _waiters[next].next = true;
+        xSemaphoreGive(_waiters[next].wake);
+    } else {
+        _busy = false;
+    }
+
+    xSemaphoreGive(_queue_lock);
+}
+
+size_t MalkuthFs::read(FsFile& file, void* buffer, size_t size, SdClass priority){
+    uint8_t* out  = static_cast<uint8_t*>(buffer);
+    size_t   done = 0;
+
+    while (done < size) {
+        size_t len = std::min(size - done, (size_t)SD_MAX_REQUEST);
+
+        lock(priority);
+        int res = file.read(out + done, len);
+        unlock();
+
+        if (res <= 0) break;
+        done += res;
+        if ((size_t)res < len) break;
+    }
+
+    return done;
+}
+
+size_t MalkuthFs::write(FsFile& file, const void* buffer, size_t size, SdClass priority){
+    const uint8_t* in   = static_cast<const uint8_t*>(buffer);
+    size_t         done = 0;
+
+    while (done < size) {
+        size_t len = std::min(size - done, (size_t)SD_MAX_REQUEST);
+
+        lock(priority);
+        size_t res = file.write(in + done, len);
+        unlock();
+
+        done += res;
+        if (res < len) break;
+    }
+
+    return done;
+}
+
+SdExtent MalkuthFs::get_extent(FsFile& file){
+    SdExtent extent;
+    uint32_t first, last;
+
+    lock();
+    if (file.isFile() && file.contiguousRange(&first, &last)) {
+        extent.first   = first;
+        extent.sectors = last - first + 1;
+    }
+    unlock();
+
+    return extent;
+}
+
+int MalkuthFs::read_extent(FsFile& file, const SdExtent& extent, void* buffer, size_t size){
+    uint8_t* out      = static_cast<uint8_t*>(buffer);
+    uint64_t position = file.curPosition();
+    uint64_t end      = file.fileSize();
+    size_t   done     = 0;
+
+    // Up to the next sector through SdFat, from there on it's aligned
+    if (extent.sectors && position % 512) {
+        size_t head = std::min(size, (size_t)(512 - position % 512));
+        int    res  = file.read(out, head);
+
+        _extent_stats.fallback_reads++;
+        if (res < (int)head) return res;
+
+        done      = res;
+        position += res;
+    }
+
+    uint64_t left  = end > position ? end - position : 0;
+    size_t   bytes = std::min<uint64_t>(size - done, left) & ~(uint64_t)511;
+    uint32_t skip  = position / 512;
+
+    if (!extent.sectors || bytes == 0 || skip + bytes / 512 > extent.sectors) {
+        if (done > 0) return done;
+
+        _extent_stats.fallback_reads++;
+        return file.read(out, size);
+    }
+
+    if (!_sd.card()->readSectors(extent.first + skip, out + done, bytes / 512) ||
+        !file.seekSet(position + bytes))
+        return done > 0 ? done : -1;
+
+    _extent_stats.raw_reads++;
+    _extent_stats.raw_bytes += bytes;
+
+    return done + bytes;
+}
+
+SdExtentStats MalkuthFs::get_extent_stats(){
+    return _extent_stats;
+}
+
+void MalkuthFs::reset_extent_stats(){
+    _extent_stats = SdExtentStats();
+}
+
+SdClassStats MalkuthFs::get_stats(SdClass priority){
+    return _stats[(uint8_t)priority];
+}
+
+void MalkuthFs::reset_stats(){
+    for (SdClassStats& stats : _stats)
+        stats = SdClassStats();
+}
+
+ReadCacheStats MalkuthFs::get_cache_stats(){
+    return _cache.get_stats();
+}
+
+void MalkuthFs::reset_cache_stats(){
+    _cache.reset_stats();
+}
+
+SdFs& MalkuthFs::get_sdfs(){
+    return _sd;
 }
 
 bool MalkuthFs::get_state(){
@@ -38,25 +329,44 @@ bool MalkuthFs::get_state(){
 }
 
 std::vector<String> MalkuthFs::get_directory_files(const char* path){
-    SdFile dir;
-    SdFile entry;
     std::vector<String> items;
 
-    if (!dir.open(path))
-      return items;
+    lock();
 
-    while (entry.openNext(&dir, O_RDONLY)){
-        char filename[256];
+    const MalkuthDirCache::Listing* listing = _dircache.get(path, true);
+    if (listing) {
+        items.reserve(listing->count());
+        for (uint16_t i = 0; i < listing->count(); i++)
+            items.push_back((*listing)[i]);
+    }
 
-        entry.getName(filename, sizeof(filename));
+    unlock();
+
+    return items;
+}
 
-        String item = filename;
-        if (entry.isDir()) item += '/';
+bool MalkuthFs::for_each_entry(const char* path, DirOrder order, const DirVisitor& visit){
+    lock();
 
-        items.push_back(item);
-        entry.close();
+    FsFile dir;
+    if (!dir.open(path, O_RDONLY) || !dir.isDir()) {
+        if (dir.isOpen()) dir.close();
+        unlock();
+        return false;
     }
 
+    MalkuthDirSort sort;
+    sort.run(_sd, dir, order, visit);
     dir.close();
-    return items;
+
+    unlock();
+    return true;
+}
+
+const MalkuthDirCache::Listing* MalkuthFs::get_directory(const char* path, bool recheck){
+    lock();
+    const MalkuthDirCache::Listing* listing = _dircache.get(path, recheck);
+    unlock();
+
+    return listing;
 }
@@ -1,10 +1,71 @@
+#pragma once
+
+#include <atomic>
 #include <vector>
 #include <SPI.h>
 #include <SdFat.h>
 
+#include "malkuth_dircache.h"
+#include "malkuth_dirsort.h"
+#include "malkuth_readcache.h"
+
 #define SD_FAT_TYPE 3
 #define SPI_SPEED   SD_SCK_MHZ(75)
 
+// Bytes read()/write() move per hold of the card, a thumbnail or a PNG never
+// keeps an audio refill waiting for more than one piece
+#ifndef SD_MAX_REQUEST
+    #define SD_MAX_REQUEST (16 * 1024)
+#endif
+
+// Tasks that can line up for the card at once (reader, audio, loop, display,
+// covers, scanner, ...)
+#ifndef SD_MAX_WAITERS
+    #define SD_MAX_WAITERS 8
+#endif
+
+// How long a request of each class may wait before it counts as missed
+#ifndef SD_DEADLINE_AUDIO_MS
+    #define SD_DEADLINE_AUDIO_MS 20
+#endif
+
+#ifndef SD_DEADLINE_UI_MS
+    #define SD_DEADLINE_UI_MS 100
+#endif
+
+#ifndef SD_DEADLINE_BACKGROUND_MS
+    #define SD_DEADLINE_BACKGROUND_MS 1000
+#endif
+
+// Who gets the card first when several tasks want it
+enum class SdClass : uint8_t {
+    AUDIO,          // reader refills and track switches, late means a gap
+    UI,             // listings, thumbnails, library lookups
+    BACKGROUND,     // metadata scanner, cover task
+    COUNT
+};
+
+typedef struct {
+    uint32_t requests   = 0;
+    uint32_t missed     = 0;    // got the card after their deadline
+    uint32_t wait_max   = 0;    // us
+    uint64_t wait_total = 0;    // us
+    uint32_t hold_max   = 0;    // us
+} SdClassStats;
+
+// Where a file sits on the card when it's in one piece, sectors = 0 for a
+// fragmented one
+typedef struct {
+    uint32_t first      = 0;
+    uint32_t sectors    = 0;
+} SdExtent;
+
+typedef struct {
+    uint32_t raw_reads      = 0;    // straight off the card by sector
+    uint64_t raw_bytes      = 0;
+    uint32_t fallback_reads = 0;    // through SdFat (fragmented, unaligned, tail)
+} SdExtentStats;
+
 /// Taken from https://github.com/greiman/SdFat/issues/450
 class ExfatSpi : public SdSpiBaseClass {
  public:
@@ -31,10 +92,10 @@ class ExfatSpi : public SdSpiBaseClass {
     return SPI.transfer(0XFF); 
   }
   
+  // Bulk transfers go through the SPI FIFO in 64 byte chunks instead of
+  // one transaction per byte, a null tx buffer clocks out 0xFF
   uint8_t receive(uint8_t* buf, size_t count) {
-    for (size_t i = 0; i < count; i++) {
-      buf[i] = SPI.transfer(0XFF);
-    }
+    SPI.transferBytes(nullptr, buf, count);
     return 0;
   }
 
@@ -43,9 +104,7 @@ class ExfatSpi : public SdSpiBaseClass {
   }
 
   void send(const uint8_t* buf, size_t count) {
-    for (size_t i = 0; i < count; i++) {
-      SPI.transfer(buf[i]);
-    }
+    SPI.writeBytes(buf, count);
   }
   
   void setSckSpeed(uint32_t maxSck) {
@@ -61,25 +120,112 @@ class ExfatSpi : public SdSpiBaseClass {
   uint8_t _pin_clk;
 };
 
+/// Access to the card for every task, SdFat itself isn't thread safe.
+///
+/// lock() is an arbiter in front of the actual mutex. Requests line up by
+/// class (audio, then UI, then background) and by deadline within one, and
+/// unlock() hands the card straight to the best one waiting at that moment,
+/// so an audio refill never waits for more than the hold that's running.
+/// A UI or background request that is already late goes ahead of those that
+/// aren't, never ahead of audio.
+/// Holds stay short (one read of at most SD_MAX_REQUEST, one scanner step,
+/// ...), wait and hold times per class are kept for the resource dump.
 class MalkuthFs {
     private:
+        struct Waiter {
+            SemaphoreHandle_t wake      = NULL;
+            bool              used      = false;
+            bool              next      = false;
+            SdClass           priority  = SdClass::UI;
+            uint32_t          deadline  = 0;    // micros()
+        };
+
         SdFs      _sd;
-        FsFile    _file;
         ExfatSpi  *_exfat_spi = NULL;
         bool      _state;
 
+        // The card itself, the queue lock only guards the waiters and is
+        // never held across I/O
+        SemaphoreHandle_t _lock       = NULL;
+        SemaphoreHandle_t _queue_lock = NULL;
+
+        Waiter    _waiters[SD_MAX_WAITERS];
+        bool      _busy     = false;    // held, or handed to a waiter
+
+        // Only the holder writes these (_owner to itself)
+        std::atomic<TaskHandle_t> _owner{nullptr};
+        uint16_t  _depth    = 0;
+        SdClass   _holder   = SdClass::UI;
+        uint32_t  _granted  = 0;
+
+        SdClassStats  _stats[(size_t)SdClass::COUNT];
+        SdExtentStats _extent_stats;
+
+        // Between the volume and the card, needs SdFat built with
+        // USE_BLOCK_DEVICE_INTERFACE, which build_opt.h turns on
+        MalkuthReadCache _cache;
+
+        void      create_lock();
+        int8_t    pick();
+        bool      mount(SdSpiConfig config);
+
+        static void lock_cache(void* user, bool take);
+
+        MalkuthDirCache   _dircache = MalkuthDirCache(DIRCACHE_BUDGET);
+
         uint8_t   _pin_cs;
 
     public:
+        // Files page and playlist share it, so a click on the nth entry
+        // plays the nth track
+        static constexpr DirOrder BROWSE_ORDER = DirOrder::GROUPED;
+
         bool init();
         bool init(const uint8_t pin_cs, const uint8_t pin_mosi, const uint8_t pin_miso, const uint8_t pin_clk);
 
+        // Every task that touches the card holds this while doing so.
+        // deadline_ms = 0 takes the class default, a nested lock() keeps
+        // whatever class the outer one asked for
+        void      lock(SdClass priority = SdClass::UI, uint32_t deadline_ms = 0);
+        void      unlock();
+
+        // Big transfers in SD_MAX_REQUEST pieces with the card given back in
+        // between. Only bounded if the caller doesn't hold it already
+        size_t    read(FsFile& file, void* buffer, size_t size, SdClass priority);
+        size_t    write(FsFile& file, const void* buffer, size_t size, SdClass priority);
+
+        // exFAT marks contiguous files in the directory entry, FAT32 gets
+        // the chain walked once, so ask once per open
+        SdExtent  get_extent(FsFile& file);
+
+        // file.read() that reads whole sectors of a contiguous file straight
+        // from the card, no cluster lookups and no volume cache in between.
+        // Anything else goes through SdFat. Needs the lock like file.read()
+        int       read_extent(FsFile& file, const SdExtent& extent, void* buffer, size_t size);
+
+        SdExtentStats get_extent_stats();
+        void          reset_extent_stats();
+
+        SdClassStats get_stats(SdClass priority);
+        void         reset_stats();
+
+        // All zero when the card is mounted without the read cache
+        ReadCacheStats get_cache_stats();
+        void           reset_cache_stats();
+
         SdFs&     get_sdfs();
-        FsFile&   get_file();
 
         // true  -> successfully initialized
         // false -> idk, something wrong i guess
         bool      get_state();
 
         std::vector<String> get_directory_files(const char* path);
+
+        // Streams the entries of path to visit under the lock, false if it
+        // isn't a directory. Only a few KB of names are in RAM at a time
+        bool      for_each_entry(const char* path, DirOrder order, const DirVisitor& visit);
+
+        // Cached listing, only the Files page (loop task) should hold on to
+        // it. recheck = false trusts the cache and never touches the card
+        const MalkuthDirCache::Listing* get_directory(const char* path, bool recheck = true);
 };
\ No newline at end of file
@@ -0,0 +1,147 @@
+#pragma once
+
+#include <Arduino.h>
+#include <atomic>
+#include <math.h>
+
+// Attenuation at 1%, 0% is muted outright
+#ifndef GAIN_MIN_DB
+    #define GAIN_MIN_DB (-50.0f)
+#endif
+
+// Q31, so 24 and 32 bit samples keep every bit they have
+static constexpr int32_t GAIN_UNITY = INT32_MAX;
+
+#if CONFIG_IDF_TARGET_ESP32S3
+// malkuth_gain.S, blocks of 8 samples in place
+extern "C" void malkuth_gain_s16_pie(int16_t* data, size_t blocks, const int16_t* gains);
+#endif
+
+/// Integer volume for the PCM on its way to I2S, instead of the player's
+/// float scaling. Every percent maps to a precomputed Q31 gain spaced evenly
+/// in dB, 16 bit audio uses the top half of it as Q15.
+/// apply() works in place on the decoder's sample layout: int16_t, or the
+/// int32_t container 24 and 32 bit come in. On the S3 the 16 bit case runs
+/// 8 samples at a time through the PIE vector unit.
+class MalkuthGain {
+private:
+    int32_t                 _table[101];
+    std::atomic<int32_t>    _gain{GAIN_UNITY};
+
+    static void apply_s16_scalar(int16_t* data, size_t count, int16_t gain) {
+        for (size_t i = 0; i < count; i++)
+            data[i] = ((int32_t)data[i] * gain) >> 15;
+    }
+
+#if CONFIG_IDF_TARGET_ESP32S3
+    // The PIE vector unit does 8 lanes at a time on 16 byte aligned blocks,
+    // the ragged ends go through the scalar loop
+    static void apply_s16(int16_t* data, size_t count, int16_t gain) {
+        while (count > 0 && ((uintptr_t)data & 15)) {
+            apply_s16_scalar(data, 1, gain);
+            data++;
+            count--;
+        }
+
+        alignas(16) int16_t gains[8] = { gain, gain, gain, gain, gain, gain, gain, gain };
+        size_t blocks = count / 8;
+
+        if (blocks > 0)
+            malkuth_gain_s16_pie(data, blocks, gains);
+
+        apply_s16_scalar(data + blocks * 8, count - blocks * 8, gain);
+    }
+#else
+    static void apply_s16(int16_t* data, size_t count, int16_t gain) {
+        apply_s16_scalar(data, count, gain);
+    }
+#endif
+
+    static void apply_s32(int32_t* data, size_t count, int32_t gain) {
+        for (size_t i = 0; i < count; i++)
+            data[i] = ((int64_t)data[i] * gain + (1 << 30)) >> 31;
+    }
+
+public:
+    MalkuthGain() {
+        _table[0] = 0;
+        for (uint8_t percent = 1; percent <= 100; percent++) {
+            float db   = GAIN_MIN_DB * (100 - percent) / 99.0f;
+            _table[percent] = percent == 100 ? GAIN_UNITY : (int32_t)(powf(10.0f, db / 20.0f) * GAIN_UNITY);
+        }
+    }
+
+    void set_percent(uint8_t percent) {
+        _gain.store(_table[percent > 100 ? 100 : percent], std::memory_order_relaxed);
+    }
+
+    int32_t get()      const { return _gain.load(std::memory_order_relaxed); }
+    bool    is_unity() const { return get() == GAIN_UNITY; }
+
+    // bits as in AudioInfo, bytes has to be whole samples. false for a
+    // format it doesn't know, the data is left alone then
+    bool apply(uint8_t* data, size_t bytes, uint8_t bits) const {
+        int32_t gain = get();
+        if (gain == GAIN_UNITY) return true;
+
+        switch (bits) {
+            case 16:
+                apply_s16((int16_t*)data, bytes / 2, gain >> 16);
+                return true;
+
+            case 24:
+            case 32:
+                apply_s32((int32_t*)data, bytes / 4, gain);
+                return true;
+
+            default:
+                return false;
+        }
+    }
+
+    // 24 bit samples, sign extended in their int32_t, into MSB aligned
+    // 32 bit I2S slots with the gain applied on the way
+    void pack_s24(const int32_t* in, int32_t* out, size_t count) const {
+        int32_t gain = get();
+
+        if (gain == GAIN_UNITY) {
+            for (size_t i = 0; i < count; i++)
+                out[i] = (int32_t)((uint32_t)in[i] << 8);
+            return;
+        }
+
+        for (size_t i = 0; i < count; i++)
+            out[i] = ((int64_t)in[i] * gain + (1 << 22)) >> 23;
+    }
+
+    // Cycles per 16 bit sample for apply() against the float multiply the
+    // player did before, on a block of the given size at 90%
+    static void benchmark(size_t samples, float& fixed_cycles, float& float_cycles) {
+        int16_t* block = (int16_t*)heap_caps_aligned_alloc(16, samples * sizeof(int16_t), MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+        fixed_cycles = float_cycles = 0.0f;
+        if (!block || samples == 0) {
+            if (block) heap_caps_free(block);
+            return;
+        }
+
+        for (size_t i = 0; i < samples; i++)
+            block[i] = (int16_t)(i * 2654435761u >> 16);
+
+        MalkuthGain gain;
+        gain.set_percent(90);
+
+        uint32_t start = ESP.getCycleCount();
+        gain.apply((uint8_t*)block, samples * sizeof(int16_t), 16);
+        fixed_cycles = (float)(ESP.getCycleCount() - start) / samples;
+
+        volatile float factor = gain.get() / (float)GAIN_UNITY;
+        float f = factor;
+
+        start = ESP.getCycleCount();
+        for (size_t i = 0; i < samples; i++)
+            block[i] = (int16_t)(f * block[i]);
+        float_cycles = (float)(ESP.getCycleCount() - start) / samples;
+
+        heap_caps_free(block);
+    }
+};
@@ -1,6 +1,8 @@
 #pragma once
 
 #include <stdint.h>
+#include <string.h>
+#include <strings.h>
 
 #ifndef TODO
 #define TODO(text) Serial.printf("[TODO] : %s\n", text)
@@ -10,5 +12,50 @@ enum class ImageType : uint8_t {
     NONE,
     FLASH,
     PNG,
-    JPG
-};
\ No newline at end of file
+    JPG,
+    THUMB       // RGB565 thumbnail from MalkuthCovers
+};
+
+// FNV-1a, used to key on-card caches by path
+inline uint32_t hash_path(const char* path) {
+    uint32_t hash = 2166136261u;
+    while (*path) {
+        hash ^= (uint8_t)*path++;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+enum class EntryType : uint8_t {
+    DIRECTORY,
+    AUDIO,
+    IMAGE,
+    OTHER
+};
+
+// Directory entry as handed to a DirVisitor, name has no trailing '/'
+struct DirEntry {
+    const char* name;
+    EntryType   type;
+};
+
+inline bool ends_with_nocase(const char* name, const char* ext) {
+    size_t name_len = strlen(name);
+    size_t ext_len  = strlen(ext);
+
+    return name_len >= ext_len && strcasecmp(name + name_len - ext_len, ext) == 0;
+}
+
+inline EntryType entry_type(const char* name, bool is_dir) {
+    if (is_dir) return EntryType::DIRECTORY;
+
+    if (ends_with_nocase(name, ".mp3") || ends_with_nocase(name, ".flac") ||
+        ends_with_nocase(name, ".wav") || ends_with_nocase(name, ".aac"))
+        return EntryType::AUDIO;
+
+    if (ends_with_nocase(name, ".png") || ends_with_nocase(name, ".jpg") ||
+        ends_with_nocase(name, ".jpeg"))
+        return EntryType::IMAGE;
+
+    return EntryType::OTHER;
+}
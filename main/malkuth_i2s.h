@@ -0,0 +1,171 @@
+#pragma once
+
+#include <AudioTools.h>
+
+#include "malkuth_gain.h"
+#include "malkuth_stats.h"
+
+// Scaled PCM goes out in pieces this big, a multiple of every frame size
+#ifndef GAIN_CHUNK
+    #define GAIN_CHUNK 2048
+#endif
+
+/// The player's way out to the DAC. Sample accurate seeking and gapless
+/// trimming, the fixed point volume, 24 bit packing and the timing of the
+/// output stages all happen on the way through.
+class CustomI2S : public I2SStream {
+public:
+  static constexpr uint64_t UNLIMITED = UINT64_MAX;
+
+  uint64_t bytes_written  = 0;
+  uint64_t skip_samples   = 0;           // decoded frames to throw away (seek, encoder delay)
+  uint64_t samples_left   = UNLIMITED;   // anything past this is encoder padding
+
+  size_t write(const uint8_t* buffer, size_t size) override {
+    size_t frame   = frameSize();
+    size_t dropped = 0;
+    size_t cut     = 0;
+
+    if (frame == 0) {
+      size_t res      = I2SStream::write(buffer, size);
+      bytes_written  += res;
+      return res;
+    }
+
+    // A seek lands on the frame holding the target, the head of that frame
+    // never reaches the DAC so the position is sample accurate
+    if (skip_samples > 0) {
+      uint64_t skip = skip_samples * frame;
+      dropped       = skip < size ? (size_t)skip : size - (size % frame);
+
+      skip_samples -= dropped / frame;
+      buffer       += dropped;
+      size         -= dropped;
+    }
+
+    if (samples_left != UNLIMITED && size > samples_left * frame) {
+      cut  = size - samples_left * frame;
+      size = samples_left * frame;
+    }
+
+    if (size == 0) return dropped + cut;
+
+    size_t res      = write_scaled(buffer, size);
+    bytes_written  += res;
+    frames_out     += res / frame;
+
+    if (samples_left != UNLIMITED)
+      samples_left -= res / frame;
+
+    return dropped + res + (res == size ? cut : 0);
+  }
+
+  MalkuthGain gain;
+
+  // Only touched by the audio task. convert is the gain/packing pass, write
+  // is mostly waiting for room in the DMA buffers
+  MalkuthStageStats stats_convert = MalkuthStageStats("convert");
+  MalkuthStageStats stats_write   = MalkuthStageStats("write");
+  MalkuthDmaMonitor dma;
+  uint64_t          frames_out    = 0;
+
+  // 24 bit goes out in 32 bit slots, the DAC takes those MSB aligned and
+  // that is the slot size it ends up in anyway. Everything after the decoder
+  // still sees 24 bits in 4 byte containers, only I2S runs at 32
+  void setAudioInfo(AudioInfo info) override {
+    _source_bits = info.bits_per_sample;
+    if (info.bits_per_sample == 24) info.bits_per_sample = 32;
+
+    dma.set_byte_rate(info.sample_rate * info.channels * (info.bits_per_sample / 8));
+    dma.restart();
+
+    I2SStream::setAudioInfo(info);
+  }
+
+  uint8_t sourceBits() const { return _source_bits; }
+
+  // The decoder's buffer is const, so anything that isn't passed through as
+  // is gets converted chunk by chunk into _scaled, in a single pass
+  size_t write_scaled(const uint8_t* buffer, size_t size) {
+    bool    pack  = _source_bits == 24;
+    size_t  total = 0;
+
+    if (!pack && gain.is_unity())
+      return write_timed(buffer, size);
+
+    while (total < size) {
+      size_t   n     = size - total < GAIN_CHUNK ? size - total : GAIN_CHUNK;
+      uint32_t start = MalkuthStageStats::now();
+
+      if (pack) {
+        gain.pack_s24((const int32_t*)(buffer + total), (int32_t*)_scaled, n / 4);
+      } else {
+        memcpy(_scaled, buffer + total, n);
+        gain.apply(_scaled, n, _source_bits);
+      }
+
+      stats_convert.record_since(start);
+
+      size_t res = write_timed(_scaled, n);
+      total     += res;
+      if (res < n) break;
+    }
+
+    return total;
+  }
+
+  size_t write_timed(const uint8_t* buffer, size_t size) {
+    dma.before_write();
+    uint32_t start = MalkuthStageStats::now();
+
+    size_t res = I2SStream::write(buffer, size);
+
+    stats_write.record_since(start);
+    dma.after_write(res);
+    return res;
+  }
+
+  // int24_t lives in 4 bytes on the decoder side
+  size_t frameSize() {
+    auto info = audioInfo();
+    int  bps  = info.bits_per_sample == 24 ? 4 : info.bits_per_sample / 8;
+
+    return info.channels * bps;
+  }
+
+  float getAudioCurrentTime() {
+    auto info = audioInfo();
+
+    if (info.sample_rate == 0) return 0.0f;
+
+    int byte_rate = info.sample_rate * frameSize();
+    
+    return byte_rate > 0 ? (float)bytes_written / byte_rate : 0.0f;
+  }
+
+  void resetBytesWritten() {
+    dma.restart();
+    bytes_written = 0;
+    skip_samples  = 0;
+    samples_left  = UNLIMITED;
+  }
+
+  // length is the track's trimmed length from its start, whatever of it
+  // lies past sample is what's left to play
+  void seekTo(uint64_t sample, uint64_t skip, uint64_t length = UNLIMITED) {
+    dma.restart();
+    bytes_written = sample * frameSize();
+    skip_samples  = skip;
+    samples_left  = length == UNLIMITED ? UNLIMITED : (length > sample ? length - sample : 0);
+  }
+
+  // Only the samples the encoder actually meant, for gapless playback
+  void trim(uint64_t skip, uint64_t length) {
+    skip_samples  = skip;
+    samples_left  = length;
+  }
+
+private:
+  uint8_t             _source_bits = 16;
+  alignas(16) uint8_t _scaled[GAIN_CHUNK];
+};
@@ -0,0 +1,453 @@
+#include "malkuth_id3.h"
+
+static uint32_t read_be32(const uint8_t* bytes) {
+    return ((uint32_t)bytes[0] << 24) | ((uint32_t)bytes[1] << 16) | ((uint32_t)bytes[2] << 8) | bytes[3];
+}
+
+///
+/// Private Function
+///
+
+uint32_t MalkuthId3::syncsafe(const uint8_t* bytes) {
+    return ((uint32_t)(bytes[0] & 0x7F) << 21) | ((uint32_t)(bytes[1] & 0x7F) << 14) |
+           ((uint32_t)(bytes[2] & 0x7F) << 7)  |  (uint32_t)(bytes[3] & 0x7F);
+}
+
+bool MalkuthId3::is_syncsafe(const uint8_t* bytes) {
+    return !((bytes[0] | bytes[1] | bytes[2] | bytes[3]) & 0x80);
+}
+
+// Next byte of the tag as it is on the card
+int MalkuthId3::raw() {
+    if (_pos == _fill) {
+        if (_tag_left == 0) return -1;
+
+        int got = _file.read(_buffer, _tag_left < sizeof(_buffer) ? _tag_left : sizeof(_buffer));
+        if (got <= 0) {
+            _tag_left = 0;
+            return -1;
+        }
+
+        _tag_left -= got;
+        _pos       = 0;
+        _fill      = got;
+    }
+
+    return _buffer[_pos++];
+}
+
+// Next byte of the tag with the tag wide unsynchronisation (v2.2/v2.3)
+// undone, every 0xFF 0x00 on the card was a lone 0xFF
+int MalkuthId3::body() {
+    int b = raw();
+
+    if (_tag_unsync && _tag_ff && b == 0x00)
+        b = raw();
+
+    _tag_ff = b == 0xFF;
+    return b;
+}
+
+bool MalkuthId3::body(uint8_t* out, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        int b = body();
+        if (b < 0) return false;
+        out[i] = b;
+    }
+    return true;
+}
+
+// Without tag unsynchronisation a tag byte is a card byte, so whatever
+// isn't buffered yet can be seeked over
+void MalkuthId3::skip_body(uint32_t count) {
+    if (_tag_unsync) {
+        while (count-- && body() >= 0);
+        return;
+    }
+
+    uint32_t buffered = _fill - _pos;
+    uint32_t taken    = count < buffered ? count : buffered;
+    _pos  += taken;
+    count -= taken;
+
+    if (count == 0) return;
+
+    if (count > _tag_left) count = _tag_left;
+    _file.seekCur(count);
+    _tag_left -= count;
+}
+
+// Next payload byte of the current frame, with the frame's own (v2.4)
+// unsynchronisation undone
+int MalkuthId3::payload() {
+    if (_frame_left == 0 || _frame_opaque) return -1;
+
+    int b = body();
+    _frame_left--;
+
+    if (b >= 0 && _frame_unsync && _frame_ff && b == 0x00) {
+        if (_frame_left == 0) return -1;
+
+        b = body();
+        _frame_left--;
+    }
+
+    if (b < 0) _frame_left = 0;
+
+    _frame_ff = b == 0xFF;
+    return b;
+}
+
+// One code point of a text frame, 0 at the terminator and -1 at the end
+// of the frame. Anything malformed comes out as U+FFFD
+int MalkuthId3::text_unit(uint8_t encoding, bool little_endian) {
+    static constexpr int REPLACEMENT = 0xFFFD;
+
+    auto next_byte = [this]() {
+        int b     = _pushback >= 0 ? _pushback : payload();
+        _pushback = -1;
+        return b;
+    };
+
+    auto next_unit = [&]() {
+        if (_pushback >= 0) {
+            int unit  = _pushback;
+            _pushback = -1;
+            return unit;
+        }
+
+        int a = payload();
+        int b = payload();
+        if (a < 0 || b < 0) return -1;
+
+        return little_endian ? (b << 8) | a : (a << 8) | b;
+    };
+
+    switch (encoding) {
+        case 0:     // ISO-8859-1 maps straight onto the first 256 code points
+            return next_byte();
+
+        case 1:
+        case 2: {
+            int unit = next_unit();
+            if (unit < 0xD800 || unit > 0xDFFF) return unit;
+            if (unit >= 0xDC00) return REPLACEMENT;
+
+            int low = next_unit();
+            if (low < 0) return REPLACEMENT;
+            if (low < 0xDC00 || low > 0xDFFF) {
+                _pushback = low;
+                return REPLACEMENT;
+            }
+
+            return 0x10000 + ((unit - 0xD800) << 10) + (low - 0xDC00);
+        }
+
+        case 3: {
+            int lead = next_byte();
+            if (lead < 0x80) return lead;
+
+            int      extra;
+            uint32_t code;
+            uint32_t min;
+
+            if      (lead >= 0xC2 && lead <= 0xDF) { extra = 1; code = lead & 0x1F; min = 0x80; }
+            else if (lead >= 0xE0 && lead <= 0xEF) { extra = 2; code = lead & 0x0F; min = 0x800; }
+            else if (lead >= 0xF0 && lead <= 0xF4) { extra = 3; code = lead & 0x07; min = 0x10000; }
+            else return REPLACEMENT;
+
+            while (extra--) {
+                int b = next_byte();
+                if (b < 0) return REPLACEMENT;
+                if ((b & 0xC0) != 0x80) {
+                    _pushback = b;
+                    return REPLACEMENT;
+                }
+                code = (code << 6) | (b & 0x3F);
+            }
+
+            if (code < min || code > 0x10FFFF || (code >= 0xD800 && code <= 0xDFFF))
+                return REPLACEMENT;
+
+            return code;
+        }
+    }
+
+    return -1;
+}
+
+// Bytes written, 0 if the whole character doesn't fit in front of the NUL
+size_t MalkuthId3::put_utf8(char* out, size_t cap, size_t used, uint32_t code) {
+    size_t length = code < 0x80 ? 1 : code < 0x800 ? 2 : code < 0x10000 ? 3 : 4;
+    if (used + length + 1 > cap) return 0;
+
+    char* at = out + used;
+    switch (length) {
+        case 1:
+            at[0] = code;
+            break;
+        case 2:
+            at[0] = 0xC0 | (code >> 6);
+            at[1] = 0x80 | (code & 0x3F);
+            break;
+        case 3:
+            at[0] = 0xE0 | (code >> 12);
+            at[1] = 0x80 | ((code >> 6) & 0x3F);
+            at[2] = 0x80 | (code & 0x3F);
+            break;
+        default:
+            at[0] = 0xF0 | (code >> 18);
+            at[1] = 0x80 | ((code >> 12) & 0x3F);
+            at[2] = 0x80 | ((code >> 6) & 0x3F);
+            at[3] = 0x80 | (code & 0x3F);
+            break;
+    }
+
+    return length;
+}
+
+///
+/// Public Function
+///
+
+bool MalkuthId3::begin() {
+    uint8_t hdr[10];
+
+    _header       = Header();
+    _pos          = 0;
+    _fill         = 0;
+    _tag_left     = 0;
+    _tag_ff       = false;
+    _frame_left   = 0;
+    _frame_opaque = false;
+
+    if (_file.read(hdr, sizeof(hdr)) != sizeof(hdr)) return false;
+
+    if (memcmp(hdr, "ID3", 3) != 0 || hdr[3] < 2 || hdr[3] > 4 || hdr[4] == 0xFF || !is_syncsafe(hdr + 6))
+        return false;
+
+    _header.version = hdr[3];
+    _header.flags   = hdr[5];
+    _header.size    = syncsafe(hdr + 6);
+    _header.total   = 10 + _header.size + ((_header.version == 4 && (_header.flags & 0x10)) ? 10 : 0);
+
+    _tag_left   = _header.size;
+    _tag_unsync = _header.version < 4 && (_header.flags & 0x80);
+
+    // v2.2 called this compression and never said what that looks like
+    if (_header.version == 2) {
+        if (_header.flags & 0x40) _tag_left = 0;
+        return true;
+    }
+
+    // Extended header, v2.3 doesn't count its own size field, v2.4 does
+    if (_header.flags & 0x40) {
+        uint8_t size[4];
+        if (!body(size, sizeof(size))) return true;
+
+        if (_header.version == 3) {
+            skip_body(read_be32(size));
+        } else {
+            uint32_t length = syncsafe(size);
+            skip_body(length > 4 ? length - 4 : 0);
+        }
+    }
+
+    return true;
+}
+
+bool MalkuthId3::next(Frame& frame) {
+    const uint8_t version = _header.version;
+
+    if (_frame_left) {
+        if (_tag_unsync) {
+            while (_frame_left && body() >= 0) _frame_left--;
+        } else {
+            skip_body(_frame_left);
+        }
+    }
+
+    _frame_left   = 0;
+    _frame_unsync = false;
+    _frame_ff     = false;
+    _frame_opaque = false;
+
+    uint8_t hdr[10];
+    uint8_t id_length = version == 2 ? 3 : 4;
+    if (!body(hdr, version == 2 ? 6 : 10)) return false;
+
+    // Padding, or something that isn't a frame header anymore
+    for (uint8_t i = 0; i < id_length; i++) {
+        if (!((hdr[i] >= 'A' && hdr[i] <= 'Z') || (hdr[i] >= '0' && hdr[i] <= '9')))
+            return false;
+        frame.id[i] = hdr[i];
+    }
+    frame.id[id_length] = '\0';
+
+    uint8_t format = 0;
+    uint8_t extras = 0;
+
+    if (version == 2) {
+        _frame_left = ((uint32_t)hdr[3] << 16) | ((uint32_t)hdr[4] << 8) | hdr[5];
+    } else if (version == 3) {
+        _frame_left = read_be32(hdr + 4);
+        format      = hdr[9];
+
+        // decompressed size, encryption method, group
+        extras        = ((format & 0x80) ? 4 : 0) + ((format & 0x40) ? 1 : 0) + ((format & 0x20) ? 1 : 0);
+        _frame_opaque = format & 0xC0;
+    } else {
+        // iTunes wrote plain sizes into v2.4 tags for a while, those have
+        // the high bit set somewhere once a frame is 128 bytes or more
+        _frame_left = is_syncsafe(hdr + 4) ? syncsafe(hdr + 4) : read_be32(hdr + 4);
+        format      = hdr[9];
+
+        // group, encryption method, data length indicator
+        extras        = ((format & 0x40) ? 1 : 0) + ((format & 0x04) ? 1 : 0) + ((format & 0x01) ? 4 : 0);
+        _frame_opaque = format & 0x0C;
+        _frame_unsync = (format & 0x02) || (_header.flags & 0x80);
+    }
+
+    for (; extras && _frame_left; extras--, _frame_left--) {
+        if (body() < 0) {
+            _frame_left = 0;
+            break;
+        }
+    }
+
+    frame.size   = _frame_left;
+    frame.opaque = _frame_opaque;
+    return true;
+}
+
+size_t MalkuthId3::read(uint8_t* out, size_t count) {
+    size_t done = 0;
+
+    if (_frame_opaque) return 0;
+
+    // Nothing to undo, straight out of the scratch buffer
+    if (!_tag_unsync && !_frame_unsync) {
+        while (done < count && _frame_left) {
+            if (_pos == _fill) {
+                int b = raw();
+                if (b < 0) {
+                    _frame_left = 0;
+                    break;
+                }
+                _pos--;
+            }
+
+            size_t take = _fill - _pos;
+            if (take > count - done)  take = count - done;
+            if (take > _frame_left)   take = _frame_left;
+
+            memcpy(out + done, _buffer + _pos, take);
+            _pos        += take;
+            _frame_left -= take;
+            done        += take;
+        }
+
+        return done;
+    }
+
+    while (done < count) {
+        int b = payload();
+        if (b < 0) break;
+        out[done++] = b;
+    }
+
+    return done;
+}
+
+size_t MalkuthId3::read_text(char* out, size_t cap) {
+    if (cap == 0) return 0;
+    out[0] = '\0';
+
+    int encoding = payload();
+    if (encoding < 0 || encoding > 3) return 0;
+
+    return read_string(encoding, out, cap);
+}
+
+size_t MalkuthId3::read_string(uint8_t encoding, char* out, size_t cap) {
+    if (cap) out[0] = '\0';
+    if (encoding > 3) return 0;
+
+    bool little_endian = false;
+    _pushback = -1;
+
+    // Byte order mark on every UTF-16 value, big endian if it's missing
+    if (encoding == 1) {
+        int a = payload();
+        int b = payload();
+        if (a < 0 || b < 0) return 0;
+
+        if      (a == 0xFF && b == 0xFE) little_endian = true;
+        else if (a == 0xFE && b == 0xFF) little_endian = false;
+        else    _pushback = (a << 8) | b;
+    }
+
+    size_t used = 0;
+    bool   full = cap == 0;
+    while (true) {
+        int code = text_unit(encoding, little_endian);
+        if (code <= 0) break;
+        if (full) continue;
+
+        size_t length = put_utf8(out, cap, used, code);
+        if (length == 0) {
+            full = true;
+            continue;
+        }
+
+        used += length;
+    }
+
+    if (cap) out[used] = '\0';
+    _pushback = -1;
+    return used;
+}
+
+bool MalkuthId3::region(uint32_t& offset, uint32_t& size) {
+    if (_frame_opaque || _tag_unsync || _frame_unsync) return false;
+
+    offset = (uint32_t)_file.position() - (_fill - _pos);
+    size   = _frame_left;
+    return true;
+}
+
+bool MalkuthId3::read_tags(FsFile& file, Tags& tags, Header* header) {
+    tags.title[0]  = '\0';
+    tags.artist[0] = '\0';
+    tags.album[0]  = '\0';
+
+    file.seek(0);
+
+    MalkuthId3 id3(file);
+    if (!id3.begin()) return false;
+
+    if (header) *header = id3.header();
+
+    Frame frame;
+    while (id3.next(frame)) {
+        char* out = nullptr;
+
+        if      (!strcmp(frame.id, "TIT2") || !strcmp(frame.id, "TT2")) out = tags.title;
+        else if (!strcmp(frame.id, "TPE1") || !strcmp(frame.id, "TP1")) out = tags.artist;
+        else if (!strcmp(frame.id, "TALB") || !strcmp(frame.id, "TAL")) out = tags.album;
+
+        if (out && !out[0])
+            id3.read_text(out, ID3_TEXT_MAX);
+
+        if (tags.title[0] && tags.artist[0] && tags.album[0]) break;
+    }
+
+    return true;
+}
+
+uint32_t MalkuthId3::tag_size(FsFile& file) {
+    file.seek(0);
+
+    MalkuthId3 id3(file);
+    return id3.begin() ? id3.header().total : 0;
+}
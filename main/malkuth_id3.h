@@ -0,0 +1,107 @@
+#pragma once
+
+#include <Arduino.h>
+#include <SdFat.h>
+
+// Tag bytes read from the card at a time
+#ifndef ID3_SCRATCH
+    #define ID3_SCRATCH 256
+#endif
+
+// UTF-8 bytes kept per text field, NUL included
+#ifndef ID3_TEXT_MAX
+    #define ID3_TEXT_MAX 128
+#endif
+
+/// ID3v2.2 / v2.3 / v2.4 tag reader that walks the frames straight off the
+/// card through a ID3_SCRATCH sized buffer and never allocates.
+/// Tag wide (v2.2/v2.3) and per frame (v2.4) unsynchronisation is undone on
+/// the fly, extended headers are skipped and text is transcoded to UTF-8
+/// into whatever storage the caller hands over.
+class MalkuthId3 {
+public:
+    struct Header {
+        uint8_t     version = 0;    // 2, 3 or 4
+        uint8_t     flags   = 0;
+        uint32_t    size    = 0;    // after the 10 byte header, footer excluded
+        uint32_t    total   = 0;    // the whole tag, where the audio starts
+    };
+
+    struct Frame {
+        char        id[5];          // 3 characters on v2.2
+        uint32_t    size;           // payload left after the flag extras
+        bool        opaque;         // compressed or encrypted, read() gives nothing
+    };
+
+    struct Tags {
+        char title[ID3_TEXT_MAX];
+        char artist[ID3_TEXT_MAX];
+        char album[ID3_TEXT_MAX];
+    };
+
+private:
+    FsFile&     _file;
+    Header      _header;
+
+    uint8_t     _buffer[ID3_SCRATCH];
+    uint16_t    _pos            = 0;
+    uint16_t    _fill           = 0;
+    uint32_t    _tag_left       = 0;    // on the card, not buffered yet
+
+    bool        _tag_unsync     = false;
+    bool        _tag_ff         = false;
+
+    uint32_t    _frame_left     = 0;    // in tag bytes (after tag unsync)
+    bool        _frame_unsync   = false;
+    bool        _frame_ff       = false;
+    bool        _frame_opaque   = false;
+
+    int         _pushback       = -1;
+
+    int      raw();
+    int      body();
+    bool     body(uint8_t* out, size_t count);
+    void     skip_body(uint32_t count);
+    int      payload();
+    int      text_unit(uint8_t encoding, bool little_endian);
+
+    static uint32_t syncsafe(const uint8_t* bytes);
+    static bool     is_syncsafe(const uint8_t* bytes);
+    static size_t   put_utf8(char* out, size_t cap, size_t used, uint32_t code);
+
+public:
+    explicit MalkuthId3(FsFile& file) : _file(file) {}
+
+    // Tag header at the current file position, false if there is none. The
+    // file belongs to the reader until it's done with the frames
+    bool begin();
+
+    const Header& header() const { return _header; }
+
+    // Skips whatever is left of the current frame, false at padding or at
+    // the end of the tag
+    bool next(Frame& frame);
+
+    // Payload of the current frame, unsynchronisation undone
+    size_t read(uint8_t* out, size_t count);
+
+    // Current frame as a text frame, first value only. Always NUL
+    // terminated, cut on a character boundary when it doesn't fit
+    size_t read_text(char* out, size_t cap);
+
+    // One terminated string of the frame in the given encoding, for frames
+    // that mix them (APIC, PIC). Read up to the terminator even when it
+    // doesn't fit, cap 0 just skips it
+    size_t read_string(uint8_t encoding, char* out, size_t cap);
+
+    // Where the rest of the current frame sits in the file, false when
+    // unsynchronisation or compression means it isn't stored as is
+    bool   region(uint32_t& offset, uint32_t& size);
+
+    // Title, artist and album of the tag at the start of file. Fields
+    // without a frame come back empty
+    static bool read_tags(FsFile& file, Tags& tags, Header* header = nullptr);
+
+    // Size of the tag at the start of file, 0 if there is none
+    static uint32_t tag_size(FsFile& file);
+};
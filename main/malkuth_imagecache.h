@@ -0,0 +1,110 @@
+#pragma once
+
+#include <Arduino.h>
+#include <vector>
+
+/// Decoded RGB565 copies of flash images, keyed by the image data pointer.
+/// Everything lives in PSRAM and the least recently drawn image goes first
+/// once the budget is hit.
+class MalkuthImageCache {
+public:
+    struct Entry {
+        const uint8_t*  key;
+        uint16_t        width;
+        uint16_t        height;
+        uint16_t*       pixels;
+        uint32_t        last_used;
+    };
+
+private:
+    std::vector<Entry>  _entries;
+    size_t              _budget = 0;
+    size_t              _used   = 0;
+    uint32_t            _tick   = 0;
+
+    uint32_t            _hits   = 0;
+    uint32_t            _misses = 0;
+
+    static size_t bytes(const Entry& entry) {
+        return (size_t)entry.width * entry.height * sizeof(uint16_t);
+    }
+
+    void evict_oldest() {
+        auto oldest = _entries.begin();
+        for (auto it = _entries.begin(); it != _entries.end(); ++it)
+            if (it->last_used < oldest->last_used) oldest = it;
+
+        _used -= bytes(*oldest);
+        heap_caps_free(oldest->pixels);
+        _entries.erase(oldest);
+    }
+
+public:
+    explicit MalkuthImageCache(size_t budget = 0) : _budget(budget) {}
+
+    ~MalkuthImageCache() {
+        clear();
+    }
+
+    Entry* find(const uint8_t* key) {
+        for (auto& entry : _entries) {
+            if (entry.key == key) {
+                entry.last_used = ++_tick;
+                _hits++;
+                return &entry;
+            }
+        }
+
+        _misses++;
+        return nullptr;
+    }
+
+    // Room for a width x height image, nullptr if it can't ever fit
+    Entry* insert(const uint8_t* key, uint16_t width, uint16_t height) {
+        Entry entry = { key, width, height, nullptr, ++_tick };
+        size_t size = bytes(entry);
+
+        if (size == 0 || size > _budget) return nullptr;
+
+        while (!_entries.empty() && _used + size > _budget)
+            evict_oldest();
+
+        entry.pixels = (uint16_t*)heap_caps_malloc(size, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+        if (!entry.pixels) return nullptr;
+
+        _used += size;
+        _entries.push_back(entry);
+        return &_entries.back();
+    }
+
+    // A decode that went wrong shouldn't stay around
+    void remove(const uint8_t* key) {
+        for (auto it = _entries.begin(); it != _entries.end(); ++it) {
+            if (it->key == key) {
+                _used -= bytes(*it);
+                heap_caps_free(it->pixels);
+                _entries.erase(it);
+                return;
+            }
+        }
+    }
+
+    void clear() {
+        for (auto& entry : _entries)
+            heap_caps_free(entry.pixels);
+
+        _entries.clear();
+        _used = 0;
+    }
+
+    void set_budget(size_t budget) {
+        _budget = budget;
+        while (!_entries.empty() && _used > _budget)
+            evict_oldest();
+    }
+
+    size_t   budget() const { return _budget; }
+    size_t   used()   const { return _used; }
+    uint32_t hits()   const { return _hits; }
+    uint32_t misses() const { return _misses; }
+};
@@ -0,0 +1,465 @@
+#include "malkuth_library.h"
+#include "malkuth_helper.h"
+
+#define LIBRARY_INDEX   LIBRARY_DIR "/library.idx"
+#define LIBRARY_POOL    LIBRARY_DIR "/library.str"
+#define LIBRARY_TEMP    LIBRARY_DIR "/library.tmp"
+#define LIBRARY_POOL_TEMP LIBRARY_DIR "/library.str.tmp"
+
+///
+/// Private Function
+///
+
+bool MalkuthLibrary::load() {
+    Header header;
+
+    _hashes.clear();
+    _live = 0;
+
+    if (_index.size() < sizeof(Header)) {
+        memcpy(header.magic, "MKLB", 4);
+        header.version  = VERSION;
+        header.count    = 0;
+        header.reserved = 0;
+
+        _index.seek(0);
+        _index.truncate(0);
+        _index.write(&header, sizeof(header));
+        _index.sync();
+        return true;
+    }
+
+    _index.seek(0);
+    if (_index.read(&header, sizeof(header)) != sizeof(header) ||
+        memcmp(header.magic, "MKLB", 4) != 0 ||
+        header.version != VERSION
+    ){
+        // Stale or broken, start over
+        _index.truncate(0);
+        _pool.truncate(0);
+        return load();
+    }
+
+    _hashes.reserve(header.count);
+
+    Record record;
+    for (uint32_t i = 0; i < header.count; i++) {
+        if (_index.read(&record, sizeof(record)) != sizeof(record))
+            break;
+        _hashes.push_back(record.hash);
+        _live += record.strings_len;
+    }
+
+    return true;
+}
+
+bool MalkuthLibrary::read_record(uint32_t slot, Record& record) {
+    _index.seek(sizeof(Header) + (uint64_t)slot * sizeof(Record));
+    return _index.read(&record, sizeof(record)) == sizeof(record);
+}
+
+bool MalkuthLibrary::read_strings(const Record& record, char* buffer, size_t size) {
+    if (record.strings_len == 0 || record.strings_len > size)
+        return false;
+
+    _pool.seek(record.strings);
+    return _pool.read(buffer, record.strings_len) == record.strings_len;
+}
+
+// Slot of the record holding this path, -1 if it isn't indexed. Leaves
+// whatever it last read in _strings
+int32_t MalkuthLibrary::find_slot(const char* path, uint32_t hash, Record& record) {
+    auto it = std::lower_bound(_hashes.begin(), _hashes.end(), hash);
+
+    // Walk the (almost always single entry) run of equal hashes
+    for (; it != _hashes.end() && *it == hash; ++it) {
+        uint32_t slot = it - _hashes.begin();
+
+        if (!read_record(slot, record))             return -1;
+        if (!read_strings(record, _strings, sizeof(_strings))) continue;
+
+        if (strcmp(_strings, path) == 0)
+            return slot;
+    }
+
+    return -1;
+}
+
+// Pending entries first (they are newer), then the ones being merged, then
+// the sorted index. The strings end up in _strings
+bool MalkuthLibrary::lookup(const char* path, Record& record) {
+    uint32_t hash = hash_path(path);
+
+    for (auto it = _pending.rbegin(); it != _pending.rend(); ++it) {
+        if (it->record.hash == hash && it->path == path) {
+            record = it->record;
+            return read_strings(record, _strings, sizeof(_strings));
+        }
+    }
+
+    for (const Pending& entry : _merge.entries) {
+        if (entry.record.hash == hash && entry.path == path) {
+            record = entry.record;
+            return read_strings(record, _strings, sizeof(_strings));
+        }
+    }
+
+    return find_slot(path, hash, record) >= 0;
+}
+
+void MalkuthLibrary::fill(const Record& record, const char* strings, AudioMetadata& metadata) {
+    const char* title   = strings + strlen(strings) + 1;
+    const char* artist  = title + strlen(title) + 1;
+    const char* album   = artist + strlen(artist) + 1;
+
+    metadata.title          = title;
+    metadata.artist         = artist;
+    metadata.album          = album;
+    metadata.duration       = record.duration;
+    metadata.total_samples  = record.total_samples;
+    metadata.sample_rate    = record.sample_rate;
+    metadata.data_offset    = record.data_offset;
+    metadata.fragmented     = record.flags & FLAG_FRAGMENTED;
+}
+
+void MalkuthLibrary::stamp(FsFile& file, Record& record) {
+    record.file_size    = file.size();
+    record.modify_date  = 0;
+    record.modify_time  = 0;
+    file.getModifyDateTime(&record.modify_date, &record.modify_time);
+}
+
+// Takes the pending list and opens the new files, false if there was
+// nothing to merge or they couldn't be opened
+bool MalkuthLibrary::merge_begin() {
+    if (_pending.empty()) return false;
+
+    Merge& merge = _merge;
+
+    // Pool bytes that belong to nothing, replaced records still count as
+    // live here so compacting may come one flush late, never early
+    uint32_t live = _live;
+    for (const Pending& entry : _pending)
+        live += entry.record.strings_len;
+
+    uint64_t dead = _pool.size() > live ? _pool.size() - live : 0;
+    merge.compact = dead >= LIBRARY_COMPACT_BYTES && dead > live;
+
+    if (!merge.index.open(LIBRARY_TEMP, O_RDWR | O_CREAT | O_TRUNC) ||
+        (merge.compact && !merge.pool.open(LIBRARY_POOL_TEMP, O_RDWR | O_CREAT | O_TRUNC))
+    ){
+        merge_abort();
+        return false;
+    }
+
+    merge.entries.swap(_pending);
+    std::sort(merge.entries.begin(), merge.entries.end(), [](const Pending& a, const Pending& b) {
+        return a.record.hash < b.record.hash;
+    });
+
+    memcpy(merge.header.magic, "MKLB", 4);
+    merge.header.version  = VERSION;
+    merge.header.count    = 0;
+    merge.header.reserved = 0;
+    merge.index.write(&merge.header, sizeof(merge.header));
+
+    merge.next   = 0;
+    merge.slot   = 0;
+    merge.live   = 0;
+    merge.hashes.clear();
+    merge.hashes.reserve(_hashes.size() + merge.entries.size());
+    merge.active = true;
+    return true;
+}
+
+// Compacting moves every record's strings into the new pool as it's
+// written, one that can't be read any more is dropped (and reparsed)
+void MalkuthLibrary::emit(Record record) {
+    Merge& merge = _merge;
+
+    if (merge.compact) {
+        if (!read_strings(record, _strings, sizeof(_strings))) return;
+
+        record.strings = merge.pool.size();
+        merge.pool.seek(record.strings);
+        if (merge.pool.write(_strings, record.strings_len) != record.strings_len) return;
+    }
+
+    if (merge.index.write(&record, sizeof(record)) != sizeof(record)) return;
+
+    merge.header.count++;
+    merge.hashes.push_back(record.hash);
+    merge.live += record.strings_len;
+}
+
+// Up to LIBRARY_FLUSH_BATCH records, old and new ones, in hash order. An
+// old record a merged entry has the same path as is left out
+void MalkuthLibrary::merge_batch() {
+    Merge&   merge = _merge;
+    Record   record;
+    uint32_t done  = 0;
+
+    _index.seek(sizeof(Header) + (uint64_t)merge.slot * sizeof(Record));
+
+    while (done < LIBRARY_FLUSH_BATCH && merge.slot < _hashes.size()) {
+        if (_index.read(&record, sizeof(record)) != sizeof(record)) {
+            merge.slot = _hashes.size();
+            break;
+        }
+
+        while (done < LIBRARY_FLUSH_BATCH && merge.next < merge.entries.size() &&
+               merge.entries[merge.next].record.hash < record.hash) {
+            emit(merge.entries[merge.next++].record);
+            done++;
+        }
+
+        // Out of batch before this record got its turn, read again next time
+        if (done >= LIBRARY_FLUSH_BATCH) break;
+
+        // Only a hash the merge has as well needs the path compared
+        size_t i        = merge.next;
+        bool   replaced = false;
+
+        if (i < merge.entries.size() && merge.entries[i].record.hash == record.hash &&
+            read_strings(record, _strings, sizeof(_strings))) {
+            for (; i < merge.entries.size() && merge.entries[i].record.hash == record.hash; i++) {
+                if (merge.entries[i].path == _strings) {
+                    replaced = true;
+                    break;
+                }
+            }
+        }
+
+        if (!replaced) emit(record);
+        merge.slot++;
+        done++;
+    }
+
+    if (merge.slot >= _hashes.size()) {
+        while (done < LIBRARY_FLUSH_BATCH && merge.next < merge.entries.size()) {
+            emit(merge.entries[merge.next++].record);
+            done++;
+        }
+    }
+}
+
+// The new files replace the old ones. Tracks put() while merging still point
+// at the old pool, a compacted one gets their strings copied over
+void MalkuthLibrary::merge_end() {
+    Merge& merge = _merge;
+    SdFs&  sd    = _fs->get_sdfs();
+
+    merge.index.seek(0);
+    merge.index.write(&merge.header, sizeof(merge.header));
+    merge.index.close();
+
+    _index.close();
+    sd.remove(LIBRARY_INDEX);
+    sd.rename(LIBRARY_TEMP, LIBRARY_INDEX);
+
+    if (merge.compact) {
+        for (auto it = _pending.begin(); it != _pending.end();) {
+            bool moved = read_strings(it->record, _strings, sizeof(_strings));
+
+            if (moved) {
+                it->record.strings = merge.pool.size();
+                merge.pool.seek(it->record.strings);
+                moved = merge.pool.write(_strings, it->record.strings_len) == it->record.strings_len;
+            }
+
+            it = moved ? it + 1 : _pending.erase(it);
+        }
+
+        merge.pool.close();
+        _pool.close();
+        sd.remove(LIBRARY_POOL);
+        sd.rename(LIBRARY_POOL_TEMP, LIBRARY_POOL);
+        _pool.open(LIBRARY_POOL, O_RDWR | O_CREAT);
+    }
+
+    _hashes.swap(merge.hashes);
+    _live  = merge.live;
+    _ready = _index.open(LIBRARY_INDEX, O_RDWR) && _pool.isOpen();
+
+    merge_abort();
+}
+
+// Drops the merge state, whatever temp files are open get closed
+void MalkuthLibrary::merge_abort() {
+    Merge& merge = _merge;
+
+    if (merge.index.isOpen()) merge.index.close();
+    if (merge.pool.isOpen())  merge.pool.close();
+
+    merge.active = false;
+    merge.entries.clear();
+    merge.hashes.clear();
+    merge.hashes.shrink_to_fit();
+}
+
+///
+/// Public Function
+///
+
+bool MalkuthLibrary::begin(MalkuthFs& fs) {
+    _fs     = &fs;
+    _ready  = false;
+
+    _fs->lock();
+    SdFs& sd = _fs->get_sdfs();
+
+    // A merge from before the remount is thrown away with what it took
+    merge_abort();
+    _pending.clear();
+
+    if (_index.isOpen()) _index.close();
+    if (_pool.isOpen())  _pool.close();
+
+    if (!sd.exists(LIBRARY_DIR))
+        sd.mkdir(LIBRARY_DIR);
+
+    if (_index.open(LIBRARY_INDEX, O_RDWR | O_CREAT) &&
+        _pool.open(LIBRARY_POOL, O_RDWR | O_CREAT)
+    ){
+        _ready = load();
+    }
+
+    _fs->unlock();
+    return _ready;
+}
+
+bool MalkuthLibrary::get(const char* path, AudioMetadata& metadata) {
+    if (!_ready) return false;
+
+    Record record;
+
+    _fs->lock();
+    bool found = lookup(path, record);
+    if (found)
+        fill(record, _strings, metadata);
+    _fs->unlock();
+
+    return found;
+}
+
+bool MalkuthLibrary::get(const char* path, FsFile& file, AudioMetadata& metadata) {
+    if (!_ready) return false;
+
+    Record current;
+    Record record;
+
+    _fs->lock();
+    stamp(file, current);
+
+    bool found = lookup(path, record) &&
+        record.file_size   == current.file_size   &&
+        record.modify_date == current.modify_date &&
+        record.modify_time == current.modify_time;
+
+    if (found)
+        fill(record, _strings, metadata);
+    _fs->unlock();
+
+    return found;
+}
+
+void MalkuthLibrary::put(const char* path, FsFile& file, const AudioMetadata& metadata) {
+    if (!_ready) return;
+
+    // Path has to survive in full or it can't be matched later
+    if (strlen(path) + 4 > sizeof(_strings)) return;
+
+    Pending entry;
+    memset(&entry.record, 0, sizeof(entry.record));
+
+    entry.record.hash           = hash_path(path);
+    entry.record.total_samples  = metadata.total_samples;
+    entry.record.sample_rate    = metadata.sample_rate;
+    entry.record.data_offset    = metadata.data_offset;
+    entry.record.duration       = metadata.duration;
+    entry.record.flags          = metadata.fragmented ? FLAG_FRAGMENTED : 0;
+    entry.path                  = path;
+
+    _fs->lock();
+
+    stamp(file, entry.record);
+
+    size_t len = 0;
+
+    auto append = [&](const char* str) {
+        size_t n = std::min(strlen(str), sizeof(_strings) - len - 1);
+        memcpy(_strings + len, str, n);
+        len += n;
+        _strings[len++] = '\0';
+    };
+
+    append(path);
+    append(metadata.title.c_str());
+    append(metadata.artist.c_str());
+    append(metadata.album.c_str());
+
+    entry.record.strings_len = len;
+    entry.record.strings     = _pool.size();
+    _pool.seek(entry.record.strings);
+    bool ok = _pool.write(_strings, len) == len;
+    _pool.sync();
+
+    if (ok) {
+        // Newer entry for the same path wins
+        for (auto it = _pending.begin(); it != _pending.end(); ++it) {
+            if (it->record.hash == entry.record.hash && it->path == entry.path) {
+                _pending.erase(it);
+                break;
+            }
+        }
+        _pending.push_back(entry);
+    }
+
+    _fs->unlock();
+}
+
+bool MalkuthLibrary::flush_step() {
+    if (!_ready) return false;
+
+    _fs->lock(SdClass::BACKGROUND);
+
+    bool more = true;
+
+    if (!_merge.active) {
+        more = merge_begin();
+    } else if (_merge.slot < _hashes.size() || _merge.next < _merge.entries.size()) {
+        merge_batch();
+    } else {
+        // Anything put() in the meantime goes next
+        merge_end();
+        more = _ready && !_pending.empty();
+    }
+
+    _fs->unlock();
+    return more;
+}
+
+bool MalkuthLibrary::wants_flush() {
+    if (!_ready) return false;
+
+    _fs->lock(SdClass::BACKGROUND);
+    bool wants = _merge.active || _pending.size() >= MAX_PENDING;
+    _fs->unlock();
+
+    return wants;
+}
+
+// What's pending now and whatever gets put() before it's done
+void MalkuthLibrary::flush() {
+    while (flush_step()) {}
+}
+
+uint32_t MalkuthLibrary::count() {
+    if (!_ready) return 0;
+
+    _fs->lock();
+    uint32_t res = _hashes.size() + _merge.entries.size() + _pending.size();
+    _fs->unlock();
+
+    return res;
+}
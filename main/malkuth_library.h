@@ -0,0 +1,144 @@
+#pragma once
+
+#include <vector>
+#include <SdFat.h>
+
+#include "malkuth_fs.h"
+#include "malkuth_audio.h"
+
+#ifndef LIBRARY_DIR
+    #define LIBRARY_DIR "/.malkuth"
+#endif
+
+// Dead bytes in library.str before flush() compacts it (and only once they
+// are more than the live ones)
+#ifndef LIBRARY_COMPACT_BYTES
+    #define LIBRARY_COMPACT_BYTES (32 * 1024)
+#endif
+
+// Records merged per flush_step(), each step is one hold of the card
+#ifndef LIBRARY_FLUSH_BATCH
+    #define LIBRARY_FLUSH_BATCH 32
+#endif
+
+/// On-card index of already parsed tracks, so switching tracks costs one
+/// record read instead of a full ID3/Vorbis/RIFF parse.
+///
+/// library.idx : header + fixed size records sorted by path hash
+/// library.str : string pool (path, title, artist, album), appended to by
+///               put() and rewritten by flush() once it's mostly dead
+///               strings of replaced records
+///
+/// Only the hashes are kept in RAM. New or changed tracks sit in a small
+/// pending list until they are merged into a fresh sorted file, a batch of
+/// records per flush_step() with the card given back in between, so the
+/// merge never holds up a refill for longer than one batch. Lookups keep
+/// using the old file until the new one replaces it.
+/// Everything runs under the MalkuthFs lock, so any task may call in, the
+/// string scratch buffer is only touched with it held.
+class MalkuthLibrary {
+private:
+    struct Header {
+        char     magic[4];
+        uint32_t version;
+        uint32_t count;
+        uint32_t reserved;
+    };
+
+    struct Record {
+        uint32_t hash;
+        uint32_t strings;       // offset into library.str
+        uint16_t strings_len;
+        uint16_t modify_date;
+        uint16_t modify_time;
+        uint16_t flags;
+        uint64_t file_size;
+        uint64_t total_samples;
+        uint32_t sample_rate;
+        uint32_t data_offset;
+        float    duration;
+        uint32_t reserved2;
+    };
+    static_assert(sizeof(Record) == 48, "library record layout changed");
+
+    struct Pending {
+        Record  record;
+        String  path;
+    };
+
+    // A flush in progress: entries taken off the pending list, sorted by
+    // hash, merged with library.idx from slot on into library.tmp
+    struct Merge {
+        bool                    active  = false;
+        bool                    compact = false;
+        std::vector<Pending>    entries;
+        size_t                  next    = 0;
+        uint32_t                slot    = 0;
+        FsFile                  index;
+        FsFile                  pool;
+        Header                  header;
+        std::vector<uint32_t>   hashes;     // what _hashes becomes
+        uint32_t                live    = 0;
+    };
+
+    // 2: flags, a v1 index would call every track contiguous
+    static constexpr uint32_t VERSION       = 2;
+
+    static constexpr uint16_t FLAG_FRAGMENTED = 1 << 0;
+
+    // Pending tracks before wants_flush() asks for a merge
+    static constexpr size_t   MAX_PENDING   = 64;
+    static constexpr size_t   MAX_STRINGS   = 1024;
+
+    MalkuthFs*  _fs     = nullptr;
+    FsFile      _index;
+    FsFile      _pool;
+    bool        _ready  = false;
+
+    std::vector<uint32_t>   _hashes;
+    std::vector<Pending>    _pending;
+    uint32_t                _live   = 0;    // pool bytes library.idx points at
+    Merge                   _merge;
+
+    // One record's strings, the readers nest and sit on small task stacks
+    char        _strings[MAX_STRINGS];
+
+    bool load();
+    int32_t find_slot(const char* path, uint32_t hash, Record& record);
+    bool lookup(const char* path, Record& record);
+    bool read_record(uint32_t slot, Record& record);
+    bool read_strings(const Record& record, char* buffer, size_t size);
+    void fill(const Record& record, const char* strings, AudioMetadata& metadata);
+    void stamp(FsFile& file, Record& record);
+
+    bool merge_begin();
+    void merge_batch();
+    void merge_end();
+    void merge_abort();
+    void emit(Record record);
+
+public:
+    bool begin(MalkuthFs& fs);
+
+    // Cached metadata, no matter how old it is (Files page, scanner, ...)
+    bool get(const char* path, AudioMetadata& metadata);
+
+    // Cached metadata, only if the file size and mtime still match
+    bool get(const char* path, FsFile& file, AudioMetadata& metadata);
+
+    // Only queues the track, the merge is left to flush_step()
+    void put(const char* path, FsFile& file, const AudioMetadata& metadata);
+
+    // One batch of the merge under a BACKGROUND hold of its own, starts one
+    // if anything is pending. false once nothing is left to merge
+    bool flush_step();
+
+    // A merge is running or enough is pending to start one, for the
+    // scanner to run flush_step() in between its own steps
+    bool wants_flush();
+
+    // Every pending track, still a batch per hold
+    void flush();
+
+    uint32_t count();
+};
@@ -0,0 +1,208 @@
+#include "malkuth_readcache.h"
+
+#define WINDOW_BYTES (READCACHE_WINDOW_SECTORS * SECTOR)
+
+///
+/// Private Function
+///
+
+// Sleeps until a read asks for the next window, then reads it under the
+// card lock like everyone else
+void MalkuthReadCache::task_prefetch(void* parameters) {
+    MalkuthReadCache* self = static_cast<MalkuthReadCache*>(parameters);
+
+    while (true) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+        self->_lock(self->_lock_user, true);
+
+        uint32_t base  = self->_prefetch;
+        self->_prefetch = NONE;
+
+        if (base != NONE && self->find(base) < 0) {
+            int8_t slot = self->fill(base);
+
+            if (slot >= 0) {
+                self->_windows[slot].prefetched = true;
+                self->_stats.prefetched++;
+            }
+        }
+
+        self->_lock(self->_lock_user, false);
+    }
+}
+
+int8_t MalkuthReadCache::find(uint32_t base) {
+    for (int8_t i = 0; i < READCACHE_WINDOWS; i++)
+        if (_windows[i].count && _windows[i].base == base) return i;
+
+    return -1;
+}
+
+// Least recently used window gets the sectors from base on, -1 if the card
+// didn't give them
+int8_t MalkuthReadCache::fill(uint32_t base) {
+    int8_t slot = 0;
+
+    for (int8_t i = 1; i < READCACHE_WINDOWS; i++) {
+        if (!_windows[slot].count) break;
+        if (!_windows[i].count || (int32_t)(_windows[i].used - _windows[slot].used) < 0)
+            slot = i;
+    }
+
+    Window& target = _windows[slot];
+    uint32_t count = std::min<uint32_t>(READCACHE_WINDOW_SECTORS, _sectors - base);
+
+    target.count      = 0;
+    target.prefetched = false;
+
+    if (!_device->readSectors(base, window(slot), count)) return -1;
+
+    target.base  = base;
+    target.count = count;
+    target.used  = ++_clock;
+
+    return slot;
+}
+
+uint8_t* MalkuthReadCache::window(int8_t slot) {
+    return _data + (size_t)slot * WINDOW_BYTES;
+}
+
+// ns sectors that all sit in one window, false if they couldn't be read at
+// all (the caller goes to the card then)
+bool MalkuthReadCache::read_window(uint32_t sector, uint8_t* dst, size_t ns) {
+    uint32_t base = sector - sector % READCACHE_WINDOW_SECTORS;
+    int8_t   slot = find(base);
+
+    if (slot >= 0) {
+        _stats.hits += ns;
+    } else {
+        slot = fill(base);
+        if (slot < 0) return false;
+        _stats.misses += ns;
+    }
+
+    Window& hit = _windows[slot];
+    if (sector + ns > hit.base + hit.count) return false;
+
+    if (hit.prefetched) {
+        hit.prefetched = false;
+        _stats.prefetch_used++;
+    }
+    hit.used = ++_clock;
+
+    memcpy(dst, window(slot) + (sector - base) * SECTOR, ns * SECTOR);
+
+    ahead(sector + ns - 1);
+    return true;
+}
+
+// Into the second half of a window looks sequential, the next one gets read
+// while the caller is busy with this one
+void MalkuthReadCache::ahead(uint32_t sector) {
+    if (!_taskhandle_prefetch) return;
+    if (sector % READCACHE_WINDOW_SECTORS < READCACHE_WINDOW_SECTORS / 2) return;
+
+    uint32_t next = sector - sector % READCACHE_WINDOW_SECTORS + READCACHE_WINDOW_SECTORS;
+    if (next >= _sectors || find(next) >= 0 || _prefetch == next) return;
+
+    _prefetch = next;
+    xTaskNotifyGive(_taskhandle_prefetch);
+}
+
+void MalkuthReadCache::invalidate(uint32_t sector, size_t ns) {
+    for (Window& window : _windows) {
+        if (window.count && sector < window.base + window.count && window.base < sector + ns) {
+            window.count      = 0;
+            window.prefetched = false;
+        }
+    }
+}
+
+///
+/// Public Function
+///
+
+bool MalkuthReadCache::begin(FsBlockDeviceInterface* device, LockCallback lock, void* user) {
+    _device    = device;
+    _lock      = lock;
+    _lock_user = user;
+    _sectors   = device ? device->sectorCount() : 0;
+
+    clear();
+
+    // Internal RAM first, memcpy out of PSRAM is slower than the card isn't
+    if (!_data) {
+        _data = (uint8_t*)heap_caps_malloc(READCACHE_WINDOWS * WINDOW_BYTES, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+        if (!_data)
+            _data = (uint8_t*)heap_caps_malloc(READCACHE_WINDOWS * WINDOW_BYTES, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    }
+
+    // Below everything that actually waits on the card. Reads go through
+    // the card driver, so the same stack as the SD reader
+    if (_lock && !_taskhandle_prefetch) {
+        xTaskCreate(
+            task_prefetch,
+            "Malkuth: Read Ahead",
+            6144,
+            this,
+            1,
+            &_taskhandle_prefetch
+        );
+    }
+
+    return _device && _data;
+}
+
+void MalkuthReadCache::clear() {
+    for (Window& window : _windows)
+        window = Window();
+
+    _prefetch = NONE;
+}
+
+ReadCacheStats MalkuthReadCache::get_stats() {
+    return _stats;
+}
+
+void MalkuthReadCache::reset_stats() {
+    _stats = ReadCacheStats();
+}
+
+bool MalkuthReadCache::isBusy() {
+    return _device->isBusy();
+}
+
+uint32_t MalkuthReadCache::sectorCount() {
+    return _sectors;
+}
+
+bool MalkuthReadCache::readSector(uint32_t sector, uint8_t* dst) {
+    if (_data && read_window(sector, dst, 1)) return true;
+
+    return _device->readSector(sector, dst);
+}
+
+bool MalkuthReadCache::readSectors(uint32_t sector, uint8_t* dst, size_t ns) {
+    bool one_window = sector / READCACHE_WINDOW_SECTORS == (sector + ns - 1) / READCACHE_WINDOW_SECTORS;
+
+    if (_data && one_window && read_window(sector, dst, ns)) return true;
+
+    if (!one_window) _stats.bypassed++;
+    return _device->readSectors(sector, dst, ns);
+}
+
+bool MalkuthReadCache::syncDevice() {
+    return _device->syncDevice();
+}
+
+bool MalkuthReadCache::writeSector(uint32_t sector, const uint8_t* src) {
+    invalidate(sector, 1);
+    return _device->writeSector(sector, src);
+}
+
+bool MalkuthReadCache::writeSectors(uint32_t sector, const uint8_t* src, size_t ns) {
+    invalidate(sector, ns);
+    return _device->writeSectors(sector, src, ns);
+}
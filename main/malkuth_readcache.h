@@ -0,0 +1,95 @@
+#pragma once
+
+#include <Arduino.h>
+#include <SdFat.h>
+
+// One window is what a miss reads from the card in a single multi block
+// command, aligned to its own size (so to the clusters on a card formatted
+// with the SD formatter)
+#ifndef READCACHE_WINDOW_SECTORS
+    #define READCACHE_WINDOW_SECTORS 8
+#endif
+
+#ifndef READCACHE_WINDOWS
+    #define READCACHE_WINDOWS 4
+#endif
+
+typedef struct {
+    uint32_t hits           = 0;    // sector reads served from RAM
+    uint32_t misses         = 0;    // sector reads that had to fill a window
+    uint32_t bypassed       = 0;    // multi sector reads straight to the card
+    uint32_t prefetched     = 0;    // windows read ahead by the task
+    uint32_t prefetch_used  = 0;    // ... that got hit before being evicted
+} ReadCacheStats;
+
+/// Sector cache between SdFat and the card.
+///
+/// SdFat reads anything smaller than a sector through its one sector volume
+/// cache, which the FAT and directory lookups keep throwing out, so every
+/// small read (4 byte FLAC block headers, tag frames, library records) costs
+/// a command of its own. Here a miss reads the whole aligned window around
+/// it, and a read in the second half of a window has the next one read ahead
+/// by a low priority task while the caller parses. Big multi sector reads
+/// (the audio reader's 16 KB refills) go straight through, they are already
+/// one command and would only push out the small stuff.
+///
+/// Every call comes from SdFat with the card held, the prefetch task takes
+/// it through the lock callback, so nothing here needs a lock of its own.
+/// Writes go through and drop the windows they touch.
+class MalkuthReadCache : public FsBlockDeviceInterface {
+public:
+    typedef void (*LockCallback)(void* user, bool take);
+
+private:
+    static constexpr size_t   SECTOR    = 512;
+    static constexpr uint32_t NONE      = 0xFFFFFFFF;
+
+    struct Window {
+        uint32_t base       = 0;        // first sector
+        uint32_t used       = 0;        // LRU stamp
+        uint8_t  count      = 0;        // sectors held, 0 = empty
+        bool     prefetched = false;    // read ahead and not hit yet
+    };
+
+    FsBlockDeviceInterface* _device     = nullptr;
+    uint32_t                _sectors    = 0;
+    uint8_t*                _data       = nullptr;
+
+    Window      _windows[READCACHE_WINDOWS];
+    uint32_t    _clock      = 0;
+    uint32_t    _prefetch   = NONE;
+
+    LockCallback    _lock       = nullptr;
+    void*           _lock_user  = nullptr;
+    TaskHandle_t    _taskhandle_prefetch = NULL;
+
+    ReadCacheStats  _stats;
+
+    static void task_prefetch(void* parameters);
+
+    int8_t   find(uint32_t base);
+    int8_t   fill(uint32_t base);
+    uint8_t* window(int8_t slot);
+    bool     read_window(uint32_t sector, uint8_t* dst, size_t ns);
+    void     ahead(uint32_t sector);
+    void     invalidate(uint32_t sector, size_t ns);
+
+public:
+    // lock is how the prefetch task gets the card, without one nothing is
+    // read ahead
+    bool begin(FsBlockDeviceInterface* device, LockCallback lock = nullptr, void* user = nullptr);
+
+    // Drops every window (card swapped, remounted, ...)
+    void clear();
+
+    ReadCacheStats get_stats();
+    void           reset_stats();
+
+    bool     isBusy() override;
+    uint32_t sectorCount() override;
+    bool     readSector(uint32_t sector, uint8_t* dst) override;
+    bool     readSectors(uint32_t sector, uint8_t* dst, size_t ns) override;
+    bool     syncDevice() override;
+    bool     writeSector(uint32_t sector, const uint8_t* src) override;
+    bool     writeSectors(uint32_t sector, const uint8_t* src, size_t ns) override;
+};
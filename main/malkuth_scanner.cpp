@@ -0,0 +1,223 @@
+#include "malkuth_scanner.h"
+#include "malkuth_audio.h"
+
+///
+/// Private Function
+///
+
+void MalkuthScanner::task_scanner(void* parameters) {
+    MalkuthScanner* self = static_cast<MalkuthScanner*>(parameters);
+    Request request;
+
+    while (true) {
+        // Between walks this is where what playback put() gets merged
+        if (xQueueReceive(self->_queue, &request, pdMS_TO_TICKS(SCAN_FLUSH_POLL_MS)) != pdTRUE) {
+            while (uxQueueMessagesWaiting(self->_queue) == 0 && self->_library->wants_flush()) {
+                self->_library->flush_step();
+                vTaskDelay(1);
+            }
+            continue;
+        }
+
+        self->walk(request.path);
+    }
+}
+
+// One step at a time until the tree is done or a newer scan() shows up
+void MalkuthScanner::walk(const char* path) {
+    uint32_t start = millis();
+
+    _running = true;
+    _depth   = 0;
+
+    snprintf(_path, sizeof(_path), "%s", path);
+    size_t len = strlen(_path);
+    if (len + 1 < sizeof(_path) && (len == 0 || _path[len - 1] != '/')) {
+        _path[len++] = '/';
+        _path[len]   = '\0';
+    }
+
+    _fs->lock(SdClass::BACKGROUND);
+    if (_dirs[0].open(_path, O_RDONLY) && _dirs[0].isDir()) {
+        _dir_len[0] = len;
+        _depth      = 1;
+    } else {
+        _dirs[0].close();
+    }
+    _fs->unlock();
+
+    bool done = _depth == 0;
+
+    // A batch of the library's merge counts as a step of its own
+    while (!done) {
+        if (uxQueueMessagesWaiting(_queue) > 0) break;
+
+        if (!_library->wants_flush() || !_library->flush_step())
+            done = !step();
+        vTaskDelay(1);
+    }
+
+    // Dropped for a newer scan, the directories are still open
+    _fs->lock(SdClass::BACKGROUND);
+    while (_depth > 0)
+        _dirs[--_depth].close();
+    _fs->unlock();
+
+    while (_library->flush_step())
+        vTaskDelay(1);
+    announce();
+
+    if (done) _last_ms = millis() - start;
+    _running = false;
+}
+
+// Next entry of the directory on top, false once the root is done
+bool MalkuthScanner::step() {
+    _fs->lock(SdClass::BACKGROUND);
+
+    FsFile& dir   = _dirs[_depth - 1];
+    FsFile& entry = _dirs[_depth];
+
+    if (!entry.openNext(&dir, O_RDONLY)) {
+        leave();
+        _fs->unlock();
+        return _depth > 0;
+    }
+
+    char   name[256];
+    size_t len  = _dir_len[_depth - 1];
+    bool   keep = false;
+
+    entry.getName(name, sizeof(name));
+
+    // Dot entries are ours (/.malkuth) or the OS's, not music
+    if (name[0] != '.' && len + strlen(name) + 2 <= sizeof(_path)) {
+        if (entry.isDir()) {
+            if (_depth <= SCAN_MAX_DEPTH) {
+                snprintf(_path + len, sizeof(_path) - len, "%s/", name);
+                _dir_len[_depth++] = strlen(_path);
+                keep = true;
+            }
+        } else if (entry_type(name, false) == EntryType::AUDIO) {
+            snprintf(_path + len, sizeof(_path) - len, "%s", name);
+            visit(entry);
+            _path[len] = '\0';
+        }
+    }
+
+    if (!keep) entry.close();
+
+    _fs->unlock();
+    return true;
+}
+
+// Same handle for the stamp check and the parse, the track is opened once
+void MalkuthScanner::visit(FsFile& entry) {
+    AudioMetadata metadata;
+    bool          parsed = false;
+
+    _files++;
+
+    if (_library->get(_path, entry, metadata)) {
+        _cached++;
+    } else {
+        metadata = MalkuthAudio::get_metadata(entry, _path);
+        metadata.fragmented = !_fs->get_extent(entry).sectors;
+
+        _library->put(_path, entry, metadata);
+        _parsed++;
+        parsed = true;
+    }
+
+    // The reader can't take these straight off the card
+    if (metadata.fragmented) {
+        _fragmented++;
+        Serial.printf("Fragmented               : %s\n", _path);
+    }
+
+    if (parsed && ++_unannounced >= SCAN_UPDATE_EVERY)
+        announce();
+}
+
+void MalkuthScanner::leave() {
+    _dirs[--_depth].close();
+
+    if (_depth > 0)
+        _path[_dir_len[_depth - 1]] = '\0';
+
+    announce();
+}
+
+void MalkuthScanner::announce() {
+    if (_unannounced == 0) return;
+
+    _unannounced   = 0;
+    _please_update = true;
+}
+
+///
+/// Public Function
+///
+
+bool MalkuthScanner::begin(MalkuthFs& fs, MalkuthLibrary& library) {
+    _fs      = &fs;
+    _library = &library;
+
+    // Same priority as the cover task, both only get the idle time. The
+    // queue holds one request, a newer one overwrites it
+    if (!_queue) {
+        _queue = xQueueCreate(1, sizeof(Request));
+
+        xTaskCreate(
+            task_scanner,
+            "Malkuth: Scanner",
+            8192,
+            this,
+            1,
+            &_taskhandle_scanner
+        );
+    }
+
+    return _queue != NULL;
+}
+
+void MalkuthScanner::scan(const char* path) {
+    if (!_queue || !path || strlen(path) >= sizeof(Request::path)) return;
+
+    Request request;
+    strcpy(request.path, path);
+
+    xQueueOverwrite(_queue, &request);
+}
+
+bool MalkuthScanner::get_update() {
+    return _please_update;
+}
+
+void MalkuthScanner::yeah_i_have_updated() {
+    _please_update = false;
+}
+
+bool MalkuthScanner::is_busy() {
+    return _running || uxQueueMessagesWaiting(_queue) > 0;
+}
+
+uint32_t MalkuthScanner::get_files() {
+    return _files;
+}
+
+uint32_t MalkuthScanner::get_parsed() {
+    return _parsed;
+}
+
+uint32_t MalkuthScanner::get_cached() {
+    return _cached;
+}
+
+uint32_t MalkuthScanner::get_fragmented() {
+    return _fragmented;
+}
+
+uint32_t MalkuthScanner::get_last_ms() {
+    return _last_ms;
+}
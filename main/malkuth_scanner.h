@@ -0,0 +1,97 @@
+#pragma once
+
+#include <Arduino.h>
+#include <SdFat.h>
+
+#include "malkuth_helper.h"
+#include "malkuth_fs.h"
+#include "malkuth_library.h"
+
+// Directories below the selected one that still get walked
+#ifndef SCAN_MAX_DEPTH
+    #define SCAN_MAX_DEPTH 8
+#endif
+
+// Newly parsed tracks between two get_update(), so a long directory shows
+// up on the Files page while it's still being walked
+#ifndef SCAN_UPDATE_EVERY
+    #define SCAN_UPDATE_EVERY 8
+#endif
+
+// How often the idle scanner looks for library tracks to merge
+#ifndef SCAN_FLUSH_POLL_MS
+    #define SCAN_FLUSH_POLL_MS 1000
+#endif
+
+/// Fills MalkuthLibrary ahead of playback, so the Files page can show title,
+/// artist and duration of every track without parsing anything itself.
+///
+/// scan() hands a directory to a low priority task which walks the whole
+/// tree below it. Every step (one entry with at most one tag parse, or one
+/// batch of the library's merge) takes the card as SdClass::BACKGROUND and
+/// gives it back right after, so the audio reader and the UI never wait on
+/// more than one step. Between walks the task merges whatever playback
+/// put() into the library the same way.
+/// Tracks the library already knows (same size and mtime) are only stamped.
+/// Whether a track is fragmented goes into the library with its tags.
+/// A newer scan() drops whatever walk is still running.
+class MalkuthScanner {
+private:
+    struct Request {
+        char path[128];
+    };
+
+    MalkuthFs*      _fs         = nullptr;
+    MalkuthLibrary* _library    = nullptr;
+
+    QueueHandle_t   _queue              = NULL;
+    TaskHandle_t    _taskhandle_scanner = NULL;
+
+    // Open directories of the walk (_path is the one on top), the slot
+    // after the top one is where the next entry gets opened
+    FsFile      _dirs[SCAN_MAX_DEPTH + 2];
+    uint16_t    _dir_len[SCAN_MAX_DEPTH + 2]  = {};
+    uint8_t     _depth                        = 0;
+    char        _path[256]                    = {};
+
+    bool        _please_update  = false;
+    bool        _running        = false;
+    uint16_t    _unannounced    = 0;
+
+    uint32_t    _files      = 0;
+    uint32_t    _parsed     = 0;
+    uint32_t    _cached     = 0;
+    uint32_t    _fragmented = 0;
+    uint32_t    _last_ms    = 0;
+
+    static void task_scanner(void* parameters);
+
+    void walk(const char* path);
+    bool step();
+    void visit(FsFile& entry);
+    void leave();
+    void announce();
+
+public:
+    bool begin(MalkuthFs& fs, MalkuthLibrary& library);
+
+    // Walk path and everything below it, replaces a scan still in progress
+    void scan(const char* path);
+
+    // More tracks got parsed since the last yeah_i_have_updated()
+    bool get_update();
+    void yeah_i_have_updated();
+
+    bool is_busy();
+
+    // Audio files seen, of those parsed now or already in the library
+    uint32_t get_files();
+    uint32_t get_parsed();
+    uint32_t get_cached();
+
+    // Of those, not in one piece on the card (each one is also printed)
+    uint32_t get_fragmented();
+
+    // How long the last complete walk took
+    uint32_t get_last_ms();
+};
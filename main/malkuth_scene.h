@@ -0,0 +1,130 @@
+#pragma once
+
+#include <Arduino.h>
+#include <algorithm>
+
+#ifndef SCENE_DIRTY_RECTS
+    #define SCENE_DIRTY_RECTS 8
+#endif
+
+/// Screen area in panel coordinates, empty once either side is 0.
+struct SceneRect {
+    int16_t     x = 0, y = 0;
+    uint16_t    w = 0, h = 0;
+
+    bool    empty()  const { return w == 0 || h == 0; }
+    int32_t right()  const { return (int32_t)x + w; }
+    int32_t bottom() const { return (int32_t)y + h; }
+    uint32_t area()  const { return (uint32_t)w * h; }
+
+    bool operator==(const SceneRect& other) const {
+        return x == other.x && y == other.y && w == other.w && h == other.h;
+    }
+
+    bool contains(const SceneRect& other) const {
+        if (empty() || other.empty()) return false;
+
+        return other.x >= x && other.right()  <= right() &&
+               other.y >= y && other.bottom() <= bottom();
+    }
+
+    bool intersects(const SceneRect& other) const {
+        if (empty() || other.empty()) return false;
+
+        return other.x < right() && x < other.right() &&
+               other.y < bottom() && y < other.bottom();
+    }
+
+    // Sharing an edge is enough for two dirty areas to be worth one push
+    bool touches(const SceneRect& other) const {
+        if (empty() || other.empty()) return false;
+
+        return other.x <= right() && x <= other.right() &&
+               other.y <= bottom() && y <= other.bottom();
+    }
+
+    SceneRect intersect(const SceneRect& other) const {
+        int32_t x0 = std::max<int32_t>(x, other.x);
+        int32_t y0 = std::max<int32_t>(y, other.y);
+        int32_t x1 = std::min<int32_t>(right(), other.right());
+        int32_t y1 = std::min<int32_t>(bottom(), other.bottom());
+
+        if (x1 <= x0 || y1 <= y0) return SceneRect();
+        return { (int16_t)x0, (int16_t)y0, (uint16_t)(x1 - x0), (uint16_t)(y1 - y0) };
+    }
+
+    SceneRect unite(const SceneRect& other) const {
+        if (empty())       return other;
+        if (other.empty()) return *this;
+
+        int32_t x0 = std::min<int32_t>(x, other.x);
+        int32_t y0 = std::min<int32_t>(y, other.y);
+        int32_t x1 = std::max<int32_t>(right(), other.right());
+        int32_t y1 = std::max<int32_t>(bottom(), other.bottom());
+
+        return { (int16_t)x0, (int16_t)y0, (uint16_t)(x1 - x0), (uint16_t)(y1 - y0) };
+    }
+};
+
+/// The parts of the screen that changed since the last compose.
+/// Areas that touch are merged as they come in, and once every slot is taken
+/// the new area goes into whichever one grows the least, so the display task
+/// never has more than SCENE_DIRTY_RECTS pushes to do.
+class MalkuthDirtyRegion {
+private:
+    SceneRect   _rects[SCENE_DIRTY_RECTS];
+    uint8_t     _count  = 0;
+    SceneRect   _bounds = { 0, 0, 0xFFFF, 0xFFFF };
+
+    void erase(uint8_t index) {
+        _rects[index] = _rects[--_count];
+    }
+
+public:
+    void set_bounds(const SceneRect& bounds) { _bounds = bounds; }
+
+    void add(SceneRect rect) {
+        rect = rect.intersect(_bounds);
+        if (rect.empty()) return;
+
+        bool merged = true;
+        while (merged) {
+            merged = false;
+
+            for (uint8_t i = 0; i < _count; i++) {
+                if (_rects[i].touches(rect)) {
+                    rect = rect.unite(_rects[i]);
+                    erase(i);
+                    merged = true;
+                    break;
+                }
+            }
+
+            if (merged || _count < SCENE_DIRTY_RECTS) continue;
+
+            uint8_t  best   = 0;
+            uint32_t growth = UINT32_MAX;
+
+            for (uint8_t i = 0; i < _count; i++) {
+                uint32_t cost = _rects[i].unite(rect).area() - _rects[i].area();
+                if (cost < growth) {
+                    growth = cost;
+                    best   = i;
+                }
+            }
+
+            rect = rect.unite(_rects[best]);
+            erase(best);
+            merged = true;
+        }
+
+        _rects[_count++] = rect;
+    }
+
+    void clear() { _count = 0; }
+
+    bool    empty() const { return _count == 0; }
+    uint8_t count() const { return _count; }
+
+    const SceneRect& operator[](uint8_t index) const { return _rects[index]; }
+};
@@ -0,0 +1,177 @@
+#pragma once
+
+#include <Arduino.h>
+#include <algorithm>
+
+// Histogram buckets are powers of two in microseconds, the last one takes
+// everything from 2^(STATS_BUCKETS - 1) us up
+#ifndef STATS_BUCKETS
+    #define STATS_BUCKETS 16
+#endif
+
+/// Timing of one pipeline stage, fed with microsecond deltas.
+/// micros() and not the cycle counter, every core has a CCOUNT of its own
+/// and the reader and audio tasks aren't pinned, a stage that blocks (the
+/// I2S write) can end on the other core than it started on.
+/// Only the task that runs the stage records into it, readers on other tasks
+/// may see a call half counted, which is fine for a dump.
+class MalkuthStageStats {
+private:
+    const char* _name;
+
+    uint32_t    _calls  = 0;
+    uint64_t    _total  = 0;
+    uint32_t    _min    = UINT32_MAX;
+    uint32_t    _max    = 0;
+    uint32_t    _buckets[STATS_BUCKETS] = {};
+
+public:
+    explicit MalkuthStageStats(const char* name) : _name(name) {}
+
+    static uint32_t now() { return micros(); }
+
+    static float to_us(uint64_t ticks) { return (float)ticks; }
+
+    void record(uint32_t us) {
+        _calls++;
+        _total += us;
+        if (us < _min) _min = us;
+        if (us > _max) _max = us;
+
+        uint8_t  bucket = 0;
+        while (us > 1 && bucket < STATS_BUCKETS - 1) {
+            us >>= 1;
+            bucket++;
+        }
+        _buckets[bucket]++;
+    }
+
+    // Times from start to now, returns now so stages can be chained
+    uint32_t record_since(uint32_t start) {
+        uint32_t end = now();
+        record(end - start);
+        return end;
+    }
+
+    void reset() {
+        _calls = 0;
+        _total = 0;
+        _min   = UINT32_MAX;
+        _max   = 0;
+        memset(_buckets, 0, sizeof(_buckets));
+    }
+
+    const char* name()  const { return _name; }
+    uint32_t    calls() const { return _calls; }
+    uint64_t    total() const { return _total; }
+
+    float min_us() const { return _calls ? to_us(_min) : 0.0f; }
+    float avg_us() const { return _calls ? to_us(_total) / _calls : 0.0f; }
+    float max_us() const { return to_us(_max); }
+
+    uint32_t bucket(uint8_t index) const { return _buckets[index]; }
+
+    void print(Print& out) const {
+        out.printf("%-8s: %8u calls, min %8.1f us, avg %8.1f us, max %8.1f us\n",
+                   _name, (unsigned)_calls, min_us(), avg_us(), max_us());
+    }
+
+    // name,calls,total_us,min_us,avg_us,max_us,bucket0,...
+    void print_csv(Print& out) const {
+        out.printf("%s,%u,%.0f,%.1f,%.1f,%.1f", _name, (unsigned)_calls, to_us(_total), min_us(), avg_us(), max_us());
+        for (uint8_t i = 0; i < STATS_BUCKETS; i++)
+            out.printf(",%u", (unsigned)_buckets[i]);
+        out.println();
+    }
+
+    static void print_csv_header(Print& out) {
+        out.print("stage,calls,total_us,min_us,avg_us,max_us");
+        for (uint8_t i = 0; i < STATS_BUCKETS - 1; i++)
+            out.printf(",lt%luus", 1UL << (i + 1));
+        out.printf(",ge%luus\n", 1UL << (STATS_BUCKETS - 1));
+    }
+};
+
+/// How full the I2S DMA buffers are, estimated from what was written against
+/// how much the DAC must have played since at the current byte rate. The
+/// driver doesn't tell, but a write that finds the estimate at zero means
+/// the DAC ran out in between, and that is an underrun.
+/// Call restart() whenever output stops on purpose (pause, seek, new track)
+/// so the gap isn't taken for one.
+class MalkuthDmaMonitor {
+private:
+    uint32_t    _capacity   = 0;
+    uint32_t    _byte_rate  = 0;
+    float       _level      = 0.0f;
+    uint32_t    _last       = 0;
+    bool        _running    = false;
+
+    uint32_t    _underruns  = 0;
+    uint32_t    _samples    = 0;
+    uint64_t    _level_sum  = 0;
+    uint32_t    _level_min  = UINT32_MAX;
+    uint32_t    _levels[4]  = {};           // under 25, 50, 75, 100 %
+
+public:
+    void set_capacity(uint32_t bytes)   { _capacity = bytes; }
+    void set_byte_rate(uint32_t rate)   { _byte_rate = rate; }
+    void restart()                      { _running = false; }
+
+    // Right before bytes go to the driver
+    void before_write() {
+        uint32_t now = micros();
+
+        if (_running && _byte_rate > 0) {
+            _level -= (float)(now - _last) * _byte_rate / 1000000.0f;
+
+            if (_level <= 0.0f) {
+                _underruns++;
+                _level = 0.0f;
+            }
+        }
+
+        _last    = now;
+        _running = true;
+
+        uint32_t level = (uint32_t)_level;
+        _samples++;
+        _level_sum += level;
+        if (level < _level_min) _level_min = level;
+        if (_capacity) _levels[std::min<uint32_t>(level * 4 / _capacity, 3)]++;
+    }
+
+    // After the driver took them, a write that had to wait left it full
+    void after_write(size_t bytes) {
+        _last   = micros();
+        _level += bytes;
+        if (_capacity && _level > _capacity) _level = _capacity;
+    }
+
+    void reset() {
+        _underruns = 0;
+        _samples   = 0;
+        _level_sum = 0;
+        _level_min = UINT32_MAX;
+        memset(_levels, 0, sizeof(_levels));
+    }
+
+    uint32_t capacity()  const { return _capacity; }
+    uint32_t underruns() const { return _underruns; }
+    uint32_t min_level() const { return _samples ? _level_min : 0; }
+    uint32_t avg_level() const { return _samples ? _level_sum / _samples : 0; }
+    uint32_t level(uint8_t quarter) const { return _levels[quarter]; }
+
+    void print(Print& out) const {
+        out.printf("DMA fill: min %u, avg %u of %u bytes, underruns %u\n",
+                   (unsigned)min_level(), (unsigned)avg_level(), (unsigned)_capacity, (unsigned)_underruns);
+        out.printf("DMA fill: %u / %u / %u / %u writes under 25/50/75/100 %%\n",
+                   (unsigned)_levels[0], (unsigned)_levels[1], (unsigned)_levels[2], (unsigned)_levels[3]);
+    }
+
+    // dma,capacity,min,avg,underruns,q0,q1,q2,q3
+    void print_csv(Print& out) const {
+        out.printf("dma,%u,%u,%u,%u,%u,%u,%u,%u\n",
+                   (unsigned)_capacity, (unsigned)min_level(), (unsigned)avg_level(), (unsigned)_underruns,
+                   (unsigned)_levels[0], (unsigned)_levels[1], (unsigned)_levels[2], (unsigned)_levels[3]);
+    }
+};
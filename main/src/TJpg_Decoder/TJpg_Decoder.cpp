@@ -0,0 +1,489 @@
+/*
+ TJpg_Decoder.cpp (SdFat only)
+ Taken from Bodmer's TJpg_Decoder library
+*/
+
+#include "TJpg_Decoder.h"
+
+//------------------------------------------------------------
+// Constructor / Destructor
+//------------------------------------------------------------
+TJpg_Decoder::TJpg_Decoder() {}
+
+TJpg_Decoder::TJpg_Decoder(SdFs &fs) {
+  jpgFs = &fs;
+}
+
+TJpg_Decoder::~TJpg_Decoder() {
+  finish();
+}
+
+//------------------------------------------------------------
+// Settings
+//------------------------------------------------------------
+void TJpg_Decoder::setSwapBytes(bool swap) {
+  _swap = swap;
+}
+
+void TJpg_Decoder::setJpgScale(uint8_t scale) {
+  switch (scale) {
+    case 1: jpgScale = 0; break;
+    case 2: jpgScale = 1; break;
+    case 4: jpgScale = 2; break;
+    case 8: jpgScale = 3; break;
+    default: jpgScale = 0;
+  }
+}
+
+void TJpg_Decoder::setProfile(uint8_t p) {
+  profile = p;
+}
+
+uint8_t TJpg_Decoder::getLastProfile() {
+  return lastProfile;
+}
+
+void TJpg_Decoder::setCallback(SketchCallback cb) {
+  tft_output = cb;
+  user_output = nullptr;
+  output_user = nullptr;
+}
+
+void TJpg_Decoder::setCallback(UserCallback cb, void *user) {
+  tft_output = nullptr;
+  user_output = cb;
+  output_user = user;
+}
+
+void TJpg_Decoder::setFileSystem(SdFs *fs, LockCallback lock, void *user) {
+  jpgFs = fs;
+  jpgLock = lock;
+  lock_user = user;
+}
+
+JRESULT TJpg_Decoder::prepare(JDEC &jdec, bool draw) {
+  void *pool = workspace;
+  size_t size = TJPGD_WORKSPACE_SIZE;
+
+  jdec.swap = _swap;
+  jdec.lut = 0;
+  jdec.szbuf = JD_SZBUF;
+  lastProfile = TJPG_PROFILE_SMALL;
+
+#if JD_FASTDECODE == 2
+  if (draw && profile != TJPG_PROFILE_SMALL) {
+    if (profile == TJPG_PROFILE_FAST_INTERNAL)
+      fastWorkspace = (uint8_t*)heap_caps_malloc(TJPGD_FAST_WORKSPACE_SIZE, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    if (!fastWorkspace)
+      fastWorkspace = (uint8_t*)heap_caps_malloc(TJPGD_FAST_WORKSPACE_SIZE, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+
+    if (fastWorkspace) {
+      pool = fastWorkspace;
+      size = TJPGD_FAST_WORKSPACE_SIZE;
+      jdec.lut = 1;
+      jdec.szbuf = TJPGD_FAST_SZBUF;
+      lastProfile = profile;
+    }
+  }
+#endif
+
+  jpgPrepared = false;
+  JRESULT res = jd_prepare(&jdec, jd_input, pool, size, this);
+  jpgPrepared = true;
+  return res;
+}
+
+void TJpg_Decoder::finish() {
+  heap_caps_free(fastWorkspace);
+  fastWorkspace = nullptr;
+}
+
+bool TJpg_Decoder::openJpg(FsFile &file, const char *filename) {
+  if (jpgLock) jpgLock(lock_user, true);
+  if (jpgFs) file = jpgFs->open(filename, O_RDONLY);
+  else        file.open(filename, O_RDONLY);
+  if (jpgLock) jpgLock(lock_user, false);
+
+  return file.isOpen();
+}
+
+//------------------------------------------------------------
+// TJpgDec input callback
+//------------------------------------------------------------
+size_t TJpg_Decoder::jd_input(JDEC* jdec, uint8_t* buf, size_t len) {
+  TJpg_Decoder *self = (TJpg_Decoder*)jdec->device;
+
+  // FLASH array source
+  if (self->jpg_source == TJPG_ARRAY) {
+    if (self->array_index + len > self->array_size) {
+      len = self->array_size - self->array_index;
+    }
+    if (buf) {
+      memcpy_P(buf, self->array_data + self->array_index, len);
+    }
+    self->array_index += len;
+  }
+
+  // SdFat file source
+  else if (self->jpg_source == TJPG_SDFAT_FILE) {
+    if (self->jpgLock) self->jpgLock(self->lock_user, true);
+
+    // A full refill stops at a sector boundary of the file, so every one
+    // after it reads whole sectors. Not while jd_prepare loads a segment,
+    // that has to come back whole
+    if (buf && self->jpgPrepared && len == jdec->szbuf) {
+      uint32_t pos = self->jpgFile->curPosition();
+      uint32_t end = (pos + len) & ~(uint32_t)511;
+      if (end > pos) len = end - pos;
+    }
+
+    uint32_t available = self->jpgFile->available();
+    if (available < len) len = available;
+    if (self->jpgLeft < len) len = self->jpgLeft;
+
+    if (buf) {
+      self->jpgFile->read(buf, len);
+    } else {
+      self->jpgFile->seekSet(self->jpgFile->curPosition() + len);
+    }
+    self->jpgLeft -= len;
+
+    if (self->jpgLock) self->jpgLock(self->lock_user, false);
+  }
+
+  return len;
+}
+
+//------------------------------------------------------------
+// TJpgDec output callback
+//------------------------------------------------------------
+int TJpg_Decoder::jd_output(JDEC* jdec, void* bitmap, JRECT* jrect) {
+  TJpg_Decoder *self = (TJpg_Decoder*)jdec->device;
+
+  if (self->fitOutput) return self->fitBlock(jrect, (uint16_t*)bitmap);
+
+  int16_t x = jrect->left + self->jpeg_x;
+  int16_t y = jrect->top  + self->jpeg_y;
+  uint16_t w = jrect->right  + 1 - jrect->left;
+  uint16_t h = jrect->bottom + 1 - jrect->top;
+
+  if (self->user_output) return self->user_output(self->output_user, x, y, w, h, (uint16_t*)bitmap);
+  if (!self->tft_output) return 0;
+  return self->tft_output(x, y, w, h, (uint16_t*)bitmap);
+}
+
+//------------------------------------------------------------
+// Draw JPG from SdFat filename
+//------------------------------------------------------------
+JRESULT TJpg_Decoder::drawJpg(int32_t x, int32_t y, const char *filename) {
+  FsFile file;
+  if (!openJpg(file, filename)) {
+    Serial.println("Jpeg file not found");
+    return JDR_INP;
+  }
+
+  return drawJpg(x, y, file);
+}
+
+//------------------------------------------------------------
+// Draw JPG from SdFat file handle
+//------------------------------------------------------------
+JRESULT TJpg_Decoder::drawJpg(int32_t x, int32_t y, FsFile& file) {
+  JRESULT res = drawJpg(x, y, file, UINT32_MAX);
+
+  if (jpgLock) jpgLock(lock_user, true);
+  file.close();
+  if (jpgLock) jpgLock(lock_user, false);
+  return res;
+}
+
+//------------------------------------------------------------
+// Draw JPG from part of a SdFat file
+//------------------------------------------------------------
+JRESULT TJpg_Decoder::drawJpg(int32_t x, int32_t y, FsFile& file, uint32_t size) {
+  JDEC jdec;
+  JRESULT res;
+
+  jpg_source = TJPG_SDFAT_FILE;
+  jpeg_x = x;
+  jpeg_y = y;
+  jpgFile = &file;
+  jpgLeft = size;
+
+  res = prepare(jdec, true);
+  if (res == JDR_OK) {
+    res = jd_decomp(&jdec, jd_output, jpgScale);
+  }
+  finish();
+
+  jpgFile = nullptr;
+  return res;
+}
+
+//------------------------------------------------------------
+// Get JPG size from SdFat filename
+//------------------------------------------------------------
+JRESULT TJpg_Decoder::getJpgSize(uint16_t *w, uint16_t *h, const char *filename) {
+  *w = *h = 0;
+
+  FsFile file;
+  if (!openJpg(file, filename)) return JDR_INP;
+
+  return getJpgSize(w, h, file);
+}
+
+//------------------------------------------------------------
+// Get JPG size from SdFat file handle
+//------------------------------------------------------------
+JRESULT TJpg_Decoder::getJpgSize(uint16_t *w, uint16_t *h, FsFile& file) {
+  JRESULT res = getJpgSize(w, h, file, UINT32_MAX);
+
+  if (jpgLock) jpgLock(lock_user, true);
+  file.close();
+  if (jpgLock) jpgLock(lock_user, false);
+  return res;
+}
+
+//------------------------------------------------------------
+// Get JPG size from part of a SdFat file
+//------------------------------------------------------------
+JRESULT TJpg_Decoder::getJpgSize(uint16_t *w, uint16_t *h, FsFile& file, uint32_t size) {
+  JDEC jdec;
+  JRESULT res;
+
+  *w = *h = 0;
+
+  jpg_source = TJPG_SDFAT_FILE;
+  jpgFile = &file;
+  jpgLeft = size;
+
+  res = prepare(jdec, false);
+  if (res == JDR_OK) {
+    *w = jdec.width;
+    *h = jdec.height;
+  }
+
+  jpgFile = nullptr;
+  return res;
+}
+
+//------------------------------------------------------------
+// Fit-to-box
+//------------------------------------------------------------
+
+// Centre of output pixel i in source pixels (8 fractional bits), the
+// first of the two it sits between and how far towards the second
+static void fitMap(uint32_t i, uint32_t src, uint32_t dst, int32_t &p0, uint8_t &frac) {
+  int32_t pos = (int32_t)(((uint64_t)(2 * i + 1) * src * 128) / dst) - 128;
+  if (pos < 0) pos = 0;
+
+  p0 = pos >> 8;
+  frac = pos & 0xFF;
+
+  if (p0 >= (int32_t)src - 1) {
+    p0 = src - 1;
+    frac = 0;
+  }
+}
+
+static inline uint16_t fitBlend(uint16_t a, uint16_t b, uint16_t c, uint16_t d, uint32_t fx, uint32_t fy, bool swap) {
+  if (swap) {
+    a = (a >> 8) | (a << 8); b = (b >> 8) | (b << 8);
+    c = (c >> 8) | (c << 8); d = (d >> 8) | (d << 8);
+  }
+
+  uint32_t wa = (256 - fx) * (256 - fy), wb = fx * (256 - fy);
+  uint32_t wc = (256 - fx) * fy,         wd = fx * fy;
+
+  uint32_t r = ((a >> 11) * wa + (b >> 11) * wb + (c >> 11) * wc + (d >> 11) * wd + 32768) >> 16;
+  uint32_t g = (((a >> 5) & 0x3F) * wa + ((b >> 5) & 0x3F) * wb + ((c >> 5) & 0x3F) * wc + ((d >> 5) & 0x3F) * wd + 32768) >> 16;
+  uint32_t bl = ((a & 0x1F) * wa + (b & 0x1F) * wb + (c & 0x1F) * wc + (d & 0x1F) * wd + 32768) >> 16;
+
+  uint16_t out = (r << 11) | (g << 5) | bl;
+  return swap ? (out >> 8) | (out << 8) : out;
+}
+
+// Crop columns of one block into the band, the band is done with the last
+// block of the MCU row
+int TJpg_Decoder::fitBlock(JRECT *rect, uint16_t *bitmap) {
+  uint16_t w = rect->right + 1 - rect->left;
+  uint16_t h = rect->bottom + 1 - rect->top;
+
+  int32_t from = rect->left > cropX ? rect->left : cropX;
+  int32_t to = rect->right + 1 < cropX + cropW ? rect->right + 1 : cropX + cropW;
+
+  if (from < to) {
+    for (uint16_t row = 0; row < h; row++)
+      memcpy(fitBand + row * cropW + (from - cropX), bitmap + row * w + (from - rect->left), (to - from) * sizeof(uint16_t));
+  }
+
+  if (rect->right + 1 < srcW) return 1;
+  return fitRows(rect->top - cropY, h);
+}
+
+// Every output row whose two source rows are in by now. Going down by at
+// most 2:1 the upper one is never further back than the carried row
+int TJpg_Decoder::fitRows(int32_t bandTop, int32_t bandRows) {
+  while (fitNext < fitH) {
+    int32_t y0;
+    uint8_t fy;
+    fitMap(fitNext, cropH, fitH, y0, fy);
+
+    int32_t y1 = y0 + (y0 < cropH - 1);
+    if (y1 >= bandTop + bandRows) break;
+
+    const uint16_t *a = y0 < bandTop ? fitCarry : fitBand + (y0 - bandTop) * cropW;
+    const uint16_t *b = y1 < bandTop ? fitCarry : fitBand + (y1 - bandTop) * cropW;
+
+    for (uint16_t u = 0; u < fitW; u++) {
+      uint16_t x0 = fitX0[u];
+      uint16_t x1 = x0 + (x0 < cropW - 1);
+      fitRow[u] = fitBlend(a[x0], a[x1], b[x0], b[x1], fitFx[u], fy, _swap);
+    }
+
+    if (!fitOutput(fitUser, fitNext, fitW, fitRow)) return 0;
+    fitNext++;
+  }
+
+  memcpy(fitCarry, fitBand + (bandRows - 1) * cropW, cropW * sizeof(uint16_t));
+  return fitNext < fitH;
+}
+
+JRESULT TJpg_Decoder::fitDecode(JDEC &jdec) {
+  // Box shaped centre crop of the full picture
+  uint32_t fullW = jdec.width, fullH = jdec.height;
+  if (fullW * fitH > fullH * fitW) fullW = fullH * fitW / fitH;
+  else                             fullH = fullW * fitH / fitW;
+
+  uint8_t scale = 0;
+  while (scale < 3 && (fullW >> (scale + 1)) >= fitW && (fullH >> (scale + 1)) >= fitH)
+    scale++;
+
+  srcW = jdec.width >> scale;
+  uint16_t srcH = jdec.height >> scale;
+
+  cropW = (fullW >> scale) ? (fullW >> scale) : 1;
+  cropH = (fullH >> scale) ? (fullH >> scale) : 1;
+  if (cropW > srcW) cropW = srcW;
+  if (cropH > srcH) cropH = srcH;
+  cropX = (srcW - cropW) / 2;
+  cropY = (srcH - cropH) / 2;
+
+  uint16_t mcuH = (jdec.msy * 8) >> scale;
+  if (!mcuH) mcuH = 1;
+
+  size_t pixels = (size_t)cropW * (mcuH + 1) + fitW * 2;
+  uint8_t *buffer = (uint8_t*)heap_caps_malloc(pixels * sizeof(uint16_t) + fitW, MALLOC_CAP_8BIT);
+  if (!buffer) return JDR_MEM1;
+
+  fitBand = (uint16_t*)buffer;
+  fitCarry = fitBand + cropW * mcuH;
+  fitRow = fitCarry + cropW;
+  fitX0 = fitRow + fitW;
+  fitFx = (uint8_t*)(fitX0 + fitW);
+
+  for (uint16_t u = 0; u < fitW; u++) {
+    int32_t x0;
+    fitMap(u, cropW, fitW, x0, fitFx[u]);
+    fitX0[u] = x0;
+  }
+
+  fitNext = 0;
+
+  JRESULT res = jd_decomp(&jdec, jd_output, scale);
+
+  // Stopped on purpose once the box was full
+  if (res == JDR_INTR && fitNext == fitH) res = JDR_OK;
+  if (res == JDR_OK && fitNext < fitH) res = JDR_INP;
+
+  heap_caps_free(buffer);
+  fitBand = fitCarry = fitRow = fitX0 = nullptr;
+  fitFx = nullptr;
+
+  return res;
+}
+
+JRESULT TJpg_Decoder::drawJpgFit(const char *filename, uint16_t w, uint16_t h, RowCallback cb, void *user) {
+  FsFile file;
+  if (!openJpg(file, filename)) return JDR_INP;
+
+  JRESULT res = drawJpgFit(file, UINT32_MAX, w, h, cb, user);
+
+  if (jpgLock) jpgLock(lock_user, true);
+  file.close();
+  if (jpgLock) jpgLock(lock_user, false);
+
+  return res;
+}
+
+JRESULT TJpg_Decoder::drawJpgFit(FsFile& file, uint32_t size, uint16_t w, uint16_t h, RowCallback cb, void *user) {
+  JDEC jdec;
+  JRESULT res;
+
+  if (!w || !h || !cb) return JDR_PAR;
+
+  jpg_source = TJPG_SDFAT_FILE;
+  jpgFile = &file;
+  jpgLeft = size;
+
+  fitOutput = cb;
+  fitUser = user;
+  fitW = w;
+  fitH = h;
+
+  res = prepare(jdec, true);
+  if (res == JDR_OK) {
+    res = fitDecode(jdec);
+  }
+  finish();
+
+  fitOutput = nullptr;
+  jpgFile = nullptr;
+  return res;
+}
+
+//------------------------------------------------------------
+// Draw JPG from memory array
+//------------------------------------------------------------
+JRESULT TJpg_Decoder::drawJpg(int32_t x, int32_t y, const uint8_t *array, uint32_t size) {
+  JDEC jdec;
+  JRESULT res;
+
+  jpg_source = TJPG_ARRAY;
+  array_data = array;
+  array_size = size;
+  array_index = 0;
+  jpeg_x = x;
+  jpeg_y = y;
+
+  res = prepare(jdec, true);
+  if (res == JDR_OK) {
+    res = jd_decomp(&jdec, jd_output, jpgScale);
+  }
+  finish();
+
+  return res;
+}
+
+//------------------------------------------------------------
+// Get JPG size from memory array
+//------------------------------------------------------------
+JRESULT TJpg_Decoder::getJpgSize(uint16_t *w, uint16_t *h, const uint8_t *array, uint32_t size) {
+  JDEC jdec;
+  JRESULT res;
+
+  *w = *h = 0;
+
+  jpg_source = TJPG_ARRAY;
+  array_data = array;
+  array_size = size;
+  array_index = 0;
+
+  res = prepare(jdec, false);
+  if (res == JDR_OK) {
+    *w = jdec.width;
+    *h = jdec.height;
+  }
+
+  return res;
+}
@@ -0,0 +1,175 @@
+/*
+ TJpg_Decoder.h (SdFat only)
+
+ JPEG Decoder for Arduino using TJpgDec:
+ http://elm-chan.org/fsw/tjpgd/00index.html
+
+ Adapted for SdFat only
+*/
+
+#ifndef TJpg_Decoder_H
+#define TJpg_Decoder_H
+
+#include <Arduino.h>
+#include <SdFat.h>
+#include "tjpgd.h"
+
+//------------------------------------------------------------
+// JPG source types
+//------------------------------------------------------------
+enum {
+  TJPG_ARRAY = 0,
+  TJPG_SDFAT_FILE
+};
+
+//------------------------------------------------------------
+// Decode profiles
+//------------------------------------------------------------
+enum {
+  TJPG_PROFILE_SMALL = 0,     // member workspace, JD_SZBUF reads, bitwise huffman search
+  TJPG_PROFILE_FAST_INTERNAL, // huffman tables and TJPGD_FAST_SZBUF reads, workspace
+                              // allocated per decode in internal RAM (PSRAM if that fails)
+  TJPG_PROFILE_FAST_PSRAM     // same, workspace in PSRAM
+};
+
+//------------------------------------------------------------
+// Callback type
+//------------------------------------------------------------
+typedef bool (*SketchCallback)(
+  int16_t x, int16_t y,
+  uint16_t w, uint16_t h,
+  uint16_t *data
+);
+
+// Same, with the pointer given to setCallback, so several decoders can
+// draw into different places at once
+typedef bool (*UserCallback)(
+  void *user,
+  int16_t x, int16_t y,
+  uint16_t w, uint16_t h,
+  uint16_t *data
+);
+
+// Finished row y (0 at the top) of a fit-to-box decode, w pixels
+typedef bool (*RowCallback)(void *user, uint16_t y, uint16_t w, uint16_t *row);
+
+// Called with take = true before and false after every read from a file
+// source, for a card shared with other tasks
+typedef void (*LockCallback)(void *user, bool take);
+
+//------------------------------------------------------------
+// Decoder class
+//
+// Every instance has its own workspace, file and callbacks, and TJpgDec
+// hands the instance back through JDEC::device, so decoders on different
+// tasks don't share anything. One instance still runs one decode at a time
+//------------------------------------------------------------
+class TJpg_Decoder {
+
+public:
+  TJpg_Decoder();
+  TJpg_Decoder(SdFs &fs);
+  ~TJpg_Decoder();
+
+  // Required by TJpgDec
+  static size_t jd_input(JDEC* jdec, uint8_t* buf, size_t len);
+  static int jd_output(JDEC* jdec, void* bitmap, JRECT* jrect);
+
+  // User API
+  void setJpgScale(uint8_t scale);
+  void setCallback(SketchCallback cb);
+  void setCallback(UserCallback cb, void *user);
+  void setSwapBytes(bool swap);
+
+  // Applies from the next draw on, falls back to TJPG_PROFILE_SMALL when
+  // the workspace can't be allocated. Size queries always use the small one
+  void setProfile(uint8_t profile);
+  uint8_t getLastProfile();
+
+  // Volume the filename overloads open from (the current one if none) and
+  // an optional lock around the reads
+  void setFileSystem(SdFs *fs, LockCallback lock = nullptr, void *user = nullptr);
+
+  // SdFat file draw, the filename is on the file system set above
+  JRESULT drawJpg(int32_t x, int32_t y, const char *filename);
+  JRESULT drawJpg(int32_t x, int32_t y, FsFile& file);
+
+  // SdFat size query
+  JRESULT getJpgSize(uint16_t *w, uint16_t *h, const char *filename);
+  JRESULT getJpgSize(uint16_t *w, uint16_t *h, FsFile& file);
+
+  // JPEG embedded in another file (ID3 APIC, FLAC PICTURE), size bytes
+  // from the current position. The file stays open
+  JRESULT drawJpg(int32_t x, int32_t y, FsFile& file, uint32_t size);
+  JRESULT getJpgSize(uint16_t *w, uint16_t *h, FsFile& file, uint32_t size);
+
+  // Fit-to-box: the picture scaled to fill w x h, centre cropped when the
+  // aspect differs. TJpgDec scales down by the nearest 1/2/4/8 that still
+  // covers the box and a bilinear pass does the rest, one MCU row at a time,
+  // so no full size picture is ever held. Rows come out top to bottom in
+  // RGB565 (byte swapped like setSwapBytes says) and the decode stops at
+  // the last one the box needs
+  JRESULT drawJpgFit(const char *filename, uint16_t w, uint16_t h, RowCallback cb, void *user);
+  JRESULT drawJpgFit(FsFile& file, uint32_t size, uint16_t w, uint16_t h, RowCallback cb, void *user);
+
+  // Array draw
+  JRESULT drawJpg(int32_t x, int32_t y, const uint8_t *array, uint32_t size);
+  JRESULT getJpgSize(uint16_t *w, uint16_t *h, const uint8_t *array, uint32_t size);
+
+public:
+  // Public so static callbacks can access
+  FsFile *jpgFile = nullptr;
+  uint32_t jpgLeft = 0;
+  bool jpgPrepared = false;   // header parsed, reads are stream refills
+
+  const uint8_t *array_data = nullptr;
+  uint32_t array_index = 0;
+  uint32_t array_size  = 0;
+
+  uint8_t jpg_source = TJPG_ARRAY;
+
+  int16_t jpeg_x = 0;
+  int16_t jpeg_y = 0;
+
+  uint8_t jpgScale = 0;
+  bool _swap = false;
+
+  SketchCallback tft_output = nullptr;
+  UserCallback user_output = nullptr;
+  void *output_user = nullptr;
+
+  SdFs *jpgFs = nullptr;
+  LockCallback jpgLock = nullptr;
+  void *lock_user = nullptr;
+
+  uint8_t workspace[TJPGD_WORKSPACE_SIZE] __attribute__((aligned(4)));
+
+private:
+  uint8_t profile = TJPG_PROFILE_SMALL;
+  uint8_t lastProfile = TJPG_PROFILE_SMALL;
+  uint8_t *fastWorkspace = nullptr;
+
+  // Fit-to-box state, the crop is in the DCT scaled picture
+  RowCallback fitOutput = nullptr;
+  void *fitUser = nullptr;
+  uint16_t fitW = 0, fitH = 0, fitNext = 0;
+  uint16_t srcW = 0;
+  int32_t cropX = 0, cropY = 0, cropW = 0, cropH = 0;
+  uint16_t *fitBand = nullptr;    // cropW x one MCU row
+  uint16_t *fitCarry = nullptr;   // last row of the band before
+  uint16_t *fitRow = nullptr;     // fitW, the row being handed out
+  uint16_t *fitX0 = nullptr;      // left source column of every output one
+  uint8_t *fitFx = nullptr;       // and the weight of the right one, /256
+
+  bool openJpg(FsFile &file, const char *filename);
+
+  JRESULT fitDecode(JDEC &jdec);
+  int fitBlock(JRECT *rect, uint16_t *bitmap);
+  int fitRows(int32_t bandTop, int32_t bandRows);
+
+  // jd_prepare on the workspace of the profile, finish() frees it again
+  JRESULT prepare(JDEC &jdec, bool draw);
+  void finish();
+};
+
+#endif
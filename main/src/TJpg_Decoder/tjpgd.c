@@ -236,7 +236,7 @@ static JRESULT create_huffman_tbl (	/* 0:OK, !0:Failed */
 			pd[i] = d;
 		}
 #if JD_FASTDECODE == 2
-		{	/* Create fast huffman decode table */
+		if (jd->lut) {	/* Create fast huffman decode table */
 			unsigned int span, td, ti;
 			uint16_t *tbl_ac = 0;
 			uint8_t *tbl_dc = 0;
@@ -302,7 +302,7 @@ static int huffext (	/* >=0: decoded data, <0: error code */
 		if (!bm) {		/* Next byte? */
 			if (!dc) {	/* No input data is available, re-fill input buffer */
 				dp = jd->inbuf;	/* Top of input buffer */
-				dc = jd->infunc(jd, dp, JD_SZBUF);
+				dc = jd->infunc(jd, dp, jd->szbuf);
 				if (!dc) return 0 - (int)JDR_INP;	/* Err: read error or wrong stream termination */
 			} else {
 				dp++;	/* Next data ptr */
@@ -346,7 +346,7 @@ static int huffext (	/* >=0: decoded data, <0: error code */
 		} else {
 			if (!dc) {	/* Buffer empty, re-fill input buffer */
 				dp = jd->inbuf;						/* Top of input buffer */
-				dc = jd->infunc(jd, dp, JD_SZBUF);
+				dc = jd->infunc(jd, dp, jd->szbuf);
 				if (!dc) return 0 - (int)JDR_INP;	/* Err: read error or wrong stream termination */
 			}
 			d = *dp++; dc--;
@@ -367,6 +367,7 @@ static int huffext (	/* >=0: decoded data, <0: error code */
 	jd->wreg = w;
 
 #if JD_FASTDECODE == 2
+	if (jd->lut) {
 	/* Table serch for the short codes */
 	d = (unsigned int)(w >> (wbit - HUFF_BIT));	/* Short code as table index */
 	if (cls) {	/* AC element */
@@ -388,13 +389,15 @@ static int huffext (	/* >=0: decoded data, <0: error code */
 	hc = jd->huffcode[id][cls] + jd->longofs[id][cls];	/* Code word table */
 	hd = jd->huffdata[id][cls] + jd->longofs[id][cls];	/* Data table */
 	bl = HUFF_BIT + 1;
-#else
+	} else
+#endif
+	{
 	/* Incremental serch for all codes */
 	hb = jd->huffbits[id][cls];	/* Bit distribution table */
 	hc = jd->huffcode[id][cls];	/* Code word table */
 	hd = jd->huffdata[id][cls];	/* Data table */
 	bl = 1;
-#endif
+	}
 	for ( ; bl <= 16; bl++) {	/* Incremental search */
 		nc = *hb++;
 		if (nc) {
@@ -437,7 +440,7 @@ static int bitext (	/* >=0: extracted data, <0: error code */
 		if (!mbit) {			/* Next byte? */
 			if (!dc) {			/* No input data is available, re-fill input buffer */
 				dp = jd->inbuf;	/* Top of input buffer */
-				dc = jd->infunc(jd, dp, JD_SZBUF);
+				dc = jd->infunc(jd, dp, jd->szbuf);
 				if (!dc) return 0 - (int)JDR_INP;	/* Err: read error or wrong stream termination */
 			} else {
 				dp++;			/* Next data ptr */
@@ -474,7 +477,7 @@ static int bitext (	/* >=0: extracted data, <0: error code */
 		} else {
 			if (!dc) {	/* Buffer empty, re-fill input buffer */
 				dp = jd->inbuf;	/* Top of input buffer */
-				dc = jd->infunc(jd, dp, JD_SZBUF);
+				dc = jd->infunc(jd, dp, jd->szbuf);
 				if (!dc) return 0 - (int)JDR_INP;	/* Err: read error or wrong stream termination */
 			}
 			d = *dp++; dc--;
@@ -521,7 +524,7 @@ static JRESULT restart (
 	for (i = 0; i < 2; i++) {
 		if (!dc) {	/* No input data is available, re-fill input buffer */
 			dp = jd->inbuf;
-			dc = jd->infunc(jd, dp, JD_SZBUF);
+			dc = jd->infunc(jd, dp, jd->szbuf);
 			if (!dc) return JDR_INP;
 		} else {
 			dp++;
@@ -548,7 +551,7 @@ static JRESULT restart (
 		for (i = 0; i < 2; i++) {	/* Get a restart marker */
 			if (!dc) {		/* No input data is available, re-fill input buffer */
 				dp = jd->inbuf;
-				dc = jd->infunc(jd, dp, JD_SZBUF);
+				dc = jd->infunc(jd, dp, jd->szbuf);
 				if (!dc) return JDR_INP;
 			}
 			marker = (marker << 8) | *dp++;	/* Get a byte */
@@ -990,14 +993,18 @@ JRESULT jd_prepare (
 	JRESULT rc;
 
   uint8_t tmp = jd->swap; // Copy the swap flag
+  uint8_t lut = jd->lut;  // and the session profile
+  size_t szbuf = jd->szbuf;
 	memset(jd, 0, sizeof (JDEC));	/* Clear decompression object (this might be a problem if machine's null pointer is not all bits zero) */
 	jd->pool = pool;		/* Work memroy */
 	jd->sz_pool = sz_pool;	/* Size of given work memory */
 	jd->infunc = infunc;	/* Stream input function */
 	jd->device = dev;		/* I/O device identifier */
   jd->swap = tmp; // Restore the swap flag
+  jd->lut = JD_FASTDECODE == 2 ? lut : 0;
+  jd->szbuf = szbuf < JD_SZBUF ? JD_SZBUF : szbuf;
 
-	jd->inbuf = seg = alloc_pool(jd, JD_SZBUF);		/* Allocate stream input buffer */
+	jd->inbuf = seg = alloc_pool(jd, jd->szbuf);		/* Allocate stream input buffer */
 	if (!seg) return JDR_MEM1;
 
 	ofs = marker = 0;		/* Find SOI marker */
@@ -1018,7 +1025,7 @@ JRESULT jd_prepare (
 
 		switch (marker & 0xFF) {
 		case 0xC0:	/* SOF0 (baseline JPEG) */
-			if (len > JD_SZBUF) return JDR_MEM2;
+			if (len > jd->szbuf) return JDR_MEM2;
 			if (jd->infunc(jd, seg, len) != len) return JDR_INP;	/* Load segment data */
 
 			jd->width = LDB_WORD(&seg[3]);		/* Image width in unit of pixel */
@@ -1043,14 +1050,14 @@ JRESULT jd_prepare (
 			break;
 
 		case 0xDD:	/* DRI - Define Restart Interval */
-			if (len > JD_SZBUF) return JDR_MEM2;
+			if (len > jd->szbuf) return JDR_MEM2;
 			if (jd->infunc(jd, seg, len) != len) return JDR_INP;	/* Load segment data */
 
 			jd->nrst = LDB_WORD(seg);	/* Get restart interval (MCUs) */
 			break;
 
 		case 0xC4:	/* DHT - Define Huffman Tables */
-			if (len > JD_SZBUF) return JDR_MEM2;
+			if (len > jd->szbuf) return JDR_MEM2;
 			if (jd->infunc(jd, seg, len) != len) return JDR_INP;	/* Load segment data */
 
 			rc = create_huffman_tbl(jd, seg, len);	/* Create huffman tables */
@@ -1058,7 +1065,7 @@ JRESULT jd_prepare (
 			break;
 
 		case 0xDB:	/* DQT - Define Quaitizer Tables */
-			if (len > JD_SZBUF) return JDR_MEM2;
+			if (len > jd->szbuf) return JDR_MEM2;
 			if (jd->infunc(jd, seg, len) != len) return JDR_INP;	/* Load segment data */
 
 			rc = create_qt_tbl(jd, seg, len);	/* Create de-quantizer tables */
@@ -1066,7 +1073,7 @@ JRESULT jd_prepare (
 			break;
 
 		case 0xDA:	/* SOS - Start of Scan */
-			if (len > JD_SZBUF) return JDR_MEM2;
+			if (len > jd->szbuf) return JDR_MEM2;
 			if (jd->infunc(jd, seg, len) != len) return JDR_INP;	/* Load segment data */
 
 			if (!jd->width || !jd->height) return JDR_FMT1;	/* Err: Invalid image size */
@@ -1095,9 +1102,9 @@ JRESULT jd_prepare (
 			jd->mcubuf = alloc_pool(jd, (n + 2) * 64 * sizeof (jd_yuv_t));	/* Allocate MCU working buffer */
 			if (!jd->mcubuf) return JDR_MEM1;			/* Err: not enough memory */
 
-			/* Align stream read offset to JD_SZBUF */
-			if (ofs %= JD_SZBUF) {
-				jd->dctr = jd->infunc(jd, seg + ofs, (size_t)(JD_SZBUF - ofs));
+			/* Align stream read offset to the input buffer size */
+			if (ofs %= jd->szbuf) {
+				jd->dctr = jd->infunc(jd, seg + ofs, (size_t)(jd->szbuf - ofs));
 			}
 			jd->dptr = seg + ofs - (JD_FASTDECODE ? 0 : 1);
 
@@ -87,6 +87,8 @@ struct JDEC {
 	size_t (*infunc)(JDEC*, uint8_t*, size_t);	/* Pointer to jpeg stream input function */
 	void* device;				/* Pointer to I/O device identifiler for the session */
 	uint8_t swap;       /* Added by Bodmer to control byte swapping */
+	uint8_t lut;		/* Added: use the fast huffman tables in this session (JD_FASTDECODE == 2 only) */
+	size_t szbuf;		/* Added: size of the stream input buffer, at least JD_SZBUF */
 };
 
 
@@ -5,6 +5,10 @@
 #define	JD_SZBUF		512
 /* Specifies size of stream input buffer */
 
+#define	TJPGD_FAST_SZBUF	4096
+/* Stream input buffer of a session with JDEC::lut set, a multiple of the
+/  512 byte SD sector so every refill after the first reads whole sectors */
+
 #define JD_FORMAT		1
 /* Specifies output pixel format.
 /  0: RGB888 (24-bit/pix)
@@ -24,7 +28,7 @@
 /  1: Enable
 */
 
-#define JD_FASTDECODE	1
+#define JD_FASTDECODE	2
 /* Optimization level
 /  0: Basic optimization. Suitable for 8/16-bit MCUs.
 /     Workspace of 3100 bytes needed.
@@ -32,13 +36,18 @@
 /     Workspace of 3480 bytes needed.
 /  2: + Table conversion for huffman decoding (wants 6 << HUFF_BIT bytes of RAM).
 /     Workspace of 9644 bytes needed.
+/  Here 2 only builds the table code in, JDEC::lut turns it on per session.
+/  A session without it decodes like level 1 in a level 1 workspace
 */
 
 // Do not change this, it is the minimum size in bytes of the workspace needed by the decoder
 #if JD_FASTDECODE == 0
  #define TJPGD_WORKSPACE_SIZE 3100
-#elif JD_FASTDECODE == 1
+#else
  #define TJPGD_WORKSPACE_SIZE 3500
-#elif JD_FASTDECODE == 2
- #define TJPGD_WORKSPACE_SIZE (3500 + 6144)
+#endif
+
+// Session with JDEC::lut, the tables plus the bigger input buffer
+#if JD_FASTDECODE == 2
+ #define TJPGD_FAST_WORKSPACE_SIZE (TJPGD_WORKSPACE_SIZE - JD_SZBUF + TJPGD_FAST_SZBUF + 6144)
 #endif
\ No newline at end of file